@@ -0,0 +1,56 @@
+# Generates a C++ table of gzip-compressed files for msr::embedded_resource.
+#
+#   cmake -DSOURCE_DIR=<dir> -DOUTPUT=<file.inc> -DWORK_DIR=<dir> -P embed_resources.cmake
+#
+# Every file under SOURCE_DIR becomes one entry whose path is relative to SOURCE_DIR.
+# Entries are sorted by path so that they can be looked up by binary search.
+
+cmake_minimum_required(VERSION 3.18)
+
+file( GLOB_RECURSE FILES RELATIVE ${SOURCE_DIR} ${SOURCE_DIR}/* )
+list( SORT FILES )
+
+file( MAKE_DIRECTORY ${WORK_DIR} )
+
+string( REPEAT "[0-9a-f]" 64 LINE_PATTERN )
+
+set( DATA "" )
+set( TABLE "" )
+set( INDEX 0 )
+
+foreach( f ${FILES} )
+  set( SOURCE ${SOURCE_DIR}/${f} )
+  set( COMPRESSED ${WORK_DIR}/${INDEX}.gz )
+
+  file( ARCHIVE_CREATE
+    OUTPUT ${COMPRESSED}
+    PATHS ${SOURCE}
+    FORMAT raw
+    COMPRESSION GZip
+  )
+
+  file( SIZE ${SOURCE} IDENTITY_SIZE )
+  file( SIZE ${COMPRESSED} COMPRESSED_SIZE )
+  file( SHA1 ${SOURCE} HASH )
+  string( SUBSTRING ${HASH} 0 16 ETAG )
+
+  file( READ ${COMPRESSED} HEX HEX )
+  string( REGEX REPLACE "(${LINE_PATTERN})" "\\1\n" HEX "${HEX}" )
+  string( REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," HEX "${HEX}" )
+
+  string( APPEND DATA "constexpr unsigned char embedded_data_${INDEX}[] = {\n${HEX}\n};\n\n" )
+  string( APPEND TABLE "\t{ \"${f}\", embedded_data_${INDEX}, ${COMPRESSED_SIZE}, ${IDENTITY_SIZE}, \"\\\"${ETAG}\\\"\" },\n" )
+
+  math( EXPR INDEX "${INDEX} + 1" )
+endforeach()
+
+file( WRITE ${OUTPUT}.tmp
+  "// generated by cmake/embed_resources.cmake from ${SOURCE_DIR}\n\n"
+  "${DATA}"
+  "constexpr embedded_resource embedded_resource_table[] = {\n"
+  "${TABLE}"
+  "\t{ nullptr, nullptr, 0, 0, nullptr },\n"
+  "};\n"
+)
+
+file( COPY_FILE ${OUTPUT}.tmp ${OUTPUT} ONLY_IF_DIFFERENT )
@@ -0,0 +1,429 @@
+// Serves a deck in audience mode on the loopback interface and loads it with
+// simulated audience devices: every client fetches the page and its assets on
+// a keep-alive connection, then follows the presenter, who moves through the
+// slides. Prints the latency of the requests and of the slide changes.
+//
+//   audience-load-test <document root> [page] [clients] [slides] [threads]
+//
+// page defaults to /index.html, clients to 500, slides to 20 and threads to
+// the number of cores. The exit code is 0 if every client followed every
+// slide, 1 if not, and 2 on bad arguments.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/filesystem.hpp>
+
+#include "msr.hpp"
+
+namespace {
+	using boost::asio::ip::tcp;
+	using clock_type = std::chrono::steady_clock;
+
+	struct load_test {
+		tcp::endpoint endpoint;
+		std::vector<std::string> paths;	// the page and its assets
+		std::uint64_t slides = 0;
+
+		std::mutex mutex;
+		std::condition_variable changed;
+
+		std::vector<double> request_ms;
+
+		// when each slide was published (by sequence) and received by a client
+		std::vector<clock_type::time_point> published;
+		std::vector<std::pair<std::uint64_t, clock_type::time_point>> received;
+
+		std::size_t loaded = 0;	// clients that have loaded the page
+		std::size_t finished = 0;	// clients that have followed every slide
+		std::size_t failed = 0;
+		std::size_t errors = 0;	// responses other than 200 and 304
+
+		void count(std::size_t &counter)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++counter;
+			changed.notify_all();
+		}
+
+		template <typename Predicate>
+		bool wait(std::chrono::seconds timeout, Predicate predicate)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			return changed.wait_for(lock, timeout, predicate);
+		}
+	};
+
+	// status line and Content-Length of a response head
+	bool parse_response_head(const std::string &head, int &status, std::size_t &length)
+	{
+		auto space = head.find(' ');
+
+		if (head.compare(0, 5, "HTTP/") != 0 || space == std::string::npos) {
+			return false;
+		}
+
+		status = std::atoi(head.c_str() + space + 1);
+		length = 0;
+
+		auto pos = msr::detail::find_ignore_case(head, "\r\ncontent-length:", 0);
+
+		if (pos != std::string::npos) {
+			length = std::strtoul(head.c_str() + pos + 17, nullptr, 10);
+		}
+
+		return true;
+	}
+
+	std::uint64_t sequence_of(const std::string &json)
+	{
+		auto pos = json.find("\"seq\":");
+		return pos == std::string::npos ? 0 : std::strtoull(json.c_str() + pos + 6, nullptr, 10);
+	}
+
+	// One audience device: loads the page, then long-polls /.msr/follow until
+	// it has seen the last slide.
+	class client :
+		public std::enable_shared_from_this<client>,
+		boost::asio::coroutine
+	{
+		load_test &test_;
+		tcp::socket socket_;
+		boost::asio::streambuf buffer_;
+		std::string request_;
+		std::string body_;
+		int status_ = 0;
+		std::size_t length_ = 0;
+		std::size_t next_path_ = 0;
+		std::uint64_t sequence_ = 0;
+		clock_type::time_point sent_;
+
+		void fail()
+		{
+			boost::system::error_code error;
+			socket_.close(error);
+			test_.count(test_.failed);
+		}
+
+		void resume(const boost::system::error_code &error = boost::system::error_code(), std::size_t length = 0)
+		{
+			auto self = shared_from_this();
+			auto next = [self](const boost::system::error_code &e, std::size_t n) {
+				self->resume(e, n);
+			};
+
+			if (error) {
+				fail();
+				return;
+			}
+
+			BOOST_ASIO_CORO_REENTER (this) {
+				BOOST_ASIO_CORO_YIELD socket_.async_connect(test_.endpoint, [self](const boost::system::error_code &e) {
+					self->resume(e);
+				});
+
+				for (;;) {
+					if (next_path_ < test_.paths.size()) {
+						request_ = test_.paths[next_path_++];
+					} else {
+						if (next_path_++ == test_.paths.size()) {
+							test_.count(test_.loaded);
+						}
+
+						request_ = "/.msr/follow?after=" + std::to_string(sequence_);
+					}
+
+					request_ = "GET " + request_ + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+					sent_ = clock_type::now();
+
+					BOOST_ASIO_CORO_YIELD boost::asio::async_write(socket_, boost::asio::buffer(request_), next);
+
+					// 103 Early Hints come before the response
+					do {
+						BOOST_ASIO_CORO_YIELD boost::asio::async_read_until(socket_, buffer_, "\r\n\r\n", next);
+
+						if (!parse_response_head(std::string(
+							boost::asio::buffers_begin(buffer_.data()),
+							boost::asio::buffers_begin(buffer_.data()) + length), status_, length_)) {
+							fail();
+							return;
+						}
+
+						buffer_.consume(length);
+					} while (status_ == 103);
+
+					if (buffer_.size() < length_) {
+						BOOST_ASIO_CORO_YIELD boost::asio::async_read(socket_, buffer_,
+							boost::asio::transfer_exactly(length_ - buffer_.size()), next);
+					}
+
+					body_.assign(
+						boost::asio::buffers_begin(buffer_.data()),
+						boost::asio::buffers_begin(buffer_.data()) + length_);
+
+					buffer_.consume(length_);
+
+					if (next_path_ <= test_.paths.size()) {
+						auto ms = std::chrono::duration<double, std::milli>(clock_type::now() - sent_).count();
+						std::lock_guard<std::mutex> lock(test_.mutex);
+						test_.request_ms.push_back(ms);
+						test_.errors += status_ != 200 && status_ != 304;
+						continue;
+					}
+
+					if (status_ != 200) {
+						fail();
+						return;
+					}
+
+					{
+						auto sequence = sequence_of(body_);
+
+						if (sequence > sequence_) {
+							sequence_ = sequence;
+
+							std::lock_guard<std::mutex> lock(test_.mutex);
+							test_.received.emplace_back(sequence, clock_type::now());
+							test_.changed.notify_all();
+						}
+					}
+
+					if (sequence_ >= test_.slides) {
+						boost::system::error_code e;
+						socket_.close(e);
+						test_.count(test_.finished);
+						return;
+					}
+				}
+			}
+		}
+
+	public:
+		client(boost::asio::io_service &io_service, load_test &test)
+			: test_(test)
+			, socket_(io_service)
+		{
+		}
+
+		void start()
+		{
+			resume();
+		}
+	};
+
+	// /.msr/present from the loopback interface, as the presenter's browser does
+	bool present(load_test &test, const std::string &page, int slide)
+	{
+		try {
+			boost::asio::io_service io_service;
+			tcp::socket socket(io_service);
+			socket.connect(test.endpoint);
+
+			std::string request = "GET /.msr/present?url=" + page + "&h=" + std::to_string(slide)
+				+ "&v=0&f=-1 HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+
+			{
+				std::lock_guard<std::mutex> lock(test.mutex);
+				test.published.push_back(clock_type::now());
+			}
+
+			boost::asio::write(socket, boost::asio::buffer(request));
+
+			boost::asio::streambuf buffer;
+			boost::system::error_code error;
+			boost::asio::read(socket, buffer, error);
+
+			std::string response(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_end(buffer.data()));
+
+			return response.compare(0, 12, "HTTP/1.1 200") == 0;
+		} catch (std::exception &) {
+			return false;
+		}
+	}
+
+	void print_percentiles(const char *name, std::vector<double> values)
+	{
+		std::cout << std::setw(22) << std::left << name;
+
+		if (values.empty()) {
+			std::cout << "-" << std::endl;
+			return;
+		}
+
+		std::sort(values.begin(), values.end());
+
+		auto at = [&](double p) {
+			return values[std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()))];
+		};
+
+		std::cout << std::fixed << std::setprecision(2)
+			<< "n=" << values.size()
+			<< " p50=" << at(0.50) << "ms"
+			<< " p90=" << at(0.90) << "ms"
+			<< " p99=" << at(0.99) << "ms"
+			<< " max=" << values.back() << "ms" << std::endl;
+	}
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+	if (argc < 2 || argc > 6) {
+		std::cerr << "usage: audience-load-test <document root> [page] [clients] [slides] [threads]" << std::endl;
+		return 2;
+	}
+
+	boost::filesystem::path root = argv[1];
+	std::string page = argc > 2 ? boost::filesystem::path(argv[2]).generic_string() : "/index.html";
+	std::size_t clients = 500;
+	std::uint64_t slides = 20;
+	std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+	try {
+		if (argc > 3) clients = std::stoul(argv[3]);
+		if (argc > 4) slides = std::stoul(argv[4]);
+		if (argc > 5) threads = std::max<std::size_t>(1, std::stoul(argv[5]));
+	} catch (std::exception &) {
+		std::cerr << "clients, slides and threads are numbers" << std::endl;
+		return 2;
+	}
+
+	boost::system::error_code error;
+
+	if (!is_directory(root, error) || clients == 0 || slides == 0) {
+		std::cerr << "usage: audience-load-test <document root> [page] [clients] [slides] [threads]" << std::endl;
+		return 2;
+	}
+
+	boost::asio::io_service server_service;
+	msr::tcp_server server(server_service);
+	msr::audience_options audience;
+
+	audience.address = "127.0.0.1";
+	audience.port = 0;
+	audience.enabled = true;
+	audience.max_connections = clients + 16;
+
+	server.set_audience_options(audience);
+
+	if (!server.start(root)) {
+		std::cerr << "the server cannot be started" << std::endl;
+		return 2;
+	}
+
+	load_test test;
+	test.endpoint = tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), server.get_port());
+	test.slides = slides;
+	test.paths.push_back(page);
+
+	for (auto &a : server.provider()->page_assets(page)) {
+		if (!a.url.empty() && a.url[0] == '/' && a.url.compare(0, 2, "//") != 0) {
+			test.paths.push_back(a.url);
+		}
+	}
+
+	std::vector<std::thread> server_threads;
+
+	for (std::size_t i = 0; i < threads; ++i) {
+		server_threads.emplace_back([&]() { server_service.run(); });
+	}
+
+	boost::asio::io_service client_service;
+	std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(client_service));
+
+	// the clients have no strands, so they share one thread
+	std::thread client_thread([&]() { client_service.run(); });
+
+	std::cout << clients << " clients, " << test.paths.size() << " requests each to load " << page
+		<< ", " << slides << " slides, " << threads << " server threads" << std::endl;
+
+	auto begin = clock_type::now();
+
+	for (std::size_t i = 0; i < clients; ++i) {
+		std::make_shared<client>(client_service, test)->start();
+	}
+
+	test.wait(std::chrono::seconds(60), [&]() { return test.loaded + test.failed >= clients; });
+
+	auto load_time = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+	// until every follower is parked on /.msr/follow
+	for (int i = 0; i < 500 && server.provider()->followers().waiting() + test.failed < clients; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	auto presented = true;
+
+	for (std::uint64_t s = 1; s <= slides && presented; ++s) {
+		presented = present(test, page, static_cast<int>(s));
+
+		// every live client has the slide before the next one
+		test.wait(std::chrono::seconds(10), [&]() {
+			std::size_t n = 0;
+
+			for (auto &r : test.received) {
+				n += r.first == s;
+			}
+
+			return n + test.failed >= clients;
+		});
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+
+	test.wait(std::chrono::seconds(10), [&]() { return test.finished + test.failed >= clients; });
+
+	auto write_waits = server.write_statistics();
+
+	server.shutdown(std::chrono::milliseconds(1000));
+	server_service.stop();
+
+	work.reset();
+	client_service.stop();
+
+	for (auto &t : server_threads) {
+		t.join();
+	}
+
+	client_thread.join();
+
+	std::vector<double> follow_ms;
+
+	for (auto &r : test.received) {
+		if (r.first >= 1 && r.first <= test.published.size()) {
+			follow_ms.push_back(std::chrono::duration<double, std::milli>(r.second - test.published[r.first - 1]).count());
+		}
+	}
+
+	std::cout << "page load of all clients: " << std::fixed << std::setprecision(2) << load_time << "s" << std::endl;
+	print_percentiles("request latency", test.request_ms);
+	print_percentiles("slide propagation", follow_ms);
+
+	static const char *priorities[] = { "document", "font", "image", "media" };
+
+	for (std::size_t p = 0; p < write_waits.size(); ++p) {
+		auto &w = write_waits[p];
+
+		if (w.count != 0) {
+			std::cout << "write wait (" << priorities[p] << "): n=" << w.count
+				<< " avg=" << w.total.count() / w.count << "us max=" << w.max.count() << "us" << std::endl;
+		}
+	}
+
+	std::cout << "finished: " << test.finished << ", failed: " << test.failed << ", error responses: " << test.errors
+		<< (presented ? "" : ", /.msr/present failed") << std::endl;
+
+	return presented && test.finished == clients ? 0 : 1;
+}
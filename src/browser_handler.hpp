@@ -11,6 +11,8 @@
 #include <quote/macro.hpp>
 #include <quote/cef/browser_handler.hpp>
 
+#include "reveal_scheme.hpp"
+
 class browser_handler :
 	public CefApp,
 	public CefBrowserProcessHandler,
@@ -37,6 +39,11 @@ public:
 		return this;
 	}
 
+	void OnRegisterCustomSchemes(CefRawPtr<CefSchemeRegistrar> registrar) override
+	{
+		register_reveal_scheme(registrar);
+	}
+
 #pragma region CEF handlers
 
 	// CefClient
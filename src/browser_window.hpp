@@ -108,6 +108,12 @@ public:
 		browser_ = b;
 	}
 
+	// search of all the decks for the find dialog (see find_dialog::deck_search)
+	void deck_search(std::function<std::vector<std::string>(const std::wstring &)> search)
+	{
+		find_dialog_.deck_search(std::move(search));
+	}
+
 	static const wchar_t *get_class_name()
 	{
 		return L"reveal-viewer browser_window";
@@ -210,7 +216,7 @@ public:
 	void show_find_dialog()
 	{
 		if (find_dialog_.get_hwnd() == nullptr) {
-			find_dialog_.create(*this, nullptr, L"Find", CW_USEDEFAULT, CW_USEDEFAULT, 300, 32);
+			find_dialog_.create(*this, nullptr, L"Find", CW_USEDEFAULT, CW_USEDEFAULT, 350, 32);
 			find_dialog_.show();
 		}
 	}
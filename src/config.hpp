@@ -0,0 +1,391 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+
+#include "include/internal/cef_string.h"
+
+#include "msr.hpp"
+
+// config.ini, next to the executable, as typed settings.
+// It is parsed once at startup (app_config::load) and again by
+// config_watcher when it changes.
+
+struct app_config {
+	// [Exe] ResourceDir: resources of CEF
+	boost::filesystem::path resource_dir;
+
+	// [Server] DocumentRoot; empty to ask for it
+	boost::filesystem::path document_root;
+	bool use_jupyter = false;
+	bool in_process = false;
+
+	msr::provider_options provider;
+
+	// additional document roots: prefix or host, path
+	std::vector<std::tuple<std::string, std::string, boost::filesystem::path>> mounts;
+
+	msr::network_options network;
+	msr::audience_options audience;
+	bool record_timing = false;
+	msr::timing_options timing;
+
+	// the settings of a missing config.ini
+	static app_config defaults(const boost::filesystem::path &exe_dir)
+	{
+		app_config config;
+
+		config.resource_dir = exe_dir / "resources";
+		config.provider.prewarm.manifest_directory = exe_dir / "manifest";
+		config.provider.hash_index_file = exe_dir / "cache" / "hashes.idx";
+		config.provider.snapshot_file = exe_dir / "cache" / "snapshot.bin";
+		config.provider.minify.cache_directory = exe_dir / "cache" / "minified";
+		config.provider.fonts.cache_directory = exe_dir / "cache" / "fonts";
+
+		return config;
+	}
+
+	// Reads file over the defaults; relative paths are relative to the directory
+	// of the file. False if it exists but cannot be read or parsed.
+	static bool read(const boost::filesystem::path &file, app_config &config)
+	{
+		auto exe_dir = file.parent_path();
+
+		config = defaults(exe_dir);
+
+		if (!exists(file)) {
+			return true;
+		}
+
+		std::wifstream ifs(file.wstring());
+
+		if (!ifs) {
+			return false;
+		}
+
+		try {
+			boost::property_tree::wptree tree;
+			read_ini(ifs, tree);
+
+			auto v = tree.get_optional<std::wstring>(L"Exe.ResourceDir");
+
+			if (v) {
+				boost::system::error_code ec;
+				config.resource_dir = canonical(*v, exe_dir, ec);
+			}
+
+			v = tree.get_optional<std::wstring>(L"Server.DocumentRoot");
+
+			if (v) {
+				if (!v->empty()) {
+					boost::system::error_code ec;
+					config.document_root = canonical(*v, exe_dir, ec);
+				}
+			}
+
+			v = tree.get_optional<std::wstring>(L"Server.Type");
+
+			if (v) {
+				if (::_wcsicmp(v->c_str(), L"jupyter") == 0) {
+					config.use_jupyter = true;
+				}
+			}
+
+			config.in_process = tree.get<bool>(L"Server.InProcess", false);
+
+			auto &image_options = config.provider.images;
+
+			image_options.enabled = tree.get<bool>(L"Image.Resize", false);
+			image_options.webp = tree.get<bool>(L"Image.WebP", false);
+			image_options.quality = tree.get<int>(L"Image.Quality", image_options.quality);
+
+			v = tree.get_optional<std::wstring>(L"Image.CacheDir");
+
+			if (v) {
+				if (!v->empty()) {
+					image_options.cache_directory = absolute(*v, exe_dir);
+				}
+			}
+
+			auto &preload_options = config.provider.preload;
+
+			preload_options.enabled = tree.get<bool>(L"Preload.Enabled", preload_options.enabled);
+			preload_options.early_hints = tree.get<bool>(L"Preload.EarlyHints", preload_options.early_hints);
+
+			auto &inline_options = config.provider.inlining;
+
+			inline_options.enabled = tree.get<bool>(L"Inline.Enabled", inline_options.enabled);
+			inline_options.max_asset_size = tree.get<std::size_t>(L"Inline.MaxAssetKB", inline_options.max_asset_size >> 10) << 10;
+			inline_options.max_total_size = tree.get<std::size_t>(L"Inline.MaxTotalKB", inline_options.max_total_size >> 10) << 10;
+
+			auto &minify_options = config.provider.minify;
+
+			minify_options.enabled = tree.get<bool>(L"Minify.Enabled", minify_options.enabled);
+
+			v = tree.get_optional<std::wstring>(L"Minify.CacheDir");
+
+			if (v) {
+				minify_options.cache_directory = v->empty() ? boost::filesystem::path() : absolute(*v, exe_dir);
+			}
+
+			auto &font_options = config.provider.fonts;
+
+			font_options.enabled = tree.get<bool>(L"Font.Subset", font_options.enabled);
+
+			v = tree.get_optional<std::wstring>(L"Font.CacheDir");
+
+			if (v) {
+				font_options.cache_directory = v->empty() ? boost::filesystem::path() : absolute(*v, exe_dir);
+			}
+
+			auto &lazy_media_options = config.provider.lazy_media;
+
+			lazy_media_options.enabled = tree.get<bool>(L"LazyMedia.Enabled", lazy_media_options.enabled);
+			lazy_media_options.eager_slides = tree.get<unsigned>(L"LazyMedia.EagerSlides", lazy_media_options.eager_slides);
+
+			auto &deck_split_options = config.provider.deck_split;
+
+			deck_split_options.enabled = tree.get<bool>(L"DeckSplit.Enabled", deck_split_options.enabled);
+			deck_split_options.min_page_size = tree.get<std::size_t>(L"DeckSplit.MinPageKB", deck_split_options.min_page_size >> 10) << 10;
+			deck_split_options.min_sections = tree.get<std::size_t>(L"DeckSplit.MinSections", deck_split_options.min_sections);
+			deck_split_options.eager_slides = tree.get<unsigned>(L"DeckSplit.EagerSlides", deck_split_options.eager_slides);
+			deck_split_options.prefetch = tree.get<unsigned>(L"DeckSplit.Prefetch", deck_split_options.prefetch);
+
+			auto &highlight_options = config.provider.highlight;
+
+			highlight_options.enabled = tree.get<bool>(L"Highlight.Enabled", highlight_options.enabled);
+			highlight_options.threads = tree.get<std::size_t>(L"Highlight.Threads", highlight_options.threads);
+			highlight_options.max_block_size = tree.get<std::size_t>(L"Highlight.MaxBlockKB", highlight_options.max_block_size >> 10) << 10;
+
+			// full-text search of the decks (/.msr/search.json and the find dialog)
+			auto &search_options = config.provider.search;
+
+			search_options.enabled = tree.get<bool>(L"Search.Enabled", search_options.enabled);
+			search_options.max_results = tree.get<std::size_t>(L"Search.MaxResults", search_options.max_results);
+			search_options.refresh_interval = std::chrono::milliseconds(tree.get<long long>(L"Search.RefreshMs", search_options.refresh_interval.count()));
+
+			// the deck served to the devices of the audience, following the presenter
+			config.audience.enabled = tree.get<bool>(L"Audience.Enabled", config.audience.enabled);
+			config.audience.address = CefString(tree.get<std::wstring>(L"Audience.Address", CefString(config.audience.address).ToWString())).ToString();
+			config.audience.port = tree.get<unsigned short>(L"Audience.Port", config.audience.port);
+			config.audience.threads = tree.get<std::size_t>(L"Audience.Threads", config.audience.threads);
+			config.audience.max_connections = tree.get<std::size_t>(L"Audience.MaxConnections", config.audience.max_connections);
+			config.audience.max_writes = tree.get<std::size_t>(L"Audience.MaxWrites", config.audience.max_writes);
+
+			auto &prewarm_options = config.provider.prewarm;
+
+			prewarm_options.enabled = tree.get<bool>(L"Prewarm.Enabled", prewarm_options.enabled);
+			prewarm_options.budget = tree.get<std::size_t>(L"Prewarm.BudgetMB", prewarm_options.budget >> 20) << 20;
+
+			auto &cache_policy = config.provider.cache;
+
+			cache_policy.hashed_urls = tree.get<bool>(L"Cache.HashedUrls", cache_policy.hashed_urls);
+
+			v = tree.get_optional<std::wstring>(L"Cache.HashIndex");
+
+			if (v) {
+				config.provider.hash_index_file = v->empty() ? boost::filesystem::path() : absolute(*v, exe_dir);
+			}
+
+			v = tree.get_optional<std::wstring>(L"Cache.Snapshot");
+
+			if (v) {
+				config.provider.snapshot_file = v->empty() ? boost::filesystem::path() : absolute(*v, exe_dir);
+			}
+
+			config.provider.snapshot_budget = tree.get<std::size_t>(L"Cache.SnapshotMB", config.provider.snapshot_budget >> 20) << 20;
+
+			// [CacheControl] pattern = directive, in order of priority
+			auto rules = tree.get_child_optional(L"CacheControl");
+
+			if (rules) {
+				cache_policy.rules.clear();
+
+				for (auto &r : *rules) {
+					cache_policy.rules.push_back({ CefString(r.first).ToString(), CefString(r.second.data()).ToString() });
+				}
+			}
+
+			// checked by /.msr/analysis.json and by deck-analyzer
+			msr::read_budgets(tree, config.provider.budgets);
+
+			// emulated link to the clients, for trying a deck under bad conditions
+			config.network.bandwidth = tree.get<std::size_t>(L"Network.BandwidthKbps", 0) * 1000 / 8;
+			config.network.latency = std::chrono::milliseconds(tree.get<int>(L"Network.LatencyMs", 0));
+			config.network.jitter = std::chrono::milliseconds(tree.get<int>(L"Network.JitterMs", 0));
+			config.network.loss = tree.get<double>(L"Network.LossPercent", 0.0) / 100.0;
+			config.network.retransmission_timeout = std::chrono::milliseconds(
+				tree.get<int>(L"Network.RetransmissionTimeoutMs", static_cast<int>(config.network.retransmission_timeout.count())));
+
+			config.record_timing = tree.get<bool>(L"Timing.Enabled", config.network.emulated());
+			config.timing.entries = tree.get<std::size_t>(L"Timing.Entries", config.timing.entries);
+
+			// Log: every request as it is sent; Trace, Har: page load timelines at exit
+			for (auto key : { L"Timing.Log", L"Timing.Trace", L"Timing.Har" }) {
+				v = tree.get_optional<std::wstring>(key);
+
+				if (v && !v->empty()) {
+					auto file = absolute(*v, exe_dir);
+
+					if (key == std::wstring(L"Timing.Log")) {
+						config.timing.log_file = file;
+					} else if (key == std::wstring(L"Timing.Trace")) {
+						config.timing.trace_file = file;
+					} else {
+						config.timing.har_file = file;
+					}
+				}
+			}
+
+			// [Mount] /name = path, [Host] name.localhost = path
+			for (auto section : { L"Mount", L"Host" }) {
+				auto child = tree.get_child_optional(section);
+
+				if (!child) {
+					continue;
+				}
+
+				for (auto &m : *child) {
+					auto key = CefString(m.first).ToString();
+					auto path = absolute(m.second.data(), exe_dir);
+
+					if (section == std::wstring(L"Mount")) {
+						config.mounts.emplace_back(key, std::string(), path);
+					} else {
+						config.mounts.emplace_back(std::string(), key, path);
+					}
+				}
+			}
+		} catch (std::exception &) {
+			return false;
+		}
+
+		config.record_timing = config.record_timing
+			|| !config.timing.log_file.empty()
+			|| !config.timing.trace_file.empty()
+			|| !config.timing.har_file.empty();
+
+		return true;
+	}
+
+	// config.ini next to the executable, or the defaults if it cannot be read
+	static app_config load(const boost::filesystem::path &exe_dir)
+	{
+		app_config config;
+
+		if (!read(exe_dir / "config.ini", config)) {
+			config = defaults(exe_dir);
+		}
+
+		return config;
+	}
+
+	// whether other can be applied to a running server with msr::tcp_server::reload();
+	// the other settings take effect at the next start
+	bool reloadable_from(const app_config &other) const
+	{
+		return resource_dir == other.resource_dir
+			&& use_jupyter == other.use_jupyter
+			&& in_process == other.in_process
+			&& network.bandwidth == other.network.bandwidth
+			&& network.latency == other.network.latency
+			&& network.jitter == other.network.jitter
+			&& network.loss == other.network.loss
+			&& network.retransmission_timeout == other.network.retransmission_timeout
+			&& audience.enabled == other.audience.enabled
+			&& audience.address == other.audience.address
+			&& audience.port == other.audience.port
+			&& audience.threads == other.audience.threads
+			&& audience.max_connections == other.audience.max_connections
+			&& audience.max_writes == other.audience.max_writes
+			&& record_timing == other.record_timing
+			&& timing.entries == other.timing.entries
+			&& timing.log_file == other.timing.log_file
+			&& timing.trace_file == other.timing.trace_file
+			&& timing.har_file == other.timing.har_file;
+	}
+};
+
+// Calls the handler, on a thread of its own, with the new settings when
+// config.ini changes. The file is polled; a change is taken once the size
+// and mtime have stayed the same for one interval, so that a file that is
+// being saved is not read half written. Files that cannot be parsed are skipped.
+class config_watcher {
+public:
+	using handler_type = std::function<void(const app_config &)>;
+
+private:
+	boost::filesystem::path file_;
+	std::chrono::milliseconds interval_;
+	handler_type handler_;
+
+	std::mutex mutex_;
+	std::condition_variable stopped_changed_;
+	bool stopped_ = false;
+	std::thread thread_;
+
+	void run()
+	{
+		msr::file_stamp applied, seen;
+		msr::get_file_stamp(file_, applied);
+		seen = applied;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		while (!stopped_changed_.wait_for(lock, interval_, [this]() { return stopped_; })) {
+			msr::file_stamp stamp;
+			msr::get_file_stamp(file_, stamp);
+
+			if (stamp == applied || stamp != seen) {
+				seen = stamp;
+				continue;
+			}
+
+			applied = stamp;
+
+			app_config config;
+
+			if (!app_config::read(file_, config)) {
+				continue;
+			}
+
+			lock.unlock();
+			handler_(config);
+			lock.lock();
+		}
+	}
+
+public:
+	config_watcher(const boost::filesystem::path &file, handler_type handler, std::chrono::milliseconds interval = std::chrono::milliseconds(500))
+		: file_(file)
+		, interval_(interval)
+		, handler_(std::move(handler))
+	{
+		thread_ = std::thread([this]() { run(); });
+	}
+
+	config_watcher(const config_watcher &) = delete;
+	config_watcher &operator=(const config_watcher &) = delete;
+
+	~config_watcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+			stopped_changed_.notify_all();
+		}
+
+		thread_.join();
+	}
+};
@@ -0,0 +1,60 @@
+// Checks the decks of a document root against the performance budgets of
+// config.ini and prints the report as JSON, for CI.
+//
+//   deck-analyzer <document root> [config.ini]
+//
+// The exit code is 0 if every budget is met, 1 if not, and 2 on bad arguments.
+
+#include <fstream>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+
+#include "msr/deck_analyzer.hpp"
+
+int wmain(int argc, wchar_t **argv)
+{
+	if (argc < 2 || argc > 3) {
+		std::cerr << "usage: deck-analyzer <document root> [config.ini]" << std::endl;
+		return 2;
+	}
+
+	boost::filesystem::path root = argv[1];
+	boost::system::error_code error;
+
+	if (!is_directory(root, error)) {
+		std::wcerr << root.wstring() << L" is not a directory" << std::endl;
+		return 2;
+	}
+
+	msr::analysis_budgets budgets;
+
+	if (argc == 3) {
+		std::wifstream ifs(argv[2]);
+
+		if (!ifs) {
+			std::wcerr << argv[2] << L" cannot be read" << std::endl;
+			return 2;
+		}
+
+		try {
+			boost::property_tree::wptree tree;
+			read_ini(ifs, tree);
+			msr::read_budgets(tree, budgets);
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 2;
+		}
+	}
+
+	msr::asset_graph assets;
+	msr::content_hash_index index;
+
+	auto analysis = msr::analyze_document_root(root, budgets, assets, index);
+
+	std::cout << msr::to_json(analysis);
+
+	return analysis.within_budget() ? 0 : 1;
+}
@@ -2,6 +2,10 @@
 
 #include <Windows.h>
 
+#include <functional>
+#include <string>
+#include <vector>
+
 #include <quote/win32/window.hpp>
 #include <quote/win32/creator.hpp>
 #include <quote/win32/procs.hpp>
@@ -30,13 +34,19 @@ class find_dialog :
 	HWND hwnd_editbox_;
 
 	button next_, prev_;
-	toggle_button case_;
+	toggle_button case_, decks_;
 	bool case_pushed_ = false;
+	bool decks_pushed_ = false;
 
 	std::wstring text_last_;
 	bool find_next_ = false;
 	bool case_last_ = false;
 
+	// slides of all the decks found by deck_search, and the one shown
+	std::vector<std::string> deck_hits_;
+	std::wstring deck_text_;
+	int deck_hit_ = -1;
+
 	std::wstring get_find_text()
 	{
 		auto length = ::GetWindowTextLengthW(hwnd_editbox_);
@@ -52,8 +62,43 @@ class find_dialog :
 		return buf.get();
 	}
 
+	void do_deck_find(bool forward)
+	{
+		std::wstring text = get_find_text();
+
+		if (text != deck_text_) {
+			deck_hits_ = text.empty() ? std::vector<std::string>() : deck_search_(text);
+			deck_text_ = text;
+			deck_hit_ = -1;
+		}
+
+		if (deck_hits_.empty()) {
+			::SetWindowTextW(this->get_hwnd(), text.empty() ? L"Find" : L"Find - not found");
+			return;
+		}
+
+		int count = static_cast<int>(deck_hits_.size());
+		deck_hit_ = forward ? (deck_hit_ + 1) % count : (deck_hit_ <= 0 ? count : deck_hit_) - 1;
+
+		::SetWindowTextW(this->get_hwnd(), (L"Find - " + std::to_wstring(deck_hit_ + 1) + L"/" + std::to_wstring(count)).c_str());
+
+		// the hits are from the server root; the page is replaced, or only
+		// its fragment if the slide is in the deck shown
+		auto frame = browser_->GetMainFrame();
+		std::string url = frame->GetURL();
+		auto scheme_end = url.find("://");
+		auto origin = url.substr(0, scheme_end == std::string::npos ? 0 : url.find('/', scheme_end + 3));
+
+		frame->LoadURL(origin + deck_hits_[deck_hit_]);
+	}
+
 	void do_find(bool forward)
 	{
+		if (decks_pushed_ && deck_search_) {
+			do_deck_find(forward);
+			return;
+		}
+
 		std::wstring text = get_find_text();
 
 		auto host = browser_->GetHost();
@@ -82,6 +127,15 @@ public:
 		default (nullptr)
 	);
 
+	// Searches all the decks of the server for the Decks button: urls of the
+	// matching slides from the server root ("/deck/index.html#/h/v"), best first.
+	QUOTE_DEFINE_SIMPLE_PROPERTY(
+		std::function<std::vector<std::string>(const std::wstring &)>,
+		deck_search,
+		accessor (all),
+		default (nullptr)
+	);
+
 	static const wchar_t *get_class_name()
 	{
 		return L"reveal-viewer find_dialog";
@@ -114,6 +168,15 @@ public:
 			case_pushed_ = pushed;
 		});
 
+		this->register_object(&decks_);
+		decks_.set_text(L"Decks");
+		decks_.state_changed(std::bind(&find_dialog::repaint, this));
+		decks_.callback([&](bool pushed) {
+			decks_pushed_ = pushed;
+			deck_text_.clear();
+			::SetWindowTextW(this->get_hwnd(), L"Find");
+		});
+
 		this->register_object(&prev_);
 		prev_.set_text(L"Prev");
 		prev_.state_changed(std::bind(&find_dialog::repaint, this));
@@ -135,6 +198,7 @@ public:
 	void uninitialize()
 	{
 		this->unregister_object(&case_);
+		this->unregister_object(&decks_);
 		this->unregister_object(&prev_);
 		this->unregister_object(&next_);
 
@@ -150,13 +214,15 @@ public:
 	{
 		::SetWindowPos(
 			hwnd_editbox_, nullptr,
-			0, 0, w - 100, h,
+			0, 0, w - 150, h,
 			SWP_NOACTIVATE | SWP_NOZORDER);
-		case_.set_position({ w - 100, 0 });
+		case_.set_position({ w - 150, 0 });
 		case_.set_size({ 100, h / 2 });
-		prev_.set_position({ w - 100, h / 2 });
-		prev_.set_size({ 50, h / 2 });
-		next_.set_position({ w - 50, h / 2 });
-		next_.set_size({ 50, h / 2 });
+		decks_.set_position({ w - 50, 0 });
+		decks_.set_size({ 50, h / 2 });
+		prev_.set_position({ w - 150, h / 2 });
+		prev_.set_size({ 75, h / 2 });
+		next_.set_position({ w - 75, h / 2 });
+		next_.set_size({ 75, h / 2 });
 	}
 };
@@ -0,0 +1,255 @@
+// Measures head-of-line blocking: while clients download a large video, a
+// page requests its stylesheet and script on a connection of its own. One
+// server thread serves both, once with the write scheduler (64 KB chunks,
+// documents before media, four chunks in flight) and once with a scheduler
+// that neither splits nor orders the bodies, as before there was one. Prints
+// the latency of the small requests and the videos downloaded meanwhile.
+//
+//   head-of-line-benchmark [video MB] [video clients] [requests]
+//
+// video MB defaults to 128, video clients to 4 and requests to 100. Works in
+// a temporary directory it makes and removes. The exit code is 0 if every
+// small request was answered, 1 if not, and 2 on bad arguments.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "msr.hpp"
+
+namespace {
+	using boost::asio::ip::tcp;
+	using clock_type = std::chrono::steady_clock;
+
+	// One request on a connected socket; false if it failed, was not 200 or
+	// was given up because stopping was set.
+	bool get(tcp::socket &socket, const std::string &target, const std::atomic<bool> *stopping = nullptr)
+	{
+		boost::system::error_code error;
+		std::string request = "GET " + target + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+		boost::asio::streambuf buffer;
+
+		boost::asio::write(socket, boost::asio::buffer(request), error);
+
+		if (error) {
+			return false;
+		}
+
+		auto head_size = boost::asio::read_until(socket, buffer, "\r\n\r\n", error);
+
+		if (error) {
+			return false;
+		}
+
+		std::string head(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + head_size);
+		buffer.consume(head_size);
+
+		auto length = head.find("Content-Length: ");
+		std::size_t remaining = length == std::string::npos ? 0 : std::stoul(head.substr(length + 16));
+
+		remaining -= std::min(remaining, buffer.size());
+
+		std::vector<char> chunk(64 * 1024);
+
+		while (remaining > 0) {
+			if (stopping && *stopping) {
+				return false;
+			}
+
+			auto n = socket.read_some(boost::asio::buffer(chunk.data(), std::min(remaining, chunk.size())), error);
+
+			if (error) {
+				return false;
+			}
+
+			remaining -= n;
+		}
+
+		return head.compare(0, 12, "HTTP/1.1 200") == 0;
+	}
+
+	struct mode {
+		const char *name;
+		std::shared_ptr<msr::write_scheduler> scheduler;
+		std::vector<double> latency_ms;
+		std::size_t failed = 0;
+		std::size_t videos = 0;
+	};
+
+	// p in [0, 1]
+	double percentile(std::vector<double> values, double p)
+	{
+		if (values.empty()) {
+			return 0.0;
+		}
+
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()))];
+	}
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+	if (argc > 4) {
+		std::cerr << "usage: head-of-line-benchmark [video MB] [video clients] [requests]" << std::endl;
+		return 2;
+	}
+
+	std::size_t video_mb = 128;
+	std::size_t video_clients = 4;
+	std::size_t requests = 100;
+
+	try {
+		if (argc > 1) video_mb = std::stoul(argv[1]);
+		if (argc > 2) video_clients = std::stoul(argv[2]);
+		if (argc > 3) requests = std::stoul(argv[3]);
+	} catch (std::exception &) {
+		std::cerr << "the arguments are numbers" << std::endl;
+		return 2;
+	}
+
+	if (video_mb == 0 || requests == 0) {
+		std::cerr << "usage: head-of-line-benchmark [video MB] [video clients] [requests]" << std::endl;
+		return 2;
+	}
+
+	auto root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("msr-head-of-line-benchmark-%%%%%%%%");
+	boost::system::error_code error;
+
+	create_directories(root, error);
+
+	{
+		// larger than the content cache takes by default, so it is streamed from the disk
+		boost::filesystem::ofstream video(root / "video.mp4", std::ios::binary | std::ios::trunc);
+		std::string megabyte(1024 * 1024, 'v');
+
+		for (std::size_t i = 0; i < video_mb; ++i) {
+			video << megabyte;
+		}
+
+		boost::filesystem::ofstream(root / "style.css", std::ios::binary | std::ios::trunc) << std::string(20 * 1024, 'c');
+		boost::filesystem::ofstream(root / "app.js", std::ios::binary | std::ios::trunc) << std::string(60 * 1024, 'j');
+	}
+
+	const auto unlimited = std::numeric_limits<std::size_t>::max();
+
+	mode modes[] = {
+		{ "write scheduler", std::make_shared<msr::write_scheduler>(), {}, 0, 0 },
+		{ "no scheduler", std::make_shared<msr::write_scheduler>(unlimited, unlimited), {}, 0, 0 },
+	};
+
+	for (auto &m : modes) {
+		boost::asio::io_service io_service;
+		msr::tcp_server server(io_service);
+
+		msr::provider_options options;
+		options.prewarm.enabled = false;
+
+		server.set_options(options);
+		server.set_write_scheduler(m.scheduler);
+
+		if (!server.start(root)) {
+			std::cerr << "the server cannot be started" << std::endl;
+			remove_all(root, error);
+			return 2;
+		}
+
+		// the one server thread the video and the page compete for
+		std::thread io_thread([&]() { io_service.run(); });
+
+		tcp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), server.get_port());
+		boost::asio::io_service client_service;
+		tcp::socket page(client_service);
+
+		// the small files are cached before the videos start
+		page.connect(endpoint, error);
+		get(page, "/style.css");
+		get(page, "/app.js");
+
+		std::atomic<bool> stopping{ false };
+		std::atomic<std::size_t> videos{ 0 };
+		std::vector<std::thread> clients;
+
+		for (std::size_t i = 0; i < video_clients; ++i) {
+			clients.emplace_back([&]() {
+				while (!stopping) {
+					boost::asio::io_service service;
+					tcp::socket socket(service);
+					boost::system::error_code e;
+
+					socket.connect(endpoint, e);
+
+					while (!e && !stopping && get(socket, "/video.mp4", &stopping)) {
+						++videos;
+					}
+				}
+			});
+		}
+
+		// the videos are being written
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+		for (std::size_t r = 0; r < requests; ++r) {
+			auto start = clock_type::now();
+
+			if (get(page, r % 2 ? "/app.js" : "/style.css")) {
+				m.latency_ms.push_back(std::chrono::duration<double, std::milli>(clock_type::now() - start).count());
+			} else {
+				++m.failed;
+
+				page.close(error);
+				page.connect(endpoint, error);
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		stopping = true;
+
+		for (auto &c : clients) {
+			c.join();
+		}
+
+		m.videos = videos;
+
+		page.close(error);
+		server.shutdown(std::chrono::seconds(1));
+		io_thread.join();
+	}
+
+	remove_all(root, error);
+
+	std::cout << requests << " stylesheet and script requests while " << video_clients << " clients download a "
+		<< video_mb << " MB video, one server thread" << std::endl;
+	std::cout << "  " << std::left << std::setw(18) << "" << std::right
+		<< std::setw(10) << "median" << std::setw(10) << "p95" << std::setw(10) << "max" << std::setw(9) << "videos" << std::endl;
+
+	auto answered = true;
+
+	for (auto &m : modes) {
+		std::cout << "  " << std::left << std::setw(18) << m.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(7) << percentile(m.latency_ms, 0.5) << " ms"
+			<< std::setw(7) << percentile(m.latency_ms, 0.95) << " ms"
+			<< std::setw(7) << percentile(m.latency_ms, 1.0) << " ms"
+			<< std::setw(9) << m.videos << std::endl;
+
+		answered = answered && m.failed == 0;
+	}
+
+	if (!answered) {
+		std::cout << "some requests failed" << std::endl;
+	}
+
+	return answered ? 0 : 1;
+}
@@ -165,6 +165,27 @@ public:
 
 		running_ = false;
 	}
+
+	bool shutdown(std::chrono::milliseconds timeout) override
+	{
+		if (!running_) {
+			return true;
+		}
+
+		::SetEvent(cancel_event_);
+
+		auto drained = ::WaitForSingleObject(helper_process_, static_cast<DWORD>(timeout.count())) == WAIT_OBJECT_0;
+
+		if (!drained) {
+			::TerminateProcess(helper_process_, 1);
+			::WaitForSingleObject(helper_process_, INFINITE);
+		}
+
+		running_ = false;
+
+		return drained;
+	}
+
 	unsigned short get_port() override
 	{
 		return port_;
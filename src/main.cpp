@@ -14,11 +14,7 @@
 #include "renderer_handler.hpp"
 #include "other_handler.hpp"
 
-#include <fstream>
-
 #include <boost/filesystem/path.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/ini_parser.hpp>
 
 # pragma comment(linker, "/manifestdependency:\"type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='amd64' publicKeyToken='6595b64144ccf1df' language='*'\"")
 
@@ -52,27 +48,14 @@ int run()
 
 	CefSettings settings;
 
+	// parsed once; main_window watches it for changes
+	auto exe_dir = boost::filesystem::path(get_exe_path()).remove_filename();
+	auto config = app_config::load(exe_dir);
+
 	{
 		CefString resource_dir = &settings.resources_dir_path;
 
-		auto exe_dir = boost::filesystem::path(get_exe_path()).remove_filename();
-		auto ini_name = exe_dir / L"config.ini";
-
-		if (exists(ini_name)) {
-			std::wifstream ifs(ini_name.wstring());
-
-			if (ifs) {
-				boost::property_tree::wptree tree;
-				read_ini(ifs, tree);
-
-				auto v = tree.get_optional<std::wstring>(L"Exe.ResourceDir");
-
-				if (v) {
-					boost::system::error_code err;
-					resource_dir.FromWString(canonical(*v, exe_dir, err).wstring());
-				}
-			}
-		}
+		resource_dir.FromWString(config.resource_dir.wstring());
 
 		if (resource_dir.empty()) {
 			resource_dir.FromWString((exe_dir / L"resources").wstring());
@@ -88,7 +71,7 @@ int run()
 				return 0;
 			}
 
-			main_window w(static_cast<browser_handler*>(app.get()));
+			main_window w(static_cast<browser_handler*>(app.get()), config);
 
 			if (!w.create(nullptr, L""))
 				return 0;
@@ -9,18 +9,20 @@
 #include <quote/cef/print_to_pdf.hpp>
 #include <quote/cef/make_string_visitor.hpp>
 
+#include <chrono>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <memory>
-
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/ini_parser.hpp>
+#include <vector>
 
 #include "include/wrapper/cef_closure_task.h"
 
 #include "msr.hpp"
+#include "config.hpp"
 #include "jupyter_server.hpp"
 #include "browser_handler.hpp"
+#include "reveal_scheme_handler.hpp"
 #include "utility.hpp"
 
 #include "browser_window.hpp"
@@ -30,7 +32,11 @@ class main_window : public browser_window
 	// micro server for reveal.js
 	boost::asio::io_service io_service_;
 	std::unique_ptr<server_base> server_;
-	std::thread server_thread_;
+	std::vector<std::thread> server_threads_;
+
+	// config.ini as it was at startup
+	app_config config_;
+	std::unique_ptr<config_watcher> config_watcher_;
 
 	CefRefPtr<browser_handler> browser_handler_;
 	std::unordered_map<int, browser_window*> other_windows_;
@@ -54,6 +60,33 @@ class main_window : public browser_window
 		FIND
 	};
 
+	// config.ini has changed; called on the thread of the watcher
+	void reload_config(msr::tcp_server &server, const app_config &config)
+	{
+		if (!config_.reloadable_from(config)) {
+			::OutputDebugStringW(L"config.ini: some of the changes take effect at the next start\n");
+		}
+
+		// a document root chosen in the dialog stays
+		auto root = config.document_root.empty() ? server.get_document_root() : config.document_root;
+
+		auto reloaded = server.reload(root, config.provider, [&](msr::resource_provider &provider) {
+			for (auto &m : config.mounts) {
+				provider.mount(std::get<0>(m), std::get<2>(m), std::get<1>(m));
+			}
+		});
+
+		if (!reloaded) {
+			::OutputDebugStringW(L"config.ini: the server could not be reloaded\n");
+			return;
+		}
+
+		// CefBrowser may be used from any thread of the browser process
+		if (browser_.get() != nullptr) {
+			browser_->Reload();
+		}
+	}
+
 	static void set_font_families(CefBrowserSettings &settings)
 	{
 		CefString(&settings.standard_font_family).FromString(L"MS Gothic", 9, true);
@@ -68,8 +101,9 @@ public:
 		return L"reveal-viewer main_window";
 	}
 
-	main_window(CefRefPtr<browser_handler> handler)
-		: browser_handler_(handler)
+	main_window(CefRefPtr<browser_handler> handler, const app_config &config)
+		: config_(config)
+		, browser_handler_(handler)
 	{
 	}
 
@@ -100,64 +134,81 @@ public:
 
 		try {
 			auto exe_dir = ::get_exe_path().remove_filename();
-			auto config_file = exe_dir / "config.ini";
-			boost::filesystem::path server_root;
-			bool use_jupyter = false;
-
-			if (exists(config_file)) {
-				std::wifstream ifs(config_file.wstring());
-
-				if (ifs) {
-					boost::property_tree::wptree tree;
-					read_ini(ifs, tree);
-
-					auto v = tree.get_optional<std::wstring>(L"Server.DocumentRoot");
-
-					if (v) {
-						if (!v->empty()) {
-							boost::system::error_code ec;
-							server_root = canonical(*v, exe_dir, ec);
-						}
-					}
-
-					v = tree.get_optional<std::wstring>(L"Server.Type");
-
-					if (v) {
-						if (::_wcsicmp(v->c_str(), L"jupyter") == 0) {
-							use_jupyter = true;
-						}
-					}
-				}
-			}
+			auto server_root = config_.document_root;
+			auto &audience_options = config_.audience;
 
 			if(server_root.empty()){
 				server_root = quote::win32::open_directory_dialog(
 					*this,
-					get_exe_path().remove_filename().c_str(),
+					exe_dir.c_str(),
 					L"Select document root directory");
 			}
 
-			if (use_jupyter) {
+			msr::tcp_server *msr_server = nullptr;
+
+			if (config_.use_jupyter) {
 				server_.reset(new jupyter_server());
 			} else {
-				server_.reset(new msr::tcp_server(io_service_));
+				msr_server = new msr::tcp_server(io_service_);
+				msr_server->set_options(config_.provider);
+				msr_server->set_network_options(config_.network);
+				msr_server->set_audience_options(audience_options);
+
+				if (config_.record_timing) {
+					msr_server->record_timing(config_.timing);
+				}
+				server_.reset(msr_server);
 			}
 
 			if (!server_->start(server_root)) {
 				return false;
 			}
 
-			if (!use_jupyter) {
-				server_thread_ = std::thread([&]() {
-					io_service_.run();
-					server_thread_.detach();
-				});
+			if (msr_server != nullptr) {
+				for (auto &m : config_.mounts) {
+					msr_server->mount(std::get<0>(m), std::get<2>(m), std::get<1>(m));
+				}
+			}
+
+			if (!config_.use_jupyter) {
+				std::size_t threads = 1;
+
+				if (audience_options.enabled) {
+					threads = audience_options.threads != 0
+						? audience_options.threads
+						: std::max(1u, std::thread::hardware_concurrency());
+				}
+
+				for (std::size_t i = 0; i < threads; ++i) {
+					server_threads_.emplace_back([&]() {
+						io_service_.run();
+					});
+				}
 			}
 
 			LONG width, height;
 			std::tie(width, height) = this->get_size();
 
-			unsigned short port = server_->get_port();
+			// the presenter connects from this machine, so /.msr/present accepts it
+			std::wstring host = L"localhost";
+
+			if (msr_server != nullptr && audience_options.enabled
+				&& audience_options.address != "0.0.0.0" && audience_options.address != "::") {
+				host = CefString(audience_options.address).ToWString();
+			}
+
+			std::wstring url = L"http://" + host + L":" + std::to_wstring(server_->get_port());
+
+			// the in-process scheme handler bypasses the emulated link and the timing,
+			// and the audience follows the presenter through the server
+			if (msr_server != nullptr && config_.in_process && !config_.network.emulated() && !config_.record_timing && !audience_options.enabled) {
+				::CefRegisterSchemeHandlerFactory(
+					reveal_scheme_name,
+					reveal_scheme_host,
+					new reveal_scheme_handler_factory(msr_server->providers()));
+
+				url = std::wstring(reveal_scheme_name) + L"://" + reveal_scheme_host + L"/";
+			}
 
 			CefWindowInfo window_info;
 			window_info.SetAsChild(this->get_hwnd(), { 0, 0, width, height });
@@ -167,7 +218,7 @@ public:
 			set_font_families(settings);
 
 			browser(CefBrowserHost::CreateBrowserSync(
-				window_info, browser_handler_.get(), L"http://localhost:" + std::to_wstring(port),
+				window_info, browser_handler_.get(), url,
 				settings, nullptr));
 
 			if (browser_.get() == nullptr) {
@@ -175,6 +226,23 @@ public:
 			}
 
 			hwnd_browser(browser_->GetHost()->GetWindowHandle());
+
+			if (msr_server != nullptr) {
+				config_watcher_.reset(new config_watcher(exe_dir / "config.ini", [this, msr_server](const app_config &config) {
+					reload_config(*msr_server, config);
+				}));
+
+				// [Search] of config.ini; finds nothing while it is disabled
+				deck_search([msr_server](const std::wstring &text) {
+					std::vector<std::string> urls;
+
+					for (auto &hit : msr_server->provider()->search(CefString(text).ToString()).hits) {
+						urls.push_back(hit.url + "#/" + std::to_string(hit.h) + "/" + std::to_string(hit.v));
+					}
+
+					return urls;
+				});
+			}
 		} catch (std::exception &e) {
 			::MessageBoxA(this->get_hwnd(), e.what(), "Error", MB_OK);
 			return false;
@@ -504,18 +572,32 @@ public:
 
 	void uninitialize() override
 	{
+		// no reload from now on
+		config_watcher_.reset();
+
+		::CefClearSchemeHandlerFactories();
+
+		auto shutdown_begin = std::chrono::steady_clock::now();
+		auto drained = server_->shutdown(std::chrono::milliseconds(2000));
+
 		if (!io_service_.stopped()) {
 			io_service_.stop();
 		}
 
-		server_->stop();
-
-		if (server_thread_.joinable()) {
-			while (server_thread_.get_id() != std::thread::id()) {
-				::Sleep(1);
+		for (auto &t : server_threads_) {
+			if (t.joinable()) {
+				t.join();
 			}
 		}
 
+		server_threads_.clear();
+
+		auto shutdown_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - shutdown_begin);
+
+		::OutputDebugStringW((L"server shutdown: " + std::to_wstring(shutdown_time.count()) + L" ms"
+			+ (drained ? L"\n" : L" (cancelled)\n")).c_str());
+
 		hwnd_browser(nullptr);
 		browser(nullptr);
 
@@ -1,285 +1,519 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/enable_shared_from_this.hpp>
-#include <boost/xpressive/xpressive.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time.hpp>
 #include <boost/filesystem.hpp>
-
+#include <boost/filesystem/fstream.hpp>
+#include <boost/version.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
-#include <sstream>
+#include <unordered_map>
+#include <vector>
 
 #include "server_base.hpp"
+#include "msr/handler_memory.hpp"
+#include "msr/http.hpp"
+#include "msr/load_timeline.hpp"
+#include "msr/network_emulation.hpp"
+#include "msr/request_timing.hpp"
+#include "msr/resource_provider.hpp"
+#include "msr/write_scheduler.hpp"
 
 // Micro Server for Reveal.js
 
 namespace msr {
 	using boost::asio::ip::tcp;
 
-	struct request_data {
-		std::string method, uri;
-		bool invalid;
-	};
+	class tcp_connection;
 
-	inline boost::posix_time::ptime parse_time(const std::string &str)
+	// the io_service an I/O object runs on; get_io_service() is gone since Boost 1.70
+	template <typename IoObject>
+	boost::asio::io_service &io_service_of(IoObject &object)
 	{
-		boost::posix_time::ptime time;
-
-		std::istringstream sstr;
+#if BOOST_VERSION >= 107000
+		return static_cast<boost::asio::io_service &>(object.get_executor().context());
+#else
+		return object.get_io_service();
+#endif
+	}
 
-		sstr.str(str);
+	// Live connections of a server and how many of them are sending a response,
+	// so that the server can drain them on shutdown.
+	class connection_registry {
+		std::mutex mutex_;
+		std::condition_variable changed_;
+		std::unordered_map<const tcp_connection *, boost::weak_ptr<tcp_connection>> connections_;
+		std::size_t busy_ = 0;
+		bool draining_ = false;
 
-		try {
-			auto facet_rfc1123 = new boost::posix_time::time_facet("%a, %d %b %Y %H:%M:%S GMT");
+	public:
+		void add(const boost::shared_ptr<tcp_connection> &connection)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			connections_[connection.get()] = connection;
+		}
 
-			sstr.imbue(std::locale(sstr.getloc(), facet_rfc1123));
-			sstr >> time;
-		} catch (std::ios_base::failure &) {
+		void remove(const tcp_connection *connection)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			connections_.erase(connection);
+			changed_.notify_all();
 		}
 
-		try {
-			auto facet_rfc850 = new boost::posix_time::time_facet("%A, %d-%b-%y %H:%M:%S GMT");
+		void begin_response()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++busy_;
+		}
 
-			sstr.imbue(std::locale(sstr.getloc(), facet_rfc850));
-			sstr >> time;
-		} catch (std::ios_base::failure &) {
+		void end_response()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			--busy_;
+			changed_.notify_all();
 		}
 
-		try {
-			auto facet_asctime = new boost::posix_time::time_facet("%a %b %e %H:%M:%S %Y");
+		// connections close after their current response from now on
+		void start_draining()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			draining_ = true;
+			changed_.notify_all();
+		}
 
-			sstr.imbue(std::locale(sstr.getloc(), facet_asctime));
-			sstr >> time;
-		} catch (std::ios_base::failure &) {
-			return boost::posix_time::ptime();
+		bool draining()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return draining_;
 		}
 
-		return time;
-	}
+		std::size_t size()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return connections_.size();
+		}
 
-	inline std::string format_time(const boost::posix_time::ptime &time)
-	{
-		auto facet_rfc1123 = new boost::posix_time::time_facet("%a, %d %b %Y %H:%M:%S GMT");
+		// true if draining has started and no response is in progress before the deadline
+		bool wait_drained(std::chrono::steady_clock::time_point deadline)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			return changed_.wait_until(lock, deadline, [this]() { return draining_ && busy_ == 0; });
+		}
 
-		std::stringstream sstr;
+		bool wait_closed(std::chrono::steady_clock::time_point deadline)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			return changed_.wait_until(lock, deadline, [this]() { return connections_.empty(); });
+		}
 
-		sstr.imbue(std::locale(sstr.getloc(), facet_rfc1123));
-		sstr << time;
+		std::vector<boost::shared_ptr<tcp_connection>> connections()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			std::vector<boost::shared_ptr<tcp_connection>> result;
 
-		return sstr.str();
-	}
+			for (auto &c : connections_) {
+				if (auto p = c.second.lock()) {
+					result.push_back(p);
+				}
+			}
 
-	inline std::string content_type(const std::string &ext)
-	{
-		if (ext == ".html" || ext == ".htm") {
-			return "text/html";
-		} else if (ext == ".css") {
-			return "text/css";
-		} else if (ext == ".js") {
-			return "application/javascript";
-		} else if (ext == ".rtf") {
-			return "application/rtf";
-		} else if (ext == ".xml") {
-			return "text/xml";
-		} else if (ext == ".txt" || ext == ".md") {
-			return "text/plain";
-		} else if (ext == ".jpg" || ext == ".jpeg") {
-			return "image/jpeg";
-		} else if (ext == ".gif") {
-			return "image/gif";
-		} else if (ext == ".png") {
-			return "image/png";
-		} else if (ext == ".tiff") {
-			return "image/tiff";
-		} else if (ext == ".woff") {
-			return "application/x-font-woff";
-		} else if (ext == ".pdf") {
-			return "application/pdf";
-		} else if (ext == ".svg") {
-			return "image/svg+xml";
-		}
-
-		// unknown or not implemented
-		return "application/octet-stream";
-	}
+			return result;
+		}
+	};
 
+	// One client connection. Its lifecycle (read a request, resolve it, respond,
+	// and loop while the client keeps the connection alive) is a stackless
+	// coroutine; every asynchronous step resumes it where it left off.
+	// The body is written in chunks, each when the write scheduler allows it
+	// and, if network conditions are emulated, once the link is ready for it.
+	// The coroutine runs on a strand, so the I/O service may be run by several threads.
 	class tcp_connection :
-		public boost::enable_shared_from_this<tcp_connection>
+		public boost::enable_shared_from_this<tcp_connection>,
+		boost::asio::coroutine
 	{
+		// request heads larger than this are answered with 400 Bad Request
+		static const std::size_t max_head_size = 16 * 1024;
+
 		tcp::socket socket_;
-		std::array<char, 4096> recv_buffer_;
-		std::string buffer_;
+		boost::asio::io_service::strand strand_;
+		boost::asio::streambuf buffer_;
 		request_data request_;
-		boost::xpressive::sregex regex_req_line_, regex_header_;
-		boost::filesystem::path root_;
-		enum class state {
-			wait_for_request_line,
-			wait_for_headers,
-			reception_completed,
-		}state_;
-
-		tcp_connection(boost::asio::io_service& io_service, const std::string &root)
+		response_data response_;
+		std::string head_;
+		bool keep_alive_ = false;
+		handler_memory memory_;
+		std::shared_ptr<provider_slot> providers_;
+		std::shared_ptr<connection_registry> registry_;
+		std::shared_ptr<write_scheduler> scheduler_;
+		std::atomic<bool> busy_{ false };
+
+		// the provider of the current request; a reloaded server gives the next one another
+		std::shared_ptr<resource_provider> provider_;
+
+		// the client is on this machine
+		bool local_ = false;
+
+		// chunks the scheduler has granted to this connection
+		std::uint64_t granted_ = 0;
+
+		// the turn of the chunk being written has not been given back; it is
+		// given back after turn_timeout() if the client is not reading
+		bool turn_held_ = false;
+		boost::asio::steady_timer turn_timer_;
+
+		// of a body that is read as it is sent (response_data::read_body)
+		std::vector<char> chunk_;
+
+		// only if network conditions are emulated
+		std::unique_ptr<network_shaper> shaper_;
+		std::unique_ptr<boost::asio::steady_timer> timer_;
+
+		// only if requests are timed
+		std::shared_ptr<timing_recorder> timing_;
+		std::uint64_t id_;
+		std::size_t served_ = 0;
+
+		// of the current response
+		response_priority priority_ = priority_document;
+		std::uint64_t order_ = 0;
+		std::size_t sent_ = 0;
+		std::chrono::steady_clock::time_point received_, first_byte_;
+		std::chrono::microseconds delayed_{ 0 };
+
+		// 103 Early Hints have been sent after the emulated round trip of the request
+		bool hinted_ = false;
+
+		tcp_connection(
+			boost::asio::io_service& io_service,
+			std::shared_ptr<provider_slot> providers,
+			std::shared_ptr<connection_registry> registry,
+			std::shared_ptr<write_scheduler> scheduler,
+			const network_options &network,
+			std::shared_ptr<timing_recorder> timing)
 			: socket_(io_service)
-			, root_(boost::filesystem::absolute(root))
+			, strand_(io_service)
+			, buffer_(max_head_size)
+			, providers_(std::move(providers))
+			, registry_(std::move(registry))
+			, scheduler_(std::move(scheduler))
+			, turn_timer_(io_service)
+			, timing_(std::move(timing))
 		{
-			using namespace boost::xpressive;
+			static std::atomic<std::uint64_t> connections{ 0 };
+			id_ = ++connections;
 
-			// https://www.w3.org/Protocols/rfc2616/rfc2616-sec5.html
-			// METHOD SP Request-URI SP HTTP-Version
-			// ([^ ]+) (?:https?://[^/]+)?([^?]*)[^ ]* .*
-			regex_req_line_ = (s1 = +~as_xpr(' ')) >> ' ' >> !("http" >> !as_xpr('s') >> "://" >> +~as_xpr('/')) >> (s2 = *~as_xpr('?')) >> *~as_xpr(' ') >> ' ' >> *_;
+			if (network.emulated()) {
+				shaper_.reset(new network_shaper(network));
+				timer_.reset(new boost::asio::steady_timer(io_service));
+			}
 		}
 
-		void handle_write(boost::shared_ptr<std::vector<char> > /* sendbuf */, size_t /* len */) {}
+		void begin_response()
+		{
+			busy_ = true;
+			registry_->begin_response();
+		}
 
-		void handle_receive(const boost::system::error_code& error, size_t len)
+		void end_response()
 		{
-			if (!error || error == boost::asio::error::message_size) {
-				// std::string message(recv_buffer_.data(), len);
-				// std::cout << message << std::endl;
+			if (busy_) {
+				busy_ = false;
+				registry_->end_response();
+			}
+		}
 
-				// parse request message
-				buffer_.append(recv_buffer_.data(), len);
+		void prepare_response()
+		{
+			head_.clear();
+			sent_ = 0;
+			priority_ = priority_for_content_type(response_.header("Content-Type"));
 
-				if (state_ == state::wait_for_request_line) {
-					auto pos = buffer_.find("\r\n");
+			head_ += "HTTP/1.1 " + response_.status + "\r\n";
+			head_ += keep_alive_ ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+			head_ += "Date: " + format_time(boost::posix_time::second_clock::universal_time()) + "\r\n";
+			head_ += "Server: Disclose Microserver\r\n";
 
-					if (pos == std::string::npos) {
-						return;
-					}
+			for (auto &h : response_.headers) {
+				head_ += h.first + ": " + h.second + "\r\n";
+			}
 
-					std::string line = buffer_.substr(0, pos);
-					buffer_.erase(0, pos + 1);
+			if (response_.status_code() != 304) {
+				head_ += "Content-Length: " + std::to_string(response_.body_size) + "\r\n";
+			}
 
-					boost::xpressive::smatch what;
+			head_ += "\r\n";
 
-					if (regex_search(line, what, regex_req_line_)) {
-						if (what[1] != "GET") {
-							// not implemented
-							request_.method = what[1];
-							state_ = state::reception_completed;
-						} else {
-							request_.method = what[1];
-							request_.uri = what[2];
-							state_ = state::wait_for_headers;
-						}
-					} else {
-						// invalid request line or invalid regex
-						request_.invalid = true;
-						state_ = state::reception_completed;
-					}
+			// std::cout << head_ << std::endl;
+		}
+
+		// true if the next chunk has to wait for the emulated link; the timer is set
+		bool delay_chunk()
+		{
+			if (!shaper_) {
+				return false;
+			}
+
+			auto size = std::min(scheduler_->chunk_size(), response_.body_size - sent_);
+			auto delay = shaper_->delay(head_.size() + size, sent_ == 0 && !hinted_);
+
+			if (delay.count() == 0) {
+				return false;
+			}
+
+			delayed_ += delay;
+			timer_->expires_from_now(delay);
+
+			return true;
+		}
+
+		// true if the early hints in head_ have to wait for the emulated link; the timer is set
+		bool delay_hints()
+		{
+			if (!shaper_) {
+				return false;
+			}
+
+			// the hints take the round trip; the response then follows them without another one
+			auto delay = shaper_->delay(head_.size(), true);
+
+			hinted_ = true;
+
+			if (delay.count() == 0) {
+				return false;
+			}
+
+			delayed_ += delay;
+			timer_->expires_from_now(delay);
+
+			return true;
+		}
+
+		void record_timing()
+		{
+			request_timing t;
+
+			t.connection = id_;
+			t.reused = served_;
+			t.method = request_.method;
+			t.uri = request_.query.empty() ? request_.uri : request_.uri + '?' + request_.query;
+			t.host = request_.header("host");
+			t.referer = request_.header("referer");
+			t.status = response_.status_code();
+			t.content_type = response_.header("Content-Type");
+			t.body_size = response_.body_size;
+			t.received = received_;
+			t.first_byte = first_byte_;
+			t.finished = std::chrono::steady_clock::now();
+			t.emulated_delay = delayed_;
+
+			timing_->record(t);
+		}
+
+		void release_turn()
+		{
+			if (turn_held_) {
+				turn_held_ = false;
+
+				boost::system::error_code error;
+				turn_timer_.cancel(error);
+
+				scheduler_->release();
+			}
+		}
+
+		// writes the head, if it has not been written yet, and the next chunk of the body
+		void write_chunk()
+		{
+			auto self = shared_from_this();
+			auto size = std::min(scheduler_->chunk_size(), response_.body_size - sent_);
+			auto data = response_.body + sent_;
+
+			turn_held_ = true;
+
+			if (response_.read_body) {
+				chunk_.resize(size);
+
+				if (response_.read_body(sent_, chunk_.data(), size) != size) {
+					strand_.post([self]() {
+						self->resume(boost::system::errc::make_error_code(boost::system::errc::io_error));
+					});
+
+					return;
 				}
 
-				if (state_ == state::wait_for_headers) {
-					// not implemented
-					state_ = state::reception_completed;
+				data = chunk_.data();
+			}
+
+			std::array<boost::asio::const_buffer, 2> buffers = { {
+				boost::asio::buffer(head_),
+				boost::asio::buffer(data, size)
+			} };
+
+			sent_ += size;
+
+			// a client that stops reading keeps its turn no longer than this
+			auto turn = granted_;
+
+			turn_timer_.expires_from_now(scheduler_->turn_timeout());
+			turn_timer_.async_wait(strand_.wrap([self, turn](const boost::system::error_code &e) {
+				if (!e && turn == self->granted_) {
+					self->release_turn();
 				}
+			}));
 
-				if (state_ == state::reception_completed) {
-					std::string status_line;
-					std::string headers;
-					std::string response;
+			boost::asio::async_write(socket_, buffers, strand_.wrap(make_custom_alloc_handler(memory_, [self](const boost::system::error_code& e, std::size_t n) {
+				self->resume(e, n);
+			})));
+		}
 
-					headers += "Connection: close\r\n";
-					headers += "Date: " + format_time(boost::posix_time::second_clock::universal_time()) + "\r\n";
-					headers += "Server: Disclose Microserver\r\n";
-					headers += "Connection: close\r\n";
+		void resume(const boost::system::error_code& error = boost::system::error_code(), std::size_t length = 0)
+		{
+			auto self = shared_from_this();
+			auto next = strand_.wrap(make_custom_alloc_handler(memory_, [self](const boost::system::error_code& e, std::size_t n) {
+				self->resume(e, n);
+			}));
 
-					boost::shared_ptr<std::vector<char> > sendbuf(new std::vector<char>);
-					auto pbuf = sendbuf.get();
+			BOOST_ASIO_CORO_REENTER (this) {
+				for (;;) {
+					BOOST_ASIO_CORO_YIELD boost::asio::async_read_until(socket_, buffer_, "\r\n\r\n", next);
 
-					if (request_.invalid) {
-						status_line = "HTTP/1.1 400 Bad Request\r\n";
-						headers += "Content-Length: 0\r\n\r\n";
-						pbuf->insert(pbuf->begin(), status_line.begin(), status_line.end());
-						pbuf->insert(pbuf->end() - 1, headers.begin(), headers.end());
+					if (error == boost::asio::error::not_found) {
+						request_ = request_data();
+						request_.invalid = true;
+					} else if (error) {
+						return;
 					} else {
-						if (request_.method != "GET") {
-							status_line = "HTTP/1.0 501 Not Implemented\r\n";
-							headers += "Content-Length: 0\r\n\r\n";
-							pbuf->insert(pbuf->begin(), status_line.begin(), status_line.end());
-							pbuf->insert(pbuf->end() - 1, headers.begin(), headers.end());
-						} else {
-							boost::system::error_code error;
-							auto path =canonical(absolute(root_ / request_.uri), error);
-
-							if (error.value() == boost::system::errc::success) {
-								if (is_directory(path)) {
-									error.assign(boost::system::errc::is_a_directory, boost::system::generic_category());
-									for (auto &f : { ".html", ".htm" }) {
-										if (exists((path / "index").replace_extension(f))) {
-											error.assign(boost::system::errc::success, boost::system::generic_category());
-											path = (path / "index").replace_extension(f);
-											break;
-										}
-									}
-								}
-							}
+						std::string head(
+							boost::asio::buffers_begin(buffer_.data()),
+							boost::asio::buffers_begin(buffer_.data()) + length);
 
-							if (error.value() != boost::system::errc::success || !exists(path)) {
-								std::string message;
-
-								if (is_directory(path)) {
-									message = (path / L"index.html").string() + " not found";
-								} else {
-									message = path.string() + " not found";
-								}
-
-								status_line = "HTTP/1.1 404 Not Found\r\n";
-								headers += "Content-Length: " + std::to_string(message.size()) + "\r\n\r\n";
-
-								pbuf->insert(pbuf->begin(), status_line.begin(), status_line.end());
-								pbuf->insert(pbuf->end() - 1, headers.begin(), headers.end());
-								pbuf->insert(pbuf->end() - 1, message.begin(), message.end());
-							} else {
-								auto last_modified = boost::posix_time::from_time_t(last_write_time(path));
-
-								status_line = "HTTP/1.1 200 OK\r\n";
-								headers += "Last-Modified: " + format_time(last_modified) + "\r\n";
-								headers += "Content-Type: " + content_type(path.extension().string()) + "\r\n";
-								headers += "Content-Length: " + std::to_string(file_size(path)) + "\r\n\r\n";
-								pbuf->insert(pbuf->begin(), status_line.begin(), status_line.end());
-								pbuf->insert(pbuf->end() - 1, headers.begin(), headers.end());
-
-								std::ifstream ifs(path.wstring(), std::ios::binary);
-								char buffer[200];
-
-								while (ifs) {
-									ifs.read(buffer, 200);
-									pbuf->insert(pbuf->end() - 1, buffer, buffer + ifs.gcount());
-								}
-							}
+						buffer_.consume(length);
+						parse_request_head(head, request_);
+					}
+
+					request_.local = local_;
+
+					order_ = scheduler_->next_order();
+					received_ = std::chrono::steady_clock::now();
+					delayed_ = std::chrono::microseconds(0);
+					hinted_ = false;
+
+					// the body of other methods is not read, so the connection cannot be reused after them
+					keep_alive_ = !request_.invalid
+						&& request_.method == "GET"
+						&& request_.keep_alive()
+						&& !registry_->draining();
+
+					begin_response();
+					provider_ = providers_->get();
+
+					// written before the response is resolved; 1xx responses are for HTTP/1.1 clients only
+					head_ = request_.version == "HTTP/1.1" ? provider_->early_hints(request_) : std::string();
+
+					if (!head_.empty()) {
+						head_ = "HTTP/1.1 103 Early Hints\r\nLink: " + head_ + "\r\n\r\n";
+
+						if (delay_hints()) {
+							BOOST_ASIO_CORO_YIELD timer_->async_wait(strand_.wrap(make_custom_alloc_handler(memory_, [self](const boost::system::error_code& e) {
+								self->resume(e);
+							})));
+						}
+
+						if (!error) {
+							BOOST_ASIO_CORO_YIELD boost::asio::async_write(socket_, boost::asio::buffer(head_), next);
+						}
+
+						if (error) {
+							end_response();
+							provider_.reset();
+							close();
+							return;
 						}
 					}
 
-					// std::cout << "status line\n" << status_line << std::endl;
-					// std::cout << "headers\n" << headers << std::endl;
+					BOOST_ASIO_CORO_YIELD provider_->handle(request_, [self](response_data response) {
+						// the provider may answer from a worker thread
+						self->strand_.post([self, response]() {
+							self->response_ = response;
+							self->resume();
+						});
+					});
+
+					prepare_response();
 
-					async_write(socket_, boost::asio::buffer(*sendbuf),
-						boost::bind(&tcp_connection::handle_write, shared_from_this(), sendbuf, len));
+					do {
+						if (delay_chunk()) {
+							BOOST_ASIO_CORO_YIELD timer_->async_wait(strand_.wrap(make_custom_alloc_handler(memory_, [self](const boost::system::error_code& e) {
+								self->resume(e);
+							})));
 
-					start_receive();
+							if (error) {
+								break;
+							}
+						}
+
+						// granted on whichever thread released a turn
+						BOOST_ASIO_CORO_YIELD scheduler_->request(priority_, order_, [self]() {
+							self->strand_.dispatch([self]() { self->write_chunk(); });
+						}, granted_++);
+
+						release_turn();
+
+						if (!head_.empty()) {
+							first_byte_ = std::chrono::steady_clock::now();
+							head_.clear();
+						}
+					} while (!error && sent_ < response_.body_size);
+
+					if (timing_ && !error) {
+						record_timing();
+					}
+
+					++served_;
+					end_response();
+					response_ = response_data();
+					provider_.reset();
+
+					if (error || !keep_alive_ || registry_->draining()) {
+						close();
+						return;
+					}
 				}
 			}
 		}
 
-		void start_receive() {
-			state_ = state::wait_for_request_line;
-			request_ = {};
-			buffer_.clear();
-			socket_.async_receive(
-				boost::asio::buffer(recv_buffer_),
-				boost::bind(&tcp_connection::handle_receive, shared_from_this(),
-					boost::asio::placeholders::error, _2));
-		}
-
 	public:
 		typedef boost::shared_ptr<tcp_connection> pointer;
 
-		static pointer create(boost::asio::io_service& io_service, const std::string &root) {
-			return pointer(new tcp_connection(io_service, root));
+		static pointer create(
+			boost::asio::io_service& io_service,
+			std::shared_ptr<provider_slot> providers,
+			std::shared_ptr<connection_registry> registry,
+			std::shared_ptr<write_scheduler> scheduler,
+			const network_options &network,
+			std::shared_ptr<timing_recorder> timing)
+		{
+			return pointer(new tcp_connection(
+				io_service, std::move(providers), std::move(registry), std::move(scheduler), network, std::move(timing)));
+		}
+
+		~tcp_connection()
+		{
+			end_response();
+			registry_->remove(this);
 		}
 
 		tcp::socket& socket() {
@@ -289,37 +523,206 @@ namespace msr {
 		void start() {
 			// std::cout << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port() << std::endl;
 
-			start_receive();
+			boost::system::error_code error;
+			auto remote = socket_.remote_endpoint(error).address();
+
+			local_ = !error && (remote.is_loopback() || remote == socket_.local_endpoint(error).address());
+
+			registry_->add(shared_from_this());
+
+			auto self = shared_from_this();
+			strand_.dispatch([self]() { self->resume(); });
+		}
+
+		bool busy() const
+		{
+			return busy_;
+		}
+
+		// pending operations complete with operation_aborted
+		void close()
+		{
+			auto self = shared_from_this();
+
+			strand_.dispatch([self]() {
+				boost::system::error_code error;
+				self->socket_.shutdown(tcp::socket::shutdown_both, error);
+				self->socket_.close(error);
+
+				if (self->timer_) {
+					self->timer_->cancel(error);
+				}
+
+				self->turn_timer_.cancel(error);
+			});
 		}
 	};
 
 	class tcp_server : public server_base {
 		tcp::acceptor acceptor_;
+
+		// the acceptor is used from one thread at a time
+		boost::asio::io_service::strand accept_strand_;
+
+		// accepting resumes after this when descriptors run out
+		boost::asio::steady_timer accept_timer_;
 		boost::filesystem::path root_;
 		tcp_connection::pointer connection_;
+		provider_options options_;
+		std::shared_ptr<provider_slot> providers_ = std::make_shared<provider_slot>();
+
+		// one reload() at a time
+		std::mutex reload_mutex_;
+		std::shared_ptr<connection_registry> registry_ = std::make_shared<connection_registry>();
+		std::shared_ptr<write_scheduler> scheduler_ = std::make_shared<write_scheduler>();
+		network_options network_;
+		timing_options timing_options_;
+		std::shared_ptr<timing_recorder> timing_;
+		audience_options audience_;
 
 		void start_accept() {
-			connection_ = tcp_connection::create(acceptor_.get_io_service(), root_.string());
+			connection_ = tcp_connection::create(io_service_of(acceptor_), providers_, registry_, scheduler_, network_, timing_);
 
 			acceptor_.async_accept(connection_->socket(),
-				boost::bind(&tcp_server::handle_accept, this, connection_,
-					boost::asio::placeholders::error));
+				accept_strand_.wrap(boost::bind(&tcp_server::handle_accept, this, connection_,
+					boost::asio::placeholders::error)));
 
 			// std::cout << "port: " << acceptor_.local_endpoint().port() << std::endl;
 		}
 
 		void handle_accept(tcp_connection::pointer new_connection,
 			const boost::system::error_code& error) {
+			// closed by shutdown()
+			if (error == boost::asio::error::operation_aborted || !acceptor_.is_open()) {
+				return;
+			}
+
 			if (!error) {
-				new_connection->start();
-				start_accept();
+				if (audience_.enabled && registry_->size() >= audience_.max_connections) {
+					boost::system::error_code e;
+					new_connection->socket().close(e);
+				} else {
+					new_connection->start();
+				}
+			} else if (error == boost::asio::error::no_descriptors || error == boost::system::errc::too_many_files_open_in_system) {
+				// give the connections in progress time to close some
+				accept_timer_.expires_from_now(std::chrono::milliseconds(100));
+				accept_timer_.async_wait(accept_strand_.wrap([this](const boost::system::error_code &e) {
+					if (!e && acceptor_.is_open()) {
+						start_accept();
+					}
+				}));
+
+				return;
 			}
+
+			// other errors (e.g. the client reset the connection) are for this connection only
+			start_accept();
 		}
 
 	public:
 		tcp_server(boost::asio::io_service &io_service)
 			: acceptor_(io_service, tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0))
+			, accept_strand_(io_service)
+			, accept_timer_(io_service)
+		{
+		}
+
+		// must be called before start()
+		void set_options(const provider_options &options)
+		{
+			options_ = options;
+		}
+
+		// Serves the deck to the audience on address:port, with a scheduler that
+		// shares the writes fairly among the clients; must be called before start().
+		// The I/O service may then be run by audience_options::threads threads.
+		void set_audience_options(const audience_options &options)
+		{
+			audience_ = options;
+
+			if (options.enabled) {
+				scheduler_ = std::make_shared<write_scheduler>(64 * 1024, options.max_writes, true);
+			}
+		}
+
+		// Replaces the write scheduler, e.g. to compare with one that neither
+		// splits nor orders the bodies; must be called before start() and after
+		// set_audience_options().
+		void set_write_scheduler(std::shared_ptr<write_scheduler> scheduler)
+		{
+			scheduler_ = std::move(scheduler);
+		}
+
+		// emulated conditions of the link to clients; must be called before start()
+		void set_network_options(const network_options &options)
+		{
+			network_ = options;
+		}
+
+		// keeps the timing of requests; must be called before start()
+		void record_timing(const timing_options &options)
+		{
+			timing_options_ = options;
+			timing_ = std::make_shared<timing_recorder>(options.entries, options.log_file);
+		}
+
+		// the recorded requests grouped into page loads; valid after start()
+		std::vector<page_load> page_loads() const
+		{
+			auto provider = providers_->get();
+
+			if (!timing_ || !provider) {
+				return std::vector<page_load>();
+			}
+
+			return build_page_loads(timing_->entries(), [provider](const request_timing &document) {
+				std::set<std::string> paths;
+
+				for (auto &a : provider->page_assets(url_path(document.uri), document.host)) {
+					if (a.render_blocking) {
+						paths.insert(url_path(a.url));
+					}
+				}
+
+				return paths;
+			});
+		}
+
+		// writes the page loads to the files of the timing options
+		bool write_timeline() const
 		{
+			if (!timing_ || (timing_options_.trace_file.empty() && timing_options_.har_file.empty())) {
+				return true;
+			}
+
+			auto pages = page_loads();
+			auto result = true;
+
+			auto write = [&](const boost::filesystem::path &file, const std::string &content) {
+				if (file.empty()) {
+					return;
+				}
+
+				boost::system::error_code error;
+				create_directories(file.parent_path(), error);
+
+				boost::filesystem::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+				ofs << content;
+
+				result = result && !!ofs;
+			};
+
+			write(timing_options_.trace_file, to_chrome_trace(pages, timing_->origin()));
+			write(timing_options_.har_file, to_har(pages, timing_->origin(), timing_->origin_time()));
+
+			return result;
+		}
+
+		// nullptr unless record_timing() has been called
+		std::shared_ptr<timing_recorder> timing() const
+		{
+			return timing_;
 		}
 
 		bool start(const boost::filesystem::path &root) override
@@ -330,7 +733,25 @@ namespace msr {
 			root_ = root;
 
 			try {
+				if (audience_.enabled) {
+					tcp::endpoint endpoint(boost::asio::ip::address::from_string(audience_.address), audience_.port);
+
+					acceptor_.close();
+					acceptor_.open(endpoint.protocol());
+					acceptor_.set_option(tcp::acceptor::reuse_address(true));
+					acceptor_.bind(endpoint);
+					acceptor_.listen();
+				}
+
+				auto options = options_;
+				options.audience = audience_.enabled;
+
+				auto provider = make_provider(root_, options);
+				providers_->exchange(provider);
+
 				start_accept();
+
+				provider->prewarm();
 			} catch (std::exception &) {
 				return false;
 			}
@@ -340,8 +761,56 @@ namespace msr {
 
 		void stop() override
 		{
-			connection_.reset();
-			acceptor_.close();
+			shutdown(std::chrono::milliseconds(0));
+		}
+
+		// The I/O thread closes the acceptor and the idle connections; the caller
+		// then waits for the responses in progress and closes what remains.
+		bool shutdown(std::chrono::milliseconds timeout) override
+		{
+			// time allowed for cancelled connections to be released after the drain timeout
+			const auto cancel_timeout = std::chrono::milliseconds(200);
+
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			auto registry = registry_;
+
+			accept_strand_.post([this, registry]() {
+				boost::system::error_code error;
+				acceptor_.close(error);
+				accept_timer_.cancel(error);
+				connection_.reset();
+
+				registry->start_draining();
+
+				// answers the followers waiting for the next slide
+				if (auto provider = providers_->get()) {
+					provider->followers().release();
+				}
+
+				for (auto &c : registry->connections()) {
+					if (!c->busy()) {
+						c->close();
+					}
+				}
+			});
+
+			auto drained = registry->wait_drained(deadline);
+
+			io_service_of(acceptor_).post([registry]() {
+				for (auto &c : registry->connections()) {
+					c->close();
+				}
+			});
+
+			drained = registry->wait_closed(std::max(deadline, std::chrono::steady_clock::now() + cancel_timeout)) && drained;
+
+			write_timeline();
+
+			if (auto provider = providers_->get()) {
+				provider->stop();
+			}
+
+			return drained;
 		}
 
 		unsigned short get_port() override
@@ -353,5 +822,82 @@ namespace msr {
 		{
 			return root_;
 		}
+
+		// Replaces the document root and the options of a running server, e.g.
+		// when config.ini changes: a new provider is made (prepare() is called
+		// with it before it takes requests, to mount more roots) and swapped in
+		// for new requests; the ones in progress complete on the old one and no
+		// connection is dropped. The listening address, the network emulation,
+		// the timing and the audience settings stay as they were at start().
+		// Blocks while the new provider is made; not to be called on an I/O thread.
+		bool reload(
+			const boost::filesystem::path &root,
+			const provider_options &options,
+			std::function<void(resource_provider &)> prepare = nullptr)
+		{
+			std::lock_guard<std::mutex> lock(reload_mutex_);
+
+			auto current = providers_->get();
+
+			if (!current) {
+				return false;
+			}
+
+			std::shared_ptr<resource_provider> next;
+
+			try {
+				auto o = options;
+				o.audience = audience_.enabled;
+
+				next = make_provider(root, o, current.get());
+
+				if (prepare) {
+					prepare(*next);
+				}
+			} catch (std::exception &) {
+				return false;
+			}
+
+			options_ = options;
+			root_ = root;
+
+			providers_->exchange(next)->retire();
+			next->prewarm();
+
+			return true;
+		}
+
+		// the current provider, shared with the in-process scheme handler; valid after start()
+		std::shared_ptr<resource_provider> provider() const
+		{
+			return providers_->get();
+		}
+
+		// follows reload(); valid after start()
+		std::shared_ptr<provider_slot> providers() const
+		{
+			return providers_;
+		}
+
+		// how long responses waited for a turn to write, by priority
+		std::array<write_scheduler::wait_statistics, priority_count> write_statistics() const
+		{
+			return scheduler_->statistics();
+		}
+
+		// Serves another document root under a path prefix ("/name") and/or
+		// for a Host header ("name.localhost"); valid after start().
+		// All roots share the caches of this server.
+		bool mount(const std::string &prefix, const boost::filesystem::path &root, const std::string &host = std::string())
+		{
+			auto provider = providers_->get();
+			return provider && provider->mount(prefix, root, host);
+		}
+
+		bool unmount(const std::string &prefix, const std::string &host = std::string())
+		{
+			auto provider = providers_->get();
+			return provider && provider->unmount(prefix, host);
+		}
 	};
 }
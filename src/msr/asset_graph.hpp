@@ -0,0 +1,598 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "file_stamp.hpp"
+#include "html.hpp"
+#include "url.hpp"
+
+namespace msr {
+	enum class asset_kind {
+		script,
+		style,
+		font,
+		image,
+		media,
+	};
+
+	// the face an @font-face rule declares
+	struct font_face {
+		// lower case; empty for fonts referenced outside @font-face
+		std::string family;
+		bool bold = false;
+		bool italic = false;
+	};
+
+	struct asset_reference {
+		asset_kind kind;
+
+		// absolute path on this server, with the query if any
+		std::string url;
+
+		// the page cannot be shown until this has been loaded
+		// (stylesheets, classic scripts without async/defer)
+		bool render_blocking;
+
+		// of fonts
+		font_face face;
+	};
+
+	using asset_list = std::vector<asset_reference>;
+
+	// How the text of a page is styled, from the font declarations of its
+	// stylesheets and style attributes, to tell which @font-face rules it uses.
+	struct font_usage {
+		// values of font-family and font declarations, lower case
+		std::set<std::string> families;
+		bool bold = false;
+		bool italic = false;
+
+		// name and value in lower case
+		void add_declaration(const std::string &name, const std::string &value)
+		{
+			auto bold_weight = [](const std::string &w) {
+				return w == "bold" || w == "bolder" || (w.size() == 3 && w[0] >= '6' && w[0] <= '9' && w.compare(1, 2, "00") == 0);
+			};
+
+			if (name == "font-family") {
+				families.insert(value);
+			} else if (name == "font-weight") {
+				bold = bold || bold_weight(value);
+			} else if (name == "font-style") {
+				italic = italic || value.compare(0, 6, "italic") == 0 || value.compare(0, 7, "oblique") == 0;
+			} else if (name == "font") {
+				families.insert(value);
+
+				std::size_t begin = 0;
+
+				while (begin < value.size()) {
+					auto end = value.find(' ', begin);
+					auto word = value.substr(begin, end - begin);
+
+					bold = bold || bold_weight(word);
+					italic = italic || word == "italic" || word == "oblique";
+
+					begin = end == std::string::npos ? end : end + 1;
+				}
+			}
+		}
+
+		void merge(const font_usage &other)
+		{
+			families.insert(other.families.begin(), other.families.end());
+			bold = bold || other.bold;
+			italic = italic || other.italic;
+		}
+
+		// whether some text may be shown in face; bold and italic faces need
+		// text in bold or italic
+		bool uses(const font_face &face) const
+		{
+			if (face.family.empty()) {
+				return true;
+			}
+
+			if ((face.bold && !bold) || (face.italic && !italic)) {
+				return false;
+			}
+
+			return std::any_of(families.begin(), families.end(), [&](const std::string &f) {
+				return f.find(face.family) != std::string::npos;
+			});
+		}
+	};
+
+	inline bool is_font_url(const std::string &url)
+	{
+		auto path = boost::algorithm::to_lower_copy(url_path(url));
+		auto dot = path.rfind('.');
+
+		if (dot == std::string::npos) {
+			return false;
+		}
+
+		auto ext = path.substr(dot);
+
+		return ext == ".woff" || ext == ".woff2" || ext == ".ttf" || ext == ".otf" || ext == ".eot";
+	}
+
+	namespace detail {
+		inline std::string trim_css(const std::string &s)
+		{
+			std::size_t begin = 0;
+			auto end = s.size();
+
+			while (begin < end && is_html_space(s[begin])) {
+				++begin;
+			}
+
+			while (end > begin && is_html_space(s[end - 1])) {
+				--end;
+			}
+
+			return s.substr(begin, end - begin);
+		}
+
+		// without spaces around it and without its quotes
+		inline std::string unquote_css(const std::string &s)
+		{
+			auto t = trim_css(s);
+
+			if (t.size() >= 2 && (t[0] == '"' || t[0] == '\'') && t.back() == t[0]) {
+				t = t.substr(1, t.size() - 2);
+			}
+
+			return t;
+		}
+
+		// s split at separator where it is not quoted or in parentheses
+		inline std::vector<std::string> split_css(const std::string &s, char separator)
+		{
+			std::vector<std::string> parts;
+			std::size_t begin = 0;
+			char quote = 0;
+			int depth = 0;
+
+			for (std::size_t i = 0; i <= s.size(); ++i) {
+				auto c = i < s.size() ? s[i] : separator;
+
+				if (quote != 0) {
+					quote = c == quote ? 0 : quote;
+				} else if (c == '"' || c == '\'') {
+					quote = c;
+				} else if (c == separator && depth == 0) {
+					parts.push_back(s.substr(begin, i - begin));
+					begin = i + 1;
+				} else if (c == '(') {
+					++depth;
+				} else if (c == ')') {
+					depth = depth > 0 ? depth - 1 : 0;
+				}
+			}
+
+			return parts;
+		}
+
+		// The body of an @font-face rule: its face and, of its src, the first
+		// source a browser would download (local() and formats other than
+		// WOFF2, WOFF, TrueType and OpenType are skipped).
+		inline void scan_font_face(const std::string &block, const std::string &base, asset_list &assets)
+		{
+			font_face face;
+			std::string src;
+
+			for (auto &declaration : split_css(block, ';')) {
+				auto colon = declaration.find(':');
+
+				if (colon == std::string::npos) {
+					continue;
+				}
+
+				auto name = boost::algorithm::to_lower_copy(trim_css(declaration.substr(0, colon)));
+				auto value = trim_css(declaration.substr(colon + 1));
+
+				if (name == "font-family") {
+					face.family = boost::algorithm::to_lower_copy(unquote_css(value));
+				} else if (name == "font-weight") {
+					font_usage weight;
+					weight.add_declaration(name, boost::algorithm::to_lower_copy(value));
+					face.bold = weight.bold;
+				} else if (name == "font-style") {
+					font_usage style;
+					style.add_declaration(name, boost::algorithm::to_lower_copy(value));
+					face.italic = style.italic;
+				} else if (name == "src") {
+					src = value;
+				}
+			}
+
+			for (auto &source : split_css(src, ',')) {
+				auto item = trim_css(source);
+
+				if (boost::algorithm::to_lower_copy(item.substr(0, 4)) != "url(") {
+					continue;
+				}
+
+				auto close = split_css(item.substr(4), ')').front();
+				auto url = resolve_url(base, unquote_css(close));
+				auto format_pos = find_ignore_case(item, "format(", 4 + close.size());
+				std::string format;
+
+				if (format_pos != std::string::npos) {
+					format = boost::algorithm::to_lower_copy(unquote_css(split_css(item.substr(format_pos + 7), ')').front()));
+				}
+
+				auto supported = format.empty()
+					? is_font_url(url) && !boost::algorithm::iends_with(url_path(url), ".eot")
+					: format.compare(0, 4, "woff") == 0 || format.compare(0, 8, "truetype") == 0 || format.compare(0, 8, "opentype") == 0;
+
+				if (!url.empty() && supported) {
+					assets.push_back({ asset_kind::font, url, false, face });
+					return;
+				}
+			}
+		}
+
+		inline bool is_css_name_char(char c)
+		{
+			return c == '-' || c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+		}
+	}
+
+	// url(...), @import and @font-face in a stylesheet, and how it styles text;
+	// base is the URL of the stylesheet
+	inline void scan_css(const std::string &css, const std::string &base, asset_list &assets, font_usage &usage)
+	{
+		auto add = [&](const std::string &ref, bool import) {
+			auto url = resolve_url(base, detail::unquote_css(ref));
+
+			if (url.empty()) {
+				return;
+			}
+
+			if (import) {
+				assets.push_back({ asset_kind::style, url, true, font_face() });
+			} else if (is_font_url(url)) {
+				assets.push_back({ asset_kind::font, url, false, font_face() });
+			} else {
+				assets.push_back({ asset_kind::image, url, false, font_face() });
+			}
+		};
+
+		std::size_t pos = 0;
+		auto size = css.size();
+
+		while (pos < size) {
+			if (css.compare(pos, 2, "/*") == 0) {
+				auto end = css.find("*/", pos + 2);
+				pos = end == std::string::npos ? size : end + 2;
+			} else if (css.compare(pos, 10, "@font-face") == 0) {
+				auto open = css.find('{', pos);
+				auto close = open == std::string::npos ? open : css.find('}', open);
+
+				if (close == std::string::npos) {
+					return;
+				}
+
+				detail::scan_font_face(css.substr(open + 1, close - open - 1), base, assets);
+				pos = close + 1;
+			} else if ((css[pos] == 'f' || css[pos] == 'F') && (pos == 0 || !detail::is_css_name_char(css[pos - 1]))) {
+				// font, font-family, font-weight and font-style declarations
+				auto end = pos;
+
+				while (end < size && detail::is_css_name_char(css[end])) {
+					++end;
+				}
+
+				auto name = boost::algorithm::to_lower_copy(css.substr(pos, end - pos));
+				auto i = end;
+
+				while (i < size && detail::is_html_space(css[i])) {
+					++i;
+				}
+
+				pos = end;
+
+				if (i == size || css[i] != ':' || name.compare(0, 4, "font") != 0) {
+					continue;
+				}
+
+				auto value_end = css.find_first_of(";}", i + 1);
+				auto value = css.substr(i + 1, value_end == std::string::npos ? std::string::npos : value_end - i - 1);
+
+				usage.add_declaration(name, boost::algorithm::to_lower_copy(detail::trim_css(value)));
+				pos = value_end == std::string::npos ? size : value_end;
+			} else if (css.compare(pos, 7, "@import") == 0) {
+				auto i = pos + 7;
+
+				while (i < size && detail::is_html_space(css[i])) {
+					++i;
+				}
+
+				if (i < size && (css[i] == '"' || css[i] == '\'')) {
+					auto close = css.find(css[i], i + 1);
+
+					if (close == std::string::npos) {
+						return;
+					}
+
+					add(css.substr(i, close - i + 1), true);
+					pos = close + 1;
+				} else if (css.compare(i, 4, "url(") == 0) {
+					auto close = css.find(')', i + 4);
+
+					if (close == std::string::npos) {
+						return;
+					}
+
+					add(css.substr(i + 4, close - i - 4), true);
+					pos = close + 1;
+				} else {
+					pos = i;
+				}
+			} else if (css.compare(pos, 4, "url(") == 0) {
+				auto i = pos + 4;
+
+				while (i < size && detail::is_html_space(css[i])) {
+					++i;
+				}
+
+				auto close = css.find(')', i);
+
+				if (close == std::string::npos) {
+					return;
+				}
+
+				add(css.substr(i, close - i), false);
+				pos = close + 1;
+			} else {
+				++pos;
+			}
+		}
+	}
+
+	// scripts, stylesheets and media referenced by a document, and how it
+	// styles text; base is the URL of the document
+	inline void scan_html(const std::string &html, const std::string &base, asset_list &assets, font_usage &usage)
+	{
+		auto add = [&](asset_kind kind, const std::string &ref, bool blocking) {
+			auto url = resolve_url(base, ref);
+
+			if (!url.empty()) {
+				assets.push_back({ kind, url, blocking, font_face() });
+			}
+		};
+
+		std::size_t style_begin = std::string::npos;
+
+		scan_html_tags(html, [&](const html_tag &tag) {
+			if (tag.closing) {
+				if (tag.name == "style" && style_begin != std::string::npos) {
+					scan_css(html.substr(style_begin, tag.begin - style_begin), base, assets, usage);
+					style_begin = std::string::npos;
+				}
+
+				return true;
+			}
+
+			auto style = tag.attribute("style");
+
+			if (style != nullptr) {
+				scan_css(style->value, base, assets, usage);
+			}
+
+			if (tag.name == "b" || tag.name == "strong" || tag.name == "th" || (tag.name.size() == 2 && tag.name[0] == 'h' && tag.name[1] >= '1' && tag.name[1] <= '6')) {
+				usage.bold = true;
+			} else if (tag.name == "i" || tag.name == "em" || tag.name == "cite" || tag.name == "var" || tag.name == "dfn" || tag.name == "address") {
+				usage.italic = true;
+			}
+
+			if (tag.name == "link") {
+				auto rel = boost::algorithm::to_lower_copy(tag.attribute_value("rel"));
+
+				if (rel.find("stylesheet") != std::string::npos && rel.find("alternate") == std::string::npos) {
+					auto media = tag.attribute_value("media");
+
+					add(asset_kind::style, tag.attribute_value("href"), media.empty() || media == "all" || media == "screen");
+				}
+			} else if (tag.name == "script") {
+				auto src = tag.attribute("src");
+
+				if (src != nullptr) {
+					auto blocking = tag.attribute("async") == nullptr
+						&& tag.attribute("defer") == nullptr
+						&& tag.attribute_value("type") != "module";
+
+					add(asset_kind::script, src->value, blocking);
+				}
+			} else if (tag.name == "style") {
+				style_begin = tag.end;
+			} else if (tag.name == "img") {
+				add(asset_kind::image, tag.attribute_value("src"), false);
+				add(asset_kind::image, tag.attribute_value("data-src"), false);
+			} else if (tag.name == "video" || tag.name == "audio" || tag.name == "source") {
+				add(asset_kind::media, tag.attribute_value("src"), false);
+				add(asset_kind::media, tag.attribute_value("data-src"), false);
+				add(asset_kind::image, tag.attribute_value("poster"), false);
+			} else if (tag.name == "section") {
+				add(asset_kind::image, tag.attribute_value("data-background-image"), false);
+				add(asset_kind::media, tag.attribute_value("data-background-video"), false);
+			}
+
+			return true;
+		});
+	}
+
+	// Records what each HTML and CSS file references.
+	// Files are scanned once per version (size and mtime).
+	class asset_graph {
+		struct scanned_file {
+			asset_list assets;
+			font_usage usage;
+		};
+
+		struct entry {
+			file_stamp stamp;
+			std::shared_ptr<const scanned_file> scanned;
+		};
+
+		std::mutex mutex_;
+		std::unordered_map<std::string, entry> entries_;
+
+		static bool is_css(const boost::filesystem::path &file)
+		{
+			return boost::algorithm::to_lower_copy(file.extension().string()) == ".css";
+		}
+
+		std::shared_ptr<const scanned_file> scan(const boost::filesystem::path &file, const std::string &url)
+		{
+			file_stamp stamp;
+
+			if (!get_file_stamp(file, stamp)) {
+				return nullptr;
+			}
+
+			// relative references depend on the directory of the URL, not only on the file
+			auto key = file.string() + '\n' + url.substr(0, url.rfind('/') + 1);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				auto iter = entries_.find(key);
+
+				if (iter != entries_.end() && iter->second.stamp == stamp) {
+					return iter->second.scanned;
+				}
+			}
+
+			std::string content;
+
+			if (!read_file(file, content)) {
+				return nullptr;
+			}
+
+			auto scanned = std::make_shared<scanned_file>();
+
+			if (is_css(file)) {
+				scan_css(content, url, scanned->assets, scanned->usage);
+			} else {
+				scan_html(content, url, scanned->assets, scanned->usage);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			entries_[key] = { stamp, scanned };
+
+			return scanned;
+		}
+
+	public:
+		// References of an HTML or CSS file served at url.
+		std::shared_ptr<const asset_list> direct_references(const boost::filesystem::path &file, const std::string &url)
+		{
+			auto scanned = scan(file, url);
+
+			return scanned ? std::shared_ptr<const asset_list>(scanned, &scanned->assets) : nullptr;
+		}
+
+		// References of a page including the ones of its stylesheets (fonts, @import).
+		// Duplicates are removed; the order is the order of discovery. Of the
+		// @font-face rules, only the faces the page and its stylesheets style
+		// text with are kept, each with one source.
+		asset_list page_assets(const boost::filesystem::path &root, const boost::filesystem::path &file, const std::string &url)
+		{
+			asset_list result;
+			std::set<std::string> seen;
+			font_usage usage;
+
+			auto collect = [&](const boost::filesystem::path &f, const std::string &u, int depth, const auto &self) -> void {
+				auto scanned = scan(f, u);
+
+				if (!scanned) {
+					return;
+				}
+
+				usage.merge(scanned->usage);
+
+				for (auto &a : scanned->assets) {
+					if (!seen.insert(a.url).second) {
+						continue;
+					}
+
+					result.push_back(a);
+
+					if (a.kind == asset_kind::style && depth < 4) {
+						auto css = root / url_path(a.url);
+						boost::system::error_code error;
+
+						if (is_regular_file(css, error)) {
+							self(css, a.url, depth + 1, self);
+						}
+					}
+				}
+			};
+
+			collect(file, url, 0, collect);
+
+			result.erase(std::remove_if(result.begin(), result.end(), [&](const asset_reference &a) {
+				return a.kind == asset_kind::font && !usage.uses(a.face);
+			}), result.end());
+
+			return result;
+		}
+	};
+
+	// Value of a Link header that preloads the critical assets of a page
+	// (render-blocking stylesheets and scripts, fonts). Empty if there is nothing to preload.
+	// prefix is prepended to the URLs (the path the document root is mounted at).
+	inline std::string preload_links(const asset_list &assets, std::size_t max_links, const std::string &prefix = std::string())
+	{
+		std::string links;
+		std::size_t count = 0;
+
+		for (auto &a : assets) {
+			if (count == max_links) {
+				break;
+			}
+
+			const char *as;
+
+			if (a.kind != asset_kind::font && !a.render_blocking) {
+				continue;
+			}
+
+			switch (a.kind) {
+			case asset_kind::style:
+				as = "style";
+				break;
+			case asset_kind::script:
+				as = "script";
+				break;
+			case asset_kind::font:
+				as = "font; crossorigin";
+				break;
+			default:
+				continue;
+			}
+
+			if (!links.empty()) {
+				links += ", ";
+			}
+
+			links += '<' + prefix + a.url + ">; rel=preload; as=" + as;
+			++count;
+		}
+
+		return links;
+	}
+}
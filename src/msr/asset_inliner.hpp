@@ -0,0 +1,276 @@
+#pragma once
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "hash.hpp"
+#include "html.hpp"
+#include "lru_cache.hpp"
+#include "url.hpp"
+
+namespace msr {
+	struct inline_options {
+		// replace small render-blocking stylesheets and scripts of pages with their content
+		bool enabled = false;
+
+		// larger files are left as references
+		std::size_t max_asset_size = 16 * 1024;
+
+		// per page
+		std::size_t max_total_size = 128 * 1024;
+	};
+
+	// Makes the url() and @import references of a stylesheet at base absolute
+	// (prefix prepended), so that the stylesheet still works when its text is
+	// moved into a page at another URL.
+	inline std::string absolutize_css_urls(const std::string &css, const std::string &base, const std::string &prefix = std::string())
+	{
+		std::string result;
+		std::size_t copied = 0;
+		std::size_t pos = 0;
+		auto size = css.size();
+
+		// [begin, end) is the reference without quotes
+		auto replace = [&](std::size_t begin, std::size_t end) {
+			auto ref = css.substr(begin, end - begin);
+			auto url = resolve_url(base, ref);
+
+			if (url.empty()) {
+				return;
+			}
+
+			auto hash = ref.find('#');
+
+			if (hash != std::string::npos) {
+				url += ref.substr(hash);
+			}
+
+			result.append(css, copied, begin - copied);
+			result += prefix + url;
+			copied = end;
+		};
+
+		auto skip_spaces = [&](std::size_t i) {
+			while (i < size && detail::is_html_space(css[i])) {
+				++i;
+			}
+
+			return i;
+		};
+
+		while (pos < size) {
+			if (css.compare(pos, 2, "/*") == 0) {
+				auto end = css.find("*/", pos + 2);
+				pos = end == std::string::npos ? size : end + 2;
+			} else if (css.compare(pos, 4, "url(") == 0 || css.compare(pos, 7, "@import") == 0) {
+				auto import = css[pos] == '@';
+				auto i = skip_spaces(pos + (import ? 7 : 4));
+
+				if (i < size && (css[i] == '"' || css[i] == '\'')) {
+					auto close = css.find(css[i], i + 1);
+
+					if (close == std::string::npos) {
+						break;
+					}
+
+					replace(i + 1, close);
+					pos = close + 1;
+				} else if (import) {
+					// @import url(...) is handled as url(...)
+					pos = i;
+				} else {
+					auto close = css.find(')', i);
+
+					if (close == std::string::npos) {
+						break;
+					}
+
+					auto end = close;
+
+					while (end > i && detail::is_html_space(css[end - 1])) {
+						--end;
+					}
+
+					replace(i, end);
+					pos = close + 1;
+				}
+			} else {
+				++pos;
+			}
+		}
+
+		result.append(css, copied, std::string::npos);
+
+		return result;
+	}
+
+	// Replaces the small render-blocking stylesheets and classic scripts of a
+	// page with <style> and <script> elements holding their content, so that
+	// the page needs fewer requests before its first paint.
+	// Results are cached by the content hashes of the page and of every input,
+	// so any change to one of them makes a new result.
+	class asset_inliner {
+	public:
+		struct result {
+			std::string html;
+
+			// the inlined references, as absolute paths under the root
+			std::vector<std::string> urls;
+		};
+
+		using result_pointer = std::shared_ptr<const result>;
+
+		// content of the file at an absolute path under the root, nullptr if there is none
+		using load_function = std::function<content_cache::content_pointer(const std::string &url)>;
+
+	private:
+		struct candidate {
+			std::size_t begin, end;
+			bool style;
+			std::string url;
+			std::string media;
+			content_cache::content_pointer content;
+		};
+
+		inline_options options_;
+		lru_cache<std::uint64_t, result> results_;
+
+		static bool is_classic_script(const html_tag &tag)
+		{
+			if (tag.attribute("async") != nullptr || tag.attribute("defer") != nullptr || tag.attribute("nomodule") != nullptr) {
+				return false;
+			}
+
+			auto type = boost::algorithm::to_lower_copy(tag.attribute_value("type"));
+
+			return tag.attribute("type") == nullptr || type.empty()
+				|| type == "text/javascript" || type == "application/javascript";
+		}
+
+		std::vector<candidate> find_candidates(const std::string &html, const std::string &base)
+		{
+			std::vector<candidate> candidates;
+			auto script = false;
+
+			scan_html_tags(html, [&](const html_tag &tag) {
+				if (tag.closing) {
+					// the element is replaced up to its end tag
+					if (script && tag.name == "script") {
+						candidates.back().end = tag.end;
+					}
+
+					script = false;
+					return true;
+				}
+
+				if (script) {
+					candidates.pop_back();
+					script = false;
+				}
+
+				if (tag.name == "link"
+					&& boost::algorithm::to_lower_copy(tag.attribute_value("rel")) == "stylesheet"
+					&& tag.attribute("disabled") == nullptr)
+				{
+					candidates.push_back({ tag.begin, tag.end, true, resolve_url(base, tag.attribute_value("href")), tag.attribute_value("media"), nullptr });
+				} else if (tag.name == "script" && tag.attribute("src") != nullptr && is_classic_script(tag) && !tag.self_closing) {
+					candidates.push_back({ tag.begin, tag.end, false, resolve_url(base, tag.attribute_value("src")), std::string(), nullptr });
+					script = true;
+				}
+
+				return true;
+			});
+
+			if (script) {
+				candidates.pop_back();
+			}
+
+			return candidates;
+		}
+
+	public:
+		explicit asset_inliner(const inline_options &options, std::size_t budget = 8 * 1024 * 1024)
+			: options_(options)
+			, results_(budget)
+		{
+		}
+
+		// base is the URL of the page under the root; prefix is prepended to the URLs in inlined stylesheets
+		result_pointer transform(const file_content &page, const std::string &base, const std::string &prefix, load_function load)
+		{
+			auto &html = *page.data;
+			auto candidates = find_candidates(html, base);
+
+			std::string key = base + '\n' + prefix + '\n' + to_hex(page.hash) + '\n';
+			std::size_t total = 0;
+
+			for (auto &c : candidates) {
+				// a query may select something other than the file
+				if (c.url.empty() || c.url.find('?') != std::string::npos) {
+					continue;
+				}
+
+				auto content = load(c.url);
+
+				if (!content || content->data->size() > options_.max_asset_size || total + content->data->size() > options_.max_total_size) {
+					continue;
+				}
+
+				// the content would end the element early
+				if (detail::find_ignore_case(*content->data, c.style ? "</style" : "</script", 0) != std::string::npos) {
+					continue;
+				}
+
+				c.content = content;
+				total += content->data->size();
+				key += c.url + ':' + to_hex(content->hash) + '\n';
+			}
+
+			auto hash = hash_bytes(key.data(), key.size());
+			auto cached = results_.find(hash);
+
+			if (cached) {
+				return cached;
+			}
+
+			auto r = std::make_shared<result>();
+			std::size_t pos = 0;
+
+			r->html.reserve(html.size() + total);
+
+			for (auto &c : candidates) {
+				if (!c.content) {
+					continue;
+				}
+
+				r->html.append(html, pos, c.begin - pos);
+
+				if (c.style) {
+					r->html += "<style data-inlined=\"" + prefix + c.url + '"';
+
+					if (!c.media.empty()) {
+						r->html += " media=\"" + c.media + '"';
+					}
+
+					r->html += '>' + absolutize_css_urls(*c.content->data, c.url, prefix) + "</style>";
+				} else {
+					r->html += "<script data-inlined=\"" + prefix + c.url + "\">" + *c.content->data + "</script>";
+				}
+
+				r->urls.push_back(c.url);
+				pos = c.end;
+			}
+
+			r->html.append(html, pos, std::string::npos);
+
+			results_.insert(hash, r, r->html.size() + sizeof(result));
+
+			return r;
+		}
+	};
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+// Audience mode: the deck is served to the devices of the audience, which
+// follow the slide the presenter is on.
+
+namespace msr {
+	struct audience_options {
+		bool enabled = false;
+
+		// interface to listen on; "0.0.0.0" for all of them
+		std::string address = "0.0.0.0";
+		unsigned short port = 8080;
+
+		// threads running the I/O service; 0: number of cores
+		std::size_t threads = 0;
+
+		// further connections are closed as they are accepted
+		std::size_t max_connections = 1024;
+
+		// chunks being written at a time, over all clients
+		std::size_t max_writes = 64;
+	};
+
+	// Where the presenter is: the page (its path) and the indices of reveal.js.
+	struct slide_state {
+		// 0 until the presenter publishes
+		std::uint64_t sequence = 0;
+
+		std::string url;
+		int h = 0;
+		int v = 0;
+		int f = -1;
+
+		std::string to_json() const
+		{
+			return "{\"seq\":" + std::to_string(sequence)
+				+ ",\"url\":" + json_quote(url)
+				+ ",\"h\":" + std::to_string(h)
+				+ ",\"v\":" + std::to_string(v)
+				+ ",\"f\":" + std::to_string(f) + "}";
+		}
+	};
+
+	// The presenter publishes its slide; followers long-poll for a state newer
+	// than the one they have. Waiting followers are answered by the next
+	// publish() (or release()), so dead ones do not pile up for longer than that.
+	class follower_channel {
+	public:
+		using handler_type = std::function<void(const slide_state &)>;
+
+	private:
+		mutable std::mutex mutex_;
+		slide_state state_;
+		std::vector<handler_type> waiting_;
+
+		void notify(std::vector<handler_type> &handlers, const slide_state &state)
+		{
+			for (auto &h : handlers) {
+				h(state);
+			}
+		}
+
+	public:
+		void publish(const std::string &url, int h, int v, int f)
+		{
+			std::vector<handler_type> handlers;
+			slide_state state;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (state_.sequence != 0 && state_.url == url && state_.h == h && state_.v == v && state_.f == f) {
+					return;
+				}
+
+				++state_.sequence;
+				state_.url = url;
+				state_.h = h;
+				state_.v = v;
+				state_.f = f;
+
+				state = state_;
+				handlers.swap(waiting_);
+			}
+
+			notify(handlers, state);
+		}
+
+		// the handler is called with the first state newer than after,
+		// before wait() returns if there is one already
+		void wait(std::uint64_t after, handler_type handler)
+		{
+			slide_state state;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (state_.sequence <= after) {
+					waiting_.push_back(std::move(handler));
+					return;
+				}
+
+				state = state_;
+			}
+
+			handler(state);
+		}
+
+		// answers the waiting followers with the current state, e.g. before shutting down
+		void release()
+		{
+			std::vector<handler_type> handlers;
+			slide_state state;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				state = state_;
+				handlers.swap(waiting_);
+			}
+
+			notify(handlers, state);
+		}
+
+		// continues from the state of another channel (of the provider this one replaces)
+		void restore(const slide_state &state)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (state_.sequence < state.sequence) {
+				state_ = state;
+			}
+		}
+
+		slide_state state() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return state_;
+		}
+
+		std::size_t waiting() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return waiting_.size();
+		}
+	};
+
+	// /.msr/follow.js for the presenter: publishes every slide and fragment change
+	inline const char *presenter_script()
+	{
+		return
+			"(function () {\n"
+			"\tfunction publish() {\n"
+			"\t\tvar i = Reveal.getIndices();\n"
+			"\t\tvar f = i.f === undefined ? -1 : i.f;\n"
+			"\t\tfetch('/.msr/present?url=' + encodeURIComponent(location.pathname) + '&h=' + i.h + '&v=' + (i.v || 0) + '&f=' + f, { cache: 'no-store' });\n"
+			"\t}\n"
+			"\tfunction start() {\n"
+			"\t\t['slidechanged', 'fragmentshown', 'fragmenthidden'].forEach(function (e) { Reveal.addEventListener(e, publish); });\n"
+			"\t\tpublish();\n"
+			"\t}\n"
+			"\tif (window.Reveal) {\n"
+			"\t\tif (Reveal.isReady()) start(); else Reveal.addEventListener('ready', start);\n"
+			"\t}\n"
+			"})();\n";
+	}
+
+	// /.msr/follow.js for the audience: goes where the presenter goes
+	inline const char *follower_script()
+	{
+		return
+			"(function () {\n"
+			"\tvar seq = 0;\n"
+			"\tfunction poll() {\n"
+			"\t\tfetch('/.msr/follow?after=' + seq, { cache: 'no-store' }).then(function (r) { return r.json(); }).then(function (s) {\n"
+			"\t\t\tseq = s.seq;\n"
+			"\t\t\tif (s.seq > 0 && s.url !== location.pathname) {\n"
+			"\t\t\t\tlocation.href = s.url + '#/' + s.h + '/' + s.v;\n"
+			"\t\t\t\treturn;\n"
+			"\t\t\t}\n"
+			"\t\t\tif (s.seq > 0 && window.Reveal) Reveal.slide(s.h, s.v, s.f < 0 ? undefined : s.f);\n"
+			"\t\t\tpoll();\n"
+			"\t\t}, function () { setTimeout(poll, 2000); });\n"
+			"\t}\n"
+			"\tpoll();\n"
+			"})();\n";
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "html.hpp"
+#include "url.hpp"
+
+namespace msr {
+	// '*' matches any run of characters and '?' any one character.
+	// A pattern without '/' is matched against the last segment of the path only.
+	inline bool match_path_pattern(const std::string &pattern, const std::string &path)
+	{
+		auto subject = pattern.find('/') == std::string::npos ? path.substr(path.rfind('/') + 1) : path;
+
+		std::size_t p = 0, s = 0;
+		auto star = std::string::npos;
+		std::size_t mark = 0;
+
+		while (s < subject.size()) {
+			if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == subject[s])) {
+				++p;
+				++s;
+			} else if (p < pattern.size() && pattern[p] == '*') {
+				star = p++;
+				mark = s;
+			} else if (star != std::string::npos) {
+				p = star + 1;
+				s = ++mark;
+			} else {
+				return false;
+			}
+		}
+
+		while (p < pattern.size() && pattern[p] == '*') {
+			++p;
+		}
+
+		return p == pattern.size();
+	}
+
+	struct cache_rule {
+		std::string pattern;
+
+		// value of Cache-Control, e.g. "no-cache" or "public, max-age=3600"
+		std::string directive;
+	};
+
+	struct cache_policy {
+		// the first rule that matches the path wins
+		// by default everything is revalidated (Last-Modified / If-Modified-Since)
+		std::vector<cache_rule> rules = {
+			{ "*", "no-cache" },
+		};
+
+		// append ?v=<content hash> to the references of served HTML
+		// and serve those URLs as immutable
+		bool hashed_urls = false;
+
+		std::string immutable_directive = "public, max-age=31536000, immutable";
+
+		// empty if no rule matches
+		std::string directive(const std::string &path) const
+		{
+			for (auto &r : rules) {
+				if (match_path_pattern(r.pattern, path)) {
+					return r.directive;
+				}
+			}
+
+			return std::string();
+		}
+	};
+
+	// Appends a query to the local references of a document (scripts, stylesheets, media).
+	// version(url) gets the reference resolved against base and returns the
+	// query to append ("?v=..."), or an empty string to leave it as is.
+	// References that already have a query or a fragment are left as is.
+	template <typename Version>
+	std::string rewrite_html_references(const std::string &html, const std::string &base, Version version)
+	{
+		struct replacement {
+			std::size_t begin, end;
+			std::string value;
+		};
+
+		std::vector<replacement> replacements;
+
+		auto add = [&](const html_tag &tag, const char *name) {
+			auto a = tag.attribute(name);
+
+			if (a == nullptr || a->value.empty() || a->value.find('#') != std::string::npos) {
+				return;
+			}
+
+			auto url = resolve_url(base, a->value);
+
+			if (url.empty() || url.find('?') != std::string::npos) {
+				return;
+			}
+
+			auto query = version(url);
+
+			if (!query.empty()) {
+				replacements.push_back({ a->value_begin, a->value_end, a->value + query });
+			}
+		};
+
+		scan_html_tags(html, [&](const html_tag &tag) {
+			if (tag.closing) {
+				return true;
+			}
+
+			if (tag.name == "link") {
+				add(tag, "href");
+			} else if (tag.name == "script" || tag.name == "img" || tag.name == "source"
+				|| tag.name == "video" || tag.name == "audio")
+			{
+				add(tag, "src");
+				add(tag, "data-src");
+
+				if (tag.name == "video") {
+					add(tag, "poster");
+				}
+			}
+
+			return true;
+		});
+
+		if (replacements.empty()) {
+			return html;
+		}
+
+		// attributes of a tag are not visited in source order
+		std::sort(replacements.begin(), replacements.end(), [](const replacement &a, const replacement &b) {
+			return a.begin < b.begin;
+		});
+
+		std::string result;
+		std::size_t pos = 0;
+
+		result.reserve(html.size() + replacements.size() * 24);
+
+		for (auto &r : replacements) {
+			result.append(html, pos, r.begin - pos);
+			result += r.value;
+			pos = r.end;
+		}
+
+		result.append(html, pos, std::string::npos);
+
+		return result;
+	}
+}
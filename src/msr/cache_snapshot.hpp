@@ -0,0 +1,179 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace msr {
+	// Bodies of the content cache written at shutdown and mapped at the next start,
+	// so that a restarted server does not read the hot files one by one again.
+	// Bodies are keyed by content hash; whether a path still has that content is
+	// decided by the hash index (size and mtime), and a body is checked against its
+	// hash when it is taken, so a stale or damaged snapshot only costs a read.
+	class cache_snapshot {
+		struct header {
+			char magic[8];
+			std::uint32_t algorithm;
+			std::uint32_t count;
+		};
+
+		struct entry {
+			std::uint64_t hash;
+			std::uint64_t offset;	// from the start of the file
+			std::uint64_t size;
+		};
+
+		std::mutex mutex_;
+		boost::interprocess::file_mapping mapping_;
+		boost::interprocess::mapped_region region_;
+		std::unordered_map<std::uint64_t, entry> entries_;
+
+	public:
+		using body_list = std::vector<std::pair<std::uint64_t, std::shared_ptr<const std::string>>>;
+
+		cache_snapshot() = default;
+		cache_snapshot(const cache_snapshot &) = delete;
+		cache_snapshot &operator=(const cache_snapshot &) = delete;
+
+		// false if there is no snapshot or it is not valid
+		bool open(const boost::filesystem::path &file)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			boost::system::error_code error;
+
+			if (!is_regular_file(file, error) || file_size(file, error) < sizeof(header) || error) {
+				return false;
+			}
+
+			try {
+				mapping_ = boost::interprocess::file_mapping(file.string().c_str(), boost::interprocess::read_only);
+				region_ = boost::interprocess::mapped_region(mapping_, boost::interprocess::read_only);
+			} catch (std::exception &) {
+				region_ = boost::interprocess::mapped_region();
+				mapping_ = boost::interprocess::file_mapping();
+				return false;
+			}
+
+			auto base = static_cast<const char *>(region_.get_address());
+			auto size = static_cast<std::uint64_t>(region_.get_size());
+			auto h = reinterpret_cast<const header *>(base);
+
+			auto table_size = sizeof(header) + sizeof(entry) * static_cast<std::uint64_t>(h->count);
+
+			if (std::memcmp(h->magic, "MSRSNAP1", 8) != 0
+				|| h->algorithm != content_hasher::algorithm
+				|| table_size > size)
+			{
+				region_ = boost::interprocess::mapped_region();
+				mapping_ = boost::interprocess::file_mapping();
+				return false;
+			}
+
+			auto table = reinterpret_cast<const entry *>(h + 1);
+
+			for (std::uint32_t i = 0; i < h->count; ++i) {
+				auto &e = table[i];
+
+				if (e.offset >= table_size && e.offset <= size && e.size <= size - e.offset) {
+					entries_.emplace(e.hash, e);
+				}
+			}
+
+			return true;
+		}
+
+		// copies the body with the given hash and size out of the snapshot
+		bool find(std::uint64_t hash, std::uint64_t size, std::string &data)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = entries_.find(hash);
+
+			if (iter == entries_.end() || iter->second.size != size) {
+				return false;
+			}
+
+			auto begin = static_cast<const char *>(region_.get_address()) + iter->second.offset;
+
+			if (hash_bytes(begin, static_cast<std::size_t>(size)) != hash) {
+				entries_.erase(iter);
+				return false;
+			}
+
+			data.assign(begin, static_cast<std::size_t>(size));
+
+			return true;
+		}
+
+		// unmaps the file; find() fails from then on
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			entries_.clear();
+			region_ = boost::interprocess::mapped_region();
+			mapping_ = boost::interprocess::file_mapping();
+		}
+
+		// Writes the bodies in the given order. The file is replaced only when
+		// it has been written completely, so it must not be open at the time.
+		static bool write(const boost::filesystem::path &file, const body_list &bodies)
+		{
+			boost::system::error_code error;
+			create_directories(file.parent_path(), error);
+
+			auto temp = file;
+			temp += ".tmp";
+
+			{
+				boost::filesystem::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+
+				if (!ofs) {
+					return false;
+				}
+
+				header h;
+				std::memcpy(h.magic, "MSRSNAP1", 8);
+				h.algorithm = content_hasher::algorithm;
+				h.count = static_cast<std::uint32_t>(bodies.size());
+
+				ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+				auto offset = sizeof(header) + sizeof(entry) * static_cast<std::uint64_t>(bodies.size());
+
+				for (auto &b : bodies) {
+					entry e = { b.first, offset, b.second->size() };
+					ofs.write(reinterpret_cast<const char *>(&e), sizeof(e));
+					offset += b.second->size();
+				}
+
+				for (auto &b : bodies) {
+					ofs.write(b.second->data(), static_cast<std::streamsize>(b.second->size()));
+				}
+
+				if (!ofs) {
+					ofs.close();
+					remove(temp, error);
+					return false;
+				}
+			}
+
+			rename(temp, file, error);
+
+			return !error;
+		}
+	};
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "cache_snapshot.hpp"
+#include "file_stamp.hpp"
+#include "hash.hpp"
+#include "hash_index.hpp"
+#include "lru_cache.hpp"
+#include "single_flight.hpp"
+
+namespace msr {
+	inline bool read_file(const boost::filesystem::path &path, std::string &content)
+	{
+		boost::filesystem::ifstream ifs(path, std::ios::binary);
+
+		if (!ifs) {
+			return false;
+		}
+
+		content.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+		return !ifs.bad();
+	}
+
+	struct file_content {
+		file_stamp stamp;
+
+		// hash of data (content_hasher)
+		std::uint64_t hash = 0;
+
+		// shared by the files that have the same content
+		std::shared_ptr<const std::string> data;
+	};
+
+	// Contents of files, keyed by path.
+	// An entry is used only while the size and mtime of the file are unchanged.
+	// Bodies are stored once per content hash, so identical files (the same
+	// reveal.js or fonts in several decks) take memory only once, and a file
+	// whose hash is already in the index is not read again when an identical
+	// file is cached. Concurrent misses for the same version of a file share one read.
+	// Bodies missing from memory are taken from the snapshot of the previous session
+	// if one is open.
+	class content_cache {
+	public:
+		using content_pointer = std::shared_ptr<const file_content>;
+
+	private:
+		content_hash_index &index_;
+		lru_cache<std::uint64_t, std::string> bodies_;
+		single_flight<std::string, content_pointer> reads_;
+		cache_snapshot snapshot_;
+
+		// larger files are read every time
+		std::size_t max_file_size_;
+
+		// files read from disk by load()
+		std::atomic<std::uint64_t> disk_reads_{ 0 };
+
+		static content_pointer make_content(const file_stamp &stamp, std::uint64_t hash, std::shared_ptr<const std::string> data)
+		{
+			auto c = std::make_shared<file_content>();
+
+			c->stamp = stamp;
+			c->hash = hash;
+			c->data = std::move(data);
+
+			return c;
+		}
+
+		content_pointer find(const boost::filesystem::path &path, const file_stamp &stamp)
+		{
+			std::uint64_t hash;
+
+			if (!index_.find(path, stamp, hash)) {
+				return nullptr;
+			}
+
+			auto body = find_body(hash, stamp.size);
+
+			return body ? make_content(stamp, hash, body) : nullptr;
+		}
+
+	public:
+		content_cache(content_hash_index &index, std::size_t budget, std::size_t max_file_size)
+			: index_(index)
+			, bodies_(budget)
+			, max_file_size_(max_file_size)
+		{
+		}
+
+		// nullptr if the file cannot be read
+		content_pointer load(const boost::filesystem::path &path)
+		{
+			file_stamp stamp;
+
+			if (!get_file_stamp(path, stamp)) {
+				return nullptr;
+			}
+
+			auto content = find(path, stamp);
+
+			if (content) {
+				return content;
+			}
+
+			auto version = path.string() + '\n' + std::to_string(stamp.size) + ':' + std::to_string(stamp.mtime);
+
+			return reads_.run(version, [&]() -> content_pointer {
+				// another read of this version may have finished since the lookup above
+				auto cached = find(path, stamp);
+
+				if (cached) {
+					return cached;
+				}
+
+				auto data = std::make_shared<std::string>();
+
+				++disk_reads_;
+
+				if (!read_file(path, *data)) {
+					return nullptr;
+				}
+
+				auto hash = hash_bytes(data->data(), data->size());
+
+				index_.insert(path, stamp, hash);
+
+				auto body = bodies_.find(hash);
+
+				if (body && *body == *data) {
+					return make_content(stamp, hash, body);
+				}
+
+				if (data->size() <= max_file_size_) {
+					bodies_.insert(hash, data, data->size() + sizeof(std::string));
+				}
+
+				return make_content(stamp, hash, data);
+			});
+		}
+
+		// body with a content hash, from memory or the snapshot; nullptr if there is none
+		std::shared_ptr<const std::string> find_body(std::uint64_t hash, std::size_t size)
+		{
+			auto body = bodies_.find(hash);
+
+			if (!body) {
+				auto data = std::make_shared<std::string>();
+
+				if (size > max_file_size_ || !snapshot_.find(hash, size, *data)) {
+					return nullptr;
+				}
+
+				bodies_.insert(hash, data, data->size() + sizeof(std::string));
+				body = data;
+			}
+
+			return body->size() == size ? body : nullptr;
+		}
+
+		// a body that is not the content of a file (e.g. a minified one), keyed by its hash
+		void insert_body(std::uint64_t hash, std::shared_ptr<const std::string> data)
+		{
+			if (data->size() <= max_file_size_) {
+				bodies_.insert(hash, data, data->size() + sizeof(std::string));
+			}
+		}
+
+		// maps a snapshot written by save_snapshot()
+		bool open_snapshot(const boost::filesystem::path &file)
+		{
+			return snapshot_.open(file);
+		}
+
+		// Writes the most recently used bodies, up to budget bytes, and closes the
+		// snapshot that was open; bodies that were not used are dropped from it.
+		bool save_snapshot(const boost::filesystem::path &file, std::size_t budget)
+		{
+			cache_snapshot::body_list bodies;
+			std::size_t total = 0;
+
+			bodies_.for_each([&](std::uint64_t hash, const std::shared_ptr<const std::string> &body, std::size_t) {
+				if (total + body->size() <= budget) {
+					total += body->size();
+					bodies.emplace_back(hash, body);
+				}
+			});
+
+			snapshot_.close();
+
+			return cache_snapshot::write(file, bodies);
+		}
+
+		std::size_t max_file_size() const
+		{
+			return max_file_size_;
+		}
+
+		std::size_t size_in_bytes() const
+		{
+			return bodies_.size_in_bytes();
+		}
+
+		std::uint64_t disk_reads() const
+		{
+			return disk_reads_;
+		}
+	};
+}
@@ -0,0 +1,562 @@
+#pragma once
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "asset_graph.hpp"
+#include "file_stamp.hpp"
+#include "hash_index.hpp"
+#include "http.hpp"
+#include "json.hpp"
+#include "worker_pool.hpp"
+
+namespace msr {
+	// Limits a document root is checked against; 0 disables a limit.
+	struct analysis_budgets {
+		// a page and everything it references
+		std::uintmax_t deck_weight = 50 * 1024 * 1024;
+
+		std::uintmax_t asset_size = 10 * 1024 * 1024;
+		std::uintmax_t image_size = 2 * 1024 * 1024;
+		std::uint64_t image_pixels = 3840 * 2160;
+
+		// images larger than this per pixel are reported as uncompressed
+		// (photos saved as PNG, BMP, TIFF)
+		double image_bytes_per_pixel = 1.0;
+
+		std::size_t render_blocking_scripts = 4;
+
+		// scripts and stylesheets larger than this that look unminified are reported
+		std::uintmax_t unminified_size = 32 * 1024;
+
+		// number of the biggest files listed
+		std::size_t biggest_assets = 10;
+
+		// 0 for the number of processors
+		std::size_t threads = 0;
+	};
+
+	struct analysis_issue {
+		// "error" if a budget is exceeded, "warning" otherwise
+		std::string severity;
+
+		// deck_weight, asset_size, image_size, image_pixels, uncompressed_image,
+		// render_blocking_scripts, unminified, duplicate_content, duplicate_library
+		std::string kind;
+
+		std::string url;
+		std::string message;
+		std::uintmax_t value = 0;
+		std::uintmax_t budget = 0;
+	};
+
+	struct analyzed_file {
+		std::string url;
+		std::uintmax_t size = 0;
+		std::uint64_t hash = 0;
+
+		// images only, 0 if unknown
+		unsigned width = 0, height = 0;
+
+		// scripts and stylesheets only
+		bool unminified = false;
+	};
+
+	struct deck_analysis {
+		std::string url;
+
+		// the page and the files it references that exist
+		std::uintmax_t weight = 0;
+		std::size_t assets = 0;
+
+		std::vector<std::string> render_blocking_scripts;
+
+		// referenced but not found under the root
+		std::vector<std::string> missing;
+	};
+
+	struct root_analysis {
+		boost::filesystem::path root;
+		std::size_t files = 0;
+		std::uintmax_t total_size = 0;
+		std::vector<deck_analysis> decks;
+		std::vector<analyzed_file> biggest;
+
+		// groups of URLs with the same content
+		std::vector<std::vector<std::string>> duplicates;
+
+		std::vector<analysis_issue> issues;
+
+		bool within_budget() const
+		{
+			return std::none_of(issues.begin(), issues.end(), [](const analysis_issue &i) {
+				return i.severity == "error";
+			});
+		}
+	};
+
+	namespace detail {
+		inline std::uint32_t big_endian(const unsigned char *p, int bytes)
+		{
+			std::uint32_t value = 0;
+
+			for (int i = 0; i < bytes; ++i) {
+				value = (value << 8) | p[i];
+			}
+
+			return value;
+		}
+
+		// dimensions from the header of a PNG, GIF, BMP or JPEG file
+		inline bool read_image_size(const boost::filesystem::path &path, unsigned &width, unsigned &height)
+		{
+			boost::filesystem::ifstream ifs(path, std::ios::binary);
+			unsigned char h[26] = {};
+
+			if (!ifs.read(reinterpret_cast<char *>(h), sizeof(h))) {
+				return false;
+			}
+
+			if (std::memcmp(h, "\x89PNG", 4) == 0) {
+				width = big_endian(h + 16, 4);
+				height = big_endian(h + 20, 4);
+				return true;
+			}
+
+			if (std::memcmp(h, "GIF8", 4) == 0) {
+				width = h[6] | (h[7] << 8);
+				height = h[8] | (h[9] << 8);
+				return true;
+			}
+
+			if (h[0] == 'B' && h[1] == 'M') {
+				width = h[18] | (h[19] << 8) | (h[20] << 16) | (h[21] << 24);
+				height = h[22] | (h[23] << 8) | (h[24] << 16) | (static_cast<unsigned>(h[25] & 0x7f) << 24);
+				return true;
+			}
+
+			if (h[0] != 0xff || h[1] != 0xd8) {
+				return false;
+			}
+
+			// JPEG: walk the segments up to a start of frame
+			ifs.seekg(2);
+
+			for (;;) {
+				unsigned char m[4];
+
+				if (!ifs.read(reinterpret_cast<char *>(m), 4) || m[0] != 0xff) {
+					return false;
+				}
+
+				auto marker = m[1];
+				auto length = big_endian(m + 2, 2);
+
+				if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+					unsigned char f[5];
+
+					if (!ifs.read(reinterpret_cast<char *>(f), 5)) {
+						return false;
+					}
+
+					height = big_endian(f + 1, 2);
+					width = big_endian(f + 3, 2);
+					return true;
+				}
+
+				if (length < 2) {
+					return false;
+				}
+
+				ifs.seekg(length - 2, std::ios::cur);
+			}
+		}
+
+		// minified code has long lines
+		inline bool looks_unminified(const boost::filesystem::path &path)
+		{
+			boost::filesystem::ifstream ifs(path, std::ios::binary);
+			char buffer[64 * 1024];
+
+			ifs.read(buffer, sizeof(buffer));
+
+			auto size = static_cast<std::size_t>(ifs.gcount());
+			auto lines = static_cast<std::size_t>(std::count(buffer, buffer + size, '\n')) + 1;
+
+			return size / lines < 200;
+		}
+
+		// "js/jquery-3.4.1.min.js" -> "jquery.js"
+		inline std::string library_name(const std::string &url)
+		{
+			static const std::regex version(R"([-_.@]?v?\d+(\.\d+)+)");
+
+			auto name = boost::algorithm::to_lower_copy(url.substr(url.rfind('/') + 1));
+			auto dot = name.rfind('.');
+			auto ext = dot == std::string::npos ? std::string() : name.substr(dot);
+
+			name.erase(std::min(dot, name.size()));
+
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".min") == 0) {
+				name.erase(name.size() - 4);
+			}
+
+			return std::regex_replace(name, version, "") + ext;
+		}
+
+		inline bool is_image_url(const std::string &url)
+		{
+			auto type = content_type(boost::algorithm::to_lower_copy(boost::filesystem::path(url_path(url)).extension().string()));
+
+			return type.compare(0, 6, "image/") == 0 && type != "image/svg+xml";
+		}
+
+		inline bool is_code_url(const std::string &url)
+		{
+			auto ext = boost::algorithm::to_lower_copy(boost::filesystem::path(url_path(url)).extension().string());
+
+			return ext == ".js" || ext == ".css";
+		}
+
+		inline std::string megabytes(std::uintmax_t size)
+		{
+			return json_number(size / (1024.0 * 1024.0)) + " MB";
+		}
+	}
+
+	// Reads the [Budget] section of config.ini (a boost::property_tree ptree or wptree):
+	// DeckMB, AssetMB, ImageMB, ImageMegapixels, ImageBytesPerPixel, RenderBlockingScripts, UnminifiedKB.
+	template <typename Tree>
+	void read_budgets(const Tree &tree, analysis_budgets &budgets)
+	{
+		using key = typename Tree::key_type;
+
+		auto get = [&](const char *name, double value) {
+			std::string path = std::string("Budget.") + name;
+			return tree.template get<double>(key(path.begin(), path.end()), value);
+		};
+
+		const double mb = 1024.0 * 1024.0;
+
+		budgets.deck_weight = static_cast<std::uintmax_t>(get("DeckMB", budgets.deck_weight / mb) * mb);
+		budgets.asset_size = static_cast<std::uintmax_t>(get("AssetMB", budgets.asset_size / mb) * mb);
+		budgets.image_size = static_cast<std::uintmax_t>(get("ImageMB", budgets.image_size / mb) * mb);
+		budgets.image_pixels = static_cast<std::uint64_t>(get("ImageMegapixels", budgets.image_pixels / 1e6) * 1e6);
+		budgets.image_bytes_per_pixel = get("ImageBytesPerPixel", budgets.image_bytes_per_pixel);
+		budgets.render_blocking_scripts = static_cast<std::size_t>(get("RenderBlockingScripts", static_cast<double>(budgets.render_blocking_scripts)));
+		budgets.unminified_size = static_cast<std::uintmax_t>(get("UnminifiedKB", budgets.unminified_size / 1024.0) * 1024.0);
+	}
+
+	// Scans a document root for what makes decks slow to load: their weight,
+	// big and uncompressed images, unminified or duplicated libraries and
+	// render-blocking scripts. Files are examined in parallel.
+	// Blocks until the analysis is done.
+	inline root_analysis analyze_document_root(
+		const boost::filesystem::path &root,
+		const analysis_budgets &budgets,
+		asset_graph &assets,
+		content_hash_index &index)
+	{
+		root_analysis result;
+		boost::system::error_code error;
+
+		result.root = canonical(absolute(root), error);
+
+		if (error) {
+			return result;
+		}
+
+		auto root_string = result.root.generic_string();
+		std::vector<boost::filesystem::path> files;
+
+		for (boost::filesystem::recursive_directory_iterator iter(result.root, error), end; !error && iter != end; iter.increment(error)) {
+			auto &path = iter->path();
+
+			if (path.filename().string().compare(0, 1, ".") == 0) {
+				if (is_directory(path, error)) {
+					iter.no_push();
+				}
+			} else if (is_regular_file(path, error)) {
+				files.push_back(path);
+			}
+		}
+
+		std::vector<analyzed_file> analyzed(files.size());
+		std::vector<deck_analysis> decks;
+		std::vector<asset_list> deck_assets;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::size_t remaining = files.size();
+
+		for (auto &f : files) {
+			auto ext = boost::algorithm::to_lower_copy(f.extension().string());
+
+			if (ext == ".html" || ext == ".htm") {
+				decks.emplace_back();
+				decks.back().url = f.generic_string().substr(root_string.size());
+				deck_assets.emplace_back();
+				++remaining;
+			}
+		}
+
+		auto finished = [&]() {
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (--remaining == 0) {
+				done.notify_all();
+			}
+		};
+
+		{
+			worker_pool pool(budgets.threads);
+
+			for (std::size_t i = 0; i < files.size(); ++i) {
+				pool.post([&, i]() {
+					auto &a = analyzed[i];
+					auto &f = files[i];
+					file_stamp stamp;
+
+					a.url = f.generic_string().substr(root_string.size());
+
+					if (get_file_stamp(f, stamp)) {
+						a.size = stamp.size;
+						index.get(f, stamp, a.hash);
+					}
+
+					if (detail::is_image_url(a.url)) {
+						detail::read_image_size(f, a.width, a.height);
+					} else if (detail::is_code_url(a.url)
+						&& a.size > budgets.unminified_size
+						&& a.url.find(".min.") == std::string::npos)
+					{
+						a.unminified = detail::looks_unminified(f);
+					}
+
+					finished();
+				});
+			}
+
+			for (std::size_t i = 0; i < decks.size(); ++i) {
+				pool.post([&, i]() {
+					deck_assets[i] = assets.page_assets(result.root, result.root / decks[i].url, decks[i].url);
+					finished();
+				});
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&]() { return remaining == 0; });
+		}
+
+		std::map<std::string, const analyzed_file *> by_url;
+
+		for (auto &a : analyzed) {
+			by_url[a.url] = &a;
+			result.total_size += a.size;
+		}
+
+		result.files = analyzed.size();
+
+		auto issue = [&](const char *severity, const char *kind, const std::string &url, const std::string &message, std::uintmax_t value, std::uintmax_t budget) {
+			result.issues.push_back({ severity, kind, url, message, value, budget });
+		};
+
+		// decks
+		for (std::size_t i = 0; i < decks.size(); ++i) {
+			auto &d = decks[i];
+			std::set<std::string> counted;
+
+			d.weight = by_url.count(d.url) != 0 ? by_url[d.url]->size : 0;
+
+			for (auto &r : deck_assets[i]) {
+				auto url = url_path(r.url);
+
+				if (r.kind == asset_kind::script && r.render_blocking) {
+					d.render_blocking_scripts.push_back(r.url);
+				}
+
+				auto iter = by_url.find(url);
+
+				if (iter == by_url.end()) {
+					d.missing.push_back(url);
+				} else if (counted.insert(url).second) {
+					d.weight += iter->second->size;
+					++d.assets;
+				}
+			}
+
+			if (budgets.deck_weight != 0 && d.weight > budgets.deck_weight) {
+				issue("error", "deck_weight", d.url, "the deck weighs " + detail::megabytes(d.weight), d.weight, budgets.deck_weight);
+			}
+
+			if (budgets.render_blocking_scripts != 0 && d.render_blocking_scripts.size() > budgets.render_blocking_scripts) {
+				issue("error", "render_blocking_scripts", d.url,
+					std::to_string(d.render_blocking_scripts.size()) + " scripts without async or defer block rendering",
+					d.render_blocking_scripts.size(), budgets.render_blocking_scripts);
+			}
+
+			result.decks.push_back(d);
+		}
+
+		// files
+		std::map<std::pair<std::uint64_t, std::uintmax_t>, std::vector<std::string>> by_content;
+		std::map<std::string, std::set<std::uint64_t>> libraries;
+		std::map<std::string, std::vector<std::string>> library_urls;
+
+		for (auto &a : analyzed) {
+			if (budgets.asset_size != 0 && a.size > budgets.asset_size) {
+				issue("error", "asset_size", a.url, "the file is " + detail::megabytes(a.size), a.size, budgets.asset_size);
+			}
+
+			if (a.width != 0 && a.height != 0) {
+				auto pixels = static_cast<std::uint64_t>(a.width) * a.height;
+
+				if (budgets.image_size != 0 && a.size > budgets.image_size) {
+					issue("error", "image_size", a.url, "the image is " + detail::megabytes(a.size), a.size, budgets.image_size);
+				}
+
+				if (budgets.image_pixels != 0 && pixels > budgets.image_pixels) {
+					issue("error", "image_pixels", a.url,
+						"the image is " + std::to_string(a.width) + "x" + std::to_string(a.height) + " pixels",
+						pixels, budgets.image_pixels);
+				}
+
+				if (budgets.image_bytes_per_pixel > 0.0 && a.size > budgets.image_bytes_per_pixel * pixels && a.size > 64 * 1024) {
+					issue("warning", "uncompressed_image", a.url,
+						json_number(static_cast<double>(a.size) / pixels) + " bytes per pixel; JPEG or WebP would be smaller",
+						a.size, static_cast<std::uintmax_t>(budgets.image_bytes_per_pixel * pixels));
+				}
+			}
+
+			if (a.unminified) {
+				issue("warning", "unminified", a.url, "the file looks unminified", a.size, budgets.unminified_size);
+			}
+
+			if (a.size >= 1024) {
+				by_content[std::make_pair(a.hash, a.size)].push_back(a.url);
+			}
+
+			if (detail::is_code_url(a.url)) {
+				auto name = detail::library_name(a.url);
+
+				libraries[name].insert(a.hash);
+				library_urls[name].push_back(a.url);
+			}
+		}
+
+		for (auto &c : by_content) {
+			if (c.second.size() > 1) {
+				result.duplicates.push_back(c.second);
+				issue("warning", "duplicate_content", c.second.front(),
+					std::to_string(c.second.size()) + " copies of the same file", c.first.second * (c.second.size() - 1), 0);
+			}
+		}
+
+		for (auto &l : libraries) {
+			if (l.second.size() > 1) {
+				auto &urls = library_urls[l.first];
+				std::string list;
+
+				for (auto &u : urls) {
+					list += (list.empty() ? "" : ", ") + u;
+				}
+
+				issue("warning", "duplicate_library", urls.front(),
+					std::to_string(l.second.size()) + " different versions of " + l.first + ": " + list, l.second.size(), 1);
+			}
+		}
+
+		result.biggest = analyzed;
+
+		std::sort(result.biggest.begin(), result.biggest.end(), [](const analyzed_file &a, const analyzed_file &b) {
+			return a.size != b.size ? a.size > b.size : a.url < b.url;
+		});
+
+		if (result.biggest.size() > budgets.biggest_assets) {
+			result.biggest.resize(budgets.biggest_assets);
+		}
+
+		return result;
+	}
+
+	inline std::string to_json(const root_analysis &analysis)
+	{
+		auto strings = [](const std::vector<std::string> &list) {
+			std::string json = "[";
+
+			for (auto &s : list) {
+				json += (json.size() > 1 ? "," : "") + json_quote(s);
+			}
+
+			return json + "]";
+		};
+
+		std::string json = "{\"root\":" + json_quote(analysis.root.generic_string())
+			+ ",\n\"within_budget\":" + (analysis.within_budget() ? "true" : "false")
+			+ ",\n\"files\":" + std::to_string(analysis.files)
+			+ ",\n\"total_size\":" + std::to_string(analysis.total_size)
+			+ ",\n\"decks\":[";
+
+		for (std::size_t i = 0; i < analysis.decks.size(); ++i) {
+			auto &d = analysis.decks[i];
+
+			json += (i != 0 ? ",\n" : "\n")
+				+ std::string("{\"url\":") + json_quote(d.url)
+				+ ",\"weight\":" + std::to_string(d.weight)
+				+ ",\"assets\":" + std::to_string(d.assets)
+				+ ",\"render_blocking_scripts\":" + strings(d.render_blocking_scripts)
+				+ ",\"missing\":" + strings(d.missing) + "}";
+		}
+
+		json += "],\n\"biggest\":[";
+
+		for (std::size_t i = 0; i < analysis.biggest.size(); ++i) {
+			auto &a = analysis.biggest[i];
+
+			json += (i != 0 ? ",\n" : "\n")
+				+ std::string("{\"url\":") + json_quote(a.url)
+				+ ",\"size\":" + std::to_string(a.size);
+
+			if (a.width != 0) {
+				json += ",\"width\":" + std::to_string(a.width) + ",\"height\":" + std::to_string(a.height);
+			}
+
+			json += "}";
+		}
+
+		json += "],\n\"duplicates\":[";
+
+		for (std::size_t i = 0; i < analysis.duplicates.size(); ++i) {
+			json += (i != 0 ? ",\n" : "\n") + strings(analysis.duplicates[i]);
+		}
+
+		json += "],\n\"issues\":[";
+
+		for (std::size_t i = 0; i < analysis.issues.size(); ++i) {
+			auto &s = analysis.issues[i];
+
+			json += (i != 0 ? ",\n" : "\n")
+				+ std::string("{\"severity\":") + json_quote(s.severity)
+				+ ",\"kind\":" + json_quote(s.kind)
+				+ ",\"url\":" + json_quote(s.url)
+				+ ",\"message\":" + json_quote(s.message)
+				+ ",\"value\":" + std::to_string(s.value)
+				+ ",\"budget\":" + std::to_string(s.budget) + "}";
+		}
+
+		json += "]}\n";
+
+		return json;
+	}
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "file_stamp.hpp"
+#include "hash.hpp"
+#include "html.hpp"
+#include "lru_cache.hpp"
+
+// Huge single-file decks (hundreds of slides in one index.html) take seconds
+// to parse. Such a page is served as a skeleton that has the first slides and
+// an empty <section> for each of the others, whose content is fetched by a
+// small loader (page?section=N) as the presenter gets near it.
+
+namespace msr {
+	struct deck_split_options {
+		bool enabled = false;
+
+		// pages smaller than this or with fewer top-level sections are served whole
+		std::size_t min_page_size = 1024 * 1024;
+		std::size_t min_sections = 32;
+
+		// top-level sections sent with the skeleton
+		unsigned eager_slides = 3;
+
+		// sections the loader fetches ahead of the current one
+		unsigned prefetch = 2;
+
+		// split pages are kept in memory, as they are usually too large for the
+		// content cache and would be read again for every slide
+		std::size_t memory_budget = 64 * 1024 * 1024;
+	};
+
+	// The top-level <section> elements of a page; vertical slides stay inside their parent.
+	struct deck_outline {
+		struct section {
+			std::size_t begin;	// '<' of the opening tag
+			std::size_t open_end;	// after the opening tag
+			std::size_t end;	// after the closing tag
+		};
+
+		std::vector<section> sections;
+	};
+
+	inline deck_outline outline_deck(const std::string &html)
+	{
+		deck_outline outline;
+		std::size_t depth = 0;
+		deck_outline::section current = {};
+
+		scan_html_tags(html, [&](const html_tag &tag) {
+			if (tag.name != "section" || tag.self_closing) {
+				return true;
+			}
+
+			if (!tag.closing) {
+				if (depth++ == 0) {
+					current.begin = tag.begin;
+					current.open_end = tag.end;
+				}
+			} else if (depth > 0 && --depth == 0) {
+				current.end = tag.end;
+				outline.sections.push_back(current);
+			}
+
+			return true;
+		});
+
+		return outline;
+	}
+
+	// the loader injected into skeletons
+	inline std::string deck_split_script(unsigned prefetch)
+	{
+		return
+			"<script>(function () {\n"
+			"\tvar loading = {};\n"
+			"\tfunction load(i) {\n"
+			"\t\tvar p = document.querySelector('.reveal .slides > section[data-msr-section=\"' + i + '\"]');\n"
+			"\t\tif (!p || loading[i]) return;\n"
+			"\t\tloading[i] = fetch(location.pathname + '?section=' + i).then(function (r) {\n"
+			"\t\t\tif (!r.ok) throw r.status;\n"
+			"\t\t\treturn r.text();\n"
+			"\t\t}).then(function (html) {\n"
+			"\t\t\tp.outerHTML = html;\n"
+			"\t\t\tReveal.sync();\n"
+			"\t\t\tvar c = Reveal.getIndices();\n"
+			"\t\t\tif (c.h === i) Reveal.slide(c.h, c.v, c.f);\n"
+			"\t\t}, function () { delete loading[i]; });\n"
+			"\t}\n"
+			"\tfunction update() {\n"
+			"\t\tvar h = Reveal.getIndices().h;\n"
+			"\t\tfor (var i = Math.max(0, h - 1); i <= h + " + std::to_string(prefetch) + "; ++i) load(i);\n"
+			"\t}\n"
+			"\tif (window.Reveal) {\n"
+			"\t\tReveal.addEventListener('slidechanged', update);\n"
+			"\t\tif (Reveal.isReady()) update(); else Reveal.addEventListener('ready', update);\n"
+			"\t}\n"
+			"})();</script>";
+	}
+
+	// Outlines and skeletons of pages, cached by the content hash of the page,
+	// and the split pages themselves, by path.
+	class deck_split_cache {
+	public:
+		using outline_pointer = std::shared_ptr<const deck_outline>;
+
+	private:
+		deck_split_options options_;
+		lru_cache<std::string, file_content> pages_;
+		lru_cache<std::uint64_t, deck_outline> outlines_;
+		lru_cache<std::uint64_t, file_content> skeletons_;
+
+		// the skeleton of page with the outline
+		std::string make_skeleton(const std::string &html, const deck_outline &outline) const
+		{
+			auto &sections = outline.sections;
+			std::string skeleton;
+
+			skeleton.reserve(sections[options_.eager_slides].begin + (sections.size() - options_.eager_slides) * 64 + 2048);
+			skeleton.append(html, 0, sections[options_.eager_slides].begin);
+
+			for (auto i = static_cast<std::size_t>(options_.eager_slides); i < sections.size(); ++i) {
+				auto &s = sections[i];
+
+				// the opening tag keeps the attributes reveal.js reads (backgrounds, transitions, ids)
+				skeleton.append(html, s.begin, s.open_end - 1 - s.begin);
+				skeleton += " data-msr-section=\"" + std::to_string(i) + "\"></section>";
+
+				auto next = i + 1 < sections.size() ? sections[i + 1].begin : s.end;
+				skeleton.append(html, s.end, next - s.end);
+			}
+
+			auto tail = sections.back().end;
+			auto body = detail::find_ignore_case(html, "</body", tail);
+
+			if (body == std::string::npos) {
+				body = html.size();
+			}
+
+			skeleton.append(html, tail, body - tail);
+			skeleton += deck_split_script(options_.prefetch);
+			skeleton.append(html, body, std::string::npos);
+
+			return skeleton;
+		}
+
+	public:
+		explicit deck_split_cache(const deck_split_options &options)
+			: options_(options)
+			, pages_(options.memory_budget)
+			, outlines_(4 * 1024 * 1024)
+			, skeletons_(16 * 1024 * 1024)
+		{
+		}
+
+		// The page at path, from memory if it is a split page; otherwise from
+		// loader(), a content_cache::content_pointer() (nullptr if the file cannot be read).
+		template <typename Loader>
+		content_cache::content_pointer load(const boost::filesystem::path &path, const file_stamp &stamp, Loader loader)
+		{
+			auto key = path.string() + '\n' + std::to_string(stamp.size) + ':' + std::to_string(stamp.mtime);
+			auto page = pages_.find(key);
+
+			if (page) {
+				return page;
+			}
+
+			page = loader();
+
+			if (page && outline(page)) {
+				pages_.insert(key, page, page->data->size() + key.size() + sizeof(file_content));
+			}
+
+			return page;
+		}
+
+		// nullptr if the page is served whole; it is parsed once per content
+		outline_pointer outline(const content_cache::content_pointer &page)
+		{
+			if (page->data->size() < options_.min_page_size) {
+				return nullptr;
+			}
+
+			auto outline = outlines_.find(page->hash);
+
+			if (!outline) {
+				auto o = std::make_shared<deck_outline>(outline_deck(*page->data));
+
+				// pages that are not split keep an empty outline, so they are not parsed again
+				if (o->sections.size() < options_.min_sections || o->sections.size() <= options_.eager_slides) {
+					o->sections.clear();
+				}
+
+				outlines_.insert(page->hash, o, o->sections.size() * sizeof(deck_outline::section) + sizeof(deck_outline));
+				outline = o;
+			}
+
+			return outline->sections.empty() ? nullptr : outline;
+		}
+
+		// the skeleton, or page if it is served whole
+		content_cache::content_pointer skeleton(const content_cache::content_pointer &page)
+		{
+			auto o = outline(page);
+
+			if (!o) {
+				return page;
+			}
+
+			std::string key = to_hex(page->hash) + "\nsplit:" + std::to_string(options_.eager_slides) + ':' + std::to_string(options_.prefetch);
+			auto hash = hash_bytes(key.data(), key.size());
+			auto cached = skeletons_.find(hash);
+
+			if (cached) {
+				return cached;
+			}
+
+			auto c = std::make_shared<file_content>();
+
+			c->stamp = page->stamp;
+			c->hash = hash;
+			c->data = std::make_shared<std::string>(make_skeleton(*page->data, *o));
+
+			skeletons_.insert(hash, c, c->data->size() + sizeof(file_content));
+
+			return c;
+		}
+
+		// the markup of top-level section index of a split page; false if there is none
+		bool section(const content_cache::content_pointer &page, std::size_t index, std::string &markup)
+		{
+			auto o = outline(page);
+
+			if (!o || index >= o->sections.size()) {
+				return false;
+			}
+
+			auto &s = o->sections[index];
+			markup.assign(*page->data, s.begin, s.end - s.begin);
+
+			return true;
+		}
+	};
+}
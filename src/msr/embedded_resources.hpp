@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "inflate.hpp"
+
+// Files compiled into the executable (see cmake/embed_resources.cmake).
+// Defining REVEALJS_PATH in CMake embeds a reveal.js distribution.
+
+namespace msr {
+	struct embedded_resource {
+		// relative to embedded_prefix
+		const char *path;
+
+		// gzip-compressed content
+		const unsigned char *data;
+		std::size_t size;
+
+		std::size_t identity_size;
+
+		// quoted, derived from the uncompressed content
+		const char *etag;
+	};
+
+	namespace detail {
+#ifdef MSR_EMBEDDED_RESOURCES
+#include "embedded_resources.inc"
+#else
+		constexpr embedded_resource embedded_resource_table[] = {
+			{ nullptr, nullptr, 0, 0, nullptr },
+		};
+#endif
+	}
+
+	// reserved URL prefix of the embedded files
+	constexpr const char embedded_prefix[] = "/.msr/reveal.js/";
+
+	// path is relative to embedded_prefix
+	inline const embedded_resource *find_embedded_resource(const std::string &path)
+	{
+		// the last entry is a terminator
+		auto first = std::begin(detail::embedded_resource_table);
+		auto last = std::end(detail::embedded_resource_table) - 1;
+
+		auto iter = std::lower_bound(first, last, path, [](const embedded_resource &r, const std::string &p) {
+			return std::strcmp(r.path, p.c_str()) < 0;
+		});
+
+		if (iter != last && path == iter->path) {
+			return iter;
+		}
+
+		return nullptr;
+	}
+
+	// The uncompressed content of an embedded file, for clients that do not
+	// accept gzip (the in-process scheme handler cannot send Content-Encoding).
+	// Inflated on first use and kept; nullptr if the entry is corrupt.
+	inline std::shared_ptr<const std::string> embedded_identity(const embedded_resource &resource)
+	{
+		static std::mutex mutex;
+		static std::unordered_map<const embedded_resource *, std::shared_ptr<const std::string>> inflated;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto iter = inflated.find(&resource);
+
+			if (iter != inflated.end()) {
+				return iter->second;
+			}
+		}
+
+		auto data = std::make_shared<std::string>();
+
+		if (!inflate_gzip(resource.data, resource.size, *data, resource.identity_size) || data->size() != resource.identity_size) {
+			return nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		return inflated.emplace(&resource, std::move(data)).first->second;
+	}
+}
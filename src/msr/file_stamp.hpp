@@ -0,0 +1,46 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <cstdint>
+#include <ctime>
+
+namespace msr {
+	// size and mtime of a file; a file whose stamp changed is a new version
+	struct file_stamp {
+		std::uintmax_t size = 0;
+		std::time_t mtime = 0;
+
+		bool operator==(const file_stamp &other) const
+		{
+			return size == other.size && mtime == other.mtime;
+		}
+
+		bool operator!=(const file_stamp &other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	inline bool get_file_stamp(const boost::filesystem::path &path, file_stamp &stamp)
+	{
+		boost::system::error_code error;
+
+		auto size = file_size(path, error);
+
+		if (error) {
+			return false;
+		}
+
+		auto mtime = last_write_time(path, error);
+
+		if (error) {
+			return false;
+		}
+
+		stamp.size = size;
+		stamp.mtime = mtime;
+
+		return true;
+	}
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "file_stamp.hpp"
+#include "font_subset.hpp"
+#include "hash.hpp"
+#include "lru_cache.hpp"
+#include "worker_pool.hpp"
+
+namespace msr {
+	struct font_options {
+		// serve fonts subset to the characters of the deck they belong to
+		bool enabled = false;
+
+		// subsets are also kept here when not empty
+		boost::filesystem::path cache_directory;
+
+		std::size_t memory_budget = 64 * 1024 * 1024;
+
+		// always kept in addition to the characters of the deck, for text made
+		// by scripts (inclusive ranges: ASCII, Latin-1, punctuation, CJK symbols, full-width forms)
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> safety_ranges = {
+			{ 0x0020, 0x007e },
+			{ 0x00a0, 0x00ff },
+			{ 0x2000, 0x206f },
+			{ 0x3000, 0x303f },
+			{ 0xff00, 0xffef },
+		};
+
+		std::size_t threads = 1;
+
+		bool operator==(const font_options &other) const
+		{
+			return enabled == other.enabled
+				&& cache_directory == other.cache_directory
+				&& memory_budget == other.memory_budget
+				&& safety_ranges == other.safety_ranges
+				&& threads == other.threads;
+		}
+	};
+
+	struct font_variant {
+		// TrueType; empty means that the original should be served
+		std::string data;
+
+		// hash of data
+		std::uint64_t hash = 0;
+	};
+
+	// Subsets the fonts of a deck to the characters used by its pages (HTML
+	// and Markdown under the document root) and caches the results in memory
+	// and on disk, keyed by the hashes of the font and of the character set.
+	// Editing a deck makes a new subset only if it adds characters.
+	class font_pipeline {
+	public:
+		using variant_pointer = std::shared_ptr<const font_variant>;
+		using handler_type = std::function<void(variant_pointer)>;
+
+	private:
+		struct deck_text {
+			std::uint64_t signature = 0;
+			std::shared_ptr<const code_point_set> code_points;
+			std::uint64_t hash = 0;
+		};
+
+		font_options options_;
+
+		// keyed by job_key()
+		lru_cache<std::string, font_variant> memory_;
+
+		std::mutex mutex_;
+		file_hash_cache hashes_;
+
+		// by document root
+		std::unordered_map<std::string, deck_text> texts_;
+
+		struct root_signature {
+			std::uint64_t value = 0;
+			std::chrono::steady_clock::time_point checked;
+		};
+
+		// of text_files(), by document root; walked again on a worker once it is older than a second
+		std::unordered_map<std::string, root_signature> signatures_;
+
+		// handlers waiting for a job, keyed by job_key()
+		std::unordered_map<std::string, std::vector<handler_type>> pending_;
+
+		// declared last so that the workers are joined before the caches are destroyed
+		worker_pool pool_;
+
+		// bump when the output of subset_font() changes
+		static const int version = 1;
+
+		static bool is_text_file(const boost::filesystem::path &path)
+		{
+			auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+
+			return ext == ".html" || ext == ".htm" || ext == ".md" || ext == ".markdown";
+		}
+
+		// The pages of a deck; hidden directories and node_modules are skipped.
+		// signature changes when one of them changes.
+		static std::vector<boost::filesystem::path> text_files(const boost::filesystem::path &root, std::uint64_t &signature)
+		{
+			std::vector<boost::filesystem::path> files;
+			fnv1a64 h;
+			boost::system::error_code error;
+
+			for (boost::filesystem::recursive_directory_iterator iter(root, error), end; !error && iter != end; iter.increment(error)) {
+				auto name = iter->path().filename().string();
+
+				if (is_directory(iter->status())) {
+					if ((!name.empty() && name[0] == '.') || name == "node_modules") {
+						iter.no_push();
+					}
+
+					continue;
+				}
+
+				file_stamp stamp;
+
+				if (!is_text_file(iter->path()) || !get_file_stamp(iter->path(), stamp)) {
+					continue;
+				}
+
+				auto key = iter->path().string() + '\n' + std::to_string(stamp.size) + ':' + std::to_string(stamp.mtime) + '\n';
+
+				h.update(key.data(), key.size());
+				files.push_back(iter->path());
+			}
+
+			signature = h.value();
+
+			return files;
+		}
+
+		// false if the signature of root has not been taken in the last second
+		bool recent_signature(const boost::filesystem::path &root, std::uint64_t &signature)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = signatures_.find(root.string());
+
+			if (iter == signatures_.end() || std::chrono::steady_clock::now() - iter->second.checked > std::chrono::seconds(1)) {
+				return false;
+			}
+
+			signature = iter->second.value;
+
+			return true;
+		}
+
+		// walks the pages; on a worker
+		std::uint64_t take_signature(const boost::filesystem::path &root)
+		{
+			root_signature signature;
+
+			text_files(root, signature.value);
+			signature.checked = std::chrono::steady_clock::now();
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			signatures_[root.string()] = signature;
+
+			return signature.value;
+		}
+
+		deck_text read_deck_text(const boost::filesystem::path &root, std::uint64_t signature)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				auto iter = texts_.find(root.string());
+
+				if (iter != texts_.end() && iter->second.signature == signature) {
+					return iter->second;
+				}
+			}
+
+			std::uint64_t current;
+			auto files = text_files(root, current);
+			auto code_points = std::make_shared<code_point_set>();
+
+			for (auto &f : files) {
+				std::string text;
+
+				if (read_file(f, text)) {
+					collect_code_points(text, *code_points);
+				}
+			}
+
+			for (auto &r : options_.safety_ranges) {
+				for (auto c = r.first; c <= r.second; ++c) {
+					code_points->push_back(c);
+				}
+			}
+
+			std::sort(code_points->begin(), code_points->end());
+			code_points->erase(std::unique(code_points->begin(), code_points->end()), code_points->end());
+
+			deck_text text;
+			text.signature = current;
+			text.code_points = code_points;
+			text.hash = hash_bytes(code_points->data(), code_points->size() * sizeof(std::uint32_t));
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			texts_[root.string()] = text;
+
+			return text;
+		}
+
+		static std::string job_key(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t signature)
+		{
+			return path.string() + '\n' + std::to_string(stamp.size) + ':' + std::to_string(stamp.mtime) + '-' + to_hex(signature);
+		}
+
+		bool read_disk_cache(const std::string &key, variant_pointer &variant)
+		{
+			if (options_.cache_directory.empty()) {
+				return false;
+			}
+
+			auto v = std::make_shared<font_variant>();
+
+			if (!read_file(options_.cache_directory / key, v->data)) {
+				return false;
+			}
+
+			v->hash = hash_bytes(v->data.data(), v->data.size());
+			variant = v;
+
+			return true;
+		}
+
+		void write_disk_cache(const std::string &key, const font_variant &variant)
+		{
+			if (options_.cache_directory.empty() || variant.data.empty()) {
+				return;
+			}
+
+			boost::system::error_code error;
+			create_directories(options_.cache_directory, error);
+
+			auto temp = options_.cache_directory / (key + ".tmp");
+
+			{
+				boost::filesystem::ofstream ofs(temp, std::ios::binary);
+
+				if (!ofs) {
+					return;
+				}
+
+				ofs.write(variant.data.data(), variant.data.size());
+
+				if (!ofs) {
+					ofs.close();
+					remove(temp, error);
+					return;
+				}
+			}
+
+			rename(temp, options_.cache_directory / key, error);
+		}
+
+		variant_pointer generate(
+			const boost::filesystem::path &root,
+			const boost::filesystem::path &path,
+			const file_stamp &stamp,
+			std::uint64_t signature)
+		{
+			std::uint64_t hash;
+
+			if (!hashes_.get(path, stamp, hash)) {
+				return nullptr;
+			}
+
+			auto text = read_deck_text(root, signature);
+			auto key = to_hex(hash) + '-' + to_hex(text.hash) + ".v" + std::to_string(version) + ".ttf";
+			variant_pointer variant;
+
+			if (!read_disk_cache(key, variant)) {
+				auto v = std::make_shared<font_variant>();
+				std::string font;
+
+				if (read_file(path, font) && subset_font(font, *text.code_points, v->data) && v->data.size() < font.size()) {
+					v->hash = hash_bytes(v->data.data(), v->data.size());
+				} else {
+					v->data.clear();
+				}
+
+				write_disk_cache(key, *v);
+				variant = v;
+			}
+
+			return variant;
+		}
+
+	public:
+		explicit font_pipeline(const font_options &options)
+			: options_(options)
+			, memory_(options.memory_budget)
+			, pool_(options.threads)
+		{
+		}
+
+		const font_options &options() const
+		{
+			return options_;
+		}
+
+		// jobs that have not started are dropped and their handlers are never called
+		void stop()
+		{
+			pool_.stop();
+		}
+
+		// WOFF2 and CFF (.otf) fonts are served as they are
+		static bool is_subsettable(const boost::filesystem::path &path)
+		{
+			auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+
+			return ext == ".ttf" || ext == ".woff";
+		}
+
+		// The subset of the font at path for the deck at root. The handler receives
+		// nullptr when the original file should be served. It is called
+		// synchronously on a memory hit, otherwise on a worker thread. The pages
+		// of the deck are walked on the worker, so an edit is seen within a second.
+		void get(const boost::filesystem::path &root, const boost::filesystem::path &path, handler_type handler)
+		{
+			file_stamp stamp;
+
+			if (!get_file_stamp(path, stamp)) {
+				handler(nullptr);
+				return;
+			}
+
+			std::uint64_t signature;
+
+			if (recent_signature(root, signature)) {
+				auto variant = memory_.find(job_key(path, stamp, signature));
+
+				if (variant) {
+					handler(variant->data.empty() ? nullptr : variant);
+					return;
+				}
+			}
+
+			pool_.post([this, root, path, stamp, handler]() {
+				auto signature = take_signature(root);
+				auto key = job_key(path, stamp, signature);
+				auto variant = memory_.find(key);
+
+				if (variant) {
+					handler(variant->data.empty() ? nullptr : variant);
+					return;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+
+					auto &handlers = pending_[key];
+					handlers.push_back(handler);
+
+					// another worker is making it
+					if (handlers.size() > 1) {
+						return;
+					}
+				}
+
+				variant = generate(root, path, stamp, signature);
+
+				if (variant) {
+					memory_.insert(key, variant, variant->data.size() + key.size() + sizeof(font_variant));
+				}
+
+				if (variant && variant->data.empty()) {
+					variant = nullptr;
+				}
+
+				std::vector<handler_type> handlers;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+
+					auto iter = pending_.find(key);
+
+					if (iter != pending_.end()) {
+						handlers.swap(iter->second);
+						pending_.erase(iter);
+					}
+				}
+
+				for (auto &h : handlers) {
+					h(variant);
+				}
+			});
+		}
+	};
+}
@@ -0,0 +1,764 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "inflate.hpp"
+
+// Subsetting of TrueType fonts (.ttf, and .woff with TrueType outlines).
+// Glyph IDs are kept: the outlines of the glyphs that are not needed are
+// removed and the character map only has the needed code points, so every
+// other table (metrics, layout, kerning) stays valid as it is.
+// Fonts with CFF outlines (.otf) and WOFF2 are not handled.
+
+namespace msr {
+	// sorted code points
+	using code_point_set = std::vector<std::uint32_t>;
+
+	namespace detail {
+		// big-endian reads that fail softly: out of range reads give 0 and set failed
+		class font_reader {
+			const std::string &data_;
+
+		public:
+			mutable bool failed = false;
+
+			explicit font_reader(const std::string &data)
+				: data_(data)
+			{
+			}
+
+			std::size_t size() const
+			{
+				return data_.size();
+			}
+
+			std::uint16_t u16(std::size_t pos) const
+			{
+				if (pos + 2 > data_.size()) {
+					failed = true;
+					return 0;
+				}
+
+				return static_cast<std::uint16_t>((static_cast<unsigned char>(data_[pos]) << 8) | static_cast<unsigned char>(data_[pos + 1]));
+			}
+
+			std::uint32_t u32(std::size_t pos) const
+			{
+				return (static_cast<std::uint32_t>(u16(pos)) << 16) | u16(pos + 2);
+			}
+		};
+
+		inline void put16(std::string &s, std::uint16_t v)
+		{
+			s += static_cast<char>(v >> 8);
+			s += static_cast<char>(v & 0xff);
+		}
+
+		inline void put32(std::string &s, std::uint32_t v)
+		{
+			put16(s, static_cast<std::uint16_t>(v >> 16));
+			put16(s, static_cast<std::uint16_t>(v & 0xffff));
+		}
+
+		inline void set32(std::string &s, std::size_t pos, std::uint32_t v)
+		{
+			for (int i = 0; i < 4; ++i) {
+				s[pos + i] = static_cast<char>((v >> (24 - 8 * i)) & 0xff);
+			}
+		}
+
+		inline std::uint32_t table_checksum(const std::string &data)
+		{
+			std::uint32_t sum = 0;
+
+			for (std::size_t pos = 0; pos < data.size(); pos += 4) {
+				std::uint32_t v = 0;
+
+				for (std::size_t i = 0; i < 4; ++i) {
+					v = (v << 8) | (pos + i < data.size() ? static_cast<unsigned char>(data[pos + i]) : 0);
+				}
+
+				sum += v;
+			}
+
+			return sum;
+		}
+
+		using font_tables = std::map<std::string, std::string>;
+
+		// tables of a TrueType/OpenType or WOFF 1.0 file, and the sfnt version
+		inline bool read_font_tables(const std::string &font, font_tables &tables, std::uint32_t &flavor)
+		{
+			font_reader r(font);
+			auto signature = r.u32(0);
+
+			if (signature == 0x774f4646) {	// 'wOFF'
+				flavor = r.u32(4);
+
+				auto count = r.u16(12);
+
+				for (std::size_t i = 0; i < count; ++i) {
+					auto entry = 44 + i * 20;
+					auto tag = font.substr(entry, 4);
+					auto offset = r.u32(entry + 4);
+					auto compressed = r.u32(entry + 8);
+					auto original = r.u32(entry + 12);
+
+					if (r.failed || offset > font.size() || compressed > font.size() - offset) {
+						return false;
+					}
+
+					auto &table = tables[tag];
+
+					if (compressed == original) {
+						table = font.substr(offset, compressed);
+					} else if (!inflate_zlib(font.data() + offset, compressed, table, original) || table.size() != original) {
+						return false;
+					}
+				}
+			} else if (signature == 0x00010000 || signature == 0x74727565 || signature == 0x4f54544f) {	// 1.0, 'true', 'OTTO'
+				flavor = signature;
+
+				auto count = r.u16(4);
+
+				for (std::size_t i = 0; i < count; ++i) {
+					auto entry = 12 + i * 16;
+					auto tag = font.substr(entry, 4);
+					auto offset = r.u32(entry + 8);
+					auto length = r.u32(entry + 12);
+
+					if (r.failed || offset > font.size() || length > font.size() - offset) {
+						return false;
+					}
+
+					tables[tag] = font.substr(offset, length);
+				}
+			} else {
+				return false;
+			}
+
+			return !tables.empty();
+		}
+
+		// sfnt file with the tables sorted by tag and the checksums filled in
+		inline std::string write_font_tables(std::uint32_t flavor, const font_tables &tables)
+		{
+			std::uint16_t count = static_cast<std::uint16_t>(tables.size());
+			std::uint16_t entry_selector = 0;
+
+			while ((2u << entry_selector) <= count) {
+				++entry_selector;
+			}
+
+			std::uint16_t search_range = static_cast<std::uint16_t>(16u << entry_selector);
+
+			std::string font;
+			put32(font, flavor);
+			put16(font, count);
+			put16(font, search_range);
+			put16(font, entry_selector);
+			put16(font, static_cast<std::uint16_t>(count * 16 - search_range));
+
+			auto offset = static_cast<std::uint32_t>(12 + 16 * tables.size());
+			std::size_t head_offset = 0;
+
+			for (auto &t : tables) {
+				font += t.first;
+				put32(font, table_checksum(t.second));
+				put32(font, offset);
+				put32(font, static_cast<std::uint32_t>(t.second.size()));
+
+				if (t.first == "head") {
+					head_offset = offset;
+				}
+
+				offset += static_cast<std::uint32_t>((t.second.size() + 3) & ~std::size_t(3));
+			}
+
+			for (auto &t : tables) {
+				font += t.second;
+				font.append((4 - t.second.size() % 4) % 4, '\0');
+			}
+
+			if (head_offset != 0 && font.size() >= head_offset + 12) {
+				set32(font, head_offset + 8, 0);
+				set32(font, head_offset + 8, 0xb1b0afba - table_checksum(font));
+			}
+
+			return font;
+		}
+
+		// glyph ID of code point c in a format 4 or 12 subtable at pos of cmap, 0 if none
+		inline std::uint16_t cmap_lookup(const font_reader &r, std::size_t pos, std::uint32_t c)
+		{
+			auto format = r.u16(pos);
+
+			if (format == 4) {
+				if (c > 0xffff) {
+					return 0;
+				}
+
+				std::size_t segments = r.u16(pos + 6) / 2;
+				auto ends = pos + 14;
+				auto starts = ends + segments * 2 + 2;
+				auto deltas = starts + segments * 2;
+				auto range_offsets = deltas + segments * 2;
+
+				// the first segment whose end is >= c
+				std::size_t lo = 0, hi = segments;
+
+				while (lo < hi) {
+					auto mid = (lo + hi) / 2;
+
+					if (r.u16(ends + mid * 2) < c) {
+						lo = mid + 1;
+					} else {
+						hi = mid;
+					}
+				}
+
+				if (lo == segments || r.u16(starts + lo * 2) > c) {
+					return 0;
+				}
+
+				auto delta = r.u16(deltas + lo * 2);
+				auto range_offset = r.u16(range_offsets + lo * 2);
+
+				if (range_offset == 0) {
+					return static_cast<std::uint16_t>(c + delta);
+				}
+
+				auto glyph = r.u16(range_offsets + lo * 2 + range_offset + (c - r.u16(starts + lo * 2)) * 2);
+
+				return glyph == 0 ? 0 : static_cast<std::uint16_t>(glyph + delta);
+			} else if (format == 12) {
+				std::size_t groups = r.u32(pos + 12);
+				std::size_t lo = 0, hi = groups;
+
+				while (lo < hi) {
+					auto mid = (lo + hi) / 2;
+					auto group = pos + 16 + mid * 12;
+
+					if (r.u32(group + 4) < c) {
+						lo = mid + 1;
+					} else {
+						hi = mid;
+					}
+
+					if (r.failed) {
+						return 0;
+					}
+				}
+
+				auto group = pos + 16 + lo * 12;
+
+				if (lo == groups || r.u32(group) > c) {
+					return 0;
+				}
+
+				return static_cast<std::uint16_t>(r.u32(group + 8) + (c - r.u32(group)));
+			}
+
+			return 0;
+		}
+
+		// the Unicode subtable to read: full repertoire (format 12) if there is one, else BMP (format 4)
+		inline bool find_unicode_cmap(const font_reader &r, std::size_t &subtable)
+		{
+			auto count = r.u16(2);
+			std::size_t bmp = 0, full = 0;
+
+			for (std::size_t i = 0; i < count; ++i) {
+				auto platform = r.u16(4 + i * 8);
+				auto encoding = r.u16(6 + i * 8);
+				std::size_t offset = r.u32(8 + i * 8);
+				auto format = r.u16(offset);
+
+				if (r.failed) {
+					return false;
+				}
+
+				if (format == 12 && ((platform == 3 && encoding == 10) || platform == 0)) {
+					full = offset;
+				} else if (format == 4 && ((platform == 3 && encoding == 1) || platform == 0)) {
+					bmp = offset;
+				}
+			}
+
+			subtable = full != 0 ? full : bmp;
+
+			return subtable != 0;
+		}
+
+		// cmap with a format 4 subtable (3, 1) for the BMP, if it fits, and a format 12 subtable (3, 10)
+		inline std::string build_cmap(const std::vector<std::pair<std::uint32_t, std::uint16_t>> &mapping)
+		{
+			// runs of consecutive code points mapped to consecutive glyphs
+			struct run {
+				std::uint32_t first, last;
+				std::uint16_t glyph;
+			};
+
+			std::vector<run> runs;
+
+			for (auto &m : mapping) {
+				if (!runs.empty() && runs.back().last + 1 == m.first
+					&& static_cast<std::uint16_t>(runs.back().glyph + (m.first - runs.back().first)) == m.second)
+				{
+					runs.back().last = m.first;
+				} else {
+					runs.push_back({ m.first, m.first, m.second });
+				}
+			}
+
+			std::string format4;
+			std::vector<run> bmp;
+
+			for (auto &r : runs) {
+				if (r.first <= 0xfffe) {
+					bmp.push_back({ r.first, std::min<std::uint32_t>(r.last, 0xfffe), r.glyph });
+				}
+			}
+
+			// the last segment maps 0xffff to glyph 0
+			bmp.push_back({ 0xffff, 0xffff, 0 });
+
+			if (16 + bmp.size() * 8 <= 0xffff) {
+				auto segments = static_cast<std::uint16_t>(bmp.size());
+				std::uint16_t selector = 0;
+
+				while ((2u << selector) <= segments) {
+					++selector;
+				}
+
+				put16(format4, 4);
+				put16(format4, static_cast<std::uint16_t>(16 + segments * 8));
+				put16(format4, 0);
+				put16(format4, static_cast<std::uint16_t>(segments * 2));
+				put16(format4, static_cast<std::uint16_t>(2u << selector));
+				put16(format4, selector);
+				put16(format4, static_cast<std::uint16_t>(segments * 2 - (2u << selector)));
+
+				for (auto &r : bmp) {
+					put16(format4, static_cast<std::uint16_t>(r.last));
+				}
+
+				put16(format4, 0);
+
+				for (auto &r : bmp) {
+					put16(format4, static_cast<std::uint16_t>(r.first));
+				}
+
+				for (auto &r : bmp) {
+					put16(format4, static_cast<std::uint16_t>(r.glyph - r.first));
+				}
+
+				for (std::size_t i = 0; i < bmp.size(); ++i) {
+					put16(format4, 0);
+				}
+			}
+
+			std::string format12;
+
+			put16(format12, 12);
+			put16(format12, 0);
+			put32(format12, static_cast<std::uint32_t>(16 + runs.size() * 12));
+			put32(format12, 0);
+			put32(format12, static_cast<std::uint32_t>(runs.size()));
+
+			for (auto &r : runs) {
+				put32(format12, r.first);
+				put32(format12, r.last);
+				put32(format12, r.glyph);
+			}
+
+			std::string cmap;
+			auto count = format4.empty() ? 1 : 2;
+			std::uint32_t offset = 4 + 8 * count;
+
+			put16(cmap, 0);
+			put16(cmap, static_cast<std::uint16_t>(count));
+
+			if (!format4.empty()) {
+				put16(cmap, 3);
+				put16(cmap, 1);
+				put32(cmap, offset);
+				offset += static_cast<std::uint32_t>(format4.size());
+			}
+
+			put16(cmap, 3);
+			put16(cmap, 10);
+			put32(cmap, offset);
+
+			return cmap + format4 + format12;
+		}
+
+		// glyphs of a coverage table, in coverage index order
+		inline std::vector<std::uint16_t> read_coverage(const font_reader &r, std::size_t pos)
+		{
+			std::vector<std::uint16_t> glyphs;
+			auto format = r.u16(pos);
+
+			if (format == 1) {
+				auto count = r.u16(pos + 2);
+
+				for (std::size_t i = 0; i < count && !r.failed; ++i) {
+					glyphs.push_back(r.u16(pos + 4 + i * 2));
+				}
+			} else if (format == 2) {
+				auto count = r.u16(pos + 2);
+
+				for (std::size_t i = 0; i < count && !r.failed; ++i) {
+					auto range = pos + 4 + i * 6;
+					auto first = r.u16(range), last = r.u16(range + 2);
+
+					for (std::uint32_t g = first; g <= last; ++g) {
+						glyphs.push_back(static_cast<std::uint16_t>(g));
+					}
+				}
+			}
+
+			return glyphs;
+		}
+
+		// Adds the glyphs that GSUB can substitute for the kept ones (vertical
+		// forms, alternates, ligatures), whatever feature or context uses them.
+		// Returns true if a glyph was added.
+		inline bool close_over_gsub(const std::string &gsub, std::vector<bool> &keep)
+		{
+			font_reader r(gsub);
+			std::size_t lookups = r.u16(8);
+			auto count = r.u16(lookups);
+			auto added = false;
+
+			auto add = [&](std::uint32_t g) {
+				if (g < keep.size() && !keep[g]) {
+					keep[g] = true;
+					added = true;
+				}
+			};
+
+			auto kept = [&](std::uint16_t g) {
+				return g < keep.size() && keep[g];
+			};
+
+			for (std::size_t i = 0; i < count && !r.failed; ++i) {
+				auto lookup = lookups + r.u16(lookups + 2 + i * 2);
+				auto type = r.u16(lookup);
+				auto subtables = r.u16(lookup + 4);
+
+				for (std::size_t j = 0; j < subtables && !r.failed; ++j) {
+					std::size_t sub = lookup + r.u16(lookup + 6 + j * 2);
+					auto sub_type = type;
+
+					if (sub_type == 7) {
+						sub_type = r.u16(sub + 2);
+						sub += r.u32(sub + 4);
+					}
+
+					auto format = r.u16(sub);
+					auto coverage = read_coverage(r, sub + r.u16(sub + 2));
+
+					if (sub_type == 1) {
+						for (std::size_t k = 0; k < coverage.size(); ++k) {
+							if (!kept(coverage[k])) {
+								continue;
+							}
+
+							if (format == 1) {
+								add(static_cast<std::uint16_t>(coverage[k] + r.u16(sub + 4)));
+							} else if (k < r.u16(sub + 4)) {
+								add(r.u16(sub + 6 + k * 2));
+							}
+						}
+					} else if (sub_type == 2 || sub_type == 3) {
+						// sequences and alternate sets have the same layout
+						auto sets = r.u16(sub + 4);
+
+						for (std::size_t k = 0; k < coverage.size() && k < sets; ++k) {
+							if (!kept(coverage[k])) {
+								continue;
+							}
+
+							auto set = sub + r.u16(sub + 6 + k * 2);
+							auto n = r.u16(set);
+
+							for (std::size_t l = 0; l < n && !r.failed; ++l) {
+								add(r.u16(set + 2 + l * 2));
+							}
+						}
+					} else if (sub_type == 4) {
+						auto sets = r.u16(sub + 4);
+
+						for (std::size_t k = 0; k < coverage.size() && k < sets; ++k) {
+							if (!kept(coverage[k])) {
+								continue;
+							}
+
+							auto set = sub + r.u16(sub + 6 + k * 2);
+							auto n = r.u16(set);
+
+							for (std::size_t l = 0; l < n && !r.failed; ++l) {
+								auto ligature = set + r.u16(set + 2 + l * 2);
+								auto components = r.u16(ligature + 2);
+								auto all = true;
+
+								for (std::size_t m = 1; m < components && all && !r.failed; ++m) {
+									all = kept(r.u16(ligature + 4 + (m - 1) * 2));
+								}
+
+								if (all) {
+									add(r.u16(ligature));
+								}
+							}
+						}
+					} else if (sub_type == 8) {
+						auto backtrack = r.u16(sub + 4);
+						auto lookahead_pos = sub + 6 + backtrack * 2;
+						auto lookahead = r.u16(lookahead_pos);
+						auto substitutes = lookahead_pos + 2 + lookahead * 2;
+						auto n = r.u16(substitutes);
+
+						for (std::size_t k = 0; k < coverage.size() && k < n; ++k) {
+							if (kept(coverage[k])) {
+								add(r.u16(substitutes + 2 + k * 2));
+							}
+						}
+					}
+				}
+			}
+
+			return added && !r.failed;
+		}
+
+		// glyph data of glyph g, empty if it has no outline
+		inline std::pair<std::size_t, std::size_t> glyph_range(const font_reader &loca, bool long_offsets, std::size_t g)
+		{
+			if (long_offsets) {
+				return { loca.u32(g * 4), loca.u32(g * 4 + 4) };
+			}
+
+			return { loca.u16(g * 2) * std::size_t(2), loca.u16(g * 2 + 2) * std::size_t(2) };
+		}
+
+		// adds the components of the kept composite glyphs
+		inline void close_over_composites(const std::string &glyf, const font_reader &loca, bool long_offsets, std::vector<bool> &keep)
+		{
+			font_reader r(glyf);
+
+			for (auto changed = true; changed;) {
+				changed = false;
+
+				for (std::size_t g = 0; g < keep.size(); ++g) {
+					if (!keep[g]) {
+						continue;
+					}
+
+					auto range = glyph_range(loca, long_offsets, g);
+
+					if (range.second <= range.first || static_cast<std::int16_t>(r.u16(range.first)) >= 0) {
+						continue;
+					}
+
+					auto pos = range.first + 10;
+					std::uint16_t flags;
+
+					do {
+						flags = r.u16(pos);
+						auto component = r.u16(pos + 2);
+
+						if (r.failed || pos >= range.second) {
+							break;
+						}
+
+						if (component < keep.size() && !keep[component]) {
+							keep[component] = true;
+							changed = true;
+						}
+
+						pos += 4 + ((flags & 0x0001) ? 4 : 2);
+
+						if (flags & 0x0008) {
+							pos += 2;
+						} else if (flags & 0x0040) {
+							pos += 4;
+						} else if (flags & 0x0080) {
+							pos += 8;
+						}
+					} while (flags & 0x0020);
+				}
+			}
+		}
+	}
+
+	// Writes a TrueType font with the glyphs of code_points (and what they need)
+	// to subset. False if the font is not a TrueType or WOFF font with TrueType outlines.
+	inline bool subset_font(const std::string &font, const code_point_set &code_points, std::string &subset)
+	{
+		detail::font_tables tables;
+		std::uint32_t flavor;
+
+		if (!detail::read_font_tables(font, tables, flavor)) {
+			return false;
+		}
+
+		for (auto tag : { "head", "maxp", "loca", "glyf", "cmap" }) {
+			if (tables.count(tag) == 0) {
+				return false;
+			}
+		}
+
+		detail::font_reader head(tables["head"]), maxp(tables["maxp"]), loca(tables["loca"]), cmap(tables["cmap"]);
+		auto long_offsets = head.u16(50) != 0;
+		std::size_t glyph_count = maxp.u16(4);
+		std::size_t subtable;
+
+		if (head.failed || maxp.failed || glyph_count == 0
+			|| loca.size() < (glyph_count + 1) * (long_offsets ? 4 : 2)
+			|| !detail::find_unicode_cmap(cmap, subtable))
+		{
+			return false;
+		}
+
+		std::vector<bool> keep(glyph_count);
+		std::vector<std::pair<std::uint32_t, std::uint16_t>> mapping;
+
+		keep[0] = true;	// .notdef
+
+		for (auto c : code_points) {
+			auto g = detail::cmap_lookup(cmap, subtable, c);
+
+			if (g != 0 && g < glyph_count) {
+				keep[g] = true;
+				mapping.emplace_back(c, g);
+			}
+		}
+
+		if (cmap.failed) {
+			return false;
+		}
+
+		auto gsub = tables.find("GSUB");
+
+		if (gsub != tables.end()) {
+			for (int pass = 0; pass < 8 && detail::close_over_gsub(gsub->second, keep); ++pass) {
+			}
+		}
+
+		auto &glyf = tables["glyf"];
+
+		detail::close_over_composites(glyf, loca, long_offsets, keep);
+
+		std::string new_glyf, new_loca;
+
+		for (std::size_t g = 0; g < glyph_count; ++g) {
+			detail::put32(new_loca, static_cast<std::uint32_t>(new_glyf.size()));
+
+			auto range = detail::glyph_range(loca, long_offsets, g);
+
+			if (keep[g] && range.first < range.second && range.second <= glyf.size()) {
+				new_glyf.append(glyf, range.first, range.second - range.first);
+				new_glyf.append((4 - new_glyf.size() % 4) % 4, '\0');
+			}
+		}
+
+		detail::put32(new_loca, static_cast<std::uint32_t>(new_glyf.size()));
+
+		if (loca.failed) {
+			return false;
+		}
+
+		tables["glyf"] = std::move(new_glyf);
+		tables["loca"] = std::move(new_loca);
+		tables["cmap"] = detail::build_cmap(mapping);
+
+		// loca has 32 bit offsets now; checkSumAdjustment is set by write_font_tables()
+		auto &head_table = tables["head"];
+		head_table[50] = 0;
+		head_table[51] = 1;
+		detail::set32(head_table, 8, 0);
+
+		// the signature is of the original
+		tables.erase("DSIG");
+
+		subset = detail::write_font_tables(flavor == 0x74727565 ? flavor : 0x00010000, tables);
+
+		return true;
+	}
+
+	// Appends the code points of UTF-8 text (and of the numeric character
+	// references in it) to code_points, unsorted.
+	inline void collect_code_points(const std::string &text, code_point_set &code_points)
+	{
+		std::size_t pos = 0;
+		auto size = text.size();
+
+		while (pos < size) {
+			auto c = static_cast<unsigned char>(text[pos]);
+			std::uint32_t value;
+			int extra;
+
+			if (c < 0x80) {
+				value = c;
+				extra = 0;
+			} else if ((c & 0xe0) == 0xc0) {
+				value = c & 0x1f;
+				extra = 1;
+			} else if ((c & 0xf0) == 0xe0) {
+				value = c & 0x0f;
+				extra = 2;
+			} else if ((c & 0xf8) == 0xf0) {
+				value = c & 0x07;
+				extra = 3;
+			} else {
+				++pos;
+				continue;
+			}
+
+			if (pos + extra >= size) {
+				break;
+			}
+
+			auto valid = true;
+
+			for (int i = 1; i <= extra; ++i) {
+				auto b = static_cast<unsigned char>(text[pos + i]);
+
+				if ((b & 0xc0) != 0x80) {
+					valid = false;
+					break;
+				}
+
+				value = (value << 6) | (b & 0x3f);
+			}
+
+			if (!valid) {
+				++pos;
+				continue;
+			}
+
+			pos += extra + 1;
+
+			// &#12354; &#x3042;
+			if (value == '&' && pos < size && text[pos] == '#') {
+				auto hex = pos + 1 < size && (text[pos + 1] == 'x' || text[pos + 1] == 'X');
+				auto end = text.find(';', pos);
+
+				if (end != std::string::npos && end - pos <= 10) {
+					try {
+						code_points.push_back(static_cast<std::uint32_t>(std::stoul(text.substr(pos + (hex ? 2 : 1), end - pos - (hex ? 2 : 1)), nullptr, hex ? 16 : 10)));
+					} catch (std::exception &) {
+					}
+				}
+			}
+
+			code_points.push_back(value);
+		}
+	}
+}
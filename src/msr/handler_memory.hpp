@@ -0,0 +1,79 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Per-connection storage for the handlers of asynchronous operations,
+// so that a connection that loops on read and write does not allocate
+// for every operation. Only one operation at a time can use the block;
+// others fall back to the heap.
+
+namespace msr {
+	class handler_memory {
+		typename std::aligned_storage<256>::type storage_;
+		bool in_use_ = false;
+
+	public:
+		handler_memory() = default;
+		handler_memory(const handler_memory &) = delete;
+		handler_memory &operator=(const handler_memory &) = delete;
+
+		void *allocate(std::size_t size)
+		{
+			if (!in_use_ && size <= sizeof(storage_)) {
+				in_use_ = true;
+				return &storage_;
+			}
+
+			return ::operator new(size);
+		}
+
+		void deallocate(void *pointer)
+		{
+			if (pointer == &storage_) {
+				in_use_ = false;
+			} else {
+				::operator delete(pointer);
+			}
+		}
+	};
+
+	template <typename Handler>
+	class custom_alloc_handler {
+		handler_memory *memory_;
+		Handler handler_;
+
+	public:
+		custom_alloc_handler(handler_memory &memory, Handler handler)
+			: memory_(&memory)
+			, handler_(std::move(handler))
+		{
+		}
+
+		template <typename... Args>
+		void operator()(Args &&... args)
+		{
+			handler_(std::forward<Args>(args)...);
+		}
+
+		friend void *asio_handler_allocate(std::size_t size, custom_alloc_handler<Handler> *self)
+		{
+			return self->memory_->allocate(size);
+		}
+
+		friend void asio_handler_deallocate(void *pointer, std::size_t /* size */, custom_alloc_handler<Handler> *self)
+		{
+			self->memory_->deallocate(pointer);
+		}
+	};
+
+	template <typename Handler>
+	custom_alloc_handler<Handler> make_custom_alloc_handler(handler_memory &memory, Handler handler)
+	{
+		return custom_alloc_handler<Handler>(memory, std::move(handler));
+	}
+}
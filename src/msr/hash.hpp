@@ -0,0 +1,171 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "file_stamp.hpp"
+
+#ifdef MSR_WITH_XXHASH
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#endif
+
+namespace msr {
+	// FNV-1a (64 bit)
+	class fnv1a64 {
+		std::uint64_t value_ = 14695981039346656037ull;
+
+	public:
+		void update(const void *data, std::size_t size)
+		{
+			auto p = static_cast<const unsigned char *>(data);
+
+			for (std::size_t i = 0; i < size; ++i) {
+				value_ ^= p[i];
+				value_ *= 1099511628211ull;
+			}
+		}
+
+		std::uint64_t value() const
+		{
+			return value_;
+		}
+	};
+
+#ifdef MSR_WITH_XXHASH
+	// XXH3 (64 bit)
+	class content_hasher {
+		XXH3_state_t *state_;
+
+	public:
+		// stored with persisted hashes, which are discarded when it changes
+		static const std::uint32_t algorithm = 2;
+
+		content_hasher()
+			: state_(XXH3_createState())
+		{
+			XXH3_64bits_reset(state_);
+		}
+
+		~content_hasher()
+		{
+			XXH3_freeState(state_);
+		}
+
+		content_hasher(const content_hasher &) = delete;
+		content_hasher &operator=(const content_hasher &) = delete;
+
+		void update(const void *data, std::size_t size)
+		{
+			XXH3_64bits_update(state_, data, size);
+		}
+
+		std::uint64_t value() const
+		{
+			return XXH3_64bits_digest(state_);
+		}
+	};
+
+	inline std::uint64_t hash_bytes(const void *data, std::size_t size)
+	{
+		return XXH3_64bits(data, size);
+	}
+#else
+	class content_hasher : public fnv1a64 {
+	public:
+		// stored with persisted hashes, which are discarded when it changes
+		static const std::uint32_t algorithm = 1;
+	};
+
+	inline std::uint64_t hash_bytes(const void *data, std::size_t size)
+	{
+		fnv1a64 h;
+		h.update(data, size);
+		return h.value();
+	}
+#endif
+
+	inline bool hash_file(const boost::filesystem::path &path, std::uint64_t &hash)
+	{
+		boost::filesystem::ifstream ifs(path, std::ios::binary);
+
+		if (!ifs) {
+			return false;
+		}
+
+		content_hasher h;
+		char buffer[65536];
+
+		while (ifs) {
+			ifs.read(buffer, sizeof(buffer));
+			h.update(buffer, static_cast<std::size_t>(ifs.gcount()));
+		}
+
+		hash = h.value();
+
+		return true;
+	}
+
+	inline std::string to_hex(std::uint64_t value)
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string s(16, '0');
+
+		for (int i = 15; i >= 0; --i) {
+			s[i] = digits[value & 0xf];
+			value >>= 4;
+		}
+
+		return s;
+	}
+
+	// Hashes of files, computed once per version (size and mtime).
+	class file_hash_cache {
+		std::mutex mutex_;
+		std::unordered_map<std::string, std::pair<file_stamp, std::uint64_t>> hashes_;
+
+	public:
+		bool find(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t &hash)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = hashes_.find(path.string());
+
+			if (iter == hashes_.end() || iter->second.first != stamp) {
+				return false;
+			}
+
+			hash = iter->second.second;
+
+			return true;
+		}
+
+		void insert(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t hash)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			hashes_[path.string()] = { stamp, hash };
+		}
+
+		// hashes the file if it is not known yet
+		bool get(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t &hash)
+		{
+			if (find(path, stamp, hash)) {
+				return true;
+			}
+
+			if (!hash_file(path, hash)) {
+				return false;
+			}
+
+			insert(path, stamp, hash);
+
+			return true;
+		}
+	};
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "file_stamp.hpp"
+#include "hash.hpp"
+#include "worker_pool.hpp"
+
+namespace msr {
+	// Maps (path, size, mtime) to the content hash of a file.
+	// The table is an open addressing hash table in a memory-mapped file,
+	// so hashes survive restarts and are not computed again for unchanged files.
+	// Without a file the table is kept in memory only.
+	// A damaged or foreign file is discarded; the index is only a cache.
+	class content_hash_index {
+		struct header {
+			char magic[8];
+			std::uint32_t algorithm;
+			std::uint32_t capacity;	// number of records, a power of 2
+			std::uint32_t count;
+			std::uint32_t reserved;
+		};
+
+		struct record {
+			std::uint64_t key;	// hash of the path, 0 for an empty slot
+			std::uint64_t size;
+			std::int64_t mtime;
+			std::uint64_t hash;
+		};
+
+		static const std::uint32_t initial_capacity = 4096;
+
+		boost::filesystem::path file_;
+
+		std::mutex mutex_;
+		boost::interprocess::file_mapping mapping_;
+		boost::interprocess::mapped_region region_;
+		std::vector<char> memory_;
+		header *header_ = nullptr;
+		record *records_ = nullptr;
+
+		std::mutex pending_mutex_;
+		std::unordered_set<std::string> pending_;
+		std::atomic<bool> stopped_{ false };
+
+		// declared last so that the worker is joined before the table is unmapped
+		worker_pool pool_;
+
+		static std::uint64_t path_key(const boost::filesystem::path &path)
+		{
+			auto s = path.generic_string();
+			auto key = hash_bytes(s.data(), s.size());
+
+			return key != 0 ? key : 1;
+		}
+
+		static std::size_t file_size_for(std::uint32_t capacity)
+		{
+			return sizeof(header) + sizeof(record) * static_cast<std::size_t>(capacity);
+		}
+
+		static void initialize(header &h, std::uint32_t capacity)
+		{
+			std::memcpy(h.magic, "MSRHIDX1", 8);
+			h.algorithm = content_hasher::algorithm;
+			h.capacity = capacity;
+			h.count = 0;
+			h.reserved = 0;
+		}
+
+		bool valid(const void *data, std::size_t size) const
+		{
+			if (size < sizeof(header)) {
+				return false;
+			}
+
+			auto h = static_cast<const header *>(data);
+
+			return std::memcmp(h->magic, "MSRHIDX1", 8) == 0
+				&& h->algorithm == content_hasher::algorithm
+				&& h->capacity != 0
+				&& (h->capacity & (h->capacity - 1)) == 0
+				&& size == file_size_for(h->capacity)
+				&& h->count < h->capacity;
+		}
+
+		void unmap()
+		{
+			region_ = boost::interprocess::mapped_region();
+			mapping_ = boost::interprocess::file_mapping();
+			header_ = nullptr;
+			records_ = nullptr;
+		}
+
+		// maps file_ with the given capacity; the file is cleared if it is not a valid index
+		bool map_file(std::uint32_t capacity)
+		{
+			boost::system::error_code error;
+
+			try {
+				auto size = exists(file_, error) ? file_size(file_, error) : 0;
+
+				if (error || size != file_size_for(capacity)) {
+					create_directories(file_.parent_path(), error);
+
+					{
+						boost::filesystem::ofstream ofs(file_, std::ios::binary | std::ios::trunc);
+
+						if (!ofs) {
+							return false;
+						}
+					}
+
+					resize_file(file_, file_size_for(capacity));
+				}
+
+				mapping_ = boost::interprocess::file_mapping(file_.string().c_str(), boost::interprocess::read_write);
+				region_ = boost::interprocess::mapped_region(mapping_, boost::interprocess::read_write);
+			} catch (std::exception &) {
+				unmap();
+				return false;
+			}
+
+			header_ = static_cast<header *>(region_.get_address());
+			records_ = reinterpret_cast<record *>(header_ + 1);
+
+			if (!valid(header_, region_.get_size()) || header_->capacity != capacity) {
+				std::memset(region_.get_address(), 0, region_.get_size());
+				initialize(*header_, capacity);
+			}
+
+			return true;
+		}
+
+		void allocate_memory(std::uint32_t capacity)
+		{
+			memory_.assign(file_size_for(capacity), 0);
+			header_ = reinterpret_cast<header *>(memory_.data());
+			records_ = reinterpret_cast<record *>(header_ + 1);
+			initialize(*header_, capacity);
+		}
+
+		void open()
+		{
+			if (!file_.empty()) {
+				boost::system::error_code error;
+				auto size = exists(file_, error) ? file_size(file_, error) : 0;
+				auto capacity = initial_capacity;
+
+				if (!error && size > sizeof(header)) {
+					auto records = (size - sizeof(header)) / sizeof(record);
+
+					if (records >= initial_capacity && records <= 0x80000000u) {
+						capacity = static_cast<std::uint32_t>(records);
+					}
+				}
+
+				if (map_file(capacity)) {
+					return;
+				}
+
+				file_.clear();
+			}
+
+			allocate_memory(initial_capacity);
+		}
+
+		record *find_slot(std::uint64_t key)
+		{
+			auto mask = header_->capacity - 1;
+
+			for (auto i = static_cast<std::uint32_t>(key) & mask;; i = (i + 1) & mask) {
+				if (records_[i].key == key || records_[i].key == 0) {
+					return &records_[i];
+				}
+			}
+		}
+
+		// doubles the table; the mutex is held
+		void grow()
+		{
+			std::vector<record> live;
+
+			for (std::uint32_t i = 0; i < header_->capacity; ++i) {
+				if (records_[i].key != 0) {
+					live.push_back(records_[i]);
+				}
+			}
+
+			auto capacity = header_->capacity * 2;
+
+			if (!file_.empty()) {
+				unmap();
+
+				boost::system::error_code error;
+				resize_file(file_, file_size_for(capacity), error);
+
+				if (error || !map_file(capacity)) {
+					file_.clear();
+					allocate_memory(capacity);
+				}
+			} else {
+				allocate_memory(capacity);
+			}
+
+			// map_file keeps a valid header, but the old records are in the wrong slots
+			std::memset(records_, 0, sizeof(record) * capacity);
+			initialize(*header_, capacity);
+
+			for (auto &r : live) {
+				*find_slot(r.key) = r;
+				++header_->count;
+			}
+		}
+
+	public:
+		// file: where the index is kept; empty for an index in memory
+		explicit content_hash_index(const boost::filesystem::path &file = boost::filesystem::path())
+			: file_(file)
+			, pool_(1)
+		{
+			open();
+		}
+
+		~content_hash_index()
+		{
+			stop();
+		}
+
+		content_hash_index(const content_hash_index &) = delete;
+		content_hash_index &operator=(const content_hash_index &) = delete;
+
+		bool find(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t &hash)
+		{
+			auto key = path_key(path);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto r = find_slot(key);
+
+			if (r->key != key || r->size != stamp.size || r->mtime != static_cast<std::int64_t>(stamp.mtime)) {
+				return false;
+			}
+
+			hash = r->hash;
+
+			return true;
+		}
+
+		void insert(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t hash)
+		{
+			auto key = path_key(path);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto r = find_slot(key);
+
+			if (r->key == 0) {
+				if ((header_->count + 1) * 4 > header_->capacity * 3) {
+					grow();
+					r = find_slot(key);
+				}
+
+				++header_->count;
+			}
+
+			r->size = stamp.size;
+			r->mtime = stamp.mtime;
+			r->hash = hash;
+			r->key = key;
+		}
+
+		// Hashes the file if it is not known yet. Blocks; see hash_in_background().
+		bool get(const boost::filesystem::path &path, const file_stamp &stamp, std::uint64_t &hash)
+		{
+			if (find(path, stamp, hash)) {
+				return true;
+			}
+
+			if (!hash_file(path, hash)) {
+				return false;
+			}
+
+			insert(path, stamp, hash);
+
+			return true;
+		}
+
+		// queues the file to be hashed on the worker of the index
+		void hash_in_background(const boost::filesystem::path &path)
+		{
+			{
+				std::lock_guard<std::mutex> lock(pending_mutex_);
+
+				if (stopped_ || !pending_.insert(path.string()).second) {
+					return;
+				}
+			}
+
+			pool_.post([this, path]() {
+				file_stamp stamp;
+				std::uint64_t hash;
+
+				if (!stopped_ && get_file_stamp(path, stamp)) {
+					get(path, stamp, hash);
+				}
+
+				std::lock_guard<std::mutex> lock(pending_mutex_);
+				pending_.erase(path.string());
+			});
+		}
+
+		// drops queued work and writes the table back
+		void stop()
+		{
+			stopped_ = true;
+			pool_.stop();
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (!file_.empty() && header_ != nullptr) {
+				region_.flush();
+			}
+		}
+	};
+}
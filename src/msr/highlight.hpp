@@ -0,0 +1,1242 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "hash.hpp"
+#include "html.hpp"
+#include "lru_cache.hpp"
+#include "worker_pool.hpp"
+
+// Syntax highlighting of <pre><code class="language-x"> blocks at serve time,
+// so that highlight.js has nothing to do in the renderer. The markup uses the
+// class names of highlight.js (hljs-keyword, hljs-string...), so the theme
+// the deck already loads applies. Highlighted blocks get class="hljs nohighlight"
+// (highlight.js skips them, the reveal.js plugin still adds line numbers) and
+// data-noescape (the plugin would escape the markup otherwise).
+
+namespace msr {
+	struct highlight_options {
+		bool enabled = false;
+
+		// 0 for one per core but one
+		std::size_t threads = 0;
+
+		// larger blocks are left to highlight.js
+		std::size_t max_block_size = 64 * 1024;
+	};
+
+	struct highlight_language {
+		enum syntax_type {
+			code,
+			markup,	// XML, HTML, SVG
+			style	// CSS, SCSS, Less
+		};
+
+		std::string name;
+		std::vector<std::string> aliases;
+		syntax_type syntax = code;
+
+		std::vector<std::string> line_comments;
+		std::string block_comment_open;
+		std::string block_comment_close;
+
+		// string delimiters; strings end at the end of the line unless the
+		// delimiter is in multiline_quotes
+		std::string quotes;
+		std::string multiline_quotes;
+		bool triple_quotes = false;	// Python """ and '''
+
+		bool preprocessor = false;	// '#' at the start of a line (C family)
+		bool decorators = false;	// @name
+		bool variables = false;	// $name, ${name}
+		bool lifetimes = false;	// Rust 'a is not a character
+		bool keys = false;	// name: and "name": are attributes (JSON, YAML)
+		bool case_insensitive = false;	// keywords (SQL)
+
+		// characters of identifiers besides letters, digits and '_'
+		std::string identifier_chars;
+
+		std::unordered_set<std::string> keywords;
+		std::unordered_set<std::string> built_ins;
+		std::unordered_set<std::string> literals;
+
+		// keywords after which an identifier is the name being defined
+		std::unordered_set<std::string> definitions;
+	};
+
+	namespace detail {
+		inline std::unordered_set<std::string> word_set(const char *words)
+		{
+			std::unordered_set<std::string> set;
+			std::istringstream iss(words);
+			std::string w;
+
+			while (iss >> w) {
+				set.insert(w);
+			}
+
+			return set;
+		}
+
+		inline std::vector<highlight_language> make_highlight_languages()
+		{
+			std::vector<highlight_language> languages;
+
+			auto c_like = [](const char *name, std::vector<std::string> aliases) {
+				highlight_language l;
+
+				l.name = name;
+				l.aliases = std::move(aliases);
+				l.line_comments = { "//" };
+				l.block_comment_open = "/*";
+				l.block_comment_close = "*/";
+				l.quotes = "\"'";
+				l.literals = word_set("true false null");
+
+				return l;
+			};
+
+			{
+				auto l = c_like("c", { "c", "h" });
+				l.preprocessor = true;
+				l.keywords = word_set(
+					"auto break case char const continue default do double else enum extern float for goto if "
+					"inline int long register restrict return short signed sizeof static struct switch typedef "
+					"union unsigned void volatile while _Bool _Complex _Atomic _Static_assert");
+				l.built_ins = word_set("printf fprintf sprintf snprintf malloc calloc realloc free memcpy memset strlen size_t FILE");
+				l.literals = word_set("true false NULL");
+				l.definitions = word_set("struct union enum");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				auto l = c_like("cpp", { "cpp", "c++", "cc", "cxx", "hpp", "hh", "hxx" });
+				l.preprocessor = true;
+				l.keywords = word_set(
+					"alignas alignof asm auto bool break case catch char char8_t char16_t char32_t class concept const "
+					"consteval constexpr constinit const_cast continue co_await co_return co_yield decltype default "
+					"delete do double dynamic_cast else enum explicit export extern final float for friend goto if "
+					"inline int long mutable namespace new noexcept operator override private protected public "
+					"register reinterpret_cast requires return short signed sizeof static static_assert static_cast "
+					"struct switch template this thread_local throw try typedef typeid typename union unsigned using "
+					"virtual void volatile wchar_t while");
+				l.built_ins = word_set(
+					"std string wstring vector map unordered_map set unordered_set list deque array pair tuple "
+					"shared_ptr unique_ptr weak_ptr make_shared make_unique optional variant function thread mutex "
+					"size_t int8_t int16_t int32_t int64_t uint8_t uint16_t uint32_t uint64_t cout cin cerr endl "
+					"move forward printf");
+				l.literals = word_set("true false nullptr NULL");
+				l.definitions = word_set("class struct union enum namespace concept");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				auto l = c_like("csharp", { "csharp", "cs", "c#" });
+				l.preprocessor = true;
+				l.keywords = word_set(
+					"abstract as async await base bool break byte case catch char checked class const continue "
+					"decimal default delegate do double else enum event explicit extern finally fixed float for "
+					"foreach get goto if implicit in init int interface internal is lock long namespace new object "
+					"operator out override params private protected public readonly record ref return sbyte sealed "
+					"set short sizeof stackalloc static string struct switch this throw try typeof uint ulong "
+					"unchecked unsafe ushort using var virtual void volatile when where while yield");
+				l.built_ins = word_set("Console Task List Dictionary String Math Exception");
+				l.definitions = word_set("class struct interface enum record namespace");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				auto l = c_like("java", { "java", "jsp" });
+				l.decorators = true;
+				l.keywords = word_set(
+					"abstract assert boolean break byte case catch char class const continue default do double "
+					"else enum extends final finally float for goto if implements import instanceof int interface "
+					"long native new package private protected public record return short static strictfp super "
+					"switch synchronized this throw throws transient try var void volatile while yield");
+				l.built_ins = word_set("String System Object Integer Long Double Boolean List Map ArrayList HashMap Math");
+				l.definitions = word_set("class interface enum record extends implements");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				auto l = c_like("javascript", { "javascript", "js", "jsx", "mjs", "cjs" });
+				l.quotes = "\"'`";
+				l.multiline_quotes = "`";
+				l.identifier_chars = "$";
+				l.keywords = word_set(
+					"as async await break case catch class const continue debugger default delete do else export "
+					"extends finally for from function get if import in instanceof let new of return set static "
+					"super switch this throw try typeof var void while with yield");
+				l.built_ins = word_set(
+					"Array Boolean Date Error JSON Map Math Number Object Promise Proxy Reflect RegExp Set String "
+					"Symbol WeakMap WeakSet console document window globalThis require module exports");
+				l.literals = word_set("true false null undefined NaN Infinity");
+				l.definitions = word_set("class function extends");
+				languages.push_back(l);
+
+				l.name = "typescript";
+				l.aliases = { "typescript", "ts", "tsx", "mts" };
+				l.decorators = true;
+				l.keywords.insert({ "abstract", "any", "boolean", "declare", "enum", "implements", "interface",
+					"keyof", "namespace", "never", "number", "private", "protected", "public", "readonly",
+					"string", "type", "unknown", "is", "asserts", "infer", "satisfies" });
+				l.definitions.insert({ "interface", "type", "enum", "namespace", "implements" });
+				languages.push_back(std::move(l));
+			}
+
+			{
+				auto l = c_like("go", { "go", "golang" });
+				l.quotes = "\"'`";
+				l.multiline_quotes = "`";
+				l.keywords = word_set(
+					"break case chan const continue default defer else fallthrough for func go goto if import "
+					"interface map package range return select struct switch type var");
+				l.built_ins = word_set(
+					"append cap close complex copy delete imag len make new panic print println real recover "
+					"bool byte complex64 complex128 error float32 float64 int int8 int16 int32 int64 rune string "
+					"uint uint8 uint16 uint32 uint64 uintptr any");
+				l.literals = word_set("true false nil iota");
+				l.definitions = word_set("func type");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				auto l = c_like("rust", { "rust", "rs" });
+				l.lifetimes = true;
+				l.keywords = word_set(
+					"as async await break const continue crate dyn else enum extern fn for if impl in let loop "
+					"match mod move mut pub ref return self Self static struct super trait type union unsafe use "
+					"where while");
+				l.built_ins = word_set(
+					"i8 i16 i32 i64 i128 isize u8 u16 u32 u64 u128 usize f32 f64 bool char str String Vec Option "
+					"Result Box Rc Arc Some None Ok Err println print format vec panic assert assert_eq");
+				l.literals = word_set("true false");
+				l.definitions = word_set("fn struct enum trait mod type union impl");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "python";
+				l.aliases = { "python", "py", "python3", "gyp" };
+				l.line_comments = { "#" };
+				l.quotes = "\"'";
+				l.triple_quotes = true;
+				l.decorators = true;
+				l.keywords = word_set(
+					"and as assert async await break class continue def del elif else except finally for from "
+					"global if import in is lambda nonlocal not or pass raise return try while with yield match case");
+				l.built_ins = word_set(
+					"abs all any bool bytes dict enumerate filter float format getattr hasattr input int isinstance "
+					"iter len list map max min next object open print range repr reversed round set setattr sorted "
+					"str sum super tuple type zip self cls");
+				l.literals = word_set("True False None");
+				l.definitions = word_set("def class");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "ruby";
+				l.aliases = { "ruby", "rb" };
+				l.line_comments = { "#" };
+				l.quotes = "\"'";
+				l.identifier_chars = "?!";
+				l.keywords = word_set(
+					"alias and begin break case class def defined? do else elsif end ensure for if in module next "
+					"not or redo rescue retry return self super then undef unless until when while yield");
+				l.built_ins = word_set("puts print require require_relative attr_accessor attr_reader attr_writer include extend raise");
+				l.literals = word_set("true false nil");
+				l.definitions = word_set("def class module");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "bash";
+				l.aliases = { "bash", "sh", "shell", "zsh" };
+				l.line_comments = { "#" };
+				l.quotes = "\"'";
+				l.multiline_quotes = "\"'";
+				l.variables = true;
+				l.identifier_chars = "-";
+				l.keywords = word_set("if then else elif fi for while until do done case esac in function select return local export");
+				l.built_ins = word_set(
+					"echo printf cd pwd ls cat grep sed awk find xargs sort uniq head tail cp mv rm mkdir chmod "
+					"chown source alias set unset read test exit sudo git make cmake curl");
+				l.literals = word_set("true false");
+				l.definitions = word_set("function");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "sql";
+				l.aliases = { "sql", "mysql", "pgsql", "postgresql", "sqlite" };
+				l.line_comments = { "--" };
+				l.block_comment_open = "/*";
+				l.block_comment_close = "*/";
+				l.quotes = "'\"";
+				l.case_insensitive = true;
+				l.keywords = word_set(
+					"add all alter and as asc begin between by case check column commit constraint create cross "
+					"database default delete desc distinct drop else end exists foreign from full group having if in "
+					"index inner insert into is join key left like limit not null offset on or order outer primary "
+					"references right rollback select set table then transaction union unique update values view "
+					"when where with");
+				l.built_ins = word_set(
+					"count sum avg min max coalesce cast char varchar text int integer bigint smallint decimal "
+					"numeric float real date time timestamp boolean");
+				l.literals = word_set("true false");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "json";
+				l.aliases = { "json", "jsonc" };
+				l.line_comments = { "//" };
+				l.block_comment_open = "/*";
+				l.block_comment_close = "*/";
+				l.quotes = "\"";
+				l.keys = true;
+				l.literals = word_set("true false null");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "yaml";
+				l.aliases = { "yaml", "yml" };
+				l.line_comments = { "#" };
+				l.quotes = "\"'";
+				l.keys = true;
+				l.identifier_chars = "-.";
+				l.literals = word_set("true false null yes no on off");
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "css";
+				l.aliases = { "css", "scss", "less" };
+				l.syntax = highlight_language::style;
+				l.block_comment_open = "/*";
+				l.block_comment_close = "*/";
+				l.quotes = "\"'";
+				languages.push_back(std::move(l));
+			}
+
+			{
+				highlight_language l;
+
+				l.name = "xml";
+				l.aliases = { "xml", "html", "xhtml", "svg", "rss", "atom", "xsl", "plist", "vue" };
+				l.syntax = highlight_language::markup;
+				l.quotes = "\"'";
+				languages.push_back(std::move(l));
+			}
+
+			return languages;
+		}
+
+		inline void append_escaped_html(std::string &out, const char *data, std::size_t size)
+		{
+			for (std::size_t i = 0; i < size; ++i) {
+				switch (data[i]) {
+				case '&':
+					out += "&amp;";
+					break;
+
+				case '<':
+					out += "&lt;";
+					break;
+
+				case '>':
+					out += "&gt;";
+					break;
+
+				default:
+					out += data[i];
+					break;
+				}
+			}
+		}
+
+		// what data-trim does in the reveal.js highlight plugin: blank lines at
+		// both ends are removed and so is the indentation common to all lines
+		inline std::string trim_code(const std::string &code)
+		{
+			std::vector<std::string> lines;
+			std::size_t pos = 0;
+
+			for (;;) {
+				auto eol = code.find('\n', pos);
+				lines.push_back(code.substr(pos, eol == std::string::npos ? std::string::npos : eol - pos));
+
+				if (eol == std::string::npos) {
+					break;
+				}
+
+				pos = eol + 1;
+			}
+
+			auto blank = [](const std::string &line) {
+				return std::all_of(line.begin(), line.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; });
+			};
+
+			while (!lines.empty() && blank(lines.front())) {
+				lines.erase(lines.begin());
+			}
+
+			while (!lines.empty() && blank(lines.back())) {
+				lines.pop_back();
+			}
+
+			auto pad = std::string::npos;
+
+			for (auto &line : lines) {
+				if (!blank(line)) {
+					auto indent = line.find_first_not_of(" \t\r\f\v");
+					pad = std::min(pad, indent);
+				}
+			}
+
+			std::string trimmed;
+
+			for (std::size_t i = 0; i < lines.size(); ++i) {
+				if (i > 0) {
+					trimmed += '\n';
+				}
+
+				if (pad != std::string::npos && lines[i].size() > pad) {
+					trimmed.append(lines[i], pad, std::string::npos);
+				}
+			}
+
+			return trimmed;
+		}
+
+		// Tokenizer writing highlighted markup for one block.
+		class highlighter {
+			const highlight_language &language_;
+			const std::string &code_;
+			std::string &out_;
+			std::size_t pos_ = 0;
+
+			// the last keyword was one of language_.definitions
+			bool definition_ = false;
+
+			bool at(const std::string &s, std::size_t pos) const
+			{
+				return !s.empty() && code_.compare(pos, s.size(), s) == 0;
+			}
+
+			bool identifier_start(char c) const
+			{
+				return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80
+					|| (c == '$' && language_.identifier_chars.find('$') != std::string::npos);
+			}
+
+			bool identifier_char(char c) const
+			{
+				return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80
+					|| language_.identifier_chars.find(c) != std::string::npos;
+			}
+
+			bool line_start(std::size_t pos) const
+			{
+				while (pos > 0 && (code_[pos - 1] == ' ' || code_[pos - 1] == '\t')) {
+					--pos;
+				}
+
+				return pos == 0 || code_[pos - 1] == '\n';
+			}
+
+			void plain(std::size_t begin, std::size_t end)
+			{
+				append_escaped_html(out_, code_.data() + begin, end - begin);
+			}
+
+			void span(const char *type, std::size_t begin, std::size_t end)
+			{
+				if (end <= begin) {
+					return;
+				}
+
+				out_ += "<span class=\"hljs-";
+				out_ += type;
+				out_ += "\">";
+				plain(begin, end);
+				out_ += "</span>";
+			}
+
+			std::size_t line_end(std::size_t pos) const
+			{
+				auto eol = code_.find('\n', pos);
+				return eol == std::string::npos ? code_.size() : eol;
+			}
+
+			// the end of a string starting at pos (the opening delimiter)
+			std::size_t string_end(std::size_t pos) const
+			{
+				if (language_.triple_quotes && pos + 2 < code_.size() && code_[pos + 1] == code_[pos] && code_[pos + 2] == code_[pos]) {
+					auto close = code_.find(code_.substr(pos, 3), pos + 3);
+					return close == std::string::npos ? code_.size() : close + 3;
+				}
+
+				auto quote = code_[pos];
+				auto multiline = language_.multiline_quotes.find(quote) != std::string::npos;
+
+				for (auto i = pos + 1; i < code_.size(); ++i) {
+					// no escapes in single quotes in shells
+					if (code_[i] == '\\' && !(language_.variables && quote == '\'')) {
+						++i;
+					} else if (code_[i] == quote) {
+						return i + 1;
+					} else if (code_[i] == '\n' && !multiline) {
+						return i;
+					}
+				}
+
+				return code_.size();
+			}
+
+			std::size_t number_end(std::size_t pos) const
+			{
+				auto i = pos;
+
+				while (i < code_.size()) {
+					auto c = code_[i];
+
+					if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '\'') {
+						// an exponent may be signed
+						if ((c == 'e' || c == 'E' || c == 'p' || c == 'P') && i + 1 < code_.size() && (code_[i + 1] == '+' || code_[i + 1] == '-')) {
+							++i;
+						}
+
+						// a member access (1..2, 1.toString) is not part of the number
+						if (c == '.' && (i + 1 >= code_.size() || !std::isdigit(static_cast<unsigned char>(code_[i + 1])))) {
+							break;
+						}
+
+						// a digit separator only between digits (C++ 1'000), not a Rust lifetime
+						if (c == '\'' && (i + 1 >= code_.size() || !std::isxdigit(static_cast<unsigned char>(code_[i + 1])))) {
+							break;
+						}
+
+						++i;
+					} else {
+						break;
+					}
+				}
+
+				return i;
+			}
+
+			bool is_word(const std::unordered_set<std::string> &set, const std::string &word) const
+			{
+				if (!language_.case_insensitive) {
+					return set.count(word) != 0;
+				}
+
+				auto lower = word;
+				std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return detail::to_lower_ascii(c); });
+
+				return set.count(lower) != 0;
+			}
+
+			// whether a key ends at pos (optional spaces, then ':' not followed by another ':')
+			bool followed_by_colon(std::size_t pos) const
+			{
+				while (pos < code_.size() && (code_[pos] == ' ' || code_[pos] == '\t')) {
+					++pos;
+				}
+
+				return pos < code_.size() && code_[pos] == ':' && (pos + 1 >= code_.size() || code_[pos + 1] != ':');
+			}
+
+			void word(std::size_t begin, std::size_t end)
+			{
+				auto w = code_.substr(begin, end - begin);
+
+				if (definition_) {
+					definition_ = false;
+
+					if (!is_word(language_.keywords, w)) {
+						span("title", begin, end);
+						return;
+					}
+				}
+
+				if (language_.keys && followed_by_colon(end)) {
+					span("attr", begin, end);
+				} else if (is_word(language_.keywords, w)) {
+					span("keyword", begin, end);
+					definition_ = is_word(language_.definitions, w);
+				} else if (is_word(language_.literals, w)) {
+					span("literal", begin, end);
+				} else if (is_word(language_.built_ins, w)) {
+					span("built_in", begin, end);
+				} else {
+					plain(begin, end);
+				}
+			}
+
+			void highlight_code()
+			{
+				auto &l = language_;
+				auto size = code_.size();
+				std::size_t text = 0;
+
+				auto flush = [&]() {
+					plain(text, pos_);
+				};
+
+				while (pos_ < size) {
+					auto c = code_[pos_];
+					auto prev = pos_ > 0 ? code_[pos_ - 1] : '\n';
+					std::size_t end = 0;
+					const char *type = nullptr;
+
+					if (l.preprocessor && c == '#' && line_start(pos_)) {
+						end = line_end(pos_);
+
+						// continued lines
+						while (end < size && end > pos_ && code_[end - (code_[end - 1] == '\r' ? 2 : 1)] == '\\') {
+							end = line_end(end + 1);
+						}
+
+						type = "meta";
+					} else if (at(l.block_comment_open, pos_)) {
+						auto close = code_.find(l.block_comment_close, pos_ + l.block_comment_open.size());
+						end = close == std::string::npos ? size : close + l.block_comment_close.size();
+						type = "comment";
+					} else if (std::any_of(l.line_comments.begin(), l.line_comments.end(), [&](const std::string &s) { return at(s, pos_); })
+						// '#' inside a word is not a comment in shells ($#, a#b)
+						&& (c != '#' || !l.variables || std::isspace(static_cast<unsigned char>(prev))))
+					{
+						end = line_end(pos_);
+						type = "comment";
+					} else if (l.quotes.find(c) != std::string::npos
+						&& !(l.lifetimes && c == '\'' && !(pos_ + 2 < size && (code_[pos_ + 1] == '\\' || code_[pos_ + 2] == '\''))))
+					{
+						end = string_end(pos_);
+						type = l.keys && followed_by_colon(end) ? "attr" : "string";
+					} else if (l.decorators && c == '@' && pos_ + 1 < size && identifier_start(code_[pos_ + 1])) {
+						end = pos_ + 1;
+
+						while (end < size && (identifier_char(code_[end]) || code_[end] == '.')) {
+							++end;
+						}
+
+						type = "meta";
+					} else if (l.variables && c == '$' && pos_ + 1 < size && (code_[pos_ + 1] == '{' || identifier_start(code_[pos_ + 1]) || std::isdigit(static_cast<unsigned char>(code_[pos_ + 1])))) {
+						if (code_[pos_ + 1] == '{') {
+							auto close = code_.find('}', pos_ + 2);
+							end = close == std::string::npos ? size : close + 1;
+						} else {
+							end = pos_ + 1;
+
+							while (end < size && (std::isalnum(static_cast<unsigned char>(code_[end])) || code_[end] == '_')) {
+								++end;
+							}
+						}
+
+						type = "variable";
+					} else if (!identifier_char(prev) && (std::isdigit(static_cast<unsigned char>(c))
+						|| (c == '.' && pos_ + 1 < size && std::isdigit(static_cast<unsigned char>(code_[pos_ + 1])))))
+					{
+						end = number_end(pos_);
+						type = "number";
+					} else if (identifier_start(c) && !identifier_char(prev)) {
+						end = pos_ + 1;
+
+						while (end < size && identifier_char(code_[end])) {
+							++end;
+						}
+
+						flush();
+						word(pos_, end);
+						pos_ = text = end;
+						continue;
+					}
+
+					if (type == nullptr) {
+						++pos_;
+						continue;
+					}
+
+					flush();
+					span(type, pos_, end);
+					pos_ = text = end;
+				}
+
+				flush();
+			}
+
+			void highlight_style()
+			{
+				auto size = code_.size();
+				std::size_t text = 0;
+				unsigned depth = 0;
+
+				// after the ':' of a declaration
+				auto value = false;
+
+				auto flush = [&]() {
+					plain(text, pos_);
+				};
+
+				auto word_char = [](char c) {
+					return std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+				};
+
+				auto word_end = [&](std::size_t i) {
+					while (i < size && word_char(code_[i])) {
+						++i;
+					}
+
+					return i;
+				};
+
+				// name: value; inside a rule, unless a '{' comes first (a nested rule)
+				auto declaration = [&]() {
+					auto next = code_.find_first_of(";{}", pos_);
+					return depth > 0 && (next == std::string::npos || code_[next] != '{');
+				};
+
+				while (pos_ < size) {
+					auto c = code_[pos_];
+					auto next = pos_ + 1 < size ? code_[pos_ + 1] : '\0';
+					auto prev = pos_ > 0 ? code_[pos_ - 1] : '\n';
+					std::size_t end = 0;
+					const char *type = nullptr;
+
+					if (at(language_.block_comment_open, pos_)) {
+						auto close = code_.find(language_.block_comment_close, pos_ + 2);
+						end = close == std::string::npos ? size : close + 2;
+						type = "comment";
+					} else if (c == '/' && next == '/' && prev != ':') {
+						// SCSS and Less; not url(http://...)
+						end = line_end(pos_);
+						type = "comment";
+					} else if (c == '"' || c == '\'') {
+						end = string_end(pos_);
+						type = "string";
+					} else if (c == '{' || c == '}' || c == ';') {
+						if (c == '{') {
+							++depth;
+						} else if (c == '}' && depth > 0) {
+							--depth;
+						}
+
+						value = false;
+					} else if (word_char(c) && word_char(prev)) {
+						// the rest of a word
+					} else if (value) {
+						if (std::isdigit(static_cast<unsigned char>(c))
+							|| (c == '#' && std::isxdigit(static_cast<unsigned char>(next)))
+							|| ((c == '-' || c == '.') && std::isdigit(static_cast<unsigned char>(next))))
+						{
+							end = pos_ + 1;
+
+							while (end < size && (std::isalnum(static_cast<unsigned char>(code_[end])) || code_[end] == '.' || code_[end] == '%')) {
+								++end;
+							}
+
+							type = "number";
+						}
+					} else if (c == '@' && std::isalpha(static_cast<unsigned char>(next))) {
+						end = word_end(pos_ + 1);
+						type = "keyword";
+					} else if (declaration()) {
+						if (c == ':') {
+							value = true;
+						} else if (std::isalpha(static_cast<unsigned char>(c)) || c == '-' || c == '_') {
+							end = word_end(pos_);
+							type = "attribute";
+						}
+					} else if ((c == '.' || c == '#') && (std::isalpha(static_cast<unsigned char>(next)) || next == '-' || next == '_')) {
+						end = word_end(pos_ + 1);
+						type = c == '.' ? "selector-class" : "selector-id";
+					} else if (c == ':') {
+						auto begin = next == ':' ? pos_ + 2 : pos_ + 1;
+
+						if (begin < size && std::isalpha(static_cast<unsigned char>(code_[begin]))) {
+							end = word_end(begin);
+							type = "selector-pseudo";
+						}
+					} else if (std::isalpha(static_cast<unsigned char>(c))) {
+						end = word_end(pos_);
+						type = "selector-tag";
+					}
+
+					if (type == nullptr) {
+						++pos_;
+						continue;
+					}
+
+					flush();
+					span(type, pos_, end);
+					pos_ = text = end;
+				}
+
+				flush();
+			}
+
+			void highlight_markup()
+			{
+				auto size = code_.size();
+				std::size_t text = 0;
+
+				auto flush = [&]() {
+					plain(text, pos_);
+				};
+
+				while (pos_ < size) {
+					if (code_.compare(pos_, 4, "<!--") == 0) {
+						auto close = code_.find("-->", pos_ + 4);
+						auto end = close == std::string::npos ? size : close + 3;
+
+						flush();
+						span("comment", pos_, end);
+						pos_ = text = end;
+						continue;
+					}
+
+					if (code_[pos_] != '<' || pos_ + 1 >= size
+						|| !(std::isalpha(static_cast<unsigned char>(code_[pos_ + 1])) || code_[pos_ + 1] == '/' || code_[pos_ + 1] == '!' || code_[pos_ + 1] == '?'))
+					{
+						++pos_;
+						continue;
+					}
+
+					flush();
+
+					auto meta = code_[pos_ + 1] == '!' || code_[pos_ + 1] == '?';
+					auto i = pos_ + (code_[pos_ + 1] == '/' ? 2 : 1);
+					auto name_begin = i;
+
+					while (i < size && !std::isspace(static_cast<unsigned char>(code_[i])) && code_[i] != '>' && code_[i] != '/') {
+						++i;
+					}
+
+					if (meta) {
+						auto close = code_.find('>', i);
+						auto end = close == std::string::npos ? size : close + 1;
+
+						span("meta", pos_, end);
+						pos_ = text = end;
+						continue;
+					}
+
+					out_ += "<span class=\"hljs-tag\">";
+					plain(pos_, name_begin);
+					span("name", name_begin, i);
+
+					// attributes
+					while (i < size && code_[i] != '>') {
+						auto c = code_[i];
+
+						if (std::isspace(static_cast<unsigned char>(c)) || c == '/' || c == '=') {
+							plain(i, i + 1);
+							++i;
+						} else if (c == '"' || c == '\'') {
+							auto close = code_.find(c, i + 1);
+							auto end = close == std::string::npos ? size : close + 1;
+
+							span("string", i, end);
+							i = end;
+						} else {
+							auto begin = i;
+
+							while (i < size && !std::isspace(static_cast<unsigned char>(code_[i])) && code_[i] != '=' && code_[i] != '>' && code_[i] != '/') {
+								++i;
+							}
+
+							span(begin > 0 && code_[begin - 1] == '=' ? "string" : "attr", begin, i);
+						}
+					}
+
+					if (i < size) {
+						plain(i, i + 1);
+						++i;
+					}
+
+					out_ += "</span>";
+					pos_ = text = i;
+				}
+
+				flush();
+			}
+
+		public:
+			highlighter(const highlight_language &language, const std::string &code, std::string &out)
+				: language_(language)
+				, code_(code)
+				, out_(out)
+			{
+			}
+
+			void run()
+			{
+				switch (language_.syntax) {
+				case highlight_language::markup:
+					highlight_markup();
+					break;
+
+				case highlight_language::style:
+					highlight_style();
+					break;
+
+				default:
+					highlight_code();
+					break;
+				}
+			}
+		};
+	}
+
+	// the language of a class name (cpp, js, language-python...), or nullptr
+	inline const highlight_language *find_highlight_language(std::string name)
+	{
+		static const auto languages = detail::make_highlight_languages();
+
+		std::transform(name.begin(), name.end(), name.begin(), [](char c) { return detail::to_lower_ascii(c); });
+
+		for (auto &l : languages) {
+			if (std::find(l.aliases.begin(), l.aliases.end(), name) != l.aliases.end()) {
+				return &l;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// code as highlighted markup
+	inline std::string highlight_code(const highlight_language &language, const std::string &code)
+	{
+		std::string out;
+		out.reserve(code.size() * 2);
+
+		detail::highlighter(language, code, out).run();
+
+		return out;
+	}
+
+	// Pages and fragments with their code blocks highlighted. Blocks are cached
+	// by the hash of their language and text, so a page that changes is
+	// highlighted again only where its code did; the blocks of a page are
+	// highlighted in parallel on a pool of workers.
+	class highlight_cache {
+		// bump when the output of the highlighter changes
+		static const int version = 1;
+
+		struct block {
+			std::size_t begin;	// '<' of <code>
+			std::size_t end;	// after </code>
+			const highlight_language *language;
+			std::string open_tag;	// the <code> tag to write
+			std::string text;
+			std::uint64_t hash;
+			std::shared_ptr<const std::string> markup;
+		};
+
+		highlight_options options_;
+		worker_pool pool_;
+		lru_cache<std::uint64_t, std::string> blocks_;
+		lru_cache<std::uint64_t, file_content> pages_;
+
+		// the language of a <code> tag, from class="language-x", "lang-x" or "x"
+		static const highlight_language *language_of(const html_tag &tag, std::vector<std::string> &other_classes)
+		{
+			const highlight_language *language = nullptr;
+			std::istringstream iss(tag.attribute_value("class"));
+			std::string c;
+
+			while (iss >> c) {
+				auto name = c;
+
+				if (name.compare(0, 9, "language-") == 0) {
+					name.erase(0, 9);
+				} else if (name.compare(0, 5, "lang-") == 0) {
+					name.erase(0, 5);
+				}
+
+				auto l = language == nullptr ? find_highlight_language(name) : nullptr;
+
+				if (l != nullptr) {
+					language = l;
+				} else if (c != "hljs") {
+					other_classes.push_back(c);
+				}
+
+				// highlight.js is asked to leave the block alone
+				if (c == "nohighlight" || c == "no-highlight") {
+					return nullptr;
+				}
+			}
+
+			return language;
+		}
+
+		static std::string quote_attribute(const std::string &value)
+		{
+			std::string quoted = "\"";
+
+			for (auto c : value) {
+				if (c == '"') {
+					quoted += "&quot;";
+				} else {
+					quoted += c;
+				}
+			}
+
+			return quoted + '"';
+		}
+
+		// the <pre><code> blocks of html that can be highlighted
+		std::vector<block> find_blocks(const std::string &html) const
+		{
+			std::vector<block> blocks;
+			std::size_t pre_end = std::string::npos;
+			std::size_t skip_until = 0;
+
+			scan_html_tags(html, [&](const html_tag &tag) {
+				if (tag.begin < skip_until) {
+					return true;
+				}
+
+				if (tag.name == "pre") {
+					// a language on <pre> would make highlight.js highlight the block again
+					auto c = " " + tag.attribute_value("class");
+					pre_end = tag.closing || c.find(" lang") != std::string::npos ? std::string::npos : tag.end;
+					return true;
+				}
+
+				if (tag.name != "code" || tag.closing || tag.self_closing || pre_end == std::string::npos
+					|| html.find_first_not_of(" \t\r\n", pre_end) != tag.begin)
+				{
+					pre_end = std::string::npos;
+					return true;
+				}
+
+				pre_end = std::string::npos;
+
+				auto close = detail::find_ignore_case(html, "</code", tag.end);
+				auto close_end = close == std::string::npos ? close : html.find('>', close);
+
+				if (close_end == std::string::npos) {
+					return false;
+				}
+
+				skip_until = close_end + 1;
+
+				std::vector<std::string> classes;
+				auto language = language_of(tag, classes);
+
+				if (language == nullptr || close - tag.end > options_.max_block_size) {
+					return true;
+				}
+
+				// the content, as the reveal.js plugin would show it
+				auto content = html.substr(tag.end, close - tag.end);
+				auto first = content.find_first_not_of(" \t\r\n");
+				std::string text;
+
+				if (first != std::string::npos && detail::find_ignore_case(content, "<script", first) == first) {
+					// <script type="text/template"> keeps <, > and & as they are
+					auto open_end = content.find('>', first);
+					auto script_end = detail::find_ignore_case(content, "</script", first);
+
+					if (open_end == std::string::npos || script_end == std::string::npos || script_end < open_end) {
+						return true;
+					}
+
+					text = content.substr(open_end + 1, script_end - open_end - 1);
+				} else if (content.find('<') == std::string::npos) {
+					text = decode_html_text(content);
+				} else {
+					// elements in the code (<mark>, unescaped markup) are left to the plugin
+					return true;
+				}
+
+				if (tag.attribute("data-trim") != nullptr) {
+					text = detail::trim_code(text);
+				}
+
+				// the tag as written, with the classes and attributes the plugin expects of highlighted code
+				std::string open = "<code class=\"hljs nohighlight";
+
+				for (auto &c : classes) {
+					open += ' ' + c;
+				}
+
+				open += '"';
+
+				for (auto &a : tag.attributes) {
+					if (a.name == "class" || a.name == "data-trim" || a.name == "data-noescape") {
+						continue;
+					}
+
+					open += ' ' + a.name;
+
+					if (a.has_value) {
+						open += '=' + quote_attribute(a.value);
+					}
+				}
+
+				open += " data-noescape>";
+
+				auto key = std::to_string(version) + '\n' + language->name + '\n' + text;
+
+				blocks.push_back({ tag.begin, close_end + 1, language, std::move(open), std::move(text), hash_bytes(key.data(), key.size()), nullptr });
+
+				return true;
+			});
+
+			return blocks;
+		}
+
+		// highlights the blocks that are not cached, in parallel
+		void highlight(std::vector<block> &blocks)
+		{
+			std::vector<block *> pending;
+
+			for (auto &b : blocks) {
+				b.markup = blocks_.find(b.hash);
+
+				if (!b.markup) {
+					pending.push_back(&b);
+				}
+			}
+
+			auto run = [this](block &b) {
+				auto markup = std::make_shared<std::string>(highlight_code(*b.language, b.text));
+
+				blocks_.insert(b.hash, markup, markup->size() + b.text.size() + sizeof(std::string));
+				b.markup = markup;
+			};
+
+			// not worth a round trip to the pool
+			if (pending.size() <= 1) {
+				for (auto b : pending) {
+					run(*b);
+				}
+
+				return;
+			}
+
+			std::mutex mutex;
+			std::condition_variable done_changed;
+			std::size_t done = 0;
+
+			// a job per worker, taking blocks in turn
+			auto jobs = std::min(pending.size(), pool_.size());
+
+			for (std::size_t j = 0; j < jobs; ++j) {
+				pool_.post([&, j]() {
+					for (auto i = j; i < pending.size(); i += jobs) {
+						run(*pending[i]);
+					}
+
+					std::lock_guard<std::mutex> lock(mutex);
+
+					++done;
+					done_changed.notify_all();
+				});
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+
+			done_changed.wait(lock, [&]() { return done == jobs; });
+		}
+
+		// html with the blocks replaced by their markup
+		static std::string splice(const std::string &html, const std::vector<block> &blocks)
+		{
+			std::string result;
+			std::size_t pos = 0;
+
+			result.reserve(html.size() + html.size() / 4);
+
+			for (auto &b : blocks) {
+				result.append(html, pos, b.begin - pos);
+				result += b.open_tag;
+				result += *b.markup;
+				result += "</code>";
+				pos = b.end;
+			}
+
+			result.append(html, pos, std::string::npos);
+
+			return result;
+		}
+
+	public:
+		explicit highlight_cache(const highlight_options &options, std::size_t budget = 8 * 1024 * 1024)
+			: options_(options)
+			, pool_(options.threads)
+			, blocks_(budget)
+			, pages_(budget)
+		{
+		}
+
+		highlight_cache(const highlight_cache &) = delete;
+		highlight_cache &operator=(const highlight_cache &) = delete;
+
+		// the page with its code highlighted; the result carries a hash derived from the page
+		content_cache::content_pointer transform(const content_cache::content_pointer &page)
+		{
+			std::string key = to_hex(page->hash) + "\nhighlight:" + std::to_string(version);
+			auto hash = hash_bytes(key.data(), key.size());
+			auto cached = pages_.find(hash);
+
+			if (cached) {
+				return cached;
+			}
+
+			auto c = std::make_shared<file_content>();
+
+			c->stamp = page->stamp;
+			c->hash = hash;
+			c->data = std::make_shared<std::string>(rewrite(*page->data));
+
+			pages_.insert(hash, c, c->data->size() + sizeof(file_content));
+
+			return c;
+		}
+
+		// html (a page or a fragment of one) with its code highlighted
+		std::string rewrite(const std::string &html)
+		{
+			auto blocks = find_blocks(html);
+
+			if (blocks.empty()) {
+				return html;
+			}
+
+			highlight(blocks);
+
+			return splice(html, blocks);
+		}
+	};
+}
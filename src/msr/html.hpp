@@ -0,0 +1,457 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal HTML tag scanner.
+// Not a conforming parser; just enough to find tags and attributes in
+// the documents reveal.js decks are made of.
+
+namespace msr {
+	struct html_attribute {
+		std::string name;	// lower case
+		std::string value;	// quotes removed, entities are not decoded
+		bool has_value = false;
+
+		// position of the value in the source ([value_begin, value_end))
+		std::size_t value_begin = 0;
+		std::size_t value_end = 0;
+	};
+
+	struct html_tag {
+		std::string name;	// lower case
+		bool closing = false;
+		bool self_closing = false;
+
+		// position of the tag in the source ([begin, end))
+		std::size_t begin = 0;
+		std::size_t end = 0;
+
+		std::vector<html_attribute> attributes;
+
+		const html_attribute *attribute(const std::string &attr_name) const
+		{
+			for (auto &a : attributes) {
+				if (a.name == attr_name) {
+					return &a;
+				}
+			}
+
+			return nullptr;
+		}
+
+		std::string attribute_value(const std::string &attr_name) const
+		{
+			auto a = attribute(attr_name);
+
+			return a != nullptr ? a->value : std::string();
+		}
+	};
+
+	namespace detail {
+		inline bool is_html_space(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+		}
+
+		inline char to_lower_ascii(char c)
+		{
+			return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+		}
+
+		inline std::size_t find_ignore_case(const std::string &s, const std::string &what, std::size_t pos)
+		{
+			if (what.empty()) {
+				return pos;
+			}
+
+			for (; pos + what.size() <= s.size(); ++pos) {
+				std::size_t i = 0;
+
+				while (i < what.size() && to_lower_ascii(s[pos + i]) == what[i]) {
+					++i;
+				}
+
+				if (i == what.size()) {
+					return pos;
+				}
+			}
+
+			return std::string::npos;
+		}
+
+		// parses the tag starting at html[pos] == '<'; returns false if it is not a tag
+		inline bool parse_html_tag(const std::string &html, std::size_t pos, html_tag &tag)
+		{
+			auto size = html.size();
+			auto i = pos + 1;
+
+			tag = html_tag();
+			tag.begin = pos;
+
+			if (i < size && html[i] == '/') {
+				tag.closing = true;
+				++i;
+			}
+
+			if (i >= size || !std::isalpha(static_cast<unsigned char>(html[i]))) {
+				return false;
+			}
+
+			while (i < size && !is_html_space(html[i]) && html[i] != '>' && html[i] != '/') {
+				tag.name += to_lower_ascii(html[i++]);
+			}
+
+			for (;;) {
+				while (i < size && is_html_space(html[i])) {
+					++i;
+				}
+
+				if (i >= size) {
+					return false;
+				}
+
+				if (html[i] == '>') {
+					tag.end = i + 1;
+					return true;
+				}
+
+				if (html[i] == '/') {
+					if (i + 1 < size && html[i + 1] == '>') {
+						tag.self_closing = true;
+						tag.end = i + 2;
+						return true;
+					}
+
+					++i;
+					continue;
+				}
+
+				html_attribute attr;
+
+				while (i < size && !is_html_space(html[i]) && html[i] != '>' && html[i] != '=' && html[i] != '/') {
+					attr.name += to_lower_ascii(html[i++]);
+				}
+
+				while (i < size && is_html_space(html[i])) {
+					++i;
+				}
+
+				if (i < size && html[i] == '=') {
+					++i;
+
+					while (i < size && is_html_space(html[i])) {
+						++i;
+					}
+
+					attr.has_value = true;
+
+					if (i < size && (html[i] == '"' || html[i] == '\'')) {
+						auto quote = html[i++];
+						auto close = html.find(quote, i);
+
+						if (close == std::string::npos) {
+							return false;
+						}
+
+						attr.value_begin = i;
+						attr.value_end = close;
+						i = close + 1;
+					} else {
+						attr.value_begin = i;
+
+						while (i < size && !is_html_space(html[i]) && html[i] != '>') {
+							++i;
+						}
+
+						attr.value_end = i;
+					}
+
+					attr.value = html.substr(attr.value_begin, attr.value_end - attr.value_begin);
+				}
+
+				if (attr.name.empty()) {
+					++i;
+					continue;
+				}
+
+				tag.attributes.push_back(std::move(attr));
+			}
+		}
+	}
+
+	namespace detail {
+		inline void append_utf8(std::string &out, std::uint32_t c)
+		{
+			if (c < 0x80) {
+				out += static_cast<char>(c);
+			} else if (c < 0x800) {
+				out += static_cast<char>(0xC0 | (c >> 6));
+				out += static_cast<char>(0x80 | (c & 0x3F));
+			} else if (c < 0x10000) {
+				out += static_cast<char>(0xE0 | (c >> 12));
+				out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (c & 0x3F));
+			} else {
+				out += static_cast<char>(0xF0 | (c >> 18));
+				out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+				out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (c & 0x3F));
+			}
+		}
+	}
+
+	// text (markup without elements) with the common named character references and the numeric ones decoded
+	inline std::string decode_html_text(const std::string &html)
+	{
+		static const struct {
+			const char *name;
+			const char *text;
+		} named[] = {
+			{ "lt", "<" }, { "gt", ">" }, { "amp", "&" }, { "quot", "\"" }, { "apos", "'" },
+			{ "nbsp", "\xC2\xA0" },
+		};
+
+		std::string text;
+		text.reserve(html.size());
+
+		for (std::size_t i = 0; i < html.size(); ++i) {
+			auto semicolon = html[i] == '&' ? html.find(';', i + 1) : std::string::npos;
+
+			if (semicolon == std::string::npos || semicolon - i > 10) {
+				text += html[i];
+				continue;
+			}
+
+			auto name = html.substr(i + 1, semicolon - i - 1);
+			auto decoded = false;
+
+			for (auto &n : named) {
+				if (name == n.name) {
+					text += n.text;
+					decoded = true;
+					break;
+				}
+			}
+
+			if (!decoded && name.size() > 1 && name[0] == '#') {
+				auto hex = name[1] == 'x' || name[1] == 'X';
+				auto digits = name.substr(hex ? 2 : 1);
+				char *end = nullptr;
+				auto c = std::strtoul(digits.c_str(), &end, hex ? 16 : 10);
+
+				if (!digits.empty() && *end == '\0' && c > 0 && c <= 0x10FFFF) {
+					detail::append_utf8(text, static_cast<std::uint32_t>(c));
+					decoded = true;
+				}
+			}
+
+			if (decoded) {
+				i = semicolon;
+			} else {
+				text += html[i];
+			}
+		}
+
+		return text;
+	}
+
+	// Elements whose content is not markup.
+	inline bool is_raw_text_element(const std::string &name)
+	{
+		return name == "script" || name == "style" || name == "textarea" || name == "title";
+	}
+
+	// Calls handler(const html_tag &) for every tag in the document, in order.
+	// Comments are skipped. The content of raw text elements (script, style...)
+	// is not scanned; the handler sees the opening tag and then the closing tag,
+	// so the content is [open.end, close.begin).
+	// The handler may return false to stop scanning.
+	template <typename Handler>
+	void scan_html_tags(const std::string &html, Handler handler)
+	{
+		std::size_t pos = 0;
+		html_tag tag;
+
+		while ((pos = html.find('<', pos)) != std::string::npos) {
+			if (html.compare(pos, 4, "<!--") == 0) {
+				auto end = html.find("-->", pos + 4);
+
+				if (end == std::string::npos) {
+					return;
+				}
+
+				pos = end + 3;
+				continue;
+			}
+
+			if (!detail::parse_html_tag(html, pos, tag)) {
+				++pos;
+				continue;
+			}
+
+			pos = tag.end;
+
+			if (!handler(static_cast<const html_tag &>(tag))) {
+				return;
+			}
+
+			if (!tag.closing && !tag.self_closing && is_raw_text_element(tag.name)) {
+				auto close = detail::find_ignore_case(html, "</" + tag.name, pos);
+
+				if (close == std::string::npos) {
+					return;
+				}
+
+				pos = close;
+			}
+		}
+	}
+
+	// Incremental scanner for documents that arrive in pieces, in constant
+	// memory: only an incomplete tag (or the tail of a raw text element that
+	// may hold the start of its end tag) is kept between calls to write().
+	// Text, comments and the content of raw text elements go to on_text as
+	// they arrive; each tag goes to on_tag once it is complete, with its source
+	// (the positions in the tag are relative to it). Concatenating the text
+	// and the tag sources gives the document back.
+	class html_stream {
+	public:
+		using text_handler = std::function<void(const char *data, std::size_t size)>;
+		using tag_handler = std::function<void(const html_tag &tag, const std::string &source)>;
+
+	private:
+		// a '<' that has not become a tag within this many bytes is text
+		static const std::size_t max_tag_size = 64 * 1024;
+
+		text_handler on_text_;
+		tag_handler on_tag_;
+		std::string buffer_;
+
+		// in a comment ("-->", which is text) or a raw text element ("</script", which is not)
+		std::string until_;
+		bool until_included_ = false;
+
+		void text(std::size_t begin, std::size_t end)
+		{
+			if (end > begin) {
+				on_text_(buffer_.data() + begin, end - begin);
+			}
+		}
+
+		void process(bool final)
+		{
+			std::size_t pos = 0;
+			auto size = buffer_.size();
+
+			while (pos < size) {
+				if (!until_.empty()) {
+					auto end = detail::find_ignore_case(buffer_, until_, pos);
+
+					if (end == std::string::npos) {
+						auto keep = final ? 0 : std::min(size - pos, until_.size() - 1);
+
+						text(pos, size - keep);
+						pos = size - keep;
+						break;
+					}
+
+					if (until_included_) {
+						end += until_.size();
+					}
+
+					text(pos, end);
+					pos = end;
+					until_.clear();
+					continue;
+				}
+
+				auto lt = buffer_.find('<', pos);
+
+				if (lt == std::string::npos) {
+					text(pos, size);
+					pos = size;
+					break;
+				}
+
+				text(pos, lt);
+				pos = lt;
+
+				// too short to tell what it is
+				if (!final && size - pos < 4) {
+					break;
+				}
+
+				if (buffer_.compare(pos, 4, "<!--") == 0) {
+					text(pos, pos + 4);
+					pos += 4;
+					until_ = "-->";
+					until_included_ = true;
+					continue;
+				}
+
+				html_tag tag;
+
+				if (!detail::parse_html_tag(buffer_, pos, tag)) {
+					auto next = pos + 1 < size ? buffer_[pos + 1] : '\0';
+					auto could_be_tag = std::isalpha(static_cast<unsigned char>(next)) || next == '/';
+
+					// incomplete; wait for the rest
+					if (could_be_tag && !final && size - pos <= max_tag_size) {
+						break;
+					}
+
+					text(pos, pos + 1);
+					++pos;
+					continue;
+				}
+
+				auto source = buffer_.substr(pos, tag.end - pos);
+
+				tag.begin -= pos;
+				tag.end -= pos;
+
+				for (auto &a : tag.attributes) {
+					a.value_begin -= pos;
+					a.value_end -= pos;
+				}
+
+				on_tag_(tag, source);
+				pos += source.size();
+
+				if (!tag.closing && !tag.self_closing && is_raw_text_element(tag.name)) {
+					until_ = "</" + tag.name;
+					until_included_ = false;
+				}
+			}
+
+			buffer_.erase(0, pos);
+		}
+
+	public:
+		html_stream(text_handler on_text, tag_handler on_tag)
+			: on_text_(std::move(on_text))
+			, on_tag_(std::move(on_tag))
+		{
+		}
+
+		void write(const char *data, std::size_t size)
+		{
+			buffer_.append(data, size);
+			process(false);
+		}
+
+		// the end of the document
+		void finish()
+		{
+			process(true);
+			buffer_.clear();
+		}
+	};
+}
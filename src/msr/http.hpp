@@ -0,0 +1,304 @@
+#pragma once
+
+#include <boost/date_time.hpp>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <locale>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace msr {
+	struct request_data {
+		std::string method, uri, query, version;
+		std::map<std::string, std::string> headers;	// names are in lower case
+		bool invalid = false;
+
+		// the client runs on this machine (the presenter in audience mode)
+		bool local = false;
+
+		std::string header(const std::string &name) const
+		{
+			auto iter = headers.find(name);
+
+			return iter != headers.end() ? iter->second : std::string();
+		}
+
+		// whether the client allows the connection to be reused for the next request
+		bool keep_alive() const
+		{
+			auto connection = boost::algorithm::to_lower_copy(header("connection"));
+
+			if (version == "HTTP/1.0") {
+				return connection.find("keep-alive") != std::string::npos;
+			}
+
+			return version == "HTTP/1.1" && connection.find("close") == std::string::npos;
+		}
+	};
+
+	// Parses a request line and header fields ending with an empty line.
+	// https://www.w3.org/Protocols/rfc2616/rfc2616-sec5.html
+	// METHOD SP Request-URI SP HTTP-Version, then field-name ":" OWS field-value
+	inline bool parse_request_head(const std::string &head, request_data &request)
+	{
+		request = request_data();
+
+		auto eol = head.find("\r\n");
+		auto line = head.substr(0, eol);
+		auto sp1 = line.find(' ');
+		auto sp2 = line.rfind(' ');
+
+		if (sp1 == std::string::npos || sp1 == 0 || sp2 == sp1) {
+			request.invalid = true;
+			return false;
+		}
+
+		request.method = line.substr(0, sp1);
+		request.version = line.substr(sp2 + 1);
+
+		auto target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+
+		// absolute form: drop the scheme and the authority
+		if (boost::algorithm::istarts_with(target, "http://") || boost::algorithm::istarts_with(target, "https://")) {
+			auto slash = target.find('/', target.find("://") + 3);
+			target = slash == std::string::npos ? std::string() : target.substr(slash);
+		}
+
+		auto question = target.find('?');
+
+		request.uri = target.substr(0, question);
+
+		if (question != std::string::npos) {
+			request.query = target.substr(question + 1);
+		}
+
+		while (eol != std::string::npos) {
+			auto begin = eol + 2;
+
+			eol = head.find("\r\n", begin);
+			line = head.substr(begin, eol == std::string::npos ? std::string::npos : eol - begin);
+
+			auto colon = line.find(':');
+
+			if (line.empty() || colon == std::string::npos || colon == 0) {
+				continue;
+			}
+
+			auto value = line.find_first_not_of(" \t", colon + 1);
+
+			request.headers[boost::algorithm::to_lower_copy(line.substr(0, colon))] =
+				value == std::string::npos ? std::string() : boost::algorithm::trim_right_copy(line.substr(value));
+		}
+
+		return true;
+	}
+
+	struct response_data {
+		// e.g. "200 OK"
+		std::string status = "200 OK";
+
+		// in the order they are sent
+		std::vector<std::pair<std::string, std::string> > headers;
+
+		// the body is not copied; owner keeps it alive
+		const char *body = nullptr;
+		std::size_t body_size = 0;
+		std::shared_ptr<const void> owner;
+
+		// instead of body, for files too large to be held in memory: reads up to
+		// size bytes of the body at offset into buffer and returns how many it has read
+		std::function<std::size_t(std::uint64_t offset, char *buffer, std::size_t size)> read_body;
+
+		int status_code() const
+		{
+			return std::atoi(status.c_str());
+		}
+
+		void add_header(const std::string &name, const std::string &value)
+		{
+			headers.emplace_back(name, value);
+		}
+
+		std::string header(const std::string &name) const
+		{
+			for (auto &h : headers) {
+				if (boost::algorithm::iequals(h.first, name)) {
+					return h.second;
+				}
+			}
+
+			return std::string();
+		}
+
+		void set_body(std::string content)
+		{
+			auto s = std::make_shared<std::string>(std::move(content));
+
+			body = s->data();
+			body_size = s->size();
+			owner = s;
+		}
+
+		void set_body(const char *data, std::size_t size, std::shared_ptr<const void> data_owner)
+		{
+			body = data;
+			body_size = size;
+			owner = std::move(data_owner);
+		}
+
+		void set_body_reader(std::size_t size, std::function<std::size_t(std::uint64_t, char *, std::size_t)> reader)
+		{
+			body = nullptr;
+			body_size = size;
+			owner.reset();
+			read_body = std::move(reader);
+		}
+	};
+
+	// whether an If-None-Match value ("a", W/"b" or *) matches etag
+	inline bool etag_matches(const std::string &none_match, const std::string &etag)
+	{
+		std::size_t pos = 0;
+
+		while (pos < none_match.size()) {
+			auto end = none_match.find(',', pos);
+
+			if (end == std::string::npos) {
+				end = none_match.size();
+			}
+
+			auto tag = boost::algorithm::trim_copy(none_match.substr(pos, end - pos));
+
+			if (tag.compare(0, 2, "W/") == 0) {
+				tag.erase(0, 2);
+			}
+
+			if (tag == "*" || tag == etag) {
+				return true;
+			}
+
+			pos = end + 1;
+		}
+
+		return false;
+	}
+
+	// value of name in a query string (a=1&b=2), empty if not found
+	inline std::string query_parameter(const std::string &query, const std::string &name)
+	{
+		std::size_t pos = 0;
+
+		while (pos <= query.size()) {
+			auto end = query.find('&', pos);
+
+			if (end == std::string::npos) {
+				end = query.size();
+			}
+
+			auto eq = query.find('=', pos);
+
+			if (eq != std::string::npos && eq < end && query.compare(pos, eq - pos, name) == 0) {
+				return query.substr(eq + 1, end - eq - 1);
+			}
+
+			pos = end + 1;
+		}
+
+		return std::string();
+	}
+
+	// RFC 1123, RFC 850 or asctime date; not_a_date_time if none of them matches
+	inline boost::posix_time::ptime parse_time(const std::string &str)
+	{
+		static const char *formats[] = {
+			"%a, %d %b %Y %H:%M:%S GMT",
+			"%A, %d-%b-%y %H:%M:%S GMT",
+			"%a %b %e %H:%M:%S %Y",
+		};
+
+		for (auto f : formats) {
+			boost::posix_time::ptime time;
+			std::istringstream sstr(str);
+
+			sstr.imbue(std::locale(std::locale::classic(), new boost::posix_time::time_input_facet(f)));
+
+			try {
+				sstr >> time;
+			} catch (std::exception &) {
+				continue;
+			}
+
+			if (!sstr.fail() && !time.is_not_a_date_time()) {
+				return time;
+			}
+		}
+
+		return boost::posix_time::ptime();
+	}
+
+	inline std::string format_time(const boost::posix_time::ptime &time)
+	{
+		auto facet_rfc1123 = new boost::posix_time::time_facet("%a, %d %b %Y %H:%M:%S GMT");
+
+		std::stringstream sstr;
+
+		sstr.imbue(std::locale(sstr.getloc(), facet_rfc1123));
+		sstr << time;
+
+		return sstr.str();
+	}
+
+	inline std::string content_type(const std::string &ext)
+	{
+		if (ext == ".html" || ext == ".htm") {
+			return "text/html";
+		} else if (ext == ".css") {
+			return "text/css";
+		} else if (ext == ".js") {
+			return "application/javascript";
+		} else if (ext == ".rtf") {
+			return "application/rtf";
+		} else if (ext == ".xml") {
+			return "text/xml";
+		} else if (ext == ".txt" || ext == ".md") {
+			return "text/plain";
+		} else if (ext == ".jpg" || ext == ".jpeg") {
+			return "image/jpeg";
+		} else if (ext == ".gif") {
+			return "image/gif";
+		} else if (ext == ".png") {
+			return "image/png";
+		} else if (ext == ".tiff") {
+			return "image/tiff";
+		} else if (ext == ".woff") {
+			return "application/x-font-woff";
+		} else if (ext == ".woff2") {
+			return "font/woff2";
+		} else if (ext == ".ttf") {
+			return "font/ttf";
+		} else if (ext == ".otf") {
+			return "font/otf";
+		} else if (ext == ".eot") {
+			return "application/vnd.ms-fontobject";
+		} else if (ext == ".json" || ext == ".map") {
+			return "application/json";
+		} else if (ext == ".pdf") {
+			return "application/pdf";
+		} else if (ext == ".svg") {
+			return "image/svg+xml";
+		}
+
+		// unknown or not implemented
+		return "application/octet-stream";
+	}
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <boost/filesystem/path.hpp>
+
+#include <string>
+
+#include "resample.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <wincodec.h>
+#include <wrl/client.h>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "windowscodecs.lib")
+#endif
+#endif
+
+#ifdef MSR_WITH_WEBP
+#include <webp/encode.h>
+#endif
+
+// Image decoding and encoding for the image pipeline.
+// Decoding and JPEG/PNG encoding use WIC; WebP encoding needs libwebp (MSR_WITH_WEBP).
+
+namespace msr {
+	enum class image_format {
+		jpeg,
+		png,
+		webp,
+	};
+
+	inline const char *image_format_name(image_format format)
+	{
+		switch (format) {
+		case image_format::jpeg:
+			return "jpeg";
+		case image_format::png:
+			return "png";
+		case image_format::webp:
+			return "webp";
+		}
+
+		return "";
+	}
+
+	inline std::string image_content_type(image_format format)
+	{
+		return std::string("image/") + image_format_name(format);
+	}
+
+	inline bool image_format_supported(image_format format)
+	{
+#ifdef _WIN32
+		if (format != image_format::webp) {
+			return true;
+		}
+#endif
+
+#ifdef MSR_WITH_WEBP
+		if (format == image_format::webp) {
+			return true;
+		}
+#endif
+
+		(void)format;
+		return false;
+	}
+
+#ifdef _WIN32
+	namespace detail {
+		using Microsoft::WRL::ComPtr;
+
+		inline ComPtr<IWICImagingFactory> create_wic_factory()
+		{
+			ComPtr<IWICImagingFactory> factory;
+
+			::CoCreateInstance(
+				CLSID_WICImagingFactory,
+				nullptr,
+				CLSCTX_INPROC_SERVER,
+				IID_PPV_ARGS(&factory));
+
+			return factory;
+		}
+
+		inline bool copy_pixels(IWICBitmapSource *source, bitmap &out)
+		{
+			ComPtr<IWICBitmapSource> converted;
+
+			if (FAILED(::WICConvertBitmapSource(GUID_WICPixelFormat32bppPBGRA, source, &converted))) {
+				return false;
+			}
+
+			UINT width, height;
+
+			if (FAILED(converted->GetSize(&width, &height))) {
+				return false;
+			}
+
+			out.resize(width, height);
+
+			return SUCCEEDED(converted->CopyPixels(
+				nullptr,
+				width * 4,
+				static_cast<UINT>(out.pixels.size()),
+				out.pixels.data()));
+		}
+	}
+#endif
+
+	// Decodes the first frame of an image.
+	// When min_width is not 0, JPEG decoders may scale down in the DCT domain
+	// to the smallest size that is still at least min_width wide.
+	inline bool decode_image(const boost::filesystem::path &path, unsigned min_width, bitmap &out)
+	{
+#ifdef _WIN32
+		using detail::ComPtr;
+
+		auto factory = detail::create_wic_factory();
+
+		if (!factory) {
+			return false;
+		}
+
+		ComPtr<IWICBitmapDecoder> decoder;
+		ComPtr<IWICBitmapFrameDecode> frame;
+
+		if (FAILED(factory->CreateDecoderFromFilename(
+			path.wstring().c_str(),
+			nullptr,
+			GENERIC_READ,
+			WICDecodeMetadataCacheOnDemand,
+			&decoder)))
+		{
+			return false;
+		}
+
+		if (FAILED(decoder->GetFrame(0, &frame))) {
+			return false;
+		}
+
+		UINT width, height;
+
+		if (FAILED(frame->GetSize(&width, &height))) {
+			return false;
+		}
+
+		ComPtr<IWICBitmapSourceTransform> transform;
+
+		if (min_width != 0 && min_width < width && SUCCEEDED(frame.As(&transform))) {
+			UINT w = min_width;
+			UINT h = static_cast<UINT>(static_cast<unsigned long long>(height) * min_width / width);
+			WICPixelFormatGUID format = GUID_WICPixelFormat32bppPBGRA;
+
+			if (SUCCEEDED(transform->GetClosestSize(&w, &h)) && w >= min_width && w < width
+				&& SUCCEEDED(transform->GetClosestPixelFormat(&format)))
+			{
+				ComPtr<IWICBitmap> scaled;
+				ComPtr<IWICBitmapLock> lock;
+				UINT stride, size;
+				BYTE *data;
+				WICRect rect = { 0, 0, static_cast<INT>(w), static_cast<INT>(h) };
+
+				if (SUCCEEDED(factory->CreateBitmap(w, h, format, WICBitmapCacheOnLoad, &scaled))
+					&& SUCCEEDED(scaled->Lock(&rect, WICBitmapLockWrite, &lock))
+					&& SUCCEEDED(lock->GetStride(&stride))
+					&& SUCCEEDED(lock->GetDataPointer(&size, &data))
+					&& SUCCEEDED(transform->CopyPixels(nullptr, w, h, &format, WICBitmapTransformRotate0, stride, size, data)))
+				{
+					lock.Reset();
+
+					return detail::copy_pixels(scaled.Get(), out);
+				}
+			}
+		}
+
+		return detail::copy_pixels(frame.Get(), out);
+#else
+		(void)path;
+		(void)min_width;
+		(void)out;
+		return false;
+#endif
+	}
+
+	// quality: 0 - 100 (ignored for PNG)
+	inline bool encode_image(const bitmap &image, image_format format, int quality, std::string &out)
+	{
+#ifdef MSR_WITH_WEBP
+		if (format == image_format::webp) {
+			// libwebp wants straight alpha
+			std::vector<std::uint8_t> straight(image.pixels);
+
+			for (std::size_t i = 0; i < straight.size(); i += 4) {
+				unsigned a = straight[i + 3];
+
+				if (a != 0 && a != 255) {
+					for (int c = 0; c < 3; ++c) {
+						straight[i + c] = static_cast<std::uint8_t>(std::min(255u, (straight[i + c] * 255u + a / 2) / a));
+					}
+				}
+			}
+
+			std::uint8_t *output = nullptr;
+			auto size = ::WebPEncodeBGRA(
+				straight.data(),
+				static_cast<int>(image.width),
+				static_cast<int>(image.height),
+				static_cast<int>(image.width * 4),
+				static_cast<float>(quality),
+				&output);
+
+			if (size == 0) {
+				return false;
+			}
+
+			out.assign(reinterpret_cast<const char *>(output), size);
+			::WebPFree(output);
+
+			return true;
+		}
+#endif
+
+#ifdef _WIN32
+		using detail::ComPtr;
+
+		if (format == image_format::webp) {
+			return false;
+		}
+
+		auto factory = detail::create_wic_factory();
+
+		if (!factory) {
+			return false;
+		}
+
+		auto container = format == image_format::jpeg ? GUID_ContainerFormatJpeg : GUID_ContainerFormatPng;
+		WICPixelFormatGUID pixel_format = format == image_format::jpeg ? GUID_WICPixelFormat24bppBGR : GUID_WICPixelFormat32bppBGRA;
+
+		ComPtr<IStream> stream;
+		ComPtr<IWICBitmapEncoder> encoder;
+		ComPtr<IWICBitmapFrameEncode> frame;
+		ComPtr<IPropertyBag2> properties;
+		ComPtr<IWICBitmap> source;
+		ComPtr<IWICFormatConverter> converter;
+
+		if (FAILED(::CreateStreamOnHGlobal(nullptr, TRUE, &stream))
+			|| FAILED(factory->CreateEncoder(container, nullptr, &encoder))
+			|| FAILED(encoder->Initialize(stream.Get(), WICBitmapEncoderNoCache))
+			|| FAILED(encoder->CreateNewFrame(&frame, &properties)))
+		{
+			return false;
+		}
+
+		if (format == image_format::jpeg) {
+			PROPBAG2 option = {};
+			option.pstrName = const_cast<LPOLESTR>(L"ImageQuality");
+
+			VARIANT value;
+			::VariantInit(&value);
+			value.vt = VT_R4;
+			value.fltVal = quality / 100.0f;
+
+			properties->Write(1, &option, &value);
+		}
+
+		if (FAILED(frame->Initialize(properties.Get()))
+			|| FAILED(frame->SetSize(image.width, image.height))
+			|| FAILED(frame->SetPixelFormat(&pixel_format))
+			|| FAILED(factory->CreateBitmapFromMemory(
+				image.width,
+				image.height,
+				GUID_WICPixelFormat32bppPBGRA,
+				image.width * 4,
+				static_cast<UINT>(image.pixels.size()),
+				const_cast<BYTE *>(image.pixels.data()),
+				&source))
+			|| FAILED(factory->CreateFormatConverter(&converter))
+			|| FAILED(converter->Initialize(
+				source.Get(),
+				pixel_format,
+				WICBitmapDitherTypeNone,
+				nullptr,
+				0.0,
+				WICBitmapPaletteTypeCustom))
+			|| FAILED(frame->WriteSource(converter.Get(), nullptr))
+			|| FAILED(frame->Commit())
+			|| FAILED(encoder->Commit()))
+		{
+			return false;
+		}
+
+		STATSTG stat;
+		LARGE_INTEGER zero = {};
+		ULONG read = 0;
+
+		if (FAILED(stream->Stat(&stat, STATFLAG_NONAME))
+			|| FAILED(stream->Seek(zero, STREAM_SEEK_SET, nullptr)))
+		{
+			return false;
+		}
+
+		out.resize(static_cast<std::size_t>(stat.cbSize.QuadPart));
+
+		if (out.empty()) {
+			return false;
+		}
+
+		return SUCCEEDED(stream->Read(&out[0], static_cast<ULONG>(out.size()), &read)) && read == out.size();
+#else
+		(void)image;
+		(void)format;
+		(void)quality;
+		(void)out;
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "file_stamp.hpp"
+#include "hash.hpp"
+#include "image_codec.hpp"
+#include "lru_cache.hpp"
+#include "worker_pool.hpp"
+
+#ifdef _WIN32
+#include <objbase.h>
+#endif
+
+namespace msr {
+	struct image_options {
+		bool enabled = false;
+
+		// variants are also kept here when not empty
+		boost::filesystem::path cache_directory;
+
+		std::size_t memory_budget = 64 * 1024 * 1024;
+
+		// requested widths are rounded up to a multiple of this
+		// so that the number of variants per image stays small
+		unsigned width_step = 128;
+
+		int quality = 85;
+
+		// re-encode to WebP when the client accepts it
+		bool webp = false;
+
+		// 0: number of cores - 1
+		std::size_t threads = 0;
+	};
+
+	// A downscaled and re-encoded image.
+	// Empty data means that the original should be served (e.g. it is already small enough).
+	struct image_variant {
+		std::string content_type;
+		std::string data;
+	};
+
+	// Resizes images to the width requested by the client and caches the
+	// results in memory and on disk, keyed by the hash of the source file,
+	// the width and the output format. Work is done on a worker pool;
+	// requests for a variant that is already being generated wait for that job.
+	class image_pipeline {
+	public:
+		using variant_pointer = std::shared_ptr<const image_variant>;
+		using handler_type = std::function<void(variant_pointer)>;
+
+	private:
+		image_options options_;
+		lru_cache<std::string, image_variant> memory_;
+
+		std::mutex mutex_;
+		file_hash_cache hashes_;
+
+		// handlers waiting for a job, keyed by job_key()
+		std::unordered_map<std::string, std::vector<handler_type>> pending_;
+
+		// declared last so that the workers are joined before the caches are destroyed
+		worker_pool pool_;
+
+		static std::string variant_key(std::uint64_t hash, unsigned width, image_format format)
+		{
+			return to_hex(hash) + '-' + std::to_string(width) + '.' + image_format_name(format);
+		}
+
+		static std::string job_key(
+			const boost::filesystem::path &path,
+			const file_stamp &stamp,
+			unsigned width,
+			image_format format)
+		{
+			return path.string() + '\n' + std::to_string(stamp.size) + ':' + std::to_string(stamp.mtime)
+				+ '-' + std::to_string(width) + '.' + image_format_name(format);
+		}
+
+		bool read_disk_cache(const std::string &key, image_format format, variant_pointer &variant)
+		{
+			if (options_.cache_directory.empty()) {
+				return false;
+			}
+
+			boost::filesystem::ifstream ifs(options_.cache_directory / key, std::ios::binary);
+
+			if (!ifs) {
+				return false;
+			}
+
+			auto v = std::make_shared<image_variant>();
+			v->content_type = image_content_type(format);
+			v->data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+			variant = v;
+
+			return true;
+		}
+
+		void write_disk_cache(const std::string &key, const image_variant &variant)
+		{
+			if (options_.cache_directory.empty() || variant.data.empty()) {
+				return;
+			}
+
+			boost::system::error_code error;
+			create_directories(options_.cache_directory, error);
+
+			auto temp = options_.cache_directory / (key + ".tmp");
+
+			{
+				boost::filesystem::ofstream ofs(temp, std::ios::binary);
+
+				if (!ofs) {
+					return;
+				}
+
+				ofs.write(variant.data.data(), variant.data.size());
+
+				if (!ofs) {
+					ofs.close();
+					remove(temp, error);
+					return;
+				}
+			}
+
+			rename(temp, options_.cache_directory / key, error);
+		}
+
+		variant_pointer generate(
+			const boost::filesystem::path &path,
+			const file_stamp &stamp,
+			unsigned width,
+			image_format format)
+		{
+			std::uint64_t hash;
+
+			if (!hashes_.get(path, stamp, hash)) {
+				return nullptr;
+			}
+
+			auto key = variant_key(hash, width, format);
+			auto variant = memory_.find(key);
+
+			if (variant) {
+				return variant;
+			}
+
+			if (!read_disk_cache(key, format, variant)) {
+				auto v = std::make_shared<image_variant>();
+				bitmap source, scaled;
+
+				if (decode_image(path, width, source)) {
+					auto height = static_cast<unsigned>(
+						(static_cast<unsigned long long>(source.height) * width + source.width / 2) / source.width);
+
+					if (downscale(source, width, std::max(1u, height), scaled)
+						&& encode_image(scaled, format, options_.quality, v->data))
+					{
+						v->content_type = image_content_type(format);
+					} else {
+						v->data.clear();
+					}
+				}
+
+				write_disk_cache(key, *v);
+				variant = v;
+			}
+
+			memory_.insert(key, variant, variant->data.size() + key.size() + sizeof(image_variant));
+
+			return variant;
+		}
+
+		static void initialize_worker()
+		{
+#ifdef _WIN32
+			::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+		}
+
+		static void uninitialize_worker()
+		{
+#ifdef _WIN32
+			::CoUninitialize();
+#endif
+		}
+
+	public:
+		explicit image_pipeline(const image_options &options)
+			: options_(options)
+			, memory_(options.memory_budget)
+			, pool_(options.threads, &image_pipeline::initialize_worker, &image_pipeline::uninitialize_worker)
+		{
+		}
+
+		const image_options &options() const
+		{
+			return options_;
+		}
+
+		// jobs that have not started are dropped and their handlers are never called
+		void stop()
+		{
+			pool_.stop();
+		}
+
+		static bool is_resizable(const boost::filesystem::path &path)
+		{
+			auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+
+			return ext == ".jpg" || ext == ".jpeg" || ext == ".png";
+		}
+
+		unsigned quantize_width(unsigned width) const
+		{
+			auto step = std::max(1u, options_.width_step);
+
+			return (width + step - 1) / step * step;
+		}
+
+		// JPEG stays JPEG and PNG stays PNG unless WebP is preferred and available
+		image_format output_format(const boost::filesystem::path &path, bool prefer_webp) const
+		{
+			if (prefer_webp && options_.webp && image_format_supported(image_format::webp)) {
+				return image_format::webp;
+			}
+
+			auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+
+			return ext == ".png" ? image_format::png : image_format::jpeg;
+		}
+
+		// The handler receives nullptr when the original file should be served.
+		// It is called synchronously on a memory hit, otherwise on a worker thread.
+		void get(const boost::filesystem::path &path, unsigned width, image_format format, handler_type handler)
+		{
+			file_stamp stamp;
+
+			if (width == 0 || !image_format_supported(format) || !get_file_stamp(path, stamp)) {
+				handler(nullptr);
+				return;
+			}
+
+			width = quantize_width(width);
+
+			std::uint64_t hash;
+
+			if (hashes_.find(path, stamp, hash)) {
+				auto variant = memory_.find(variant_key(hash, width, format));
+
+				if (variant) {
+					handler(variant->data.empty() ? nullptr : variant);
+					return;
+				}
+			}
+
+			auto key = job_key(path, stamp, width, format);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				auto &handlers = pending_[key];
+				handlers.push_back(std::move(handler));
+
+				if (handlers.size() > 1) {
+					return;
+				}
+			}
+
+			pool_.post([this, key, path, stamp, width, format]() {
+				auto variant = generate(path, stamp, width, format);
+
+				if (variant && variant->data.empty()) {
+					variant = nullptr;
+				}
+
+				std::vector<handler_type> handlers;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+
+					auto iter = pending_.find(key);
+
+					if (iter != pending_.end()) {
+						handlers.swap(iter->second);
+						pending_.erase(iter);
+					}
+				}
+
+				for (auto &h : handlers) {
+					h(variant);
+				}
+			});
+		}
+	};
+}
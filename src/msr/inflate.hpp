@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// DEFLATE decoder (RFC 1950/1951/1952) for the compressed tables of WOFF
+// fonts and the embedded gzip files. Small and slow rather than fast; it is
+// used on cache misses only.
+
+namespace msr {
+	namespace detail {
+		class inflater {
+			struct huffman {
+				std::vector<short> count = std::vector<short>(16);
+				std::vector<short> symbol;
+			};
+
+			const unsigned char *data_;
+			std::size_t size_;
+			std::size_t pos_ = 0;
+			unsigned bit_buffer_ = 0;
+			int bit_count_ = 0;
+			std::string &out_;
+
+			// -1 at the end of the input
+			int bits(int need)
+			{
+				long value = bit_buffer_;
+
+				while (bit_count_ < need) {
+					if (pos_ == size_) {
+						return -1;
+					}
+
+					value |= static_cast<long>(data_[pos_++]) << bit_count_;
+					bit_count_ += 8;
+				}
+
+				bit_buffer_ = static_cast<unsigned>(value >> need);
+				bit_count_ -= need;
+
+				return static_cast<int>(value & ((1L << need) - 1));
+			}
+
+			// canonical code from code lengths; false if over-subscribed
+			static bool construct(huffman &h, const short *length, int n)
+			{
+				h.symbol.assign(n, 0);
+				std::fill(h.count.begin(), h.count.end(), static_cast<short>(0));
+
+				for (int i = 0; i < n; ++i) {
+					++h.count[length[i]];
+				}
+
+				int left = 1;
+
+				for (int len = 1; len < 16; ++len) {
+					left <<= 1;
+					left -= h.count[len];
+
+					if (left < 0) {
+						return false;
+					}
+				}
+
+				short offsets[16];
+				offsets[1] = 0;
+
+				for (int len = 1; len < 15; ++len) {
+					offsets[len + 1] = offsets[len] + h.count[len];
+				}
+
+				for (int i = 0; i < n; ++i) {
+					if (length[i] != 0) {
+						h.symbol[offsets[length[i]]++] = static_cast<short>(i);
+					}
+				}
+
+				return true;
+			}
+
+			// -1 on error
+			int decode(const huffman &h)
+			{
+				int code = 0, first = 0, index = 0;
+
+				for (int len = 1; len < 16; ++len) {
+					auto bit = bits(1);
+
+					if (bit < 0) {
+						return -1;
+					}
+
+					code |= bit;
+
+					int count = h.count[len];
+
+					if (code - count < first) {
+						return h.symbol[index + (code - first)];
+					}
+
+					index += count;
+					first += count;
+					first <<= 1;
+					code <<= 1;
+				}
+
+				return -1;
+			}
+
+			bool stored()
+			{
+				bit_buffer_ = 0;
+				bit_count_ = 0;
+
+				if (size_ - pos_ < 4) {
+					return false;
+				}
+
+				unsigned length = data_[pos_] | (data_[pos_ + 1] << 8);
+				unsigned complement = data_[pos_ + 2] | (data_[pos_ + 3] << 8);
+				pos_ += 4;
+
+				if (length != (~complement & 0xffff) || size_ - pos_ < length) {
+					return false;
+				}
+
+				out_.append(reinterpret_cast<const char *>(data_ + pos_), length);
+				pos_ += length;
+
+				return true;
+			}
+
+			bool codes(const huffman &lengths, const huffman &distances)
+			{
+				static const short length_base[29] = {
+					3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+					35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+				static const short length_extra[29] = {
+					0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+					3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+				static const short distance_base[30] = {
+					1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+					257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+					8193, 12289, 16385, 24577 };
+				static const short distance_extra[30] = {
+					0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+					7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+					12, 12, 13, 13 };
+
+				for (;;) {
+					auto symbol = decode(lengths);
+
+					if (symbol < 0) {
+						return false;
+					} else if (symbol < 256) {
+						out_ += static_cast<char>(symbol);
+					} else if (symbol == 256) {
+						return true;
+					} else {
+						symbol -= 257;
+
+						if (symbol >= 29) {
+							return false;
+						}
+
+						auto extra = bits(length_extra[symbol]);
+						auto distance_symbol = extra < 0 ? -1 : decode(distances);
+
+						if (distance_symbol < 0 || distance_symbol >= 30) {
+							return false;
+						}
+
+						auto distance_extra_bits = bits(distance_extra[distance_symbol]);
+
+						if (distance_extra_bits < 0) {
+							return false;
+						}
+
+						std::size_t length = length_base[symbol] + extra;
+						std::size_t distance = distance_base[distance_symbol] + distance_extra_bits;
+
+						if (distance > out_.size()) {
+							return false;
+						}
+
+						// may overlap what is being copied
+						auto from = out_.size() - distance;
+
+						for (std::size_t i = 0; i < length; ++i) {
+							out_ += out_[from + i];
+						}
+					}
+				}
+			}
+
+			bool fixed()
+			{
+				static huffman lengths, distances;
+				static const bool constructed = []() {
+					short length[288];
+					int i = 0;
+
+					for (; i < 144; ++i) length[i] = 8;
+					for (; i < 256; ++i) length[i] = 9;
+					for (; i < 280; ++i) length[i] = 7;
+					for (; i < 288; ++i) length[i] = 8;
+
+					construct(lengths, length, 288);
+
+					for (i = 0; i < 30; ++i) length[i] = 5;
+
+					construct(distances, length, 30);
+
+					return true;
+				}();
+
+				(void)constructed;
+
+				return codes(lengths, distances);
+			}
+
+			bool dynamic()
+			{
+				static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+				auto nlen = bits(5);
+				auto ndist = bits(5);
+				auto ncode = bits(4);
+
+				if (ncode < 0) {
+					return false;
+				}
+
+				nlen += 257;
+				ndist += 1;
+				ncode += 4;
+
+				if (nlen > 286 || ndist > 30) {
+					return false;
+				}
+
+				short length[320] = {};
+
+				for (int i = 0; i < ncode; ++i) {
+					auto b = bits(3);
+
+					if (b < 0) {
+						return false;
+					}
+
+					length[order[i]] = static_cast<short>(b);
+				}
+
+				huffman lencode, distcode;
+
+				if (!construct(lencode, length, 19)) {
+					return false;
+				}
+
+				int index = 0;
+
+				while (index < nlen + ndist) {
+					auto symbol = decode(lencode);
+
+					if (symbol < 0) {
+						return false;
+					}
+
+					if (symbol < 16) {
+						length[index++] = static_cast<short>(symbol);
+						continue;
+					}
+
+					short value = 0;
+					int repeat;
+
+					if (symbol == 16) {
+						if (index == 0) {
+							return false;
+						}
+
+						value = length[index - 1];
+						repeat = bits(2) + 3;
+					} else if (symbol == 17) {
+						repeat = bits(3) + 3;
+					} else {
+						repeat = bits(7) + 11;
+					}
+
+					if (repeat < 3 || index + repeat > nlen + ndist) {
+						return false;
+					}
+
+					while (repeat-- > 0) {
+						length[index++] = value;
+					}
+				}
+
+				if (length[256] == 0) {
+					return false;
+				}
+
+				return construct(lencode, length, nlen) && construct(distcode, length + nlen, ndist)
+					&& codes(lencode, distcode);
+			}
+
+		public:
+			inflater(const void *data, std::size_t size, std::string &out)
+				: data_(static_cast<const unsigned char *>(data))
+				, size_(size)
+				, out_(out)
+			{
+			}
+
+			bool run()
+			{
+				int last;
+
+				do {
+					last = bits(1);
+					auto type = bits(2);
+
+					if (type < 0) {
+						return false;
+					}
+
+					auto ok = type == 0 ? stored()
+						: type == 1 ? fixed()
+						: type == 2 ? dynamic()
+						: false;
+
+					if (!ok) {
+						return false;
+					}
+				} while (last == 0);
+
+				return true;
+			}
+		};
+	}
+
+	// zlib stream (RFC 1950); expected_size is only a hint
+	inline bool inflate_zlib(const void *data, std::size_t size, std::string &out, std::size_t expected_size = 0)
+	{
+		auto p = static_cast<const unsigned char *>(data);
+
+		if (size < 6 || (p[0] & 0x0f) != 8 || ((p[0] << 8) | p[1]) % 31 != 0 || (p[1] & 0x20) != 0) {
+			return false;
+		}
+
+		out.clear();
+		out.reserve(expected_size);
+
+		if (!detail::inflater(p + 2, size - 6, out).run()) {
+			return false;
+		}
+
+		std::uint32_t a = 1, b = 0;
+
+		for (unsigned char c : out) {
+			a = (a + c) % 65521;
+			b = (b + a) % 65521;
+		}
+
+		auto adler = (static_cast<std::uint32_t>(p[size - 4]) << 24) | (p[size - 3] << 16) | (p[size - 2] << 8) | p[size - 1];
+
+		return ((b << 16) | a) == adler;
+	}
+
+	namespace detail {
+		inline std::uint32_t crc32(const std::string &data)
+		{
+			static const auto table = []() {
+				std::vector<std::uint32_t> t(256);
+
+				for (std::uint32_t n = 0; n < 256; ++n) {
+					auto c = n;
+
+					for (int k = 0; k < 8; ++k) {
+						c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					}
+
+					t[n] = c;
+				}
+
+				return t;
+			}();
+
+			std::uint32_t c = 0xffffffffu;
+
+			for (unsigned char b : data) {
+				c = table[(c ^ b) & 0xff] ^ (c >> 8);
+			}
+
+			return c ^ 0xffffffffu;
+		}
+	}
+
+	// gzip member (RFC 1952); expected_size is only a hint
+	inline bool inflate_gzip(const void *data, std::size_t size, std::string &out, std::size_t expected_size = 0)
+	{
+		auto p = static_cast<const unsigned char *>(data);
+
+		if (size < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) {
+			return false;
+		}
+
+		auto flags = p[3];
+		std::size_t pos = 10;
+
+		// FEXTRA, FNAME, FCOMMENT, FHCRC
+		if (flags & 4) {
+			pos += 2 + (p[pos] | (p[pos + 1] << 8));
+		}
+
+		for (int flag : { 8, 16 }) {
+			if (flags & flag) {
+				while (pos < size && p[pos] != 0) {
+					++pos;
+				}
+
+				++pos;
+			}
+		}
+
+		if (flags & 2) {
+			pos += 2;
+		}
+
+		if (pos + 8 > size) {
+			return false;
+		}
+
+		out.clear();
+		out.reserve(expected_size);
+
+		if (!detail::inflater(p + pos, size - pos - 8, out).run()) {
+			return false;
+		}
+
+		auto word = [&](std::size_t i) {
+			return static_cast<std::uint32_t>(p[i]) | (p[i + 1] << 8) | (p[i + 2] << 16) | (static_cast<std::uint32_t>(p[i + 3]) << 24);
+		};
+
+		return word(size - 8) == detail::crc32(out) && word(size - 4) == static_cast<std::uint32_t>(out.size());
+	}
+}
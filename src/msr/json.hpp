@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+namespace msr {
+	// s as a JSON string literal, quotes included; s is UTF-8
+	inline std::string json_quote(const std::string &s)
+	{
+		std::string result;
+
+		result.reserve(s.size() + 2);
+		result += '"';
+
+		for (auto c : s) {
+			switch (c) {
+			case '"':
+				result += "\\\"";
+				break;
+
+			case '\\':
+				result += "\\\\";
+				break;
+
+			case '\n':
+				result += "\\n";
+				break;
+
+			case '\r':
+				result += "\\r";
+				break;
+
+			case '\t':
+				result += "\\t";
+				break;
+
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					char buffer[8];
+					std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned char>(c));
+					result += buffer;
+				} else {
+					result += c;
+				}
+			}
+		}
+
+		result += '"';
+
+		return result;
+	}
+
+	// a number with up to 3 decimals
+	inline std::string json_number(double value)
+	{
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+
+		std::string s = buffer;
+
+		while (s.back() == '0') {
+			s.pop_back();
+		}
+
+		if (s.back() == '.') {
+			s.pop_back();
+		}
+
+		return s;
+	}
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "hash.hpp"
+#include "html.hpp"
+#include "lru_cache.hpp"
+
+namespace msr {
+	struct lazy_media_options {
+		// defer the media of slides after the first ones to reveal.js lazy loading
+		bool enabled = false;
+
+		// <section> elements, in document order, whose media are loaded at startup
+		unsigned eager_slides = 2;
+	};
+
+	// Rewrites the media of the slides after the first eager_slides of a page so
+	// that reveal.js loads them when they come near: src becomes data-src
+	// (img, video, audio, iframe, source), images and frames get loading="lazy",
+	// and video and audio get preload="none". Media that already use data-src,
+	// ask for data-preload, or have a srcset are left to the browser
+	// (with loading="lazy" for images).
+	// The page is fed with write() in any number of pieces and the result goes
+	// to the sink as it is produced.
+	class lazy_media_rewriter {
+	public:
+		using sink_type = std::function<void(const char *data, std::size_t size)>;
+
+	private:
+		unsigned eager_slides_;
+		sink_type sink_;
+		html_stream stream_;
+
+		unsigned sections_ = 0;
+
+		// slide numbers of the open <section> elements
+		std::vector<unsigned> open_;
+
+		static std::string quote_attribute(const std::string &value)
+		{
+			std::string quoted = "\"";
+
+			for (auto c : value) {
+				if (c == '"') {
+					quoted += "&quot;";
+				} else {
+					quoted += c;
+				}
+			}
+
+			return quoted + '"';
+		}
+
+		// the tag with its attributes rewritten; source if nothing changes
+		std::string rewrite(const html_tag &tag, const std::string &source) const
+		{
+			auto image = tag.name == "img" || tag.name == "iframe";
+			auto media = tag.name == "video" || tag.name == "audio";
+
+			if (!image && !media && tag.name != "source") {
+				return source;
+			}
+
+			auto defer_src = tag.attribute("src") != nullptr && tag.attribute("data-src") == nullptr
+				&& tag.attribute("data-preload") == nullptr && tag.attribute("srcset") == nullptr;
+			auto add_loading = image && tag.attribute("loading") == nullptr;
+			auto add_preload = media && tag.attribute("preload") == nullptr;
+
+			if (!defer_src && !add_loading && !add_preload) {
+				return source;
+			}
+
+			// the name as written
+			std::string result = source.substr(0, 1 + tag.name.size());
+
+			for (auto &a : tag.attributes) {
+				result += ' ';
+				result += defer_src && a.name == "src" ? "data-src" : a.name;
+
+				if (a.has_value) {
+					result += '=' + quote_attribute(a.value);
+				}
+			}
+
+			if (add_loading) {
+				result += " loading=\"lazy\"";
+			}
+
+			if (add_preload) {
+				result += " preload=\"none\"";
+			}
+
+			result += tag.self_closing ? "/>" : ">";
+
+			return result;
+		}
+
+		void on_tag(const html_tag &tag, const std::string &source)
+		{
+			if (tag.name == "section" && !tag.self_closing) {
+				if (tag.closing) {
+					if (!open_.empty()) {
+						open_.pop_back();
+					}
+				} else {
+					open_.push_back(sections_++);
+				}
+			}
+
+			if (!tag.closing && !open_.empty() && open_.back() >= eager_slides_) {
+				auto rewritten = rewrite(tag, source);
+				sink_(rewritten.data(), rewritten.size());
+			} else {
+				sink_(source.data(), source.size());
+			}
+		}
+
+	public:
+		lazy_media_rewriter(unsigned eager_slides, sink_type sink)
+			: eager_slides_(eager_slides)
+			, sink_(std::move(sink))
+			, stream_(
+				[this](const char *data, std::size_t size) { sink_(data, size); },
+				[this](const html_tag &tag, const std::string &source) { on_tag(tag, source); })
+		{
+		}
+
+		lazy_media_rewriter(const lazy_media_rewriter &) = delete;
+		lazy_media_rewriter &operator=(const lazy_media_rewriter &) = delete;
+
+		void write(const char *data, std::size_t size)
+		{
+			stream_.write(data, size);
+		}
+
+		void finish()
+		{
+			stream_.finish();
+		}
+	};
+
+	// Pages rewritten by lazy_media_rewriter, cached by the content hash of the
+	// page and the options; the result carries a hash derived from both.
+	class lazy_media_cache {
+		lazy_media_options options_;
+		lru_cache<std::uint64_t, file_content> pages_;
+
+	public:
+		explicit lazy_media_cache(const lazy_media_options &options, std::size_t budget = 8 * 1024 * 1024)
+			: options_(options)
+			, pages_(budget)
+		{
+		}
+
+		content_cache::content_pointer transform(const content_cache::content_pointer &page)
+		{
+			std::string key = to_hex(page->hash) + "\nlazy:" + std::to_string(options_.eager_slides);
+			auto hash = hash_bytes(key.data(), key.size());
+			auto cached = pages_.find(hash);
+
+			if (cached) {
+				return cached;
+			}
+
+			auto html = std::make_shared<std::string>();
+			auto &source = *page->data;
+
+			html->reserve(source.size() + source.size() / 16);
+
+			lazy_media_rewriter rewriter(options_.eager_slides, [&](const char *data, std::size_t size) {
+				html->append(data, size);
+			});
+
+			// pieces the page is fed in; the rewriter does not need the whole page
+			// (a local, since std::min takes it by reference)
+			const std::size_t chunk_size = 16 * 1024;
+
+			for (std::size_t pos = 0; pos < source.size(); pos += chunk_size) {
+				rewriter.write(source.data() + pos, std::min(chunk_size, source.size() - pos));
+			}
+
+			rewriter.finish();
+
+			auto c = std::make_shared<file_content>();
+
+			c->stamp = page->stamp;
+			c->hash = hash;
+			c->data = html;
+
+			pages_.insert(hash, c, html->size() + sizeof(file_content));
+
+			return c;
+		}
+	};
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "json.hpp"
+#include "request_timing.hpp"
+#include "url.hpp"
+
+namespace msr {
+	// One navigation: an HTML document and the requests made for it.
+	struct page_load {
+		struct asset {
+			request_timing timing;
+			bool render_blocking = false;
+		};
+
+		request_timing document;
+
+		// in the order they were received
+		std::vector<asset> assets;
+
+		// indices into assets of the chain of render-blocking requests that
+		// finished last, from the one the document referenced to the last one
+		std::vector<std::size_t> critical_path;
+
+		// the last render-blocking asset (or the document, if it has none) has been sent
+		std::chrono::steady_clock::time_point usable;
+
+		// the last request of the page has been sent
+		std::chrono::steady_clock::time_point finished;
+	};
+
+	// path of an absolute Referer URL ("http://localhost:1234/deck/index.html?x" -> "/deck/index.html")
+	inline std::string referer_path(const std::string &referer)
+	{
+		auto scheme = referer.find("://");
+
+		if (scheme == std::string::npos) {
+			return std::string();
+		}
+
+		auto slash = referer.find('/', scheme + 3);
+
+		return slash == std::string::npos ? std::string("/") : url_path(referer.substr(slash));
+	}
+
+	// Groups requests into page loads. A request belongs to the page its Referer
+	// names, directly or through a stylesheet of the page; requests without a
+	// usable Referer belong to the last page whose requests came over the same connection.
+	// render_blocking(document) returns the paths of the assets that block rendering of the document.
+	inline std::vector<page_load> build_page_loads(
+		const std::vector<request_timing> &entries,
+		const std::function<std::set<std::string>(const request_timing &)> &render_blocking)
+	{
+		std::vector<page_load> pages;
+		std::vector<std::set<std::string>> blocking;
+
+		// path (of a document or an asset) and connection -> latest page
+		std::unordered_map<std::string, std::size_t> by_path;
+		std::unordered_map<std::uint64_t, std::size_t> by_connection;
+
+		auto sorted = entries;
+
+		std::stable_sort(sorted.begin(), sorted.end(), [](const request_timing &a, const request_timing &b) {
+			return a.received < b.received;
+		});
+
+		for (auto &t : sorted) {
+			auto path = url_path(t.uri);
+
+			if (t.content_type == "text/html" && (t.status == 200 || t.status == 304)) {
+				page_load page;
+
+				page.document = t;
+				page.usable = page.finished = t.finished;
+
+				by_path[path] = by_connection[t.connection] = pages.size();
+				pages.push_back(std::move(page));
+				blocking.push_back(render_blocking(t));
+				continue;
+			}
+
+			auto iter = by_path.find(referer_path(t.referer));
+			std::size_t index;
+
+			if (iter != by_path.end()) {
+				index = iter->second;
+			} else {
+				auto c = by_connection.find(t.connection);
+
+				if (c == by_connection.end()) {
+					continue;
+				}
+
+				index = c->second;
+			}
+
+			by_path[path] = by_connection[t.connection] = index;
+
+			page_load::asset a;
+			a.timing = t;
+			a.render_blocking = blocking[index].count(path) != 0;
+
+			pages[index].assets.push_back(std::move(a));
+		}
+
+		for (auto &page : pages) {
+			std::size_t last = page.assets.size();
+
+			for (std::size_t i = 0; i < page.assets.size(); ++i) {
+				auto &t = page.assets[i].timing;
+
+				page.finished = std::max(page.finished, t.finished);
+
+				if (page.assets[i].render_blocking && t.finished >= page.usable) {
+					page.usable = t.finished;
+					last = i;
+				}
+			}
+
+			// back along the Referers to the document
+			auto document = url_path(page.document.uri);
+			std::set<std::size_t> visited;
+
+			while (last < page.assets.size() && visited.insert(last).second) {
+				page.critical_path.insert(page.critical_path.begin(), last);
+
+				auto referer = referer_path(page.assets[last].timing.referer);
+
+				if (referer.empty() || referer == document) {
+					break;
+				}
+
+				auto parent = page.assets.size();
+
+				for (std::size_t i = 0; i < page.assets.size(); ++i) {
+					if (url_path(page.assets[i].timing.uri) == referer) {
+						parent = i;
+					}
+				}
+
+				last = parent;
+			}
+		}
+
+		return pages;
+	}
+
+	namespace detail {
+		inline double milliseconds(std::chrono::steady_clock::duration d)
+		{
+			return std::chrono::duration<double, std::milli>(d).count();
+		}
+
+		inline double microseconds(std::chrono::steady_clock::duration d)
+		{
+			return std::chrono::duration<double, std::micro>(d).count();
+		}
+
+		inline std::string iso_time(std::chrono::system_clock::time_point origin_time, std::chrono::steady_clock::duration offset)
+		{
+			auto t = origin_time + std::chrono::duration_cast<std::chrono::system_clock::duration>(offset);
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+			auto time = boost::posix_time::from_time_t(static_cast<std::time_t>(us / 1000000))
+				+ boost::posix_time::microseconds(us % 1000000);
+
+			return boost::posix_time::to_iso_extended_string(time) + 'Z';
+		}
+	}
+
+	// Chrome trace event format (chrome://tracing, the Performance panel of DevTools).
+	// Each page is a span on thread 0 with an instant event where it became usable;
+	// each request is a span on the thread of its connection.
+	inline std::string to_chrome_trace(const std::vector<page_load> &pages, std::chrono::steady_clock::time_point origin)
+	{
+		std::string json = "{\"traceEvents\":[\n";
+		auto first = true;
+
+		auto add = [&](const std::string &event) {
+			if (!first) {
+				json += ",\n";
+			}
+
+			json += event;
+			first = false;
+		};
+
+		add("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"page loads\"}}");
+
+		auto request = [&](const request_timing &t, const char *category, bool render_blocking) {
+			add("{\"name\":" + json_quote(t.uri)
+				+ ",\"cat\":\"" + category + "\""
+				+ ",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(t.connection)
+				+ ",\"ts\":" + json_number(detail::microseconds(t.received - origin))
+				+ ",\"dur\":" + json_number(detail::microseconds(t.finished - t.received))
+				+ ",\"args\":{\"status\":" + std::to_string(t.status)
+				+ ",\"bytes\":" + std::to_string(t.body_size)
+				+ ",\"content_type\":" + json_quote(t.content_type)
+				+ ",\"ttfb_ms\":" + json_number(detail::milliseconds(t.first_byte - t.received))
+				+ ",\"transfer_ms\":" + json_number(detail::milliseconds(t.finished - t.first_byte))
+				+ ",\"emulated_delay_ms\":" + json_number(std::chrono::duration<double, std::milli>(t.emulated_delay).count())
+				+ ",\"render_blocking\":" + (render_blocking ? "true" : "false")
+				+ "}}");
+		};
+
+		for (auto &page : pages) {
+			auto &d = page.document;
+
+			add("{\"name\":" + json_quote("page " + d.uri)
+				+ ",\"cat\":\"page\",\"ph\":\"X\",\"pid\":1,\"tid\":0"
+				+ ",\"ts\":" + json_number(detail::microseconds(d.received - origin))
+				+ ",\"dur\":" + json_number(detail::microseconds(page.finished - d.received))
+				+ ",\"args\":{\"usable_ms\":" + json_number(detail::milliseconds(page.usable - d.received))
+				+ ",\"requests\":" + std::to_string(page.assets.size() + 1)
+				+ "}}");
+
+			add("{\"name\":\"usable\",\"cat\":\"page\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0"
+				",\"ts\":" + json_number(detail::microseconds(page.usable - origin)) + "}");
+
+			request(d, "document", true);
+
+			for (std::size_t i = 0; i < page.assets.size(); ++i) {
+				auto critical = std::find(page.critical_path.begin(), page.critical_path.end(), i) != page.critical_path.end();
+
+				request(page.assets[i].timing, critical ? "critical" : "asset", page.assets[i].render_blocking);
+			}
+		}
+
+		json += "\n]}\n";
+
+		return json;
+	}
+
+	// HTTP Archive 1.2; onContentLoad of a page is the time it became usable
+	inline std::string to_har(
+		const std::vector<page_load> &pages,
+		std::chrono::steady_clock::time_point origin,
+		std::chrono::system_clock::time_point origin_time)
+	{
+		std::string pages_json, entries_json;
+
+		auto entry = [&](const request_timing &t, std::size_t page) {
+			auto wait = detail::milliseconds(t.first_byte - t.received);
+			auto receive = detail::milliseconds(t.finished - t.first_byte);
+			auto scheme_host = "http://" + (t.host.empty() ? std::string("localhost") : t.host);
+			auto status = t.status == 200 ? "OK" : t.status == 304 ? "Not Modified" : "";
+
+			if (!entries_json.empty()) {
+				entries_json += ",\n";
+			}
+
+			entries_json += "{\"pageref\":\"page_" + std::to_string(page)
+				+ "\",\"startedDateTime\":" + json_quote(detail::iso_time(origin_time, t.received - origin))
+				+ ",\"time\":" + json_number(wait + receive)
+				+ ",\"request\":{\"method\":" + json_quote(t.method)
+				+ ",\"url\":" + json_quote(scheme_host + t.uri)
+				+ ",\"httpVersion\":\"HTTP/1.1\",\"cookies\":[],\"headers\":[],\"queryString\":[],\"headersSize\":-1,\"bodySize\":0}"
+				+ ",\"response\":{\"status\":" + std::to_string(t.status)
+				+ ",\"statusText\":\"" + status
+				+ "\",\"httpVersion\":\"HTTP/1.1\",\"cookies\":[],\"headers\":[]"
+				+ ",\"content\":{\"size\":" + std::to_string(t.body_size) + ",\"mimeType\":" + json_quote(t.content_type) + "}"
+				+ ",\"redirectURL\":\"\",\"headersSize\":-1,\"bodySize\":" + std::to_string(t.body_size) + "}"
+				+ ",\"cache\":{}"
+				+ ",\"timings\":{\"send\":0,\"wait\":" + json_number(wait) + ",\"receive\":" + json_number(receive) + "}"
+				+ ",\"connection\":\"" + std::to_string(t.connection) + "\"}";
+		};
+
+		for (std::size_t i = 0; i < pages.size(); ++i) {
+			auto &page = pages[i];
+			auto &d = page.document;
+
+			if (!pages_json.empty()) {
+				pages_json += ",\n";
+			}
+
+			pages_json += "{\"startedDateTime\":" + json_quote(detail::iso_time(origin_time, d.received - origin))
+				+ ",\"id\":\"page_" + std::to_string(i)
+				+ "\",\"title\":" + json_quote(d.uri)
+				+ ",\"pageTimings\":{\"onContentLoad\":" + json_number(detail::milliseconds(page.usable - d.received))
+				+ ",\"onLoad\":" + json_number(detail::milliseconds(page.finished - d.received)) + "}}";
+
+			entry(d, i);
+
+			for (auto &a : page.assets) {
+				entry(a.timing, i);
+			}
+		}
+
+		return "{\"log\":{\"version\":\"1.2\",\"creator\":{\"name\":\"Disclose Microserver\",\"version\":\"1\"},\n\"pages\":[\n"
+			+ pages_json + "\n],\n\"entries\":[\n" + entries_json + "\n]}}\n";
+	}
+}
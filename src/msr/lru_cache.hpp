@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace msr {
+	// Thread-safe LRU cache limited by the total size of its values in bytes.
+	// Values are shared, so an entry evicted while it is being sent stays alive.
+	template <typename Key, typename Value, typename Hash = std::hash<Key>>
+	class lru_cache {
+	public:
+		using value_pointer = std::shared_ptr<const Value>;
+
+	private:
+		struct entry {
+			Key key;
+			value_pointer value;
+			std::size_t size;
+		};
+
+		using list_type = std::list<entry>;
+
+		mutable std::mutex mutex_;
+		list_type list_;
+		std::unordered_map<Key, typename list_type::iterator, Hash> map_;
+		std::size_t budget_;
+		std::size_t used_ = 0;
+
+		void evict()
+		{
+			while (used_ > budget_ && !list_.empty()) {
+				auto &last = list_.back();
+				used_ -= last.size;
+				map_.erase(last.key);
+				list_.pop_back();
+			}
+		}
+
+	public:
+		explicit lru_cache(std::size_t budget)
+			: budget_(budget)
+		{
+		}
+
+		value_pointer find(const Key &key)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = map_.find(key);
+
+			if (iter == map_.end()) {
+				return nullptr;
+			}
+
+			list_.splice(list_.begin(), list_, iter->second);
+
+			return iter->second->value;
+		}
+
+		// values larger than the whole budget are not cached
+		void insert(const Key &key, value_pointer value, std::size_t size)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = map_.find(key);
+
+			if (iter != map_.end()) {
+				used_ -= iter->second->size;
+				list_.erase(iter->second);
+				map_.erase(iter);
+			}
+
+			if (size > budget_) {
+				return;
+			}
+
+			list_.push_front({ key, std::move(value), size });
+			map_.emplace(key, list_.begin());
+			used_ += size;
+
+			evict();
+		}
+
+		void erase(const Key &key)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = map_.find(key);
+
+			if (iter != map_.end()) {
+				used_ -= iter->second->size;
+				list_.erase(iter->second);
+				map_.erase(iter);
+			}
+		}
+
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			list_.clear();
+			map_.clear();
+			used_ = 0;
+		}
+
+		void set_budget(std::size_t budget)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			budget_ = budget;
+			evict();
+		}
+
+		// f(key, value, size) for every entry, most recently used first;
+		// the cache is locked meanwhile, so f must not call it
+		template <typename Function>
+		void for_each(Function f) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			for (auto &e : list_) {
+				f(e.key, e.value, e.size);
+			}
+		}
+
+		std::size_t size_in_bytes() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			return used_;
+		}
+	};
+}
@@ -0,0 +1,683 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "content_cache.hpp"
+#include "hash.hpp"
+#include "html.hpp"
+#include "worker_pool.hpp"
+
+// Conservative minifiers: they remove comments and whitespace and nothing
+// else, and give the input back unchanged when they meet something they
+// do not understand (an unterminated string or comment).
+
+namespace msr {
+	enum class minify_kind {
+		none,
+		css,
+		js,
+		svg,
+		html,
+	};
+
+	inline minify_kind minify_kind_for(const std::string &content_type)
+	{
+		if (content_type == "text/css") {
+			return minify_kind::css;
+		} else if (content_type == "application/javascript") {
+			return minify_kind::js;
+		} else if (content_type == "image/svg+xml") {
+			return minify_kind::svg;
+		} else if (content_type == "text/html") {
+			return minify_kind::html;
+		}
+
+		return minify_kind::none;
+	}
+
+	namespace detail {
+		inline bool is_identifier_char(char c)
+		{
+			return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$' || static_cast<unsigned char>(c) >= 0x80;
+		}
+
+		// copies the quoted string at s[pos]; false if it is not terminated
+		inline bool copy_quoted(const std::string &s, std::size_t &pos, std::string &out)
+		{
+			auto quote = s[pos];
+			auto begin = pos++;
+
+			while (pos < s.size() && s[pos] != quote) {
+				if (s[pos] == '\\') {
+					++pos;
+				} else if (s[pos] == '\n' && quote != '`') {
+					return false;
+				}
+
+				++pos;
+			}
+
+			if (pos >= s.size()) {
+				return false;
+			}
+
+			out.append(s, begin, ++pos - begin);
+
+			return true;
+		}
+
+		// a space between a and b is needed to keep them apart
+		inline bool space_needed(char a, char b)
+		{
+			return (is_identifier_char(a) && is_identifier_char(b))
+				|| ((a == '+' || a == '-') && (b == '+' || b == '-'))
+				|| (a == '/' && b == '/');
+		}
+
+		class js_minifier {
+			const std::string &s_;
+			std::string out_;
+			std::size_t pos_ = 0;
+			bool failed_ = false;
+
+			// pending whitespace; a newline is kept for automatic semicolon insertion
+			bool space_ = false;
+			bool newline_ = false;
+
+			// a '/' after this starts a regular expression, not a division
+			bool regex_allowed() const
+			{
+				auto end = out_.size();
+
+				while (end > 0 && (out_[end - 1] == ' ' || out_[end - 1] == '\n')) {
+					--end;
+				}
+
+				if (end == 0) {
+					return true;
+				}
+
+				auto c = out_[end - 1];
+
+				if (std::strchr("(,=:[!&|?{};+-*%<>~^", c) != nullptr) {
+					return true;
+				}
+
+				if (!is_identifier_char(c)) {
+					return false;
+				}
+
+				auto begin = end;
+
+				while (begin > 0 && is_identifier_char(out_[begin - 1])) {
+					--begin;
+				}
+
+				static const char *const keywords[] = {
+					"return", "typeof", "instanceof", "case", "do", "else", "in", "of",
+					"new", "delete", "void", "throw", "yield", "await",
+				};
+
+				auto word = out_.substr(begin, end - begin);
+
+				for (auto k : keywords) {
+					if (word == k) {
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+			void flush_space(char next)
+			{
+				if (newline_) {
+					if (!out_.empty()) {
+						out_ += '\n';
+					}
+				} else if (space_ && !out_.empty() && space_needed(out_.back(), next)) {
+					out_ += ' ';
+				}
+
+				space_ = newline_ = false;
+			}
+
+			void copy_regex()
+			{
+				auto begin = pos_++;
+				auto in_class = false;
+
+				while (pos_ < s_.size()) {
+					auto c = s_[pos_];
+
+					if (c == '\n') {
+						failed_ = true;
+						return;
+					}
+
+					if (c == '\\') {
+						pos_ += 2;
+						continue;
+					}
+
+					if (c == '[') {
+						in_class = true;
+					} else if (c == ']') {
+						in_class = false;
+					} else if (c == '/' && !in_class) {
+						break;
+					}
+
+					++pos_;
+				}
+
+				if (pos_ >= s_.size()) {
+					failed_ = true;
+					return;
+				}
+
+				++pos_;
+
+				while (pos_ < s_.size() && is_identifier_char(s_[pos_])) {
+					++pos_;
+				}
+
+				out_.append(s_, begin, pos_ - begin);
+			}
+
+			// template literal; the code of ${...} is minified too
+			void copy_template()
+			{
+				out_ += s_[pos_++];
+
+				while (pos_ < s_.size() && s_[pos_] != '`') {
+					if (s_[pos_] == '\\') {
+						out_.append(s_, pos_, 2);
+						pos_ += 2;
+					} else if (s_.compare(pos_, 2, "${") == 0) {
+						out_ += "${";
+						pos_ += 2;
+						code(true);
+
+						if (failed_) {
+							return;
+						}
+
+						out_ += '}';
+						++pos_;
+					} else {
+						out_ += s_[pos_++];
+					}
+				}
+
+				if (pos_ >= s_.size()) {
+					failed_ = true;
+					return;
+				}
+
+				out_ += s_[pos_++];
+			}
+
+			// until the end, or until the '}' that closes a ${ if in_template
+			void code(bool in_template)
+			{
+				int depth = 0;
+
+				while (pos_ < s_.size() && !failed_) {
+					auto c = s_[pos_];
+
+					if (c == '\n' || c == '\r') {
+						newline_ = true;
+						++pos_;
+					} else if (c == ' ' || c == '\t' || c == '\f' || c == '\v') {
+						space_ = true;
+						++pos_;
+					} else if (s_.compare(pos_, 2, "//") == 0) {
+						auto end = s_.find('\n', pos_);
+						pos_ = end == std::string::npos ? s_.size() : end;
+					} else if (s_.compare(pos_, 2, "/*") == 0) {
+						auto end = s_.find("*/", pos_ + 2);
+
+						if (end == std::string::npos) {
+							failed_ = true;
+							return;
+						}
+
+						if (s_.find('\n', pos_) < end) {
+							newline_ = true;
+						} else {
+							space_ = true;
+						}
+
+						pos_ = end + 2;
+					} else if (in_template && c == '}' && depth == 0) {
+						space_ = newline_ = false;
+						return;
+					} else {
+						auto regex = c == '/' && regex_allowed();
+
+						flush_space(c);
+
+						if (c == '"' || c == '\'') {
+							failed_ = !copy_quoted(s_, pos_, out_);
+						} else if (c == '`') {
+							copy_template();
+						} else if (regex) {
+							copy_regex();
+						} else {
+							if (c == '{') {
+								++depth;
+							} else if (c == '}') {
+								--depth;
+							}
+
+							out_ += c;
+							++pos_;
+						}
+					}
+				}
+
+				if (in_template) {
+					failed_ = true;
+				}
+			}
+
+		public:
+			explicit js_minifier(const std::string &s)
+				: s_(s)
+			{
+			}
+
+			bool run(std::string &out)
+			{
+				out_.reserve(s_.size());
+				code(false);
+
+				if (failed_) {
+					return false;
+				}
+
+				out = std::move(out_);
+				return true;
+			}
+		};
+	}
+
+	inline std::string minify_css(const std::string &css)
+	{
+		std::string out;
+		std::size_t pos = 0;
+		auto space = false;
+
+		out.reserve(css.size());
+
+		while (pos < css.size()) {
+			auto c = css[pos];
+
+			if (detail::is_html_space(c)) {
+				space = true;
+				++pos;
+			} else if (css.compare(pos, 2, "/*") == 0) {
+				auto end = css.find("*/", pos + 2);
+
+				if (end == std::string::npos) {
+					return css;
+				}
+
+				// /*! ... */ is a license
+				if (css.compare(pos, 3, "/*!") == 0) {
+					out.append(css, pos, end + 2 - pos);
+				} else {
+					space = true;
+				}
+
+				pos = end + 2;
+			} else {
+				if (space && !out.empty() && std::strchr("{};,:", out.back()) == nullptr && std::strchr("{};,", c) == nullptr) {
+					out += ' ';
+				}
+
+				space = false;
+
+				if (c == '"' || c == '\'') {
+					if (!detail::copy_quoted(css, pos, out)) {
+						return css;
+					}
+
+					continue;
+				}
+
+				// the last semicolon of a block
+				if (c == '}' && !out.empty() && out.back() == ';') {
+					out.pop_back();
+				}
+
+				out += c;
+				++pos;
+			}
+		}
+
+		return out;
+	}
+
+	inline std::string minify_js(const std::string &js)
+	{
+		std::string out;
+
+		return detail::js_minifier(js).run(out) ? out : js;
+	}
+
+	// Comments and whitespace between tags. Raw text elements and <pre> are
+	// kept as they are; so is a space between elements inside text, where it shows.
+	// For SVG, <metadata> (editor data) is removed as well.
+	inline std::string minify_markup(const std::string &markup, bool svg)
+	{
+		std::string out;
+		std::size_t pos = 0;
+		int preformatted = 0;
+		int text = 0;
+		std::size_t skip_until = std::string::npos;
+
+		out.reserve(markup.size());
+
+		// whitespace between two tags; pos is the start of the next tag
+		auto between = [&](std::size_t begin, std::size_t end) {
+			auto s = markup.substr(begin, end - begin);
+
+			if (skip_until != std::string::npos) {
+				return;
+			}
+
+			auto blank = std::all_of(s.begin(), s.end(), detail::is_html_space);
+
+			if (!blank || preformatted > 0) {
+				out += s;
+			} else if (s.empty() || out.empty() || detail::is_html_space(out.back())) {
+				// around a removed comment
+			} else if (text > 0) {
+				out += ' ';
+			} else if (!svg) {
+				// inline elements are separated by this in HTML
+				out += s.find('\n') != std::string::npos ? '\n' : ' ';
+			}
+		};
+
+		while (pos < markup.size()) {
+			auto lt = markup.find('<', pos);
+
+			if (lt == std::string::npos) {
+				between(pos, markup.size());
+				break;
+			}
+
+			between(pos, lt);
+
+			if (markup.compare(lt, 4, "<!--") == 0) {
+				auto end = markup.find("-->", lt + 4);
+
+				if (end == std::string::npos) {
+					return markup;
+				}
+
+				// conditional comments of old IE are code
+				if (markup.compare(lt, 5, "<!--[") == 0 && skip_until == std::string::npos) {
+					out.append(markup, lt, end + 3 - lt);
+				}
+
+				pos = end + 3;
+				continue;
+			}
+
+			html_tag tag;
+
+			if (!detail::parse_html_tag(markup, lt, tag)) {
+				if (skip_until == std::string::npos) {
+					out += '<';
+				}
+
+				pos = lt + 1;
+				continue;
+			}
+
+			auto end = tag.end;
+
+			if (!tag.closing && !tag.self_closing && is_raw_text_element(tag.name)) {
+				auto close = detail::find_ignore_case(markup, "</" + tag.name, tag.end);
+
+				if (close == std::string::npos) {
+					return markup;
+				}
+
+				end = close;
+			}
+
+			if (svg && tag.name == "metadata" && !tag.closing && !tag.self_closing) {
+				auto close = detail::find_ignore_case(markup, "</metadata", tag.end);
+				auto gt = close == std::string::npos ? close : markup.find('>', close);
+
+				if (gt == std::string::npos) {
+					return markup;
+				}
+
+				pos = gt + 1;
+				continue;
+			}
+
+			if (tag.name == "pre" || tag.name == "textarea") {
+				preformatted += tag.closing ? -1 : tag.self_closing ? 0 : 1;
+			} else if (svg && (tag.name == "text" || tag.name == "tspan" || tag.name == "textpath")) {
+				text += tag.closing ? -1 : tag.self_closing ? 0 : 1;
+			}
+
+			out.append(markup, lt, end - lt);
+			pos = end;
+		}
+
+		return out;
+	}
+
+	inline std::string minify(const std::string &content, minify_kind kind)
+	{
+		switch (kind) {
+		case minify_kind::css:
+			return minify_css(content);
+
+		case minify_kind::js:
+			return minify_js(content);
+
+		case minify_kind::svg:
+			return minify_markup(content, true);
+
+		case minify_kind::html:
+			return minify_markup(content, false);
+
+		default:
+			return content;
+		}
+	}
+
+	struct minify_options {
+		bool enabled = false;
+
+		// minified bodies by content hash; kept in memory only if empty
+		boost::filesystem::path cache_directory;
+
+		std::size_t threads = 1;
+
+		bool operator==(const minify_options &other) const
+		{
+			return enabled == other.enabled && cache_directory == other.cache_directory && threads == other.threads;
+		}
+	};
+
+	// Minified versions of files. The first request for a file is answered
+	// with the original while a worker minifies it; the result goes into the
+	// content cache (under its own hash) and into a disk cache named by the
+	// hash of the original, so later requests and later sessions get it at once.
+	class minify_cache {
+		// bump when the output of the minifiers changes
+		static const int version = 1;
+
+		struct entry {
+			std::uint64_t hash;
+			std::size_t size;
+		};
+
+		minify_options options_;
+		content_cache &contents_;
+
+		std::mutex mutex_;
+		std::unordered_map<std::uint64_t, entry> minified_;
+		std::unordered_set<std::uint64_t> pending_;
+		std::atomic<bool> stopped_{ false };
+
+		// declared last so that the workers are joined before the rest is destroyed
+		worker_pool pool_;
+
+		boost::filesystem::path cache_file(std::uint64_t hash, minify_kind kind) const
+		{
+			static const char *const extensions[] = { "", "css", "js", "svg", "html" };
+
+			return options_.cache_directory
+				/ (to_hex(hash) + ".v" + std::to_string(version) + ".min." + extensions[static_cast<int>(kind)]);
+		}
+
+		void minify_in_background(std::shared_ptr<const std::string> data, std::uint64_t hash, minify_kind kind)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (stopped_ || !pending_.insert(hash).second) {
+					return;
+				}
+			}
+
+			pool_.post([this, data, hash, kind]() {
+				auto result = std::make_shared<std::string>();
+				auto file = options_.cache_directory.empty() ? boost::filesystem::path() : cache_file(hash, kind);
+
+				if (file.empty() || !read_file(file, *result)) {
+					*result = minify(*data, kind);
+
+					if (!file.empty()) {
+						boost::system::error_code error;
+						create_directories(file.parent_path(), error);
+
+						auto temp = file;
+						temp += ".tmp";
+
+						{
+							boost::filesystem::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+							ofs.write(result->data(), result->size());
+						}
+
+						rename(temp, file, error);
+					}
+				}
+
+				// not worth it; the original is served
+				if (result->size() >= data->size()) {
+					result.reset();
+				}
+
+				std::uint64_t minified_hash = 0;
+
+				if (result) {
+					minified_hash = hash_bytes(result->data(), result->size());
+					contents_.insert_body(minified_hash, result);
+				}
+
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				minified_[hash] = { minified_hash, result ? result->size() : 0 };
+				pending_.erase(hash);
+			});
+		}
+
+	public:
+		minify_cache(const minify_options &options, content_cache &contents)
+			: options_(options)
+			, contents_(contents)
+			, pool_(std::max<std::size_t>(1, options.threads))
+		{
+		}
+
+		~minify_cache()
+		{
+			stop();
+		}
+
+		minify_cache(const minify_cache &) = delete;
+		minify_cache &operator=(const minify_cache &) = delete;
+
+		// The minified version of content (same stamp, the hash of the minified
+		// body), or nullptr if it is not ready (then it is made in the background)
+		// or not smaller than the original.
+		content_cache::content_pointer find(const content_cache::content_pointer &content, minify_kind kind)
+		{
+			// the result would not be kept by the content cache
+			if (kind == minify_kind::none || !content || content->data->size() > contents_.max_file_size()) {
+				return nullptr;
+			}
+
+			entry e = { 0, 0 };
+			auto known = false;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				auto iter = minified_.find(content->hash);
+
+				if (iter != minified_.end()) {
+					e = iter->second;
+					known = true;
+				}
+			}
+
+			if (known && e.size == 0) {
+				return nullptr;
+			}
+
+			if (known) {
+				auto body = contents_.find_body(e.hash, e.size);
+
+				if (body) {
+					auto c = std::make_shared<file_content>();
+
+					c->stamp = content->stamp;
+					c->hash = e.hash;
+					c->data = body;
+
+					return c;
+				}
+
+				// evicted from the content cache; made again from the disk cache
+				std::lock_guard<std::mutex> lock(mutex_);
+				minified_.erase(content->hash);
+			}
+
+			minify_in_background(content->data, content->hash, kind);
+
+			return nullptr;
+		}
+
+		// drops queued work
+		void stop()
+		{
+			stopped_ = true;
+			pool_.stop();
+		}
+	};
+}
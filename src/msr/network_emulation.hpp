@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+namespace msr {
+	// Conditions of the link between the server and its clients, emulated on
+	// the write path of every connection; everything off by default.
+	struct network_options {
+		// bytes per second, 0 for unlimited
+		std::size_t bandwidth = 0;
+
+		// round-trip time added before every response, and once more before
+		// the first response of a connection (the TCP handshake)
+		std::chrono::milliseconds latency{ 0 };
+
+		// the round-trip time varies by up to this much either way
+		std::chrono::milliseconds jitter{ 0 };
+
+		// probability that a chunk is lost and sent again after the retransmission timeout;
+		// TCP never drops data, so loss shows as delay
+		double loss = 0.0;
+		std::chrono::milliseconds retransmission_timeout{ 200 };
+
+		bool emulated() const
+		{
+			return bandwidth != 0 || latency.count() != 0 || jitter.count() != 0 || loss > 0.0;
+		}
+	};
+
+	// Delays the writes of one connection according to network_options.
+	// Bandwidth is a token bucket that goes into debt for a chunk larger than
+	// what is available; the next write waits until the debt is paid.
+	class network_shaper {
+		network_options options_;
+		std::mt19937 random_;
+
+		double tokens_;	// bytes
+		std::chrono::steady_clock::time_point refilled_ = std::chrono::steady_clock::now();
+		bool connected_ = false;
+
+		// a burst of a quarter of a second
+		double capacity() const
+		{
+			return options_.bandwidth / 4.0;
+		}
+
+		std::chrono::microseconds round_trip()
+		{
+			auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(options_.latency);
+
+			if (options_.jitter.count() > 0) {
+				auto jitter = std::chrono::duration_cast<std::chrono::microseconds>(options_.jitter).count();
+				rtt += std::chrono::microseconds(std::uniform_int_distribution<std::int64_t>(-jitter, jitter)(random_));
+			}
+
+			return std::max(rtt, std::chrono::microseconds(0));
+		}
+
+	public:
+		explicit network_shaper(const network_options &options)
+			: options_(options)
+			, random_(std::random_device()())
+			, tokens_(capacity())
+		{
+		}
+
+		// how long to wait before writing a chunk of the given size
+		std::chrono::microseconds delay(std::size_t size, bool first_chunk)
+		{
+			std::chrono::microseconds delay(0);
+
+			if (first_chunk) {
+				delay += round_trip();
+
+				if (!connected_) {
+					connected_ = true;
+					delay += round_trip();
+				}
+			}
+
+			if (options_.loss > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(random_) < options_.loss) {
+				delay += std::chrono::duration_cast<std::chrono::microseconds>(options_.retransmission_timeout);
+			}
+
+			if (options_.bandwidth != 0) {
+				auto now = std::chrono::steady_clock::now();
+				auto elapsed = std::chrono::duration<double>(now - refilled_).count();
+
+				refilled_ = now;
+				tokens_ = std::min(capacity(), tokens_ + elapsed * options_.bandwidth);
+
+				// the chunk is paid for now; the debt is waited out before it is sent
+				tokens_ -= static_cast<double>(size);
+
+				if (tokens_ < 0.0) {
+					delay += std::chrono::microseconds(static_cast<std::int64_t>(-tokens_ * 1e6 / options_.bandwidth));
+				}
+			}
+
+			return delay;
+		}
+	};
+}
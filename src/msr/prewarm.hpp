@@ -0,0 +1,389 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "asset_graph.hpp"
+#include "content_cache.hpp"
+#include "hash.hpp"
+#include "http.hpp"
+#include "worker_pool.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace msr {
+	struct prewarm_options {
+		bool enabled = true;
+
+		// stop once this many bytes have been loaded
+		std::size_t budget = 64 * 1024 * 1024;
+
+		std::size_t threads = 2;
+
+		// where the access manifest of each document root is kept; not recorded if empty
+		boost::filesystem::path manifest_directory;
+
+		// number of files kept in a manifest
+		std::size_t manifest_entries = 1024;
+	};
+
+	// Counts which files of a document root are served, so that the next
+	// session can load the hottest ones first.
+	// A manifest is a text file of "<count>\t<path relative to the root>" lines.
+	class access_manifest {
+		std::mutex mutex_;
+		std::unordered_map<std::string, std::size_t> counts_;
+		bool loaded_ = false;
+
+	public:
+		void record(const std::string &relative_path)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++counts_[relative_path];
+		}
+
+		// Merges the counts of a previous session, at half weight so that old
+		// sessions fade out. Only the first call reads the file; a manifest
+		// carried over a reload is not halved again.
+		bool load(const boost::filesystem::path &file)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (loaded_) {
+				return true;
+			}
+
+			boost::filesystem::ifstream ifs(file);
+
+			if (!ifs) {
+				return false;
+			}
+
+			loaded_ = true;
+
+			std::string line;
+
+			while (std::getline(ifs, line)) {
+				auto tab = line.find('\t');
+
+				if (tab == std::string::npos || tab + 1 == line.size()) {
+					continue;
+				}
+
+				try {
+					counts_[line.substr(tab + 1)] += (std::stoul(line.substr(0, tab)) + 1) / 2;
+				} catch (std::exception &) {
+				}
+			}
+
+			return true;
+		}
+
+		bool save(const boost::filesystem::path &file, std::size_t max_entries) const
+		{
+			auto paths = hottest(max_entries);
+
+			boost::system::error_code error;
+			create_directories(file.parent_path(), error);
+
+			auto temp = file;
+			temp += ".tmp";
+
+			{
+				boost::filesystem::ofstream ofs(temp);
+
+				if (!ofs) {
+					return false;
+				}
+
+				for (auto &p : paths) {
+					ofs << p.second << '\t' << p.first << '\n';
+				}
+
+				if (!ofs) {
+					ofs.close();
+					remove(temp, error);
+					return false;
+				}
+			}
+
+			rename(temp, file, error);
+
+			return !error;
+		}
+
+		// most served first
+		std::vector<std::pair<std::string, std::size_t>> hottest(std::size_t max_entries) const
+		{
+			std::vector<std::pair<std::string, std::size_t>> paths;
+
+			{
+				std::lock_guard<std::mutex> lock(const_cast<std::mutex &>(mutex_));
+				paths.assign(counts_.begin(), counts_.end());
+			}
+
+			std::sort(paths.begin(), paths.end(), [](const auto &a, const auto &b) {
+				return a.second != b.second ? a.second > b.second : a.first < b.first;
+			});
+
+			if (paths.size() > max_entries) {
+				paths.resize(max_entries);
+			}
+
+			return paths;
+		}
+	};
+
+	// Loads files of a document root into the content cache in the background
+	// at startup, so that the first pass through a deck does not wait on disk.
+	// The order is the manifest of the previous session if there is one,
+	// otherwise the critical assets of index.html followed by the rest of the
+	// tree, text before media. Loading pauses while requests are being served.
+	class cache_prewarmer {
+	public:
+		// true while the server is busy with requests
+		using busy_function = std::function<bool()>;
+
+	private:
+		boost::filesystem::path root_;
+		prewarm_options options_;
+		content_cache &contents_;
+		asset_graph &assets_;
+		busy_function busy_;
+		std::shared_ptr<access_manifest> manifest_;
+		std::atomic<bool> stopped_{ false };
+
+		// signalled by notify_idle() and stop()
+		std::mutex idle_mutex_;
+		std::condition_variable idle_;
+
+		// declared last so that the workers are joined before the rest is destroyed
+		worker_pool pool_;
+
+		boost::filesystem::path manifest_file() const
+		{
+			if (options_.manifest_directory.empty()) {
+				return boost::filesystem::path();
+			}
+
+			auto root = root_.generic_string();
+
+			return options_.manifest_directory / (to_hex(hash_bytes(root.data(), root.size())) + ".manifest");
+		}
+
+		static boost::filesystem::path canonical_root(const boost::filesystem::path &root)
+		{
+			boost::system::error_code error;
+			auto path = canonical(absolute(root), error);
+
+			return error ? absolute(root) : path;
+		}
+
+		static int file_rank(const boost::filesystem::path &file)
+		{
+			auto type = content_type(file.extension().string());
+
+			if (type == "text/html" || type == "text/css" || type == "application/javascript") {
+				return 0;
+			}
+
+			if (is_font_url(file.filename().string())) {
+				return 1;
+			}
+
+			return type.compare(0, 6, "image/") == 0 ? 2 : 3;
+		}
+
+		std::vector<boost::filesystem::path> walk_root()
+		{
+			std::vector<boost::filesystem::path> files;
+
+			auto index = root_ / "index.html";
+			boost::system::error_code error;
+
+			if (is_regular_file(index, error)) {
+				files.push_back(index);
+
+				for (auto &a : assets_.page_assets(root_, index, "/index.html")) {
+					if (a.kind != asset_kind::media) {
+						files.push_back(root_ / url_path(a.url));
+					}
+				}
+			}
+
+			std::vector<std::pair<boost::filesystem::path, std::uintmax_t>> rest;
+			boost::filesystem::recursive_directory_iterator iter(root_, error), end;
+
+			while (!error && iter != end && !stopped_) {
+				auto &path = iter->path();
+
+				if (path.filename().string().compare(0, 1, ".") == 0) {
+					// .git and the like
+					if (is_directory(path, error)) {
+						iter.no_push();
+					}
+				} else if (is_regular_file(path, error)) {
+					rest.emplace_back(path, file_size(path, error));
+				}
+
+				iter.increment(error);
+			}
+
+			std::stable_sort(rest.begin(), rest.end(), [](const auto &a, const auto &b) {
+				auto ra = file_rank(a.first), rb = file_rank(b.first);
+
+				return ra != rb ? ra < rb : a.second < b.second;
+			});
+
+			for (auto &r : rest) {
+				files.push_back(r.first);
+			}
+
+			return files;
+		}
+
+		void run()
+		{
+			std::vector<boost::filesystem::path> files;
+
+			auto manifest = manifest_file();
+
+			if (!manifest.empty() && manifest_->load(manifest)) {
+				for (auto &p : manifest_->hottest(options_.manifest_entries)) {
+					files.push_back(root_ / p.first);
+				}
+			} else {
+				files = walk_root();
+			}
+
+			std::size_t queued = 0;
+			std::set<boost::filesystem::path> seen;
+
+			for (auto &f : files) {
+				boost::system::error_code error;
+				auto size = file_size(f, error);
+
+				if (error || size > contents_.max_file_size() || !seen.insert(f).second) {
+					continue;
+				}
+
+				if (queued + size > options_.budget) {
+					break;
+				}
+
+				queued += static_cast<std::size_t>(size);
+
+				pool_.post([this, f]() {
+					// live requests first, but not for longer than a second
+					if (busy_) {
+						std::unique_lock<std::mutex> lock(idle_mutex_);
+						idle_.wait_for(lock, std::chrono::seconds(1), [this]() { return stopped_ || !busy_(); });
+					}
+
+					if (!stopped_) {
+						contents_.load(f);
+					}
+				});
+			}
+		}
+
+		static void initialize_worker()
+		{
+#ifdef _WIN32
+			// lower CPU and I/O priority
+			::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#endif
+		}
+
+	public:
+		cache_prewarmer(
+			const boost::filesystem::path &root,
+			const prewarm_options &options,
+			content_cache &contents,
+			asset_graph &assets,
+			busy_function busy,
+			std::shared_ptr<access_manifest> manifest = nullptr)
+			: root_(canonical_root(root))
+			, options_(options)
+			, contents_(contents)
+			, assets_(assets)
+			, busy_(std::move(busy))
+			, manifest_(manifest ? std::move(manifest) : std::make_shared<access_manifest>())
+			, pool_(std::max<std::size_t>(1, options.threads), &cache_prewarmer::initialize_worker)
+		{
+		}
+
+		~cache_prewarmer()
+		{
+			stop();
+		}
+
+		void start()
+		{
+			pool_.post([this]() {
+				run();
+			});
+		}
+
+		// the busy function may have become false; waiting loads resume
+		void notify_idle()
+		{
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex_);
+			}
+
+			idle_.notify_all();
+		}
+
+		// the counts of this root, to carry over to the prewarmer of a reloaded provider
+		std::shared_ptr<access_manifest> manifest() const
+		{
+			return manifest_;
+		}
+
+		// records that a file under the root has been served
+		void record(const boost::filesystem::path &file)
+		{
+			auto root = root_.generic_string();
+			auto path = file.generic_string();
+
+			if (path.compare(0, root.size(), root) == 0 && path.size() > root.size() + 1) {
+				manifest_->record(path.substr(root.size() + 1));
+			}
+		}
+
+		// pending loads are dropped and the manifest is written
+		void stop()
+		{
+			if (stopped_.exchange(true)) {
+				return;
+			}
+
+			notify_idle();
+			pool_.stop();
+
+			auto manifest = manifest_file();
+
+			if (!manifest.empty()) {
+				manifest_->save(manifest, options_.manifest_entries);
+			}
+		}
+	};
+}
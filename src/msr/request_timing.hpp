@@ -0,0 +1,138 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace msr {
+	struct request_timing {
+		std::uint64_t connection = 0;
+
+		// requests served on the connection before this one
+		std::size_t reused = 0;
+
+		std::string method;
+		std::string uri;
+		std::string host;
+		std::string referer;
+		int status = 0;
+		std::string content_type;
+		std::size_t body_size = 0;
+
+		// the head of the request has been read
+		std::chrono::steady_clock::time_point received;
+
+		// the response head and the first chunk of the body have been written
+		std::chrono::steady_clock::time_point first_byte;
+
+		std::chrono::steady_clock::time_point finished;
+
+		// part of the time spent in emulated network conditions
+		std::chrono::microseconds emulated_delay{ 0 };
+	};
+
+	struct timing_options {
+		// number of requests kept in memory
+		std::size_t entries = 4096;
+
+		// not written if empty
+		boost::filesystem::path log_file;
+
+		// page load timelines written when the server shuts down; not written if empty
+		boost::filesystem::path trace_file;	// Chrome trace event format
+		boost::filesystem::path har_file;	// HTTP Archive
+	};
+
+	// The last requests of a server and how long they took, optionally also
+	// appended to a log of tab separated lines:
+	// received, time to first byte, total, emulated delay (ms), status, bytes, content type, method, URI.
+	class timing_recorder {
+		std::mutex mutex_;
+		std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+		std::chrono::system_clock::time_point origin_time_ = std::chrono::system_clock::now();
+		std::size_t capacity_;
+		std::deque<request_timing> entries_;
+		boost::filesystem::ofstream log_;
+
+		static double milliseconds(std::chrono::steady_clock::duration d)
+		{
+			return std::chrono::duration<double, std::milli>(d).count();
+		}
+
+	public:
+		explicit timing_recorder(std::size_t capacity = 4096, const boost::filesystem::path &log_file = boost::filesystem::path())
+			: capacity_(capacity)
+		{
+			if (!log_file.empty()) {
+				boost::system::error_code error;
+				create_directories(log_file.parent_path(), error);
+
+				log_.open(log_file, std::ios::app);
+				log_ << std::fixed << std::setprecision(3);
+			}
+		}
+
+		timing_recorder(const timing_recorder &) = delete;
+		timing_recorder &operator=(const timing_recorder &) = delete;
+
+		// times are relative to this
+		std::chrono::steady_clock::time_point origin() const
+		{
+			return origin_;
+		}
+
+		// origin() in wall-clock time
+		std::chrono::system_clock::time_point origin_time() const
+		{
+			return origin_time_;
+		}
+
+		void record(const request_timing &t)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (capacity_ != 0) {
+				if (entries_.size() == capacity_) {
+					entries_.pop_front();
+				}
+
+				entries_.push_back(t);
+			}
+
+			if (log_.is_open()) {
+				log_ << milliseconds(t.received - origin_) << '\t'
+					<< milliseconds(t.first_byte - t.received) << '\t'
+					<< milliseconds(t.finished - t.received) << '\t'
+					<< milliseconds(t.emulated_delay) << '\t'
+					<< t.status << '\t'
+					<< t.body_size << '\t'
+					<< t.content_type << '\t'
+					<< t.method << '\t'
+					<< t.uri << '\n';
+
+				// so that the log can be followed while the deck loads
+				log_.flush();
+			}
+		}
+
+		// oldest first
+		std::vector<request_timing> entries()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return std::vector<request_timing>(entries_.begin(), entries_.end());
+		}
+
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			entries_.clear();
+		}
+	};
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MSR_RESAMPLE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace msr {
+	// 32bpp premultiplied BGRA, rows are packed (stride == width * 4)
+	struct bitmap {
+		unsigned width = 0;
+		unsigned height = 0;
+		std::vector<std::uint8_t> pixels;
+
+		void resize(unsigned w, unsigned h)
+		{
+			width = w;
+			height = h;
+			pixels.assign(static_cast<std::size_t>(w) * h * 4, 0);
+		}
+	};
+
+	namespace detail {
+		// weights of the source pixels covered by each destination pixel (box filter)
+		struct resample_taps {
+			std::vector<unsigned> first;
+			std::vector<unsigned> count;
+			std::vector<unsigned> offset;
+			std::vector<float> weights;
+
+			resample_taps(unsigned src, unsigned dst)
+				: first(dst), count(dst), offset(dst)
+			{
+				double scale = static_cast<double>(src) / dst;
+
+				for (unsigned i = 0; i < dst; ++i) {
+					double begin = i * scale;
+					double end = (i + 1) * scale;
+					auto b = static_cast<unsigned>(begin);
+					auto e = std::min(src, static_cast<unsigned>(std::ceil(end)));
+
+					first[i] = b;
+					count[i] = e - b;
+					offset[i] = static_cast<unsigned>(weights.size());
+
+					for (unsigned j = b; j < e; ++j) {
+						double lo = std::max(begin, static_cast<double>(j));
+						double hi = std::min(end, static_cast<double>(j + 1));
+						weights.push_back(static_cast<float>((hi - lo) / scale));
+					}
+				}
+			}
+		};
+
+		// one source row -> dst_width pixels of 4 float channels
+		inline void resample_row(const std::uint8_t *src, const resample_taps &taps, float *out)
+		{
+			auto dst_width = taps.first.size();
+
+			for (std::size_t x = 0; x < dst_width; ++x) {
+				auto p = src + taps.first[x] * 4;
+				auto w = &taps.weights[taps.offset[x]];
+				auto n = taps.count[x];
+
+#ifdef MSR_RESAMPLE_SSE2
+				__m128 acc = _mm_setzero_ps();
+				__m128i zero = _mm_setzero_si128();
+
+				for (unsigned k = 0; k < n; ++k, p += 4) {
+					__m128i px = _mm_cvtsi32_si128(*reinterpret_cast<const int *>(p));
+					px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(px, zero), zero);
+					acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(px), _mm_set1_ps(w[k])));
+				}
+
+				_mm_storeu_ps(out + x * 4, acc);
+#else
+				float acc[4] = {};
+
+				for (unsigned k = 0; k < n; ++k, p += 4) {
+					for (int c = 0; c < 4; ++c) {
+						acc[c] += p[c] * w[k];
+					}
+				}
+
+				for (int c = 0; c < 4; ++c) {
+					out[x * 4 + c] = acc[c];
+				}
+#endif
+			}
+		}
+
+		inline void accumulate_row(float *acc, const float *row, float weight, std::size_t floats)
+		{
+			std::size_t i = 0;
+
+#ifdef MSR_RESAMPLE_SSE2
+			__m128 w = _mm_set1_ps(weight);
+
+			for (; i + 4 <= floats; i += 4) {
+				_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+			}
+#endif
+
+			for (; i < floats; ++i) {
+				acc[i] += row[i] * weight;
+			}
+		}
+
+		inline void store_row(const float *acc, std::uint8_t *out, std::size_t floats)
+		{
+			std::size_t i = 0;
+
+#ifdef MSR_RESAMPLE_SSE2
+			__m128 half = _mm_set1_ps(0.5f);
+
+			for (; i + 16 <= floats; i += 16) {
+				__m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i), half));
+				__m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 4), half));
+				__m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 8), half));
+				__m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 12), half));
+				__m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+			}
+#endif
+
+			for (; i < floats; ++i) {
+				auto v = static_cast<int>(acc[i] + 0.5f);
+				out[i] = static_cast<std::uint8_t>(v < 0 ? 0 : v > 255 ? 255 : v);
+			}
+		}
+	}
+
+	// Area-averaging downscale. Only shrinks; returns false when the
+	// requested size is not smaller than the source.
+	// Source rows are visited once, so memory stays at a few destination rows.
+	inline bool downscale(const bitmap &src, unsigned width, unsigned height, bitmap &dst)
+	{
+		if (width == 0 || height == 0 || width > src.width || height > src.height
+			|| (width == src.width && height == src.height))
+		{
+			return false;
+		}
+
+		detail::resample_taps htaps(src.width, width);
+		detail::resample_taps vtaps(src.height, height);
+
+		auto floats = static_cast<std::size_t>(width) * 4;
+		std::vector<float> row(floats), acc(floats);
+		std::size_t src_stride = static_cast<std::size_t>(src.width) * 4;
+		unsigned row_y = src.height;
+
+		dst.resize(width, height);
+
+		for (unsigned y = 0; y < height; ++y) {
+			std::fill(acc.begin(), acc.end(), 0.0f);
+
+			auto w = &vtaps.weights[vtaps.offset[y]];
+
+			for (unsigned k = 0; k < vtaps.count[y]; ++k) {
+				auto sy = vtaps.first[y] + k;
+
+				// the boundary row is shared with the previous destination row
+				if (sy != row_y) {
+					detail::resample_row(&src.pixels[sy * src_stride], htaps, row.data());
+					row_y = sy;
+				}
+
+				detail::accumulate_row(acc.data(), row.data(), w[k], floats);
+			}
+
+			detail::store_row(acc.data(), &dst.pixels[y * floats], floats);
+		}
+
+		return true;
+	}
+}
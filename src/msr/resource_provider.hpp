@@ -0,0 +1,1447 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "asset_graph.hpp"
+#include "asset_inliner.hpp"
+#include "audience.hpp"
+#include "cache_policy.hpp"
+#include "content_cache.hpp"
+#include "deck_analyzer.hpp"
+#include "deck_split.hpp"
+#include "embedded_resources.hpp"
+#include "font_pipeline.hpp"
+#include "hash.hpp"
+#include "highlight.hpp"
+#include "http.hpp"
+#include "image_pipeline.hpp"
+#include "lazy_media.hpp"
+#include "lru_cache.hpp"
+#include "minify.hpp"
+#include "prewarm.hpp"
+#include "search_index.hpp"
+#include "worker_pool.hpp"
+
+// Resolves requests to responses independently of how they arrive.
+// Used by msr::tcp_server and by the in-process reveal:// scheme handler.
+
+namespace msr {
+	struct preload_options {
+		// send Link: rel=preload headers with HTML pages
+		bool enabled = true;
+
+		// also send them as 103 Early Hints before the response, as they were
+		// sent with the last response for the page (see early_hints())
+		// (Chromium only acts on Early Hints received over HTTP/2 or later)
+		bool early_hints = false;
+
+		std::size_t max_links = 32;
+	};
+
+	struct provider_options {
+		image_options images;
+		preload_options preload;
+		prewarm_options prewarm;
+		inline_options inlining;
+		lazy_media_options lazy_media;
+		deck_split_options deck_split;
+		highlight_options highlight;
+		search_options search;
+		minify_options minify;
+		font_options fonts;
+		cache_policy cache;
+
+		// pages follow the presenter (/.msr/follow.js, /.msr/follow, /.msr/present)
+		bool audience = false;
+
+		std::size_t content_cache_budget = 256 * 1024 * 1024;
+		std::size_t content_cache_max_file_size = 16 * 1024 * 1024;
+
+		// limits checked by /.msr/analysis.json
+		analysis_budgets budgets;
+
+		// persistent index of content hashes; kept in memory only if empty
+		boost::filesystem::path hash_index_file;
+
+		// the hot part of the content cache is written here by stop() and
+		// read back by the next provider; not kept if empty
+		boost::filesystem::path snapshot_file;
+		std::size_t snapshot_budget = 64 * 1024 * 1024;
+	};
+
+	// width in device pixels the client wants an image to be, 0 if unspecified
+	// (query ?w=, or the Sec-CH-Width / Sec-CH-Viewport-Width and Sec-CH-DPR client hints)
+	inline unsigned requested_image_width(const request_data &request)
+	{
+		auto to_number = [](const std::string &s) {
+			try {
+				return s.empty() ? 0.0 : std::stod(s);
+			} catch (std::exception &) {
+				return 0.0;
+			}
+		};
+
+		auto w = to_number(query_parameter(request.query, "w"));
+
+		if (w <= 0.0) {
+			w = to_number(request.header("sec-ch-width"));
+		}
+
+		if (w <= 0.0) {
+			auto dpr = to_number(request.header("sec-ch-dpr"));
+			w = to_number(request.header("sec-ch-viewport-width")) * (dpr > 0.0 ? dpr : 1.0);
+		}
+
+		return w > 0.0 && w < 65536.0 ? static_cast<unsigned>(std::ceil(w)) : 0;
+	}
+
+	// A document root served under a path prefix and/or for a Host header.
+	struct mount_point {
+		// "" or "/name"; requests for "/name/..." are served as "/..."
+		std::string prefix;
+
+		// lower case, without the port; empty for any host
+		std::string host;
+
+		boost::filesystem::path root;
+		std::unique_ptr<cache_prewarmer> prewarmer;
+	};
+
+	// Serves one or more document roots. The content cache, the asset graph
+	// and the image pipeline are shared by all of them, under the budgets of
+	// provider_options, so mounting more decks does not multiply memory.
+	// Thread-safe; front ends may call handle() concurrently from any thread.
+	class resource_provider {
+	public:
+		using handler_type = std::function<void(response_data)>;
+
+	private:
+		using mount_pointer = std::shared_ptr<const mount_point>;
+		using mount_list = std::vector<mount_pointer>;
+
+		boost::filesystem::path root_;
+		provider_options options_;
+		// shared with the provider this one replaces if their options are the same,
+		// so that a reload keeps what has been cached
+		std::shared_ptr<content_hash_index> index_;
+		std::shared_ptr<content_cache> contents_;
+		std::shared_ptr<asset_graph> assets_;
+		asset_inliner inliner_;
+		lazy_media_cache lazy_media_;
+		deck_split_cache deck_split_;
+		std::unique_ptr<image_pipeline> images_;
+		std::shared_ptr<minify_cache> minified_;	// shared like contents_
+		std::shared_ptr<font_pipeline> fonts_;	// shared like contents_
+		std::unique_ptr<highlight_cache> highlighted_;
+		std::shared_ptr<search_index_set> searches_;	// shared like fonts_
+
+		follower_channel followers_;
+
+		// Link header last sent with each page, by the host of its mount and its URL
+		lru_cache<std::string, std::string> early_hints_{ 1024 * 1024 };
+
+		std::atomic<bool> snapshot_saved_{ false };
+
+		// replaced by another provider, which now owns the shared index and caches
+		std::atomic<bool> retired_{ false };
+
+		// access counts of the prewarmers by document root, carried over a reload
+		mutable std::mutex manifests_mutex_;
+		std::unordered_map<std::string, std::shared_ptr<access_manifest>> manifests_;
+
+		// requests whose handler has not been called yet
+		std::atomic<int> active_{ 0 };
+
+		// those of them that are not long polls waiting for the presenter;
+		// the prewarmers wait while there are any
+		std::atomic<int> serving_{ 0 };
+
+		// reserved endpoints that take long (/.msr/analysis.json) and search
+		// index refreshes; created on first use
+		std::mutex tasks_mutex_;
+		std::unique_ptr<worker_pool> tasks_;
+
+		// streamed bodies read for front ends that must not block (see read_body());
+		// created on first use, under tasks_mutex_
+		std::unique_ptr<worker_pool> readers_;
+
+		// replaced as a whole when a root is mounted or unmounted
+		std::mutex mounts_mutex_;
+		std::shared_ptr<const mount_list> mounts_;
+
+		std::shared_ptr<const mount_list> mounts()
+		{
+			std::lock_guard<std::mutex> lock(mounts_mutex_);
+			return mounts_;
+		}
+
+		static std::string normalize_prefix(const std::string &prefix)
+		{
+			auto p = normalize_url_path(prefix.empty() || prefix[0] != '/' ? '/' + prefix : prefix);
+
+			while (!p.empty() && p.back() == '/') {
+				p.pop_back();
+			}
+
+			return p;
+		}
+
+		static std::string request_host(const request_data &request)
+		{
+			auto host = boost::algorithm::to_lower_copy(request.header("host"));
+			auto bracket = host.rfind(']');
+			auto colon = host.rfind(':');
+
+			if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+				host.erase(colon);
+			}
+
+			return host;
+		}
+
+		// The mount for a request: one for its host before one for any host,
+		// then the longest prefix.
+		mount_pointer find_mount(const request_data &request)
+		{
+			auto list = mounts();
+			auto host = request_host(request);
+			mount_pointer found;
+
+			for (auto &m : *list) {
+				if (!m->host.empty() && m->host != host) {
+					continue;
+				}
+
+				auto &prefix = m->prefix;
+
+				if (!prefix.empty()
+					&& (request.uri.compare(0, prefix.size(), prefix) != 0
+						|| (request.uri.size() > prefix.size() && request.uri[prefix.size()] != '/')))
+				{
+					continue;
+				}
+
+				if (!found
+					|| (found->host.empty() && !m->host.empty())
+					|| (found->host.empty() == m->host.empty() && found->prefix.size() < prefix.size()))
+				{
+					found = m;
+				}
+			}
+
+			return found;
+		}
+
+		// the work no request waits for
+		void stop_background()
+		{
+			followers_.release();
+
+			for (auto &m : *mounts()) {
+				if (m->prewarmer) {
+					m->prewarmer->stop();
+				}
+			}
+
+			// a successor that shares the content cache writes the snapshot when it stops
+			if (!options_.snapshot_file.empty() && !(retired_ && contents_.use_count() > 1) && !snapshot_saved_.exchange(true)) {
+				contents_->save_snapshot(options_.snapshot_file, options_.snapshot_budget);
+			}
+		}
+
+		std::unique_ptr<cache_prewarmer> make_prewarmer(const boost::filesystem::path &root)
+		{
+			if (!options_.prewarm.enabled) {
+				return nullptr;
+			}
+
+			std::shared_ptr<access_manifest> manifest;
+
+			{
+				std::lock_guard<std::mutex> lock(manifests_mutex_);
+
+				auto &m = manifests_[root.generic_string()];
+
+				if (!m) {
+					m = std::make_shared<access_manifest>();
+				}
+
+				manifest = m;
+			}
+
+			return std::unique_ptr<cache_prewarmer>(new cache_prewarmer(root, options_.prewarm, *contents_, *assets_, [this]() {
+				return serving_ > 0;
+			}, manifest));
+		}
+
+		static response_data make_error(const std::string &status, const std::string &message = std::string())
+		{
+			response_data response;
+
+			response.status = status;
+
+			if (!message.empty()) {
+				response.add_header("Content-Type", "text/plain");
+				response.set_body(message);
+			}
+
+			return response;
+		}
+
+		// gzip as it is embedded, or inflated for clients that do not accept it
+		response_data make_embedded(const request_data &request, const embedded_resource &resource) const
+		{
+			response_data response;
+			auto path = boost::filesystem::path(resource.path);
+			auto gzip = request.header("accept-encoding").find("gzip") != std::string::npos;
+
+			// the two encodings are different representations
+			std::string etag = resource.etag;
+
+			if (!gzip) {
+				etag.insert(etag.size() - 1, "-identity");
+			}
+
+			response.add_header("ETag", etag);
+			response.add_header("Cache-Control", "public, max-age=31536000, immutable");
+			response.add_header("Vary", "Accept-Encoding");
+
+			if (request.header("if-none-match") == etag) {
+				response.status = "304 Not Modified";
+				return response;
+			}
+
+			response.add_header("Content-Type", content_type(path.extension().string()));
+
+			if (gzip) {
+				response.add_header("Content-Encoding", "gzip");
+				response.set_body(reinterpret_cast<const char *>(resource.data), resource.size, nullptr);
+			} else {
+				auto identity = embedded_identity(resource);
+
+				if (!identity) {
+					return make_error("500 Internal Server Error", std::string(resource.path) + " could not be inflated");
+				}
+
+				response.set_body(identity->data(), identity->size(), identity);
+			}
+
+			return response;
+		}
+
+		// path is root or under it; both canonical
+		static bool is_within(const boost::filesystem::path &root, const boost::filesystem::path &path)
+		{
+			auto p = path.begin();
+
+			for (auto &r : root) {
+				if (p == path.end() || *p != r) {
+					return false;
+				}
+
+				++p;
+			}
+
+			return true;
+		}
+
+		static std::string strong_etag(std::uint64_t hash)
+		{
+			return '"' + to_hex(hash) + '"';
+		}
+
+		// "?v=<content hash>" of a file, empty if it cannot be read or has not been hashed yet
+		// (it is then hashed in the background for the next request)
+		std::string file_version(const boost::filesystem::path &file)
+		{
+			file_stamp stamp;
+			std::uint64_t hash;
+
+			if (!get_file_stamp(file, stamp)) {
+				return std::string();
+			}
+
+			if (!index_->find(file, stamp, hash)) {
+				index_->hash_in_background(file);
+				return std::string();
+			}
+
+			return "?v=" + to_hex(hash);
+		}
+
+		// variant is a resized image to send instead of the file, or nullptr;
+		// request.uri is relative to the mount
+		response_data make_file(
+			const mount_point &mount,
+			const request_data &request,
+			const boost::filesystem::path &path,
+			image_pipeline::variant_pointer variant)
+		{
+			response_data response;
+			auto type = content_type(path.extension().string());
+			auto &policy = options_.cache;
+
+			// the page is rewritten (references carry the versions of the files, small assets
+			// are inlined, media are loaded lazily, slides on demand, or code is highlighted),
+			// so it is validated by its rewritten content instead of its mtime
+			auto rewritten_html = type == "text/html" && !variant
+				&& (policy.hashed_urls || options_.inlining.enabled || options_.lazy_media.enabled
+					|| options_.deck_split.enabled || options_.highlight.enabled || options_.audience);
+
+			// ?original=1 bypasses minification
+			auto minifiable = minified_ && !variant && query_parameter(request.query, "original") != "1";
+
+			// the minified content if it is ready, else the original
+			auto minified = [&](const content_cache::content_pointer &content, const std::string &content_type) {
+				auto m = minifiable ? minified_->find(content, minify_kind_for(content_type)) : nullptr;
+				return m ? m : content;
+			};
+
+			// the references of the page that carry a version, so that its preloads match them
+			std::map<std::string, std::string> versioned;
+
+			auto version = [&](const std::string &url) {
+				auto v = file_version(mount.root / url_path(url));
+
+				if (!v.empty()) {
+					versioned[url] = v;
+				}
+
+				return v;
+			};
+
+			file_stamp stamp;
+
+			if (!get_file_stamp(path, stamp)) {
+				return make_error("500 Internal Server Error", path.string() + " could not be read");
+			}
+
+			auto v = query_parameter(request.query, "v");
+			auto directive = policy.hashed_urls && !v.empty() && "?v=" + v == file_version(path)
+				? policy.immutable_directive
+				: policy.directive(request.uri);
+
+			if (!directive.empty()) {
+				response.add_header("Cache-Control", directive);
+			}
+
+			if (images_) {
+				if (image_pipeline::is_resizable(path)) {
+					response.add_header("Vary", "Accept, Sec-CH-Width, Sec-CH-Viewport-Width, Sec-CH-DPR");
+				} else if (type == "text/html") {
+					response.add_header("Accept-CH", "Sec-CH-Width, Sec-CH-Viewport-Width, Sec-CH-DPR");
+				}
+			}
+
+			std::uint64_t hash = 0;
+			auto has_etag = false;
+
+			if (!rewritten_html) {
+				auto last_modified = boost::posix_time::from_time_t(stamp.mtime);
+
+				response.add_header("Last-Modified", format_time(last_modified));
+
+				// variants have no ETag; they depend on the width and the format too;
+				// minified content is validated by its own hash, known after loading
+				if (!variant && !(minifiable && minify_kind_for(type) != minify_kind::none) && index_->find(path, stamp, hash)) {
+					response.add_header("ETag", strong_etag(hash));
+					has_etag = true;
+				}
+
+				// If-None-Match takes precedence over If-Modified-Since
+				auto none_match = request.header("if-none-match");
+				auto since = parse_time(request.header("if-modified-since"));
+
+				if (!none_match.empty()
+					? has_etag && etag_matches(none_match, strong_etag(hash))
+					: !since.is_not_a_date_time() && last_modified <= since)
+				{
+					response.status = "304 Not Modified";
+					return response;
+				}
+			}
+
+			if (variant) {
+				response.add_header("Content-Type", variant->content_type);
+				response.set_body(variant->data.data(), variant->data.size(), variant);
+
+				return response;
+			}
+
+			// too large to be cached; streamed in chunks as it is sent instead of read whole here
+			if (type != "text/html" && stamp.size > contents_->max_file_size()) {
+				auto file = std::make_shared<boost::filesystem::ifstream>(path, std::ios::binary);
+
+				if (!*file) {
+					return make_error("500 Internal Server Error", path.string() + " could not be read");
+				}
+
+				// the next response has an ETag
+				if (!has_etag) {
+					index_->hash_in_background(path);
+				}
+
+				response.add_header("Content-Type", type);
+				response.set_body_reader(static_cast<std::size_t>(stamp.size), [file](std::uint64_t offset, char *buffer, std::size_t size) {
+					file->seekg(static_cast<std::streamoff>(offset));
+					file->read(buffer, static_cast<std::streamsize>(size));
+
+					return static_cast<std::size_t>(file->gcount());
+				});
+
+				return response;
+			}
+
+			auto content = type == "text/html" && options_.deck_split.enabled
+				? deck_split_.load(path, stamp, [&]() { return contents_->load(path); })
+				: contents_->load(path);
+
+			if (!content) {
+				return make_error("500 Internal Server Error", path.string() + " could not be read");
+			}
+
+			if (mount.prewarmer) {
+				mount.prewarmer->record(path);
+			}
+
+			content = minified(content, type);
+
+			response.add_header("Content-Type", type);
+
+			std::vector<std::string> inlined;
+
+			// ?section=N: a slide of a split deck, for the loader of its skeleton
+			auto section = query_parameter(request.query, "section");
+
+			if (rewritten_html && options_.deck_split.enabled && !section.empty()) {
+				std::string html;
+				std::size_t index = 0;
+
+				try {
+					index = std::stoul(section);
+				} catch (std::exception &) {
+					return make_error("404 Not Found");
+				}
+
+				if (!deck_split_.section(content, index, html)) {
+					return make_error("404 Not Found");
+				}
+
+				if (highlighted_) {
+					html = highlighted_->rewrite(html);
+				}
+
+				if (policy.hashed_urls) {
+					html = rewrite_html_references(html, request.uri, version);
+				}
+
+				auto etag = '"' + to_hex(hash_bytes(html.data(), html.size())) + '"';
+
+				response.add_header("ETag", etag);
+
+				if (request.header("if-none-match") == etag) {
+					response.status = "304 Not Modified";
+					return response;
+				}
+
+				response.set_body(std::move(html));
+
+				return response;
+			}
+
+			if (rewritten_html) {
+				std::string html;
+				auto page = options_.deck_split.enabled ? deck_split_.skeleton(content) : content;
+
+				if (highlighted_) {
+					page = highlighted_->transform(page);
+				}
+
+				if (options_.lazy_media.enabled) {
+					page = lazy_media_.transform(page);
+				}
+
+				if (options_.inlining.enabled) {
+					auto result = inliner_.transform(*page, request.uri, mount.prefix, [&](const std::string &url) {
+						auto asset = contents_->load(mount.root / url);
+						return asset ? minified(asset, content_type(boost::filesystem::path(url).extension().string())) : asset;
+					});
+
+					html = result->html;
+					inlined = result->urls;
+				} else {
+					html = *page->data;
+				}
+
+				if (policy.hashed_urls) {
+					html = rewrite_html_references(html, request.uri, version);
+				}
+
+				if (options_.audience) {
+					auto body = detail::find_ignore_case(html, "</body", 0);
+					html.insert(body == std::string::npos ? html.size() : body, "<script src=\"/.msr/follow.js\"></script>");
+				}
+
+				auto etag = '"' + to_hex(hash_bytes(html.data(), html.size())) + '"';
+
+				response.add_header("ETag", etag);
+
+				if (request.header("if-none-match") == etag) {
+					response.status = "304 Not Modified";
+					return response;
+				}
+
+				response.set_body(std::move(html));
+			} else {
+				if (!has_etag) {
+					response.add_header("ETag", strong_etag(content->hash));
+
+					if (etag_matches(request.header("if-none-match"), strong_etag(content->hash))) {
+						response.status = "304 Not Modified";
+						return response;
+					}
+				}
+
+				response.set_body(content->data->data(), content->data->size(), content);
+			}
+
+			if (type == "text/html" && options_.preload.enabled) {
+				auto assets = assets_->page_assets(mount.root, path, request.uri);
+
+				// what has been inlined needs no request
+				assets.erase(std::remove_if(assets.begin(), assets.end(), [&](const asset_reference &a) {
+					return std::find(inlined.begin(), inlined.end(), a.url) != inlined.end();
+				}), assets.end());
+
+				// fonts and images found in stylesheets are requested without a version
+				for (auto &a : assets) {
+					auto v = versioned.find(a.url);
+
+					if (v != versioned.end()) {
+						a.url += v->second;
+					}
+				}
+
+				auto links = preload_links(assets, options_.preload.max_links, mount.prefix);
+
+				if (!links.empty()) {
+					response.add_header("Link", links);
+				}
+
+				// also when empty, so that hints the page no longer needs are not sent again
+				if (options_.preload.early_hints) {
+					auto key = mount.host + '\n' + mount.prefix + request.uri;
+					early_hints_.insert(key, std::make_shared<std::string>(links), key.size() + links.size());
+				}
+			}
+
+			return response;
+		}
+
+		// a font subset to the characters of the deck instead of the file
+		response_data make_font_subset(const request_data &request, font_pipeline::variant_pointer subset)
+		{
+			response_data response;
+			auto directive = options_.cache.directive(request.uri);
+			auto etag = strong_etag(subset->hash);
+
+			// not immutable even under a versioned URL; the subset changes with the deck
+			if (!directive.empty()) {
+				response.add_header("Cache-Control", directive);
+			}
+
+			response.add_header("ETag", etag);
+
+			if (etag_matches(request.header("if-none-match"), etag)) {
+				response.status = "304 Not Modified";
+				return response;
+			}
+
+			response.add_header("Content-Type", "font/ttf");
+			response.set_body(subset->data.data(), subset->data.size(), subset);
+
+			return response;
+		}
+
+		// a follower waiting for the presenter on /.msr/follow, under any mount
+		bool is_long_poll(const request_data &request)
+		{
+			if (!options_.audience) {
+				return false;
+			}
+
+			auto mount = find_mount(request);
+
+			return mount && request.uri.compare(mount->prefix.size(), std::string::npos, "/.msr/follow") == 0;
+		}
+
+		// /.msr/follow.js, /.msr/follow and /.msr/present; false for other requests
+		bool handle_audience(const request_data &request, handler_type handler)
+		{
+			auto json_response = [](const std::string &json) {
+				response_data response;
+				response.add_header("Content-Type", "application/json");
+				response.add_header("Cache-Control", "no-store");
+				response.set_body(json);
+				return response;
+			};
+
+			if (request.uri == "/.msr/follow.js") {
+				response_data response;
+				response.add_header("Content-Type", "application/javascript");
+				response.add_header("Cache-Control", "no-cache");
+				response.set_body(request.local ? presenter_script() : follower_script());
+				handler(response);
+			} else if (request.uri == "/.msr/follow") {
+				std::uint64_t after = 0;
+
+				try {
+					after = std::stoull("0" + query_parameter(request.query, "after"));
+				} catch (std::exception &) {
+				}
+
+				// answered when the presenter moves
+				followers_.wait(after, [handler, json_response](const slide_state &state) {
+					handler(json_response(state.to_json()));
+				});
+			} else if (request.uri == "/.msr/present") {
+				if (!request.local) {
+					handler(make_error("403 Forbidden"));
+					return true;
+				}
+
+				auto number = [&](const char *name, int default_value) {
+					try {
+						return std::stoi(query_parameter(request.query, name));
+					} catch (std::exception &) {
+						return default_value;
+					}
+				};
+
+				followers_.publish(
+					percent_decode(query_parameter(request.query, "url")),
+					number("h", 0), number("v", 0), number("f", -1));
+
+				handler(json_response(followers_.state().to_json()));
+			} else {
+				return false;
+			}
+
+			return true;
+		}
+
+		void post_task(std::function<void()> task)
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex_);
+
+			if (!tasks_) {
+				tasks_.reset(new worker_pool(1));
+			}
+
+			tasks_->post(std::move(task));
+		}
+
+		// performance budget report of a document root, made on a worker
+		void analyze(const boost::filesystem::path &root, handler_type handler)
+		{
+			post_task([this, root, handler]() {
+				auto analysis = analyze_document_root(root, options_.budgets, *assets_, *index_);
+
+				response_data response;
+				response.add_header("Content-Type", "application/json");
+				response.add_header("Cache-Control", "no-store");
+				response.set_body(to_json(analysis));
+
+				handler(response);
+			});
+		}
+
+		// /.msr/search.json?q=...&limit=N: slides of the root matching q. The
+		// first query waits for the root to be indexed; later ones are answered
+		// from the index while a stale one is refreshed in the background.
+		void search(const mount_pointer &mount, const request_data &request, handler_type handler)
+		{
+			auto index = searches_->get(mount->root);
+			auto query = percent_decode(query_parameter(request.query, "q"));
+			std::size_t limit = 0;
+
+			try {
+				limit = std::stoul("0" + query_parameter(request.query, "limit"));
+			} catch (std::exception &) {
+			}
+
+			auto respond = [mount, handler](search_result result) {
+				for (auto &hit : result.hits) {
+					hit.url = mount->prefix + hit.url;
+				}
+
+				response_data response;
+				response.add_header("Content-Type", "application/json");
+				response.add_header("Cache-Control", "no-store");
+				response.set_body(to_json(result));
+
+				handler(response);
+			};
+
+			if (!index->complete()) {
+				post_task([index, query, limit, respond]() {
+					if (index->claim_refresh()) {
+						index->refresh();
+					}
+
+					respond(index->search(query, limit));
+				});
+
+				return;
+			}
+
+			post_task([index]() {
+				if (index->claim_refresh()) {
+					index->refresh();
+				}
+			});
+
+			respond(index->search(query, limit));
+		}
+
+		void resolve(const request_data &original, handler_type handler)
+		{
+			if (original.invalid) {
+				handler(make_error("400 Bad Request"));
+				return;
+			}
+
+			if (original.method != "GET") {
+				handler(make_error("501 Not Implemented"));
+				return;
+			}
+
+			auto mount = find_mount(original);
+
+			if (!mount) {
+				handler(make_error("404 Not Found", original.uri + " not found"));
+				return;
+			}
+
+			if (original.uri == mount->prefix && !mount->prefix.empty()) {
+				// relative references of the index page need the trailing slash
+				auto response = make_error("301 Moved Permanently");
+				response.add_header("Location", original.uri + '/' + (original.query.empty() ? "" : '?' + original.query));
+				handler(response);
+				return;
+			}
+
+			auto request = original;
+			request.uri.erase(0, mount->prefix.size());
+
+			// a full scan of the deck; not for the audience
+			if (request.uri == "/.msr/analysis.json" && request.local) {
+				analyze(mount->root, handler);
+				return;
+			}
+
+			if (searches_ && request.uri == "/.msr/search.json") {
+				search(mount, request, handler);
+				return;
+			}
+
+			if (options_.audience && handle_audience(request, handler)) {
+				return;
+			}
+
+			static const auto prefix_length = sizeof(embedded_prefix) - 1;
+
+			if (request.uri.compare(0, prefix_length, embedded_prefix) == 0) {
+				auto resource = find_embedded_resource(request.uri.substr(prefix_length));
+
+				if (resource != nullptr) {
+					handler(make_embedded(request, *resource));
+					return;
+				}
+			}
+
+			boost::system::error_code error;
+			auto path = canonical(absolute(mount->root / request.uri), error);
+
+			// ".." and links may lead out of the root
+			if (!error && !is_within(mount->root, path)) {
+				handler(make_error("404 Not Found", original.uri + " not found"));
+				return;
+			}
+
+			if (error.value() == boost::system::errc::success) {
+				if (is_directory(path)) {
+					error.assign(boost::system::errc::is_a_directory, boost::system::generic_category());
+					for (auto &f : { ".html", ".htm" }) {
+						if (exists((path / "index").replace_extension(f))) {
+							error.assign(boost::system::errc::success, boost::system::generic_category());
+							path = (path / "index").replace_extension(f);
+							break;
+						}
+					}
+				}
+			}
+
+			if (error.value() != boost::system::errc::success || !exists(path)) {
+				std::string message;
+
+				if (is_directory(path)) {
+					message = (path / L"index.html").string() + " not found";
+				} else {
+					message = path.string() + " not found";
+				}
+
+				handler(make_error("404 Not Found", message));
+				return;
+			}
+
+			if (images_ && image_pipeline::is_resizable(path)) {
+				auto width = requested_image_width(request);
+
+				if (width != 0) {
+					auto prefer_webp = query_parameter(request.query, "format") == "webp"
+						|| request.header("accept").find("image/webp") != std::string::npos;
+					auto format = images_->output_format(path, prefer_webp);
+
+					images_->get(path, width, format, [this, mount, request, path, handler](image_pipeline::variant_pointer variant) {
+						handler(make_file(*mount, request, path, variant));
+					});
+
+					return;
+				}
+			}
+
+			// ?original=1 bypasses subsetting
+			if (fonts_ && font_pipeline::is_subsettable(path) && query_parameter(request.query, "original") != "1") {
+				fonts_->get(mount->root, path, [this, mount, request, path, handler](font_pipeline::variant_pointer subset) {
+					handler(subset ? make_font_subset(request, subset) : make_file(*mount, request, path, nullptr));
+				});
+
+				return;
+			}
+
+			handler(make_file(*mount, request, path, nullptr));
+		}
+
+	public:
+		// previous is the provider this one is to replace (see retire()), or nullptr;
+		// its persistent files are not opened twice
+		resource_provider(const boost::filesystem::path &root, const provider_options &options, const resource_provider *previous = nullptr)
+			: root_(boost::filesystem::absolute(root))
+			, options_(options)
+			, index_(previous != nullptr && previous->options_.hash_index_file == options.hash_index_file
+				? previous->index_
+				: std::make_shared<content_hash_index>(options.hash_index_file))
+			, contents_(previous != nullptr && previous->index_ == index_
+					&& previous->options_.content_cache_budget == options.content_cache_budget
+					&& previous->options_.content_cache_max_file_size == options.content_cache_max_file_size
+				? previous->contents_
+				: std::make_shared<content_cache>(*index_, options.content_cache_budget, options.content_cache_max_file_size))
+			, assets_(previous != nullptr ? previous->assets_ : std::make_shared<asset_graph>())
+			, inliner_(options.inlining)
+			, lazy_media_(options.lazy_media)
+			, deck_split_(options.deck_split)
+		{
+			if (options_.images.enabled) {
+				images_.reset(new image_pipeline(options_.images));
+			}
+
+			if (options_.minify.enabled) {
+				minified_ = previous != nullptr && previous->minified_ && previous->contents_ == contents_ && previous->options_.minify == options_.minify
+					? previous->minified_
+					: std::make_shared<minify_cache>(options_.minify, *contents_);
+			}
+
+			if (options_.fonts.enabled) {
+				fonts_ = previous != nullptr && previous->fonts_ && previous->options_.fonts == options_.fonts
+					? previous->fonts_
+					: std::make_shared<font_pipeline>(options_.fonts);
+			}
+
+			if (options_.highlight.enabled) {
+				highlighted_.reset(new highlight_cache(options_.highlight));
+			}
+
+			if (options_.search.enabled) {
+				searches_ = previous != nullptr && previous->searches_ && previous->searches_->options() == options_.search
+					? previous->searches_
+					: std::make_shared<search_index_set>(options_.search);
+
+				// indexed before the first query; claimed on the worker, since
+				// stop() discards the jobs that have not started
+				auto index = searches_->get(root_);
+
+				post_task([index]() {
+					if (index->claim_refresh()) {
+						index->refresh();
+					}
+				});
+			}
+
+			// previous still maps its snapshot and writes it back when it retires
+			if (!options_.snapshot_file.empty() && (previous == nullptr || previous->options_.snapshot_file != options_.snapshot_file)) {
+				contents_->open_snapshot(options_.snapshot_file);
+			}
+
+			if (previous != nullptr) {
+				followers_.restore(previous->followers_.state());
+
+				// so that the manifests are read once, not halved on every reload
+				std::lock_guard<std::mutex> lock(previous->manifests_mutex_);
+				manifests_ = previous->manifests_;
+			}
+
+			// canonical like those of mount(), so that resolved paths can be checked against it
+			boost::system::error_code error;
+			auto mount = std::make_shared<mount_point>();
+			mount->root = canonical(absolute(root_), error);
+
+			if (error) {
+				mount->root = root_;
+			}
+
+			mount->prewarmer = make_prewarmer(mount->root);
+
+			mounts_ = std::make_shared<mount_list>(mount_list{ mount });
+		}
+
+		~resource_provider()
+		{
+			stop();
+		}
+
+		const boost::filesystem::path &root() const
+		{
+			return root_;
+		}
+
+		// bytes held by the content cache of all mounts
+		std::size_t cache_size_in_bytes() const
+		{
+			return contents_->size_in_bytes();
+		}
+
+		// files the content cache of all mounts has read from disk
+		std::uint64_t disk_reads() const
+		{
+			return contents_->disk_reads();
+		}
+
+		// Slides of the roots mounted for any host that match query, best first,
+		// with urls from the server root. Does not wait: roots not indexed yet
+		// are left out and the result is not complete.
+		search_result search(const std::string &query, std::size_t limit = 0)
+		{
+			search_result result;
+
+			if (!searches_) {
+				return result;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			result.complete = true;
+
+			for (auto &m : *mounts()) {
+				if (!m->host.empty()) {
+					continue;
+				}
+
+				auto index = searches_->get(m->root);
+
+				post_task([index]() {
+					if (index->claim_refresh()) {
+						index->refresh();
+					}
+				});
+
+				if (!index->complete()) {
+					result.complete = false;
+					continue;
+				}
+
+				auto found = index->search(query, limit);
+				result.total += found.total;
+
+				for (auto &hit : found.hits) {
+					hit.url = m->prefix + hit.url;
+					result.hits.push_back(std::move(hit));
+				}
+			}
+
+			if (limit == 0) {
+				limit = searches_->options().max_results;
+			}
+
+			std::stable_sort(result.hits.begin(), result.hits.end(), [](const search_hit &a, const search_hit &b) {
+				return a.score > b.score;
+			});
+
+			if (result.hits.size() > limit) {
+				result.hits.resize(limit);
+			}
+
+			result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			return result;
+		}
+
+		// Serves root under prefix ("/name") and/or for a host ("name.localhost").
+		// A mount with the same prefix and host is replaced.
+		// The root given to the constructor is mounted at "" for any host.
+		bool mount(const std::string &prefix, const boost::filesystem::path &root, const std::string &host = std::string())
+		{
+			boost::system::error_code error;
+
+			auto m = std::make_shared<mount_point>();
+			m->prefix = prefix.empty() ? prefix : normalize_prefix(prefix);
+			m->host = boost::algorithm::to_lower_copy(host);
+			m->root = canonical(absolute(root), error);
+
+			if (error || !is_directory(m->root, error)) {
+				return false;
+			}
+
+			m->prewarmer = make_prewarmer(m->root);
+
+			{
+				std::lock_guard<std::mutex> lock(mounts_mutex_);
+
+				auto list = std::make_shared<mount_list>();
+
+				for (auto &old : *mounts_) {
+					if (old->prefix != m->prefix || old->host != m->host) {
+						list->push_back(old);
+					}
+				}
+
+				list->push_back(m);
+				mounts_ = list;
+			}
+
+			if (m->prewarmer) {
+				m->prewarmer->start();
+			}
+
+			return true;
+		}
+
+		bool unmount(const std::string &prefix, const std::string &host = std::string())
+		{
+			auto p = prefix.empty() ? prefix : normalize_prefix(prefix);
+			auto h = boost::algorithm::to_lower_copy(host);
+			mount_pointer removed;
+
+			{
+				std::lock_guard<std::mutex> lock(mounts_mutex_);
+
+				auto list = std::make_shared<mount_list>();
+
+				for (auto &m : *mounts_) {
+					if (m->prefix == p && m->host == h) {
+						removed = m;
+					} else {
+						list->push_back(m);
+					}
+				}
+
+				mounts_ = list;
+			}
+
+			if (removed && removed->prewarmer) {
+				removed->prewarmer->stop();
+			}
+
+			return removed != nullptr;
+		}
+
+		// starts loading the document roots into the content cache in the background
+		void prewarm()
+		{
+			for (auto &m : *mounts()) {
+				if (m->prewarmer) {
+					m->prewarmer->start();
+				}
+			}
+		}
+
+		// References of the page at uri (requested for host), with the URLs the client uses;
+		// empty if it is not a page of this server.
+		asset_list page_assets(const std::string &uri, const std::string &host = std::string())
+		{
+			request_data request;
+			request.uri = uri;
+
+			if (!host.empty()) {
+				request.headers["host"] = host;
+			}
+
+			auto mount = find_mount(request);
+
+			if (!mount) {
+				return asset_list();
+			}
+
+			auto relative = uri.substr(mount->prefix.size());
+			boost::system::error_code error;
+			auto path = canonical(absolute(mount->root / relative), error);
+
+			if (!error && !is_within(mount->root, path)) {
+				return asset_list();
+			}
+
+			if (!error && is_directory(path, error)) {
+				path /= "index.html";
+			}
+
+			if (error || !is_regular_file(path, error)) {
+				return asset_list();
+			}
+
+			auto assets = assets_->page_assets(mount->root, path, relative.empty() ? "/" : relative);
+
+			for (auto &a : assets) {
+				a.url = mount->prefix + a.url;
+			}
+
+			return assets;
+		}
+
+		// Link header value to send as 103 Early Hints before request is resolved:
+		// the one sent with the last response for the same page. Empty if there
+		// is none or early hints are off.
+		std::string early_hints(const request_data &request)
+		{
+			if (!options_.preload.enabled || !options_.preload.early_hints || request.invalid || request.method != "GET") {
+				return std::string();
+			}
+
+			auto mount = find_mount(request);
+
+			if (!mount) {
+				return std::string();
+			}
+
+			auto links = early_hints_.find(mount->host + '\n' + request.uri);
+
+			return links ? *links : std::string();
+		}
+
+		// the presenter side of audience mode
+		follower_channel &followers()
+		{
+			return followers_;
+		}
+
+		// stops background work; requests are still answered, without it
+		void stop()
+		{
+			stop_background();
+
+			// the requests in progress on a retired provider still need the pipelines,
+			// and those it shares with its successor are the successor's to stop;
+			// the rest stop when the last request releases this provider
+			if (retired_) {
+				return;
+			}
+
+			if (images_) {
+				images_->stop();
+			}
+
+			if (minified_) {
+				minified_->stop();
+			}
+
+			if (fonts_) {
+				fonts_->stop();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(tasks_mutex_);
+
+				if (tasks_) {
+					tasks_->stop();
+				}
+
+				if (readers_) {
+					readers_->stop();
+				}
+			}
+
+			index_->stop();
+
+			if (searches_) {
+				searches_->stop();
+			}
+		}
+
+		// Stops the background work of this provider after its successor has
+		// taken over; the requests in progress still complete (see stop()).
+		void retire()
+		{
+			retired_ = true;
+			stop_background();
+		}
+
+		// The handler is called exactly once, either before handle() returns
+		// or later on a worker thread.
+		void handle(const request_data &request, handler_type handler)
+		{
+			auto long_poll = is_long_poll(request);
+
+			++active_;
+
+			if (!long_poll) {
+				++serving_;
+			}
+
+			resolve(request, [this, handler, long_poll](response_data response) {
+				if (!long_poll && --serving_ == 0 && options_.prewarm.enabled) {
+					for (auto &m : *mounts()) {
+						if (m->prewarmer) {
+							m->prewarmer->notify_idle();
+						}
+					}
+				}
+
+				--active_;
+				handler(std::move(response));
+			});
+		}
+
+		// Reads a piece of a streamed body (response_data::read_body) on a
+		// worker and calls the handler there with the bytes read, for front
+		// ends that must not block, like the reveal:// scheme handler on the
+		// CEF I/O thread. buffer must stay valid until the handler is called.
+		void read_body(const response_data &response, std::uint64_t offset, char *buffer, std::size_t size, std::function<void(std::size_t)> handler)
+		{
+			auto reader = response.read_body;
+
+			std::lock_guard<std::mutex> lock(tasks_mutex_);
+
+			if (!readers_) {
+				readers_.reset(new worker_pool(1));
+			}
+
+			readers_->post([reader, offset, buffer, size, handler]() {
+				handler(reader(offset, buffer, size));
+			});
+		}
+	};
+
+	// Destroys providers on a thread of its own. The last reference to a
+	// retired provider may be dropped by a job on one of its pools, or by a
+	// scheme handler that CEF releases on a pool thread, and a pool cannot
+	// be stopped from one of its own threads.
+	class provider_reaper {
+		std::mutex mutex_;
+		std::condition_variable queued_;
+		std::deque<resource_provider *> queue_;
+		bool stopping_ = false;
+		std::thread thread_;
+
+		provider_reaper()
+			: thread_([this]() { run(); })
+		{
+		}
+
+		void run()
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+
+			for (;;) {
+				queued_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+
+				if (queue_.empty()) {
+					return;
+				}
+
+				auto provider = queue_.front();
+				queue_.pop_front();
+
+				lock.unlock();
+				delete provider;
+				lock.lock();
+			}
+		}
+
+	public:
+		// the providers still queued are destroyed before it returns
+		~provider_reaper()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+
+			queued_.notify_one();
+			thread_.join();
+		}
+
+		provider_reaper(const provider_reaper &) = delete;
+		provider_reaper &operator=(const provider_reaper &) = delete;
+
+		static provider_reaper &instance()
+		{
+			static provider_reaper reaper;
+			return reaper;
+		}
+
+		void dispose(resource_provider *provider)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				queue_.push_back(provider);
+			}
+
+			queued_.notify_one();
+		}
+	};
+
+	// A provider that is destroyed by the reaper wherever its last reference is dropped.
+	inline std::shared_ptr<resource_provider> make_provider(const boost::filesystem::path &root, const provider_options &options, const resource_provider *previous = nullptr)
+	{
+		auto &reaper = provider_reaper::instance();
+
+		return std::shared_ptr<resource_provider>(new resource_provider(root, options, previous), [&reaper](resource_provider *provider) {
+			reaper.dispose(provider);
+		});
+	}
+
+	// The provider new requests go to. Replacing it is read-copy-update: a
+	// request keeps the provider it started with, which lives until the last
+	// of them completes.
+	class provider_slot {
+		std::shared_ptr<resource_provider> provider_;
+
+	public:
+		std::shared_ptr<resource_provider> get() const
+		{
+			return std::atomic_load(&provider_);
+		}
+
+		// the previous provider
+		std::shared_ptr<resource_provider> exchange(std::shared_ptr<resource_provider> provider)
+		{
+			return std::atomic_exchange(&provider_, std::move(provider));
+		}
+	};
+}
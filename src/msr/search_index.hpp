@@ -0,0 +1,1161 @@
+#pragma once
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "content_cache.hpp"
+#include "file_stamp.hpp"
+#include "html.hpp"
+#include "json.hpp"
+#include "url.hpp"
+
+// Full-text search over the decks of a document root, one document per
+// slide. HTML pages are split at their <section> elements (h and v as
+// reveal.js counts them, data-markdown sections expanded) and Markdown
+// files at their --- lines. The index is refreshed incrementally: only
+// files whose size or mtime changed are read again.
+
+namespace msr {
+	struct search_options {
+		bool enabled = false;
+
+		// a query refreshes the index in the background if it is older than this
+		std::chrono::milliseconds refresh_interval{ 2000 };
+
+		std::size_t max_results = 50;
+
+		// terms a prefix query may expand to
+		std::size_t max_expansions = 256;
+
+		bool operator==(const search_options &other) const
+		{
+			return enabled == other.enabled
+				&& refresh_interval == other.refresh_interval
+				&& max_results == other.max_results
+				&& max_expansions == other.max_expansions;
+		}
+	};
+
+	struct search_hit {
+		std::string url;	// of the page, from the root
+		int h = 0;
+		int v = 0;
+		std::string title;
+		std::string snippet;
+		std::size_t score = 0;
+	};
+
+	struct search_result {
+		std::vector<search_hit> hits;
+
+		// matching slides, including those beyond the limit
+		std::size_t total = 0;
+
+		// false until the whole root has been indexed once
+		bool complete = false;
+
+		double elapsed_ms = 0.0;
+	};
+
+	inline std::string to_json(const search_result &result)
+	{
+		std::string json = "{\"complete\":";
+
+		json += result.complete ? "true" : "false";
+		json += ",\"total\":" + std::to_string(result.total);
+		json += ",\"elapsed_ms\":" + json_number(result.elapsed_ms);
+		json += ",\"hits\":[";
+
+		for (std::size_t i = 0; i < result.hits.size(); ++i) {
+			auto &h = result.hits[i];
+
+			json += i > 0 ? ",{" : "{";
+			json += "\"url\":" + json_quote(h.url);
+			json += ",\"h\":" + std::to_string(h.h);
+			json += ",\"v\":" + std::to_string(h.v);
+			json += ",\"title\":" + json_quote(h.title);
+			json += ",\"snippet\":" + json_quote(h.snippet);
+			json += ",\"score\":" + std::to_string(h.score);
+			json += '}';
+		}
+
+		json += "]}";
+
+		return json;
+	}
+
+	namespace detail {
+		// the code point at text[i] and its length in bytes; invalid bytes are taken one at a time
+		inline std::uint32_t decode_utf8(const std::string &text, std::size_t i, std::size_t &length)
+		{
+			auto c = static_cast<unsigned char>(text[i]);
+			length = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+
+			if (length == 1 || i + length > text.size()) {
+				length = 1;
+				return c;
+			}
+
+			std::uint32_t cp = c & (0x7F >> length);
+
+			for (std::size_t k = 1; k < length; ++k) {
+				cp = (cp << 6) | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+			}
+
+			return cp;
+		}
+
+		// Calls f(term, begin, end) for the words of UTF-8 text, in order.
+		// Letters and digits make words, lower cased (ASCII only). Kana, kanji
+		// and other scripts written without spaces (U+3000 and up) are taken one
+		// character at a time, so a query for a word in them is a phrase query.
+		template <typename Function>
+		void tokenize_search_text(const std::string &text, Function f)
+		{
+			std::string term;
+			std::size_t begin = 0;
+
+			auto flush = [&](std::size_t end) {
+				if (!term.empty()) {
+					f(term, begin, end);
+					term.clear();
+				}
+			};
+
+			for (std::size_t i = 0; i < text.size();) {
+				std::size_t length;
+				auto cp = decode_utf8(text, i, length);
+
+				if (cp < 0x80) {
+					if (std::isalnum(static_cast<int>(cp))) {
+						if (term.empty()) {
+							begin = i;
+						}
+
+						term += to_lower_ascii(static_cast<char>(cp));
+					} else {
+						flush(i);
+					}
+				} else if (cp >= 0x3000) {
+					flush(i);
+					begin = i;
+					term.assign(text, i, length);
+					flush(i + length);
+				} else if ((cp < 0xC0 && cp != 0xAA && cp != 0xB5 && cp != 0xBA) || (cp >= 0x2000 && cp < 0x2C00)) {
+					// Latin-1 punctuation, general punctuation and symbols
+					flush(i);
+				} else {
+					if (term.empty()) {
+						begin = i;
+					}
+
+					term.append(text, i, length);
+				}
+
+				i += length;
+			}
+
+			flush(text.size());
+		}
+
+		// text with runs of white space made one space
+		inline std::string collapse_space(const std::string &text)
+		{
+			std::string result;
+			auto space = true;
+
+			result.reserve(text.size());
+
+			for (auto c : text) {
+				if (is_html_space(c)) {
+					if (!space) {
+						result += ' ';
+						space = true;
+					}
+				} else {
+					result += c;
+					space = false;
+				}
+			}
+
+			if (!result.empty() && result.back() == ' ') {
+				result.pop_back();
+			}
+
+			return result;
+		}
+	}
+
+	// A slide as found in a page, before it is indexed.
+	struct search_slide {
+		int h = 0;
+		int v = 0;
+		std::string title;
+		std::string text;
+	};
+
+	namespace detail {
+		// The separator of a data-markdown section as a line of text: reveal.js
+		// takes regular expressions, and those in use are lines like ^\r?\n---\r?\n$.
+		inline std::string markdown_separator(const std::string &pattern)
+		{
+			std::string line;
+
+			for (std::size_t i = 0; i < pattern.size(); ++i) {
+				if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+					auto next = pattern[++i];
+
+					if (next != 'r' && next != 'n') {
+						line += next;
+					}
+				} else if (pattern[i] != '^' && pattern[i] != '$' && pattern[i] != '?') {
+					line += pattern[i];
+				}
+			}
+
+			return line;
+		}
+
+		// Markdown split into slides, starting at h; lines equal to separator start
+		// the next slide and lines equal to vertical (if not empty) the next vertical one.
+		inline void split_markdown(
+			const std::string &markdown,
+			const std::string &separator,
+			const std::string &vertical,
+			int &h,
+			std::vector<search_slide> &slides)
+		{
+			search_slide slide;
+			slide.h = h;
+
+			auto finish = [&]() {
+				slide.text = collapse_space(slide.text);
+				slides.push_back(slide);
+				slide = search_slide();
+			};
+
+			std::size_t pos = 0;
+
+			while (pos <= markdown.size()) {
+				auto eol = markdown.find('\n', pos);
+				auto line = markdown.substr(pos, eol == std::string::npos ? std::string::npos : eol - pos);
+
+				pos = eol == std::string::npos ? markdown.size() + 1 : eol + 1;
+
+				while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+					line.pop_back();
+				}
+
+				if (!separator.empty() && line == separator) {
+					auto next_h = slide.h + 1;
+					finish();
+					slide.h = next_h;
+					continue;
+				}
+
+				if (!vertical.empty() && line == vertical) {
+					auto same_h = slide.h, next_v = slide.v + 1;
+					finish();
+					slide.h = same_h;
+					slide.v = next_v;
+					continue;
+				}
+
+				// <!-- .slide: ... --> and the like
+				if (line.compare(0, 4, "<!--") == 0) {
+					continue;
+				}
+
+				if (slide.title.empty() && !line.empty() && line[0] == '#' && line.find_first_not_of('#') != std::string::npos) {
+					slide.title = collapse_space(line.substr(line.find_first_not_of('#')));
+				}
+
+				slide.text += line;
+				slide.text += '\n';
+			}
+
+			finish();
+			h = slides.back().h + 1;
+		}
+
+		inline bool is_inline_element(const std::string &name)
+		{
+			static const char *names[] = {
+				"a", "abbr", "b", "code", "em", "i", "kbd", "mark", "q", "s", "small", "span", "strong", "sub", "sup", "u",
+			};
+
+			return std::find_if(std::begin(names), std::end(names), [&](const char *n) { return name == n; }) != std::end(names);
+		}
+	}
+
+	// The slides of a page. Markdown files referenced by data-markdown are
+	// read relative to dir and added to sources.
+	inline std::vector<search_slide> extract_slides(
+		const std::string &html,
+		const boost::filesystem::path &dir,
+		std::vector<boost::filesystem::path> &sources)
+	{
+		std::vector<search_slide> slides;
+		std::string outside;
+
+		// the open <section> elements; whether each holds a slide of its own
+		struct open_section {
+			bool markdown;
+			std::string separator;
+			std::string vertical;
+		};
+
+		std::vector<open_section> open;
+		int h = 0;
+		int v = 0;
+		std::size_t heading = 0;
+		std::size_t text_begin = std::string::npos;
+
+		// the slide text goes to: the last one open, or outside
+		auto current = [&]() -> search_slide * {
+			return open.empty() || slides.empty() ? nullptr : &slides.back();
+		};
+
+		auto add_text = [&](std::size_t begin, std::size_t end) {
+			if (begin >= end) {
+				return;
+			}
+
+			auto text = decode_html_text(html.substr(begin, end - begin));
+			auto slide = current();
+
+			if (slide == nullptr) {
+				outside += text;
+				return;
+			}
+
+			slide->text += text;
+
+			if (heading > 0 && slide->title.size() < 256) {
+				slide->title += text;
+			}
+		};
+
+		scan_html_tags(html, [&](const html_tag &tag) {
+			add_text(text_begin, tag.begin);
+			text_begin = tag.end;
+
+			auto slide = current();
+
+			if (!detail::is_inline_element(tag.name) && slide != nullptr) {
+				slide->text += ' ';
+			}
+
+			if (tag.name == "section" && !tag.self_closing) {
+				if (tag.closing) {
+					if (!open.empty()) {
+						open.pop_back();
+
+						if (open.empty()) {
+							++h;
+							v = 0;
+						} else if (open.size() == 1) {
+							++v;
+						}
+					}
+
+					return true;
+				}
+
+				auto markdown = tag.attribute("data-markdown");
+				auto separator = tag.attribute("data-separator");
+				auto vertical = tag.attribute("data-separator-vertical");
+
+				open.push_back({
+					markdown != nullptr,
+					separator != nullptr ? detail::markdown_separator(separator->value) : "---",
+					vertical != nullptr ? detail::markdown_separator(vertical->value) : std::string()
+				});
+
+				// an external file; reveal.js makes as many sections of it as it has slides
+				if (markdown != nullptr && !markdown->value.empty() && open.size() == 1) {
+					auto path = dir / url_path(decode_html_text(markdown->value));
+					std::string content;
+
+					if (read_file(path, content)) {
+						sources.push_back(path);
+						detail::split_markdown(content, open.back().separator, open.back().vertical, h, slides);
+
+						// the closing </section> adds one
+						--h;
+						open.back().markdown = false;
+
+						return true;
+					}
+				}
+
+				search_slide s;
+				s.h = h;
+				s.v = open.size() == 1 ? 0 : v;
+
+				// a vertical stack shares h with its first slide
+				if (!slides.empty() && slides.back().h == s.h && slides.back().v == s.v) {
+					return true;
+				}
+
+				slides.push_back(s);
+				return true;
+			}
+
+			if (tag.name.size() == 2 && tag.name[0] == 'h' && tag.name[1] >= '1' && tag.name[1] <= '6') {
+				heading = tag.closing ? (heading > 0 ? heading - 1 : 0) : heading + 1;
+				return true;
+			}
+
+			if (is_raw_text_element(tag.name) && !tag.closing && !tag.self_closing) {
+				// inline Markdown is text; scripts and styles are not
+				auto close = detail::find_ignore_case(html, "</" + tag.name, tag.end);
+				auto end = close == std::string::npos ? html.size() : close;
+
+				if (tag.name == "textarea" && !open.empty() && open.back().markdown && open.size() == 1) {
+					// the slides replace the one of the section
+					if (!slides.empty() && slides.back().h == h && slides.back().text.find_first_not_of(' ') == std::string::npos) {
+						slides.pop_back();
+					}
+
+					detail::split_markdown(decode_html_text(html.substr(tag.end, end - tag.end)), open.back().separator, open.back().vertical, h, slides);
+
+					// the closing </section> adds one
+					--h;
+					open.back().markdown = false;
+				}
+
+				text_begin = end;
+			}
+
+			return true;
+		});
+
+		for (auto &s : slides) {
+			s.text = detail::collapse_space(s.text);
+			s.title = detail::collapse_space(s.title);
+		}
+
+		// a page that is not a deck is one slide
+		if (slides.empty()) {
+			search_slide s;
+			s.text = detail::collapse_space(outside);
+			slides.push_back(s);
+		}
+
+		return slides;
+	}
+
+	// The index of a document root. Thread-safe; search() may be called while
+	// refresh() runs on another thread, and sees the index as it was before
+	// or after each changed file.
+	class search_index {
+		// a slide with a term, and how many times
+		struct posting {
+			std::uint32_t slide;
+			std::uint32_t count;
+		};
+
+		using posting_list = std::vector<posting>;
+		using match_list = std::vector<std::pair<std::uint32_t, std::uint32_t>>;	// slide, count
+
+		struct slide_entry {
+			const std::string *url;
+			int h;
+			int v;
+			std::string title;
+			std::string text;
+
+			// the terms of the text in order, for phrases
+			std::vector<std::uint32_t> tokens;
+		};
+
+		struct document {
+			std::string url;
+			std::vector<std::pair<boost::filesystem::path, file_stamp>> sources;
+
+			// slides [first, first + count); ids only grow, so postings stay sorted
+			std::uint32_t first = 0;
+			std::uint32_t count = 0;
+
+			std::vector<std::uint32_t> terms;
+		};
+
+		// a document read from disk, not indexed yet; terms are numbered per document
+		struct parsed_document {
+			std::string key;
+			document doc;
+			std::vector<search_slide> slides;
+			std::vector<std::vector<std::uint32_t>> tokens;	// by slide
+			std::vector<std::string> terms;
+		};
+
+		boost::filesystem::path root_;
+		search_options options_;
+
+		mutable std::mutex mutex_;
+
+		// terms are numbered as they are first seen; the numbers are not reused
+		std::map<std::string, std::uint32_t> dictionary_;
+		std::vector<posting_list> postings_;	// by term
+
+		std::unordered_map<std::uint32_t, slide_entry> slides_;
+		std::map<std::string, document> documents_;	// by path
+		std::uint32_t next_slide_ = 0;
+		bool complete_ = false;
+
+		// one refresh() at a time
+		std::mutex refresh_mutex_;
+		std::atomic<bool> refreshing_{ false };
+		std::atomic<bool> stopped_{ false };
+		std::chrono::steady_clock::time_point refreshed_;
+
+		static bool is_page(const boost::filesystem::path &path)
+		{
+			auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+			return ext == ".html" || ext == ".htm";
+		}
+
+		static bool is_markdown(const boost::filesystem::path &path)
+		{
+			auto ext = boost::algorithm::to_lower_copy(path.extension().string());
+			return ext == ".md" || ext == ".markdown";
+		}
+
+		bool changed(const std::string &key) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto iter = documents_.find(key);
+
+			if (iter == documents_.end()) {
+				return true;
+			}
+
+			for (auto &s : iter->second.sources) {
+				file_stamp stamp;
+
+				if (!get_file_stamp(s.first, stamp) || stamp != s.second) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		bool parse(const boost::filesystem::path &path, parsed_document &parsed) const
+		{
+			std::string content;
+			file_stamp stamp;
+
+			if (!get_file_stamp(path, stamp) || !read_file(path, content)) {
+				return false;
+			}
+
+			auto root_string = root_.generic_string();
+			std::vector<boost::filesystem::path> sources;
+
+			parsed.key = path.generic_string();
+			parsed.doc.url = parsed.key.substr(root_string.size());
+			parsed.doc.sources.emplace_back(path, stamp);
+
+			if (is_page(path)) {
+				parsed.slides = extract_slides(content, path.parent_path(), sources);
+			} else {
+				int h = 0;
+				detail::split_markdown(content, "---", "", h, parsed.slides);
+			}
+
+			for (auto &s : sources) {
+				file_stamp source_stamp;
+				get_file_stamp(s, source_stamp);
+				parsed.doc.sources.emplace_back(s, source_stamp);
+			}
+
+			std::unordered_map<std::string, std::uint32_t> numbers;
+
+			parsed.tokens.resize(parsed.slides.size());
+
+			for (std::size_t i = 0; i < parsed.slides.size(); ++i) {
+				detail::tokenize_search_text(parsed.slides[i].text, [&](const std::string &term, std::size_t, std::size_t) {
+					auto n = numbers.emplace(term, static_cast<std::uint32_t>(parsed.terms.size()));
+
+					if (n.second) {
+						parsed.terms.push_back(term);
+					}
+
+					parsed.tokens[i].push_back(n.first->second);
+				});
+			}
+
+			return true;
+		}
+
+		// with mutex_ held
+		void remove(document &doc)
+		{
+			auto first = doc.first, last = doc.first + doc.count;
+
+			for (auto t : doc.terms) {
+				auto &list = postings_[t];
+				auto begin = std::lower_bound(list.begin(), list.end(), first, [](const posting &p, std::uint32_t s) { return p.slide < s; });
+				auto end = std::lower_bound(begin, list.end(), last, [](const posting &p, std::uint32_t s) { return p.slide < s; });
+
+				list.erase(begin, end);
+			}
+
+			for (auto id = first; id < last; ++id) {
+				slides_.erase(id);
+			}
+		}
+
+		// with mutex_ held
+		void add(parsed_document &parsed)
+		{
+			auto old = documents_.find(parsed.key);
+
+			if (old != documents_.end()) {
+				remove(old->second);
+				documents_.erase(old);
+			}
+
+			auto &doc = documents_[parsed.key];
+
+			doc = std::move(parsed.doc);
+			doc.first = next_slide_;
+			doc.count = static_cast<std::uint32_t>(parsed.slides.size());
+			doc.terms.reserve(parsed.terms.size());
+
+			// the numbers of the document's terms in the index
+			for (auto &t : parsed.terms) {
+				auto n = dictionary_.emplace(t, static_cast<std::uint32_t>(postings_.size()));
+
+				if (n.second) {
+					postings_.emplace_back();
+				}
+
+				doc.terms.push_back(n.first->second);
+			}
+
+			std::vector<std::uint32_t> counts(parsed.terms.size());
+			std::vector<std::uint32_t> seen;
+
+			for (std::size_t i = 0; i < parsed.slides.size(); ++i) {
+				auto id = next_slide_++;
+				auto &tokens = parsed.tokens[i];
+
+				for (auto &t : tokens) {
+					if (counts[t]++ == 0) {
+						seen.push_back(t);
+					}
+
+					t = doc.terms[t];
+				}
+
+				for (auto t : seen) {
+					postings_[doc.terms[t]].push_back({ id, counts[t] });
+					counts[t] = 0;
+				}
+
+				seen.clear();
+
+				auto &s = parsed.slides[i];
+				slides_[id] = { &doc.url, s.h, s.v, std::move(s.title), std::move(s.text), std::move(tokens) };
+			}
+		}
+
+		// the terms a word of a query stands for: itself, or those it is a prefix of
+		std::vector<std::uint32_t> expand(const std::string &word, bool prefix) const
+		{
+			std::vector<std::uint32_t> terms;
+
+			if (!prefix) {
+				auto iter = dictionary_.find(word);
+
+				if (iter != dictionary_.end()) {
+					terms.push_back(iter->second);
+				}
+
+				return terms;
+			}
+
+			for (auto iter = dictionary_.lower_bound(word);
+				iter != dictionary_.end() && iter->first.compare(0, word.size(), word) == 0 && terms.size() < options_.max_expansions;
+				++iter)
+			{
+				terms.push_back(iter->second);
+			}
+
+			return terms;
+		}
+
+		// the slides with any of terms, and their counts; sorted by slide
+		match_list slides_with(const std::vector<std::uint32_t> &terms) const
+		{
+			match_list matches;
+
+			if (terms.size() == 1) {
+				for (auto &p : postings_[terms.front()]) {
+					matches.emplace_back(p.slide, p.count);
+				}
+
+				return matches;
+			}
+
+			for (auto t : terms) {
+				for (auto &p : postings_[t]) {
+					matches.emplace_back(p.slide, p.count);
+				}
+			}
+
+			std::sort(matches.begin(), matches.end());
+
+			// one entry per slide
+			std::size_t n = 0;
+
+			for (std::size_t i = 0; i < matches.size(); ++i) {
+				if (n > 0 && matches[n - 1].first == matches[i].first) {
+					matches[n - 1].second += matches[i].second;
+				} else {
+					matches[n++] = matches[i];
+				}
+			}
+
+			matches.resize(n);
+
+			return matches;
+		}
+
+		// slide -> matches of one clause of a query: words in a row, the last one
+		// a prefix if prefix is set; with mutex_ held
+		match_list match(const std::vector<std::string> &words, bool prefix) const
+		{
+			std::vector<std::vector<std::uint32_t>> terms;
+
+			for (std::size_t i = 0; i < words.size(); ++i) {
+				terms.push_back(expand(words[i], prefix && i + 1 == words.size()));
+
+				if (terms.back().empty()) {
+					return match_list();
+				}
+			}
+
+			auto matches = slides_with(terms.front());
+
+			if (words.size() == 1) {
+				return matches;
+			}
+
+			// slides with all the words, then with them in a row
+			for (std::size_t i = 1; i < terms.size() && !matches.empty(); ++i) {
+				auto other = slides_with(terms[i]);
+				std::size_t n = 0;
+				auto b = other.begin();
+
+				for (auto &m : matches) {
+					b = std::lower_bound(b, other.end(), m.first, [](const match_list::value_type &o, std::uint32_t slide) { return o.first < slide; });
+
+					if (b != other.end() && b->first == m.first) {
+						matches[n++] = m;
+					}
+				}
+
+				matches.resize(n);
+			}
+
+			for (auto &t : terms) {
+				std::sort(t.begin(), t.end());
+			}
+
+			std::size_t n = 0;
+
+			for (auto &m : matches) {
+				auto &tokens = slides_.at(m.first).tokens;
+				std::uint32_t count = 0;
+
+				for (std::size_t start = 0; start + terms.size() <= tokens.size(); ++start) {
+					std::size_t k = 0;
+
+					while (k < terms.size() && std::binary_search(terms[k].begin(), terms[k].end(), tokens[start + k])) {
+						++k;
+					}
+
+					count += k == terms.size() ? 1 : 0;
+				}
+
+				if (count > 0) {
+					matches[n++] = { m.first, count };
+				}
+			}
+
+			matches.resize(n);
+
+			return matches;
+		}
+
+		// the text around the first match of terms in text
+		static std::string snippet(const std::string &text, const std::vector<std::string> &terms, bool prefix)
+		{
+			static const std::size_t before = 40, after = 100;
+
+			std::size_t found = std::string::npos;
+			std::size_t index = 0;
+			std::vector<std::size_t> begins;
+
+			detail::tokenize_search_text(text, [&](const std::string &term, std::size_t begin, std::size_t) {
+				if (found != std::string::npos || terms.empty()) {
+					return;
+				}
+
+				auto last = index + 1 == terms.size();
+				auto matches = prefix && last ? term.compare(0, terms[index].size(), terms[index]) == 0 : term == terms[index];
+
+				if (matches && last) {
+					found = index == 0 ? begin : begins.front();
+				} else if (matches) {
+					if (index == 0) {
+						begins.assign(1, begin);
+					}
+
+					++index;
+				} else {
+					index = 0;
+
+					if (term == terms[0] && terms.size() > 1) {
+						begins.assign(1, begin);
+						index = 1;
+					}
+				}
+			});
+
+			auto begin = found == std::string::npos || found < before ? 0 : found - before;
+			auto end = std::min(text.size(), (found == std::string::npos ? 0 : found) + after);
+
+			// whole characters only
+			while (begin > 0 && (static_cast<unsigned char>(text[begin]) & 0xC0) == 0x80) {
+				--begin;
+			}
+
+			while (end < text.size() && (static_cast<unsigned char>(text[end]) & 0xC0) == 0x80) {
+				++end;
+			}
+
+			return (begin > 0 ? "..." : "") + text.substr(begin, end - begin) + (end < text.size() ? "..." : "");
+		}
+
+	public:
+		search_index(const boost::filesystem::path &root, const search_options &options)
+			: root_(root)
+			, options_(options)
+		{
+		}
+
+		search_index(const search_index &) = delete;
+		search_index &operator=(const search_index &) = delete;
+
+		const boost::filesystem::path &root() const
+		{
+			return root_;
+		}
+
+		// whether the root has been indexed once
+		bool complete() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return complete_;
+		}
+
+		// true (once) if the index is older than the refresh interval and no
+		// refresh is running; the caller is then to call refresh()
+		bool claim_refresh()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (complete_ && std::chrono::steady_clock::now() - refreshed_ < options_.refresh_interval) {
+					return false;
+				}
+			}
+
+			auto expected = false;
+			return refreshing_.compare_exchange_strong(expected, true);
+		}
+
+		// Reads the pages and Markdown files that are new or changed since the
+		// last refresh and drops those that are gone.
+		void refresh()
+		{
+			std::lock_guard<std::mutex> refresh_lock(refresh_mutex_);
+
+			std::vector<boost::filesystem::path> pages, markdown;
+			boost::system::error_code error;
+
+			for (boost::filesystem::recursive_directory_iterator iter(root_, error), end; !error && iter != end && !stopped_; iter.increment(error)) {
+				auto &path = iter->path();
+
+				if (path.filename().string().compare(0, 1, ".") == 0) {
+					// .git and the like
+					if (is_directory(path, error)) {
+						iter.no_push();
+					}
+				} else if (is_page(path)) {
+					pages.push_back(path);
+				} else if (is_markdown(path)) {
+					markdown.push_back(path);
+				}
+			}
+
+			std::set<std::string> seen;
+			std::set<std::string> referenced;
+
+			auto update = [&](const boost::filesystem::path &path) {
+				auto key = path.generic_string();
+				seen.insert(key);
+
+				if (!changed(key)) {
+					std::lock_guard<std::mutex> lock(mutex_);
+
+					for (auto &s : documents_[key].sources) {
+						referenced.insert(s.first.generic_string());
+					}
+
+					return;
+				}
+
+				// parsed without the lock; searches go on meanwhile
+				parsed_document parsed;
+
+				if (!parse(path, parsed)) {
+					return;
+				}
+
+				for (std::size_t i = 1; i < parsed.doc.sources.size(); ++i) {
+					referenced.insert(parsed.doc.sources[i].first.generic_string());
+				}
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				add(parsed);
+			};
+
+			for (auto &p : pages) {
+				if (stopped_) {
+					break;
+				}
+
+				update(p);
+			}
+
+			// Markdown that a page shows is found under the page
+			for (auto &m : markdown) {
+				if (stopped_) {
+					break;
+				}
+
+				if (referenced.count(m.generic_string()) == 0) {
+					update(m);
+				} else {
+					seen.erase(m.generic_string());
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (!stopped_) {
+				for (auto iter = documents_.begin(); iter != documents_.end();) {
+					if (seen.count(iter->first) == 0) {
+						remove(iter->second);
+						iter = documents_.erase(iter);
+					} else {
+						++iter;
+					}
+				}
+
+				complete_ = true;
+			}
+
+			refreshed_ = std::chrono::steady_clock::now();
+			refreshing_ = false;
+		}
+
+		// Slides matching query, best first. Words are matched exactly; a word
+		// ending with * is a prefix; "quoted words" must appear in a row. All
+		// the words and phrases must be in the slide. limit 0 for max_results.
+		search_result search(const std::string &query, std::size_t limit = 0) const
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			// clauses of the query: terms in a row, whether the last one is a prefix
+			std::vector<std::pair<std::vector<std::string>, bool>> clauses;
+
+			for (std::size_t pos = 0; pos < query.size();) {
+				std::size_t end;
+				std::string words;
+
+				if (query[pos] == ' ' || query[pos] == '\t') {
+					++pos;
+					continue;
+				}
+
+				if (query[pos] == '"') {
+					end = query.find('"', pos + 1);
+					end = end == std::string::npos ? query.size() : end;
+					words = query.substr(pos + 1, end - pos - 1);
+					++end;
+				} else {
+					end = query.find_first_of(" \t\"", pos);
+					end = end == std::string::npos ? query.size() : end;
+					words = query.substr(pos, end - pos);
+				}
+
+				pos = end;
+
+				std::vector<std::string> terms;
+				std::size_t last_end = 0;
+
+				detail::tokenize_search_text(words, [&](const std::string &term, std::size_t, std::size_t e) {
+					terms.push_back(term);
+					last_end = e;
+				});
+
+				if (!terms.empty()) {
+					clauses.emplace_back(std::move(terms), last_end < words.size() && words[last_end] == '*');
+				}
+			}
+
+			search_result result;
+
+			if (limit == 0) {
+				limit = options_.max_results;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			result.complete = complete_;
+
+			match_list matches;
+
+			for (std::size_t i = 0; i < clauses.size(); ++i) {
+				auto m = match(clauses[i].first, clauses[i].second);
+
+				if (i == 0) {
+					matches = std::move(m);
+					continue;
+				}
+
+				// both sorted by slide
+				match_list both;
+				auto a = matches.begin();
+				auto b = m.begin();
+
+				while (a != matches.end() && b != m.end()) {
+					if (a->first < b->first) {
+						++a;
+					} else if (b->first < a->first) {
+						++b;
+					} else {
+						both.emplace_back(a->first, a->second + b->second);
+						++a;
+						++b;
+					}
+				}
+
+				matches = std::move(both);
+			}
+
+			result.total = matches.size();
+
+			auto order = [this](const match_list::value_type &a, const match_list::value_type &b) {
+				if (a.second != b.second) {
+					return a.second > b.second;
+				}
+
+				auto &sa = slides_.at(a.first), &sb = slides_.at(b.first);
+
+				return std::tie(*sa.url, sa.h, sa.v) < std::tie(*sb.url, sb.h, sb.v);
+			};
+
+			auto count = std::min(limit, matches.size());
+
+			std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), order);
+
+			for (std::size_t i = 0; i < count; ++i) {
+				auto &s = slides_.at(matches[i].first);
+				search_hit hit;
+
+				hit.url = *s.url;
+				hit.h = s.h;
+				hit.v = s.v;
+				hit.title = s.title;
+				hit.snippet = snippet(s.text, clauses.front().first, clauses.front().second);
+				hit.score = matches[i].second;
+
+				result.hits.push_back(std::move(hit));
+			}
+
+			result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			return result;
+		}
+
+		// makes a running refresh() return early
+		void stop()
+		{
+			stopped_ = true;
+		}
+	};
+
+	// The search indexes of the mounted roots, by root. Shared by a provider
+	// with the one that replaces it, so a reload does not index again.
+	class search_index_set {
+		search_options options_;
+		std::mutex mutex_;
+		std::map<boost::filesystem::path, std::shared_ptr<search_index>> indexes_;
+
+	public:
+		explicit search_index_set(const search_options &options)
+			: options_(options)
+		{
+		}
+
+		const search_options &options() const
+		{
+			return options_;
+		}
+
+		// the index of root, made empty if there is none yet
+		std::shared_ptr<search_index> get(const boost::filesystem::path &root)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto &index = indexes_[root];
+
+			if (!index) {
+				index = std::make_shared<search_index>(root, options_);
+			}
+
+			return index;
+		}
+
+		void stop()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			for (auto &i : indexes_) {
+				i.second->stop();
+			}
+		}
+	};
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <exception>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+namespace msr {
+	// Runs at most one call per key at a time.
+	// Threads that ask for a key while a call for it is in progress wait for
+	// that call and get its result instead of running their own.
+	template <typename Key, typename Result, typename Hash = std::hash<Key>>
+	class single_flight {
+		std::mutex mutex_;
+		std::unordered_map<Key, std::shared_future<Result>, Hash> calls_;
+
+	public:
+		// Exceptions thrown by function are rethrown to every waiter.
+		template <typename Function>
+		Result run(const Key &key, Function function)
+		{
+			std::promise<Result> promise;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+
+				auto iter = calls_.find(key);
+
+				if (iter != calls_.end()) {
+					auto future = iter->second;
+
+					lock.unlock();
+
+					return future.get();
+				}
+
+				calls_.emplace(key, promise.get_future().share());
+			}
+
+			try {
+				auto result = function();
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					calls_.erase(key);
+				}
+
+				promise.set_value(result);
+
+				return result;
+			} catch (...) {
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					calls_.erase(key);
+				}
+
+				promise.set_exception(std::current_exception());
+				throw;
+			}
+		}
+	};
+}
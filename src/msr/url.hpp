@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+#include <vector>
+
+namespace msr {
+	// true for "http://...", "data:...", "//host/..." and so on
+	inline bool is_external_url(const std::string &url)
+	{
+		if (url.compare(0, 2, "//") == 0) {
+			return true;
+		}
+
+		for (auto c : url) {
+			if (c == ':') {
+				return true;
+			}
+
+			if (!std::isalnum(static_cast<unsigned char>(c)) && c != '+' && c != '-' && c != '.') {
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	// removes "." and ".." segments from an absolute path
+	inline std::string normalize_url_path(const std::string &path)
+	{
+		std::vector<std::string> segments;
+		std::size_t pos = 1;
+
+		while (pos <= path.size()) {
+			auto end = path.find('/', pos);
+
+			if (end == std::string::npos) {
+				end = path.size();
+			}
+
+			auto segment = path.substr(pos, end - pos);
+
+			if (segment == "..") {
+				if (!segments.empty()) {
+					segments.pop_back();
+				}
+
+				if (end == path.size()) {
+					segments.push_back("");
+				}
+			} else if (segment == ".") {
+				if (end == path.size()) {
+					segments.push_back("");
+				}
+			} else {
+				segments.push_back(segment);
+			}
+
+			pos = end + 1;
+		}
+
+		std::string result;
+
+		for (auto &s : segments) {
+			result += '/';
+			result += s;
+		}
+
+		return result.empty() ? "/" : result;
+	}
+
+	// Resolves a reference found in the document at base (an absolute path
+	// such as "/deck/index.html") to an absolute path with its query.
+	// Returns an empty string for external URLs and fragment-only references.
+	inline std::string resolve_url(const std::string &base, std::string ref)
+	{
+		auto hash = ref.find('#');
+
+		if (hash != std::string::npos) {
+			ref.erase(hash);
+		}
+
+		if (ref.empty() || is_external_url(ref)) {
+			return std::string();
+		}
+
+		std::string query;
+		auto question = ref.find('?');
+
+		if (question != std::string::npos) {
+			query = ref.substr(question);
+			ref.erase(question);
+		}
+
+		if (ref.empty()) {
+			ref = base;
+		} else if (ref[0] != '/') {
+			auto dir = base.substr(0, base.rfind('/') + 1);
+			ref = (dir.empty() ? "/" : dir) + ref;
+		}
+
+		return normalize_url_path(ref) + query;
+	}
+
+	// "/a/b.css?v=1" -> "/a/b.css"
+	inline std::string url_path(const std::string &url)
+	{
+		return url.substr(0, url.find('?'));
+	}
+
+	// "%2Fa%20b" -> "/a b"; malformed escapes are left as they are
+	inline std::string percent_decode(const std::string &s)
+	{
+		auto hex = [](char c) {
+			return c >= '0' && c <= '9' ? c - '0'
+				: c >= 'a' && c <= 'f' ? c - 'a' + 10
+				: c >= 'A' && c <= 'F' ? c - 'A' + 10
+				: -1;
+		};
+
+		std::string result;
+
+		for (std::size_t i = 0; i < s.size(); ++i) {
+			if (s[i] == '%' && i + 2 < s.size() && hex(s[i + 1]) >= 0 && hex(s[i + 2]) >= 0) {
+				result += static_cast<char>(hex(s[i + 1]) * 16 + hex(s[i + 2]));
+				i += 2;
+			} else if (s[i] == '+') {
+				result += ' ';
+			} else {
+				result += s[i];
+			}
+		}
+
+		return result;
+	}
+}
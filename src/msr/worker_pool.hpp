@@ -0,0 +1,83 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace msr {
+	// Fixed number of threads running their own io_service.
+	// Used for work that must not block the server thread.
+	class worker_pool {
+		boost::asio::io_service io_service_;
+		std::unique_ptr<boost::asio::io_service::work> work_;
+		std::vector<std::thread> threads_;
+
+	public:
+		// on_start/on_exit run on every worker thread (e.g. CoInitializeEx/CoUninitialize)
+		explicit worker_pool(
+			std::size_t threads = 0,
+			std::function<void()> on_start = nullptr,
+			std::function<void()> on_exit = nullptr)
+			: work_(new boost::asio::io_service::work(io_service_))
+		{
+			if (threads == 0) {
+				// hardware_concurrency() may be 0 if it is not known
+				auto n = std::thread::hardware_concurrency();
+				threads = n > 1 ? n - 1 : 1;
+			}
+
+			for (std::size_t i = 0; i < threads; ++i) {
+				threads_.emplace_back([this, on_start, on_exit]() {
+					if (on_start) {
+						on_start();
+					}
+
+					io_service_.run();
+
+					if (on_exit) {
+						on_exit();
+					}
+				});
+			}
+		}
+
+		~worker_pool()
+		{
+			stop();
+		}
+
+		worker_pool(const worker_pool &) = delete;
+		worker_pool &operator=(const worker_pool &) = delete;
+
+		template <typename Handler>
+		void post(Handler &&handler)
+		{
+			io_service_.post(std::forward<Handler>(handler));
+		}
+
+		std::size_t size() const
+		{
+			return threads_.size();
+		}
+
+		// queued jobs that have not started yet are discarded;
+		// not to be called by one of them, since it joins every thread
+		void stop()
+		{
+			work_.reset();
+			io_service_.stop();
+
+			for (auto &t : threads_) {
+				if (t.joinable()) {
+					t.join();
+				}
+			}
+
+			threads_.clear();
+		}
+	};
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace msr {
+	enum response_priority {
+		priority_document,	// HTML, CSS, scripts and other text
+		priority_font,
+		priority_image,
+		priority_media,	// video, audio and anything else
+		priority_count
+	};
+
+	inline response_priority priority_for_content_type(const std::string &type)
+	{
+		if (type.compare(0, 5, "text/") == 0 || type == "application/javascript" || type == "application/json") {
+			return priority_document;
+		}
+
+		if (type.compare(0, 5, "font/") == 0 || type == "application/x-font-woff" || type == "application/vnd.ms-fontobject") {
+			return priority_font;
+		}
+
+		return type.compare(0, 6, "image/") == 0 ? priority_image : priority_media;
+	}
+
+	// Hands out turns to write a chunk of a response body, so that the chunks
+	// of a large video do not delay the stylesheet a slide is waiting for.
+	// Waiting writes go by priority, then by the order of their requests;
+	// at most max_in_flight chunks are being written at a time. A writer gives
+	// its turn back when the chunk has been written or after turn_timeout,
+	// whichever is first, so a client that stops reading does not hold up the rest.
+	// If fair, writes of the same priority go first to the connections that
+	// have been granted the fewest chunks, so that hundreds of clients loading
+	// the same deck progress together instead of one after another.
+	// Thread safe; grants are called without the lock held.
+	// Every grant must be followed by release().
+	class write_scheduler {
+	public:
+		using grant_function = std::function<void()>;
+
+		struct wait_statistics {
+			std::size_t count = 0;
+			std::chrono::microseconds total{ 0 };
+			std::chrono::microseconds max{ 0 };
+		};
+
+	private:
+		struct waiter {
+			response_priority priority;
+			std::uint64_t share;	// 0 unless fair
+			std::uint64_t order;
+			std::chrono::steady_clock::time_point since;
+			grant_function grant;
+
+			// the top of a priority_queue is the greatest element
+			bool operator<(const waiter &other) const
+			{
+				if (priority != other.priority) {
+					return priority > other.priority;
+				}
+
+				return share != other.share ? share > other.share : order > other.order;
+			}
+		};
+
+		std::size_t chunk_size_;
+		std::size_t max_in_flight_;
+		bool fair_;
+		std::chrono::milliseconds turn_timeout_;
+		std::mutex mutex_;
+		std::size_t in_flight_ = 0;
+		std::uint64_t next_order_ = 0;
+		std::priority_queue<waiter> waiting_;
+
+		// time spent waiting for a turn, by priority
+		std::array<wait_statistics, priority_count> statistics_;
+
+		// the waiters that may write now; called with the lock held
+		std::vector<grant_function> take_granted()
+		{
+			std::vector<grant_function> granted;
+
+			while (in_flight_ < max_in_flight_ && !waiting_.empty()) {
+				auto w = waiting_.top();
+				waiting_.pop();
+
+				auto wait = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - w.since);
+				auto &s = statistics_[w.priority];
+
+				++s.count;
+				s.total += wait;
+				s.max = std::max(s.max, wait);
+
+				++in_flight_;
+				granted.push_back(std::move(w.grant));
+			}
+
+			return granted;
+		}
+
+		static void call(std::vector<grant_function> granted)
+		{
+			for (auto &g : granted) {
+				g();
+			}
+		}
+
+	public:
+		explicit write_scheduler(
+			std::size_t chunk_size = 64 * 1024,
+			std::size_t max_in_flight = 4,
+			bool fair = false,
+			std::chrono::milliseconds turn_timeout = std::chrono::milliseconds(250))
+			: chunk_size_(std::max<std::size_t>(1, chunk_size))
+			, max_in_flight_(std::max<std::size_t>(1, max_in_flight))
+			, fair_(fair)
+			, turn_timeout_(turn_timeout)
+		{
+		}
+
+		write_scheduler(const write_scheduler &) = delete;
+		write_scheduler &operator=(const write_scheduler &) = delete;
+
+		std::size_t chunk_size() const
+		{
+			return chunk_size_;
+		}
+
+		// how long a grant may be held while its chunk is being written
+		std::chrono::milliseconds turn_timeout() const
+		{
+			return turn_timeout_;
+		}
+
+		// position of a request in arrival order
+		std::uint64_t next_order()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return next_order_++;
+		}
+
+		// grant is called when the caller may write one chunk, possibly before request() returns;
+		// share is the number of chunks the connection has been granted so far
+		void request(response_priority priority, std::uint64_t order, grant_function grant, std::uint64_t share = 0)
+		{
+			std::vector<grant_function> granted;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				waiting_.push({ priority, fair_ ? share : 0, order, std::chrono::steady_clock::now(), std::move(grant) });
+				granted = take_granted();
+			}
+
+			call(std::move(granted));
+		}
+
+		// the chunk of a grant has been written, or the turn_timeout has passed
+		void release()
+		{
+			std::vector<grant_function> granted;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				--in_flight_;
+				granted = take_granted();
+			}
+
+			call(std::move(granted));
+		}
+
+		std::array<wait_statistics, priority_count> statistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return statistics_;
+		}
+	};
+}
@@ -2,6 +2,14 @@
 
 #include "include/cef_app.h"
 
+#include "reveal_scheme.hpp"
+
 class other_handler : public CefApp {
 	IMPLEMENT_REFCOUNTING(other_handler);
+
+public:
+	void OnRegisterCustomSchemes(CefRawPtr<CefSchemeRegistrar> registrar) override
+	{
+		register_reveal_scheme(registrar);
+	}
 };
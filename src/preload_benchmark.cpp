@@ -0,0 +1,466 @@
+// Measures how much sooner a deck can be shown with Link: rel=preload. The
+// deck is served on the loopback interface with an emulated round-trip time,
+// once without preload, once with Link headers and once with 103 Early Hints
+// too. A simulated browser loads the page on up to six keep-alive
+// connections: it finds the stylesheets and scripts in the HTML, the fonts
+// in the stylesheets it applies and, if the server sends them, fetches the
+// preloaded URLs as soon as the Link header arrives. Prints the median time
+// until the page and everything it needs to be shown (render-blocking assets
+// and the fonts in use) have loaded.
+//
+//   preload-benchmark <document root> [page] [round trip ms] [runs]
+//
+// page defaults to /index.html, the round trip to 100 ms and runs to 5. The
+// exit code is 0 if every run loaded the page and its critical assets, 1 if
+// not, and 2 on bad arguments.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "msr.hpp"
+
+namespace {
+	using boost::asio::ip::tcp;
+	using clock_type = std::chrono::steady_clock;
+
+	// urls of a Link header
+	std::vector<std::string> link_urls(const std::string &links)
+	{
+		std::vector<std::string> urls;
+		std::size_t begin = 0;
+
+		while ((begin = links.find('<', begin)) != std::string::npos) {
+			auto end = links.find('>', begin);
+
+			if (end == std::string::npos) {
+				break;
+			}
+
+			urls.push_back(links.substr(begin + 1, end - begin - 1));
+			begin = end + 1;
+		}
+
+		return urls;
+	}
+
+	std::string header_of(const std::string &head, const std::string &name)
+	{
+		auto pos = head.find("\r\n" + name + ": ");
+
+		if (pos == std::string::npos) {
+			return std::string();
+		}
+
+		pos += name.size() + 4;
+
+		return head.substr(pos, head.find("\r\n", pos) - pos);
+	}
+
+	// One page load. Every fetch runs on its own thread and waits for one of
+	// the six connections a browser opens to a host.
+	class browser {
+		static const std::size_t max_connections = 6;
+
+		tcp::endpoint endpoint_;
+		std::string page_;
+		bool use_links_;
+		clock_type::time_point start_ = clock_type::now();
+
+		boost::asio::io_service service_;
+
+		std::mutex mutex_;
+		std::condition_variable changed_;
+
+		std::vector<std::unique_ptr<tcp::socket>> idle_;
+		std::size_t open_ = 0;
+
+		std::vector<std::thread> threads_;
+		std::size_t pending_ = 0;
+
+		std::set<std::string> requested_;
+		std::map<std::string, double> loaded_ms_;
+		std::map<std::string, std::string> stylesheets_;	// loaded, by url
+		std::set<std::string> applied_;	// stylesheets the page uses
+		std::set<std::string> critical_;
+		msr::asset_list fonts_;
+		msr::font_usage usage_;
+		bool failed_ = false;
+
+		std::unique_ptr<tcp::socket> acquire()
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			changed_.wait(lock, [this]() { return !idle_.empty() || open_ < max_connections; });
+
+			if (!idle_.empty()) {
+				auto socket = std::move(idle_.back());
+				idle_.pop_back();
+				return socket;
+			}
+
+			++open_;
+			lock.unlock();
+
+			std::unique_ptr<tcp::socket> socket(new tcp::socket(service_));
+			boost::system::error_code error;
+			socket->connect(endpoint_, error);
+
+			if (error) {
+				release(nullptr);
+				return nullptr;
+			}
+
+			return socket;
+		}
+
+		// nullptr if the connection has been closed
+		void release(std::unique_ptr<tcp::socket> socket)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (socket) {
+				idle_.push_back(std::move(socket));
+			} else {
+				--open_;
+			}
+
+			changed_.notify_all();
+		}
+
+		// with mutex_ held
+		void fetch(const std::string &url)
+		{
+			if (url.empty() || url[0] != '/' || url.compare(0, 2, "//") == 0 || !requested_.insert(url).second) {
+				return;
+			}
+
+			++pending_;
+			threads_.emplace_back([this, url]() { get(url); });
+		}
+
+		void get(const std::string &url)
+		{
+			std::string head, body;
+			auto socket = acquire();
+			auto ok = socket && request(*socket, url, head, body);
+
+			release(ok && header_of(head, "Connection") == "keep-alive" ? std::move(socket) : nullptr);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (!ok || head.compare(9, 3, "200") != 0) {
+				failed_ = true;
+			} else {
+				loaded_ms_[url] = std::chrono::duration<double, std::milli>(clock_type::now() - start_).count();
+
+				auto type = header_of(head, "Content-Type");
+
+				if (url == page_) {
+					parse_page(body);
+				} else if (type.compare(0, 8, "text/css") == 0) {
+					stylesheets_[url] = body;
+
+					if (applied_.count(url)) {
+						apply(url);
+					}
+				}
+			}
+
+			--pending_;
+			changed_.notify_all();
+		}
+
+		// head is that of the final response; Link headers of 103 responses are acted on as they arrive
+		bool request(tcp::socket &socket, const std::string &url, std::string &head, std::string &body)
+		{
+			boost::system::error_code error;
+			std::string request = "GET " + url + " HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept-Encoding: identity\r\n\r\n";
+			boost::asio::streambuf buffer;
+
+			boost::asio::write(socket, boost::asio::buffer(request), error);
+
+			for (;;) {
+				if (error) {
+					return false;
+				}
+
+				auto size = boost::asio::read_until(socket, buffer, "\r\n\r\n", error);
+
+				if (error) {
+					return false;
+				}
+
+				head.assign(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + size);
+				buffer.consume(size);
+
+				if (head.size() < 12) {
+					return false;
+				}
+
+				if (use_links_ && url == page_) {
+					std::lock_guard<std::mutex> lock(mutex_);
+
+					for (auto &u : link_urls(header_of(head, "Link"))) {
+						fetch(u);
+					}
+				}
+
+				if (head[9] != '1') {
+					break;
+				}
+			}
+
+			std::size_t length = 0;
+
+			try {
+				length = std::stoul("0" + header_of(head, "Content-Length"));
+			} catch (std::exception &) {
+				return false;
+			}
+
+			if (buffer.size() < length) {
+				boost::asio::read(socket, buffer, boost::asio::transfer_exactly(length - buffer.size()), error);
+			}
+
+			if (buffer.size() < length) {
+				return false;
+			}
+
+			body.assign(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + length);
+
+			return true;
+		}
+
+		// with mutex_ held
+		void parse_page(const std::string &html)
+		{
+			msr::asset_list assets;
+			msr::scan_html(html, page_, assets, usage_);
+
+			for (auto &a : assets) {
+				if (a.kind == msr::asset_kind::font) {
+					fonts_.push_back(a);
+				} else if (a.render_blocking) {
+					critical_.insert(a.url);
+					fetch(a.url);
+
+					if (a.kind == msr::asset_kind::style) {
+						applied_.insert(a.url);
+
+						if (stylesheets_.count(a.url)) {
+							apply(a.url);
+						}
+					}
+				}
+			}
+
+			fetch_fonts();
+		}
+
+		// with mutex_ held
+		void apply(const std::string &url)
+		{
+			msr::asset_list assets;
+			msr::scan_css(stylesheets_[url], url, assets, usage_);
+
+			for (auto &a : assets) {
+				if (a.kind == msr::asset_kind::font) {
+					fonts_.push_back(a);
+				}
+			}
+
+			fetch_fonts();
+		}
+
+		// with mutex_ held
+		void fetch_fonts()
+		{
+			for (auto &f : fonts_) {
+				if (usage_.uses(f.face)) {
+					critical_.insert(f.url);
+					fetch(f.url);
+				}
+			}
+		}
+
+	public:
+		browser(const tcp::endpoint &endpoint, const std::string &page, bool use_links)
+			: endpoint_(endpoint)
+			, page_(page)
+			, use_links_(use_links)
+		{
+		}
+
+		struct result {
+			bool loaded = false;
+			double critical_ms = 0.0;
+			std::size_t requests = 0;
+		};
+
+		result load()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				critical_.insert(page_);
+				fetch(page_);
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				changed_.wait(lock, [this]() { return pending_ == 0; });
+			}
+
+			// no fetch is started once none is pending
+			for (auto &t : threads_) {
+				t.join();
+			}
+
+			result r;
+			r.loaded = !failed_;
+			r.requests = requested_.size();
+
+			for (auto &url : critical_) {
+				auto loaded = loaded_ms_.find(url);
+
+				if (loaded == loaded_ms_.end()) {
+					r.loaded = false;
+				} else {
+					r.critical_ms = std::max(r.critical_ms, loaded->second);
+				}
+			}
+
+			return r;
+		}
+	};
+
+	struct mode {
+		const char *name;
+		bool preload;
+		bool early_hints;
+		std::unique_ptr<msr::tcp_server> server;
+		std::vector<double> critical_ms;
+		std::size_t requests = 0;
+	};
+
+	double median(std::vector<double> values)
+	{
+		std::sort(values.begin(), values.end());
+		return values.empty() ? 0.0 : values[values.size() / 2];
+	}
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+	if (argc < 2 || argc > 5) {
+		std::cerr << "usage: preload-benchmark <document root> [page] [round trip ms] [runs]" << std::endl;
+		return 2;
+	}
+
+	boost::filesystem::path root = argv[1];
+	std::string page = argc > 2 ? boost::filesystem::path(argv[2]).generic_string() : "/index.html";
+	std::size_t round_trip = 100;
+	std::size_t runs = 5;
+
+	try {
+		if (argc > 3) round_trip = std::stoul(argv[3]);
+		if (argc > 4) runs = std::stoul(argv[4]);
+	} catch (std::exception &) {
+		std::cerr << "the round trip and runs are numbers" << std::endl;
+		return 2;
+	}
+
+	boost::system::error_code error;
+
+	if (!is_directory(root, error) || runs == 0) {
+		std::cerr << "usage: preload-benchmark <document root> [page] [round trip ms] [runs]" << std::endl;
+		return 2;
+	}
+
+	boost::asio::io_service server_service;
+	msr::network_options network;
+	network.latency = std::chrono::milliseconds(round_trip);
+
+	mode modes[] = {
+		{ "no preload", false, false, nullptr, {}, 0 },
+		{ "Link preload", true, false, nullptr, {}, 0 },
+		{ "Link preload + 103", true, true, nullptr, {}, 0 },
+	};
+
+	for (auto &m : modes) {
+		msr::provider_options options;
+		options.preload.enabled = m.preload;
+		options.preload.early_hints = m.early_hints;
+
+		m.server.reset(new msr::tcp_server(server_service));
+		m.server->set_options(options);
+		m.server->set_network_options(network);
+
+		if (!m.server->start(root)) {
+			std::cerr << "the server cannot be started" << std::endl;
+			return 2;
+		}
+	}
+
+	std::vector<std::thread> server_threads;
+
+	for (int i = 0; i < 2; ++i) {
+		server_threads.emplace_back([&]() { server_service.run(); });
+	}
+
+	auto loaded = true;
+
+	// the first load fills the caches and the early hints; it is not counted
+	for (std::size_t run = 0; run <= runs; ++run) {
+		for (auto &m : modes) {
+			tcp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), m.server->get_port());
+			auto r = browser(endpoint, page, m.preload).load();
+
+			loaded = loaded && r.loaded;
+
+			if (run > 0) {
+				m.critical_ms.push_back(r.critical_ms);
+				m.requests = r.requests;
+			}
+		}
+	}
+
+	for (auto &m : modes) {
+		m.server->shutdown(std::chrono::seconds(1));
+	}
+
+	for (auto &t : server_threads) {
+		t.join();
+	}
+
+	auto baseline = median(modes[0].critical_ms);
+
+	std::cout << page << ", " << round_trip << " ms round trip, median of " << runs << " loads" << std::endl;
+
+	for (auto &m : modes) {
+		auto ms = median(m.critical_ms);
+
+		std::cout << "  " << std::left << std::setw(20) << m.name
+			<< std::right << std::fixed << std::setprecision(1) << std::setw(8) << ms << " ms"
+			<< std::setw(8) << std::showpos << ms - baseline << std::noshowpos << " ms"
+			<< std::setw(6) << m.requests << " requests" << std::endl;
+	}
+
+	if (!loaded) {
+		std::cout << "some loads failed or missed critical assets" << std::endl;
+	}
+
+	return loaded ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+// Drives msr::resource_provider headlessly through a fake front end that
+// builds requests the way the reveal:// scheme handler does and waits for
+// the handler, which may be called on a worker thread. Needs neither
+// sockets nor CEF.
+//
+//   provider-test
+//
+// Works in a temporary directory it makes and removes. Prints one line per
+// check; the exit code is 0 if every check passed and 1 if not.
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "msr/resource_provider.hpp"
+#include "test_support.hpp"
+
+namespace {
+	using test_support::check;
+	using test_support::write_file;
+
+	// The fake front end: one request in, one response out.
+	class front_end {
+		msr::resource_provider &provider_;
+
+	public:
+		explicit front_end(msr::resource_provider &provider)
+			: provider_(provider)
+		{
+		}
+
+		msr::response_data get(const std::string &target, const std::map<std::string, std::string> &headers = {}, const std::string &method = "GET")
+		{
+			msr::request_data request;
+			auto question = target.find('?');
+
+			request.method = method;
+			request.version = "HTTP/1.1";
+			request.uri = target.substr(0, question);
+			request.query = question == std::string::npos ? std::string() : target.substr(question + 1);
+			request.headers = headers;
+			request.local = true;
+
+			auto promise = std::make_shared<std::promise<msr::response_data>>();
+			auto future = promise->get_future();
+			auto calls = std::make_shared<std::atomic<int>>(0);
+
+			provider_.handle(request, [promise, calls](msr::response_data response) {
+				if (++*calls == 1) {
+					promise->set_value(std::move(response));
+				}
+			});
+
+			if (future.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+				msr::response_data timeout;
+				timeout.status = "000 No Response";
+				return timeout;
+			}
+
+			auto response = future.get();
+
+			// a second call would have happened by now in most cases
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			if (*calls != 1) {
+				response.status = "000 Handler Called Twice";
+			}
+
+			return response;
+		}
+	};
+
+	std::string body_of(const msr::response_data &response)
+	{
+		return std::string(response.body, response.body_size);
+	}
+}
+
+int main()
+{
+	auto root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("msr-provider-test-%%%%%%%%");
+	auto other = root / "other-root";
+	auto deck = root / "deck";
+
+	const std::string page = "<html><head><link rel=\"stylesheet\" href=\"css/theme.css\"></head>"
+		"<body><div class=\"reveal\"><div class=\"slides\"><section>One</section></div></div></body></html>";
+	const std::string css = "body { color: #222; }";
+	std::string binary(70000, '\0');
+
+	for (std::size_t i = 0; i < binary.size(); ++i) {
+		binary[i] = static_cast<char>(i * 7);
+	}
+
+	write_file(deck / "index.html", page);
+	write_file(deck / "css" / "theme.css", css);
+	write_file(deck / "data.bin", binary);
+	write_file(other / "a.txt", "other root");
+
+	{
+		msr::provider_options options;
+		options.prewarm.enabled = false;
+
+		msr::resource_provider provider(deck, options);
+		front_end client(provider);
+
+		auto index = client.get("/index.html");
+		check(index.status_code() == 200 && body_of(index) == page, "GET /index.html is the page");
+		check(index.header("Content-Type") == "text/html", "pages are text/html");
+		check(index.header("Link").find("</css/theme.css>; rel=preload; as=style") != std::string::npos, "pages preload their stylesheets");
+
+		check(body_of(client.get("/")) == page, "GET / is index.html");
+		check(client.get("/css/theme.css").header("Content-Type") == "text/css", "stylesheets are text/css");
+		check(body_of(client.get("/data.bin")) == binary, "binary files arrive unchanged");
+		check(client.get("/missing.html").status_code() == 404, "missing files are 404");
+
+		auto etag = index.header("ETag");
+		check(!etag.empty() && client.get("/index.html", { { "if-none-match", etag } }).status_code() == 304, "If-None-Match with the ETag is 304");
+
+		check(client.get("/index.html", {}, "POST").status_code() == 501, "other methods than GET are 501");
+
+		msr::request_data invalid;
+		invalid.invalid = true;
+
+		std::promise<int> status;
+		provider.handle(invalid, [&](msr::response_data response) { status.set_value(response.status_code()); });
+		check(status.get_future().get() == 400, "invalid requests are 400");
+
+		check(provider.mount("/other", other), "a second root can be mounted");
+
+		auto redirect = client.get("/other");
+		check(redirect.status_code() == 301 && redirect.header("Location") == "/other/", "a mount without the slash redirects");
+		check(body_of(client.get("/other/a.txt")) == "other root", "files of the second root are served under its prefix");
+		check(body_of(client.get("/index.html")) == page, "the first root is still served");
+
+		// every request is answered once while many are in progress
+		std::atomic<int> wrong{ 0 };
+		std::vector<std::thread> threads;
+
+		for (int t = 0; t < 8; ++t) {
+			threads.emplace_back([&, t]() {
+				for (int i = 0; i < 200; ++i) {
+					auto target = (i + t) % 3 == 0 ? "/index.html" : (i + t) % 3 == 1 ? "/data.bin" : "/other/a.txt";
+					auto response = client.get(target);
+
+					wrong += response.status_code() != 200;
+				}
+			});
+		}
+
+		for (auto &t : threads) {
+			t.join();
+		}
+
+		check(wrong == 0, "1600 concurrent requests from 8 threads are answered once each");
+
+		provider.stop();
+	}
+
+	// the last reference is dropped by a job on one of the provider's own pools
+	{
+		msr::provider_options options;
+		options.prewarm.enabled = false;
+
+		auto provider = msr::make_provider(deck, options);
+		std::weak_ptr<msr::resource_provider> released = provider;
+		std::promise<int> status;
+
+		msr::request_data request;
+		request.method = "GET";
+		request.version = "HTTP/1.1";
+		request.uri = "/.msr/analysis.json";
+		request.local = true;
+
+		provider->handle(request, [&status, provider](msr::response_data response) { status.set_value(response.status_code()); });
+		provider.reset();
+
+		check(status.get_future().get() == 200, "the analysis is made on a worker");
+
+		for (int i = 0; i < 1000 && !released.expired(); ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		check(released.expired(), "a provider released on its own worker is destroyed");
+	}
+
+	boost::system::error_code error;
+	remove_all(root, error);
+
+	return test_support::report();
+}
@@ -6,6 +6,7 @@
 
 #include <quote/macro.hpp>
 
+#include "reveal_scheme.hpp"
 #include "v8_handler.hpp"
 
 class renderer_handler :
@@ -20,6 +21,11 @@ public:
 		return this;
 	}
 
+	void OnRegisterCustomSchemes(CefRawPtr<CefSchemeRegistrar> registrar) override
+	{
+		register_reveal_scheme(registrar);
+	}
+
 	void OnContextCreated(
 		CefRefPtr<CefBrowser> browser,
 		CefRefPtr<CefFrame> frame,
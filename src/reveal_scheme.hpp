@@ -0,0 +1,16 @@
+#pragma once
+
+#include "include/cef_scheme.h"
+
+// reveal://deck/... serves the document root in process, through the same
+// msr::resource_provider as msr::tcp_server but without a socket.
+
+const wchar_t reveal_scheme_name[] = L"reveal";
+const wchar_t reveal_scheme_host[] = L"deck";
+
+// must be called from CefApp::OnRegisterCustomSchemes in every process
+inline void register_reveal_scheme(CefRawPtr<CefSchemeRegistrar> registrar)
+{
+	// standard, not local, not display isolated, secure, CORS enabled, not CSP bypassing
+	registrar->AddCustomScheme(reveal_scheme_name, true, false, false, true, true, false);
+}
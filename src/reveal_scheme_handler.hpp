@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "include/cef_parser.h"
+#include "include/cef_resource_handler.h"
+#include "include/cef_scheme.h"
+
+#include "msr/resource_provider.hpp"
+#include "reveal_scheme.hpp"
+
+class reveal_scheme_handler : public CefResourceHandler {
+	IMPLEMENT_REFCOUNTING(reveal_scheme_handler);
+
+	std::shared_ptr<msr::resource_provider> provider_;
+
+	// written by the provider, possibly from a worker thread
+	std::mutex mutex_;
+	msr::response_data response_;
+	std::size_t offset_ = 0;
+
+	// of a streamed body, read ahead on a worker of the provider;
+	// not touched here while reading_
+	std::vector<char> chunk_;
+	std::size_t chunk_pos_ = 0;
+	bool reading_ = false;
+	bool failed_ = false;
+
+	// starts reading the next chunk of a streamed body; with mutex_ held
+	void read_chunk(CefRefPtr<CefCallback> callback)
+	{
+		CefRefPtr<reveal_scheme_handler> self = this;
+		auto size = std::min<std::size_t>(64 * 1024, response_.body_size - offset_);
+
+		reading_ = true;
+		chunk_.resize(size);
+		chunk_pos_ = 0;
+
+		provider_->read_body(response_, offset_, chunk_.data(), size, [self, callback, size](std::size_t n) {
+			{
+				std::lock_guard<std::mutex> lock(self->mutex_);
+
+				self->reading_ = false;
+				self->failed_ = n != size;
+			}
+
+			callback->Continue();
+		});
+	}
+
+public:
+	explicit reveal_scheme_handler(std::shared_ptr<msr::resource_provider> provider)
+		: provider_(std::move(provider))
+	{
+	}
+
+	bool ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback) override
+	{
+		CefURLParts parts;
+
+		if (!CefParseURL(request->GetURL(), parts)) {
+			return false;
+		}
+
+		msr::request_data data;
+
+		data.method = request->GetMethod().ToString();
+		data.uri = CefString(&parts.path).ToString();
+		data.query = CefString(&parts.query).ToString();
+		data.local = true;
+
+		CefRequest::HeaderMap headers;
+		request->GetHeaderMap(headers);
+
+		for (auto &h : headers) {
+			data.headers[boost::algorithm::to_lower_copy(h.first.ToString())] = h.second.ToString();
+		}
+
+		// Chromium does not decode responses of custom scheme handlers,
+		// so ask for identity bodies (embedded files are inflated)
+		data.headers.erase("accept-encoding");
+
+		CefRefPtr<reveal_scheme_handler> self = this;
+
+		provider_->handle(data, [self, callback](msr::response_data response) {
+			{
+				std::lock_guard<std::mutex> lock(self->mutex_);
+				self->response_ = std::move(response);
+			}
+
+			callback->Continue();
+		});
+
+		return true;
+	}
+
+	void GetResponseHeaders(
+		CefRefPtr<CefResponse> response,
+		int64& response_length,
+		CefString& redirectUrl) override
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto type = response_.header("Content-Type");
+		auto space = response_.status.find(' ');
+
+		response->SetStatus(response_.status_code());
+		response->SetStatusText(space != std::string::npos ? response_.status.substr(space + 1) : "");
+		response->SetMimeType(type.substr(0, type.find(';')));
+
+		CefResponse::HeaderMap headers;
+
+		for (auto &h : response_.headers) {
+			headers.insert({ h.first, h.second });
+		}
+
+		response->SetHeaderMap(headers);
+
+		// CEF follows a redirect only when it is given here (not for 304, which has no Location)
+		auto location = response_.header("Location");
+
+		if (response_.status_code() / 100 == 3 && !location.empty()) {
+			redirectUrl = location;
+		}
+
+		response_length = static_cast<int64>(response_.body_size);
+	}
+
+	bool ReadResponse(
+		void* data_out,
+		int bytes_to_read,
+		int& bytes_read,
+		CefRefPtr<CefCallback> callback) override
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto n = std::min(static_cast<std::size_t>(bytes_to_read), response_.body_size - offset_);
+
+		bytes_read = static_cast<int>(n);
+
+		if (n == 0) {
+			return false;
+		}
+
+		if (!response_.read_body) {
+			std::memcpy(data_out, response_.body + offset_, n);
+		} else if (failed_) {
+			bytes_read = 0;
+			return false;
+		} else if (reading_ || chunk_pos_ == chunk_.size()) {
+			// the file is read on a worker; CEF calls again after callback->Continue()
+			if (!reading_) {
+				read_chunk(callback);
+			}
+
+			bytes_read = 0;
+			return true;
+		} else {
+			n = std::min(n, chunk_.size() - chunk_pos_);
+			bytes_read = static_cast<int>(n);
+
+			std::memcpy(data_out, chunk_.data() + chunk_pos_, n);
+			chunk_pos_ += n;
+		}
+
+		offset_ += n;
+
+		return true;
+	}
+
+	void Cancel() override
+	{
+	}
+};
+
+class reveal_scheme_handler_factory : public CefSchemeHandlerFactory {
+	IMPLEMENT_REFCOUNTING(reveal_scheme_handler_factory);
+
+	// each request goes to the provider current when it starts
+	std::shared_ptr<msr::provider_slot> providers_;
+
+public:
+	explicit reveal_scheme_handler_factory(std::shared_ptr<msr::provider_slot> providers)
+		: providers_(std::move(providers))
+	{
+	}
+
+	CefRefPtr<CefResourceHandler> Create(
+		CefRefPtr<CefBrowser> browser,
+		CefRefPtr<CefFrame> frame,
+		const CefString& scheme_name,
+		CefRefPtr<CefRequest> request) override
+	{
+		return new reveal_scheme_handler(providers_->get());
+	}
+};
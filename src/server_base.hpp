@@ -1,13 +1,26 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 
 #include <boost/filesystem/path.hpp>
 
 class server_base {
 public:
+	virtual ~server_base() = default;
+
 	virtual bool start(const boost::filesystem::path &root) = 0;
 	virtual void stop() = 0;
+
+	// Stops accepting requests, lets the ones in progress finish within timeout
+	// and cancels the rest. Returns false if something had to be cancelled.
+	// Must not be called from a thread that runs the server.
+	virtual bool shutdown(std::chrono::milliseconds /* timeout */)
+	{
+		stop();
+		return true;
+	}
+
 	virtual unsigned short get_port() = 0;
 	virtual const boost::filesystem::path &get_document_root() = 0;
 };
@@ -0,0 +1,208 @@
+// Shuts msr down while it is under load and checks that it drains: clients
+// keep requesting a large and a small file on keep-alive connections and
+// followers wait for the presenter when shutdown() is called.
+//
+//   shutdown-test [clients] [followers]
+//
+// clients defaults to 32 and followers to 16. Works in a temporary directory
+// it makes and removes. The exit code is 0 if the server drained in time, no
+// response was cut off, every follower was answered and the I/O threads
+// returned, and 1 if not.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "msr.hpp"
+#include "test_support.hpp"
+
+namespace {
+	using boost::asio::ip::tcp;
+	using test_support::check;
+	using test_support::write_file;
+
+	enum class outcome { complete, refused, cut_off };
+
+	// One request on a connected socket; a response is cut off if its head
+	// arrived and the connection closed before the whole body did.
+	outcome request(tcp::socket &socket, const std::string &target, bool &keep_alive)
+	{
+		boost::system::error_code error;
+		std::string request = "GET " + target + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+
+		boost::asio::write(socket, boost::asio::buffer(request), error);
+
+		if (error) {
+			return outcome::refused;
+		}
+
+		boost::asio::streambuf buffer;
+		auto head_size = boost::asio::read_until(socket, buffer, "\r\n\r\n", error);
+
+		if (error) {
+			return outcome::refused;
+		}
+
+		std::string head(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + head_size);
+		buffer.consume(head_size);
+
+		auto length = head.find("Content-Length: ");
+		std::size_t body_size = length == std::string::npos ? 0 : std::stoul(head.substr(length + 16));
+
+		keep_alive = head.find("Connection: keep-alive") != std::string::npos;
+
+		if (buffer.size() < body_size) {
+			boost::asio::read(socket, buffer, boost::asio::transfer_exactly(body_size - buffer.size()), error);
+		}
+
+		return buffer.size() >= body_size && head.compare(0, 12, "HTTP/1.1 200") == 0 ? outcome::complete : outcome::cut_off;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int clients = argc > 1 ? std::max(1, std::atoi(argv[1])) : 32;
+	int followers = argc > 2 ? std::max(0, std::atoi(argv[2])) : 16;
+	auto root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("msr-shutdown-test-%%%%%%%%");
+
+	// gives up on a hang instead of blocking the test run
+	std::thread([]() {
+		std::this_thread::sleep_for(std::chrono::seconds(60));
+		std::cout << "FAILED  the test did not finish in 60 seconds" << std::endl;
+		std::_Exit(1);
+	}).detach();
+
+	write_file(root / "index.html", "<html><body><div class=\"reveal\"><div class=\"slides\"><section>One</section></div></div></body></html>");
+	write_file(root / "big.bin", std::string(4 * 1024 * 1024, 'x'));
+	write_file(root / "small.txt", "small");
+
+	boost::asio::io_service io_service;
+	msr::tcp_server server(io_service);
+
+	msr::provider_options options;
+	options.prewarm.enabled = false;
+	server.set_options(options);
+
+	msr::audience_options audience;
+	audience.enabled = true;
+	audience.address = "127.0.0.1";
+	audience.port = 0;
+	server.set_audience_options(audience);
+
+	if (!server.start(root)) {
+		std::cout << "FAILED  the server did not start" << std::endl;
+		return 1;
+	}
+
+	tcp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), server.get_port());
+
+	std::vector<std::thread> io_threads;
+
+	for (int i = 0; i < 4; ++i) {
+		io_threads.emplace_back([&]() { io_service.run(); });
+	}
+
+	std::atomic<bool> stopping{ false };
+	std::atomic<int> complete{ 0 }, cut_off{ 0 }, answered{ 0 };
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < clients; ++i) {
+		threads.emplace_back([&, i]() {
+			while (!stopping) {
+				boost::asio::io_service client_service;
+				tcp::socket socket(client_service);
+				boost::system::error_code error;
+
+				socket.connect(endpoint, error);
+
+				if (error) {
+					return;
+				}
+
+				for (int n = 0;; ++n) {
+					bool keep_alive = false;
+					auto result = request(socket, (i + n) % 2 ? "/big.bin" : "/small.txt", keep_alive);
+
+					complete += result == outcome::complete;
+					cut_off += result == outcome::cut_off;
+
+					if (result != outcome::complete || !keep_alive) {
+						break;
+					}
+				}
+			}
+		});
+	}
+
+	for (int i = 0; i < followers; ++i) {
+		threads.emplace_back([&]() {
+			boost::asio::io_service client_service;
+			tcp::socket socket(client_service);
+			boost::system::error_code error;
+			bool keep_alive = false;
+
+			socket.connect(endpoint, error);
+
+			if (!error && request(socket, "/.msr/follow?after=0", keep_alive) == outcome::complete) {
+				++answered;
+			}
+		});
+	}
+
+	// under load for a while, with every follower's long poll held by the provider
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	while (server.provider()->followers().waiting() < static_cast<std::size_t>(followers)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	auto before = complete.load();
+	auto started = std::chrono::steady_clock::now();
+	auto drained = server.shutdown(std::chrono::seconds(5));
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+
+	stopping = true;
+
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	// nothing is left for the I/O service once every connection is released
+	auto io_done = std::async(std::launch::async, [&]() {
+		for (auto &t : io_threads) {
+			t.join();
+		}
+	});
+
+	auto io_returned = io_done.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+
+	check(before > 0, std::to_string(before) + " responses were complete before shutdown()");
+	check(drained, "shutdown() drained the responses in progress (" + std::to_string(elapsed.count()) + " ms)");
+	check(elapsed < std::chrono::seconds(6), "shutdown() returned within its timeout");
+	check(cut_off == 0, "no response was cut off (" + std::to_string(cut_off.load()) + " were)");
+	check(answered == followers, std::to_string(answered.load()) + " of " + std::to_string(followers) + " followers were answered");
+	check(io_returned, "the I/O threads returned");
+
+	boost::asio::io_service client_service;
+	tcp::socket socket(client_service);
+	boost::system::error_code error;
+	socket.connect(endpoint, error);
+	check(!!error, "connections are refused after shutdown()");
+
+	if (!io_returned) {
+		std::_Exit(1);
+	}
+
+	remove_all(root, error);
+
+	return test_support::report();
+}
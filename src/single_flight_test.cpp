@@ -0,0 +1,121 @@
+// Checks that concurrent requests for a file that is not cached yet make one
+// disk read between them, and that a changed file is read once more.
+//
+//   single-flight-test [threads]
+//
+// threads defaults to 32. Works in a temporary directory it makes and
+// removes. Exit code is 0 if every check passed and 1 if not.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "msr/resource_provider.hpp"
+#include "test_support.hpp"
+
+namespace {
+	using test_support::check;
+	using test_support::write_file;
+
+	int get(msr::resource_provider &provider, const std::string &uri)
+	{
+		msr::request_data request;
+		request.method = "GET";
+		request.version = "HTTP/1.1";
+		request.uri = uri;
+		request.local = true;
+
+		auto promise = std::make_shared<std::promise<int>>();
+		auto future = promise->get_future();
+
+		provider.handle(request, [promise](msr::response_data response) { promise->set_value(response.status_code()); });
+
+		return future.wait_for(std::chrono::seconds(10)) == std::future_status::ready ? future.get() : 0;
+	}
+
+	// Requests uri from every thread at once; returns the number of responses that were not 200.
+	int get_all_at_once(msr::resource_provider &provider, const std::string &uri, int threads)
+	{
+		std::mutex mutex;
+		std::condition_variable start;
+		bool started = false;
+		std::atomic<int> wrong{ 0 };
+		std::vector<std::thread> workers;
+
+		for (int i = 0; i < threads; ++i) {
+			workers.emplace_back([&]() {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					start.wait(lock, [&]() { return started; });
+				}
+
+				wrong += get(provider, uri) != 200;
+			});
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			started = true;
+		}
+
+		start.notify_all();
+
+		for (auto &w : workers) {
+			w.join();
+		}
+
+		return wrong;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int threads = argc > 1 ? std::max(1, std::atoi(argv[1])) : 32;
+	auto root = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("msr-single-flight-test-%%%%%%%%");
+
+	// large enough that the readers overlap
+	write_file(root / "big.bin", std::string(8 * 1024 * 1024, 'x'));
+	write_file(root / "small.txt", "small");
+
+	{
+		msr::provider_options options;
+		options.prewarm.enabled = false;
+
+		msr::resource_provider provider(root, options);
+		auto before = provider.disk_reads();
+
+		check(get_all_at_once(provider, "/big.bin", threads) == 0, std::to_string(threads) + " concurrent requests for a large file are 200");
+		check(provider.disk_reads() - before == 1, "the large file was read once (" + std::to_string(provider.disk_reads() - before) + " reads)");
+
+		before = provider.disk_reads();
+		check(get_all_at_once(provider, "/small.txt", threads) == 0, std::to_string(threads) + " concurrent requests for a small file are 200");
+		check(provider.disk_reads() - before == 1, "the small file was read once (" + std::to_string(provider.disk_reads() - before) + " reads)");
+
+		before = provider.disk_reads();
+		get_all_at_once(provider, "/big.bin", threads);
+		check(provider.disk_reads() == before, "cached files are not read again");
+
+		// a different size is a different version whatever the mtime resolution is
+		write_file(root / "small.txt", "changed");
+		before = provider.disk_reads();
+		get_all_at_once(provider, "/small.txt", threads);
+		check(provider.disk_reads() - before == 1, "a changed file is read once more");
+
+		provider.stop();
+	}
+
+	boost::system::error_code error;
+	remove_all(root, error);
+
+	return test_support::report();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+// What provider-test, single-flight-test and shutdown-test share: one line
+// per check, and the files they serve, in a temporary directory.
+
+namespace test_support {
+	// checks that have failed so far
+	inline int &failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	inline void check(bool passed, const std::string &name)
+	{
+		std::cout << (passed ? "ok      " : "FAILED  ") << name << std::endl;
+		failures() += !passed;
+	}
+
+	inline void write_file(const boost::filesystem::path &path, const std::string &content)
+	{
+		create_directories(path.parent_path());
+		boost::filesystem::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+		ofs << content;
+	}
+
+	// prints the summary; the exit code of the test
+	inline int report()
+	{
+		std::cout << (failures() == 0 ? "all checks passed" : std::to_string(failures()) + " checks failed") << std::endl;
+
+		return failures() == 0 ? 0 : 1;
+	}
+}